@@ -19,6 +19,7 @@
 */
 
 #include <math.h>
+#include <vector>
 #include <GL/glew.h>
 #include <GL/freeglut.h>
 
@@ -30,6 +31,25 @@
 #include "lighting_technique.h"
 #include "glut_backend.h"
 #include "mesh.h"
+#include "asset_registry.h"
+#include "texture_loader.h"
+#include "texture_residency.h"
+#include "texture_streamer.h"
+#include "uniform_buffers.h"
+#include "texture_cooker.h"
+#include "sampler_cache.h"
+#include "gpu_timer.h"
+#include "gl_state.h"
+#include "clustered_lights.h"
+#include "gbuffer.h"
+#include "depth_pass_technique.h"
+#include "cascaded_shadows.h"
+#include "irradiance_probes.h"
+#include "probe_baker.h"
+#include "visibility_buffer.h"
+#include "visibility_technique.h"
+#include "occlusion_culler.h"
+#include "pvs_baker.h"
 #ifdef FREETYPE
 #include "freetypeGL.h"
 #endif
@@ -39,8 +59,24 @@
 #include "camera.cpp"
 #include "texture.cpp"
 #include "lighting_technique.cpp"
+#include "meshlet_cull_technique.cpp"
 #include "glut_backend.cpp"
 #include "mesh.cpp"
+#include "asset_registry.cpp"
+#include "texture_loader.cpp"
+#include "texture_cooker.cpp"
+#include "sampler_cache.cpp"
+#include "gpu_timer.cpp"
+#include "gl_state.cpp"
+#include "clustered_lights.cpp"
+#include "gbuffer.cpp"
+#include "depth_pass_technique.cpp"
+#include "cascaded_shadows.cpp"
+#include "probe_baker.cpp"
+#include "visibility_buffer.cpp"
+#include "visibility_technique.cpp"
+#include "occlusion_culler.cpp"
+#include "pvs_baker.cpp"
 
 #define WINDOW_WIDTH  1280  
 #define WINDOW_HEIGHT 1024
@@ -49,15 +85,41 @@
 #define NUM_COLS 20
 #define NUM_INSTANCES NUM_ROWS * NUM_COLS
 
+#define DEFAULT_ANISOTROPY 8.0f
+
+// Default GPU memory budget of the textures, see --texture-budget
+#define TEXTURE_BUDGET_MB 256
+
+#define BENCHMARK_WARMUP_FRAMES 30
+#define BENCHMARK_FRAMES        300
+
+// The texture filtering modes compared by --bench
+struct BenchmarkMode {
+    const char* pName;
+    SamplerFilter Filter;
+    float MaxAnisotropy;
+};
+
+static const BenchmarkMode BenchmarkModes[] = {
+    { "bilinear, no mipmaps", SAMPLER_FILTER_BILINEAR, 1.0f },
+    { "trilinear", SAMPLER_FILTER_TRILINEAR, 1.0f },
+    { "trilinear, 16x anisotropic", SAMPLER_FILTER_TRILINEAR, 16.0f }
+};
+
 
 class Tutorial33 : public ICallbacks
 {
 public:
 
-    Tutorial33()
+    Tutorial33(bool Benchmark, bool TextureStreaming, unsigned int NumPointLights, bool ClusteredLighting,
+               bool DeferredShading, bool VisibilityShading, bool DepthPrepass, bool Shadows,
+               bool OcclusionCulling, bool MeshletCulling, const std::string& ProbeFile, const std::string& SceneFile,
+               const std::string& PVSFile, bool StreamMesh, float StaticFraction)
     {
         m_pGameCamera = NULL;
         m_pEffect = NULL;
+        m_pDepthPass = NULL;
+        m_pVisibilityPass = NULL;
         m_scale = 0.0f;
         m_directionalLight.Color = Vector3f(1.0f, 1.0f, 1.0f);
         m_directionalLight.AmbientIntensity = 0.55f;
@@ -73,13 +135,44 @@ public:
         m_pMesh = NULL;
         m_frameCount = 0;
         m_fps = 0.0f;
+        m_benchmark = Benchmark;
+        m_textureStreaming = TextureStreaming;
+        m_pointLights.resize(NumPointLights);
+        m_clusteredLighting = ClusteredLighting;
+        m_deferredShading = DeferredShading;
+        m_visibilityShading = VisibilityShading;
+        m_depthPrepass = DepthPrepass;
+        m_shadows = Shadows;
+        m_occlusionCulling = OcclusionCulling;
+        m_meshletCulling = MeshletCulling;
+        m_occluderReady = false;
+        m_probeFile = ProbeFile;
+        m_sceneFile = SceneFile;
+        m_pvsFile = PVSFile;
+        m_streamMesh = StreamMesh;
+        m_staticFraction = StaticFraction;
+        m_usePVS = true;
+        m_pvsCell = -1;
+        m_benchmarkMode = 0;
+        m_benchmarkFrame = 0;
+        m_benchmarkTime = 0.0;
+        m_benchmarkSamples = 0;
     }
 
     ~Tutorial33()
     {
         SAFE_DELETE(m_pEffect);
+        SAFE_DELETE(m_pDepthPass);
+        SAFE_DELETE(m_pVisibilityPass);
         SAFE_DELETE(m_pGameCamera);
-        SAFE_DELETE(m_pMesh);
+        AssetRegistry::ReleaseMesh(m_pMesh);
+        TextureLoader::Shutdown();
+        TextureStreamer::Shutdown();
+        UniformBuffers::Shutdown();
+        ClusteredLights::Shutdown();
+        CascadedShadows::Shutdown();
+        IrradianceProbes::Shutdown();
+        OcclusionCuller::Shutdown();
     }    
 
     bool Init()
@@ -90,28 +183,105 @@ public:
 
         m_pGameCamera = new Camera(WINDOW_WIDTH, WINDOW_HEIGHT, Pos, Target, Up);
       
+        // The lighting technique compiles the feedback in only if the streamer is on
+        if (m_textureStreaming && !TextureStreamer::Init(WINDOW_WIDTH, WINDOW_HEIGHT)) {
+            printf("Texture streaming is not supported, loading the full textures\n");
+        }
+
+        // Picks the permutations of the lighting technique
+        if (m_clusteredLighting && !ClusteredLights::Init()) {
+            printf("Clustered lighting is not supported, using at most %d point lights\n", MAX_POINT_LIGHTS);
+        }
+
+        if (m_shadows && !CascadedShadows::Init()) {
+            printf("Shadows are not supported\n");
+        }
+
+        if (!m_probeFile.empty() && !IrradianceProbes::Load(m_probeFile)) {
+            printf("Error loading the irradiance probes, using the constant ambient light\n");
+        }
+
         m_pEffect = new LightingTechnique();
 
+        // The program is built by the driver while the mesh loads, see Wait below
         if (!m_pEffect->Init()) {
             printf("Error initializing the lighting technique\n");
             return false;
         }
 
+        m_pDepthPass = new DepthPassTechnique();
+
+        if (!m_pDepthPass->Init()) {
+            printf("Error initializing the depth pass technique\n");
+            return false;
+        }
+
+        m_pVisibilityPass = new VisibilityTechnique();
+
+        if (!m_pVisibilityPass->Init()) {
+            printf("Error initializing the visibility technique\n");
+            return false;
+        }
+
+        if (!m_gbuffer.Init(WINDOW_WIDTH, WINDOW_HEIGHT)) {
+            return false;
+        }
+
+        if (!m_visibilityBuffer.Init(WINDOW_WIDTH, WINDOW_HEIGHT)) {
+            return false;
+        }
+
+        SamplerDesc Sampler;
+        Sampler.MaxAnisotropy = DEFAULT_ANISOTROPY;
+        SamplerCache::SetDefault(Sampler);
+
+        if (!m_gpuTimer.Init()) {
+            return false;
+        }
+
+        if (m_benchmark) {
+            SetBenchmarkMode(0);
+        }
+
+        m_pMesh = AssetRegistry::AcquireMesh(m_sceneFile.empty() ? "./Content/spider.obj" : m_sceneFile, m_streamMesh);
+
+        if (!m_pMesh) {
+            return false;            
+        }
+
+        // Checked against the scene in UpdateVisibleSet, a streamed mesh has no entries yet
+        if (!m_pvsFile.empty()) {
+            m_visibleSets.Load(m_pvsFile);
+        }
+
+        // SetMeshletCulling prints what is missing
+        if (m_meshletCulling && !m_pMesh->SetMeshletCulling(true)) {
+            printf("Meshlet culling is not supported\n");
+            m_meshletCulling = false;
+        }
+
+        if (!m_pEffect->Wait()) {
+            printf("Error initializing the lighting technique\n");
+            return false;
+        }
+
         m_pEffect->Enable();
 
         m_pEffect->SetColorTextureUnit(COLOR_TEXTURE_UNIT_INDEX);
         m_pEffect->SetDirectionalLight(m_directionalLight);
         m_pEffect->SetMatSpecularIntensity(0.0f);
         m_pEffect->SetMatSpecularPower(0);
-        m_pEffect->SetColor(0, Vector4f(1.0f, 0.5f, 0.5f, 0.0f));
-        m_pEffect->SetColor(1, Vector4f(0.5f, 1.0f, 1.0f, 0.0f));
-        m_pEffect->SetColor(2, Vector4f(1.0f, 0.5f, 1.0f, 0.0f));
-        m_pEffect->SetColor(3, Vector4f(1.0f, 1.0f, 1.0f, 0.0f));
-
-        m_pMesh = new Mesh();
 
-        if (!m_pMesh->LoadMesh("./Content/spider.obj")) {
-            return false;            
+        if (m_sceneFile.empty()) {
+            m_pEffect->SetColor(0, Vector4f(1.0f, 0.5f, 0.5f, 0.0f));
+            m_pEffect->SetColor(1, Vector4f(0.5f, 1.0f, 1.0f, 0.0f));
+            m_pEffect->SetColor(2, Vector4f(1.0f, 0.5f, 1.0f, 0.0f));
+            m_pEffect->SetColor(3, Vector4f(1.0f, 1.0f, 1.0f, 0.0f));
+        }
+        else {
+            for (unsigned int i = 0 ; i < 4 ; i++) {
+                m_pEffect->SetColor(i, Vector4f(1.0f, 1.0f, 1.0f, 0.0f));
+            }
         }
         
 #ifdef FREETYPE
@@ -123,6 +293,9 @@ public:
         m_time = glutGet(GLUT_ELAPSED_TIME);
 
         CalcPositions();
+        InitPointLights();
+
+        UpdateShadowBounds();
         
         return true;
     }
@@ -131,6 +304,61 @@ public:
     {
         GLUTBackendRun(this);
     }
+
+
+    // Offline mode: lights the scene in SceneFile with the directional light of the demo
+    // and writes the irradiance probes of it to ProbeFile, see ProbeBaker
+    bool BakeProbes(const std::string& SceneFile, const std::string& ProbeFile)
+    {
+        if (m_shadows && !CascadedShadows::Init()) {
+            printf("Shadows are not supported\n");
+        }
+
+        m_pEffect = new LightingTechnique();
+
+        if (!m_pEffect->Init() || !m_pEffect->Wait()) {
+            printf("Error initializing the lighting technique\n");
+            return false;
+        }
+
+        m_pEffect->SetColorTextureUnit(COLOR_TEXTURE_UNIT_INDEX);
+        m_pEffect->SetMatSpecularIntensity(0.0f);
+        m_pEffect->SetMatSpecularPower(0);
+
+        // Untinted, the repeated sub-meshes of the scene get instance IDs of their own
+        for (unsigned int i = 0 ; i < 4 ; i++) {
+            m_pEffect->SetColor(i, Vector4f(1.0f, 1.0f, 1.0f, 0.0f));
+        }
+
+        m_pMesh = AssetRegistry::AcquireMesh(SceneFile);
+
+        if (!m_pMesh) {
+            return false;
+        }
+
+        return ProbeBaker::Bake(m_pMesh, m_pEffect, m_directionalLight, ProbeFile);
+    }
+
+
+    // Offline mode: writes the potentially visible sets of the scene in SceneFile to
+    // PVSFile, see PVSBaker
+    bool BakePVS(const std::string& SceneFile, const std::string& PVSFile)
+    {
+        m_pVisibilityPass = new VisibilityTechnique();
+
+        if (!m_pVisibilityPass->Init() || !m_pVisibilityPass->Wait()) {
+            printf("Error initializing the visibility technique\n");
+            return false;
+        }
+
+        m_pMesh = AssetRegistry::AcquireMesh(SceneFile);
+
+        if (!m_pMesh) {
+            return false;
+        }
+
+        return PVSBaker::Bake(m_pMesh, m_pVisibilityPass, PVSFile);
+    }
     
 
     virtual void RenderSceneCB()
@@ -143,33 +371,283 @@ public:
 
         glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
+        m_pEffect->SetPass(m_deferredShading ? LIGHTING_PASS_GBUFFER : LIGHTING_PASS_FORWARD);
         m_pEffect->Enable();
-        m_pEffect->SetEyeWorldPos(m_pGameCamera->GetPos());
         
         Pipeline p;
         p.SetCamera(m_pGameCamera->GetPos(), m_pGameCamera->GetTarget(), m_pGameCamera->GetUp());
         p.SetPerspectiveProj(m_persProjInfo);   
-        p.Rotate(0.0f, 90.0f, 0.0f);
-        p.Scale(0.005f, 0.005f, 0.005f);                
+
+        FrameUniforms& Frame = UniformBuffers::EditFrame();
+        Frame.VP = p.GetVPTrans();
+        Frame.InvVP = Frame.VP.Inverse();
+        Frame.EyeWorldPos = m_pGameCamera->GetPos();
+        Frame.ZNear = m_persProjInfo.zNear;
+        Frame.ZFar = m_persProjInfo.zFar;
+        Frame.ScreenSize = Vector2f((float)WINDOW_WIDTH, (float)WINDOW_HEIGHT);
+
+        UpdatePointLights();
 
         Matrix4f WVPMatrics[NUM_INSTANCES];
         Matrix4f WorldMatrices[NUM_INSTANCES];
-        
-        for (unsigned int i = 0 ; i < NUM_INSTANCES ; i++) {
-            Vector3f Pos(m_positions[i]);
-            Pos.y += sinf(m_scale) * m_velocity[i];
-            p.WorldPos(Pos);        
-            WVPMatrics[i] = p.GetWVPTrans().Transpose();
-            WorldMatrices[i] = p.GetWorldTrans().Transpose();
+        unsigned int NumInstances = NUM_INSTANCES;
+
+        if (m_sceneFile.empty()) {
+            p.Rotate(0.0f, 90.0f, 0.0f);
+            p.Scale(0.005f, 0.005f, 0.005f);                
+
+            for (unsigned int i = 0 ; i < NUM_INSTANCES ; i++) {
+                Vector3f Pos(m_positions[i]);
+                Pos.y += sinf(m_scale) * m_velocity[i];
+                p.WorldPos(Pos);        
+                WVPMatrics[i] = p.GetWVPTrans().Transpose();
+                WorldMatrices[i] = p.GetWorldTrans().Transpose();
+            }
+        }
+        else {
+            // The static scene is drawn once as is
+            NumInstances = 1;
+            WVPMatrics[0] = p.GetVPTrans().Transpose();
+            WorldMatrices[0].InitIdentity();
         }
+
+        UpdateVisibleSet();
+
+        // Taken before the update, which may bring in the last parts
+        const bool Streaming = m_pMesh->IsStreaming();
         
-        m_pMesh->Render(NUM_INSTANCES, WVPMatrics, WorldMatrices);
+        m_pMesh->UpdateStreaming(m_pGameCamera->GetPos());
+
+        // The parts of the mesh that arrive are missing from the cached shadows
+        if (Streaming) {
+            UpdateShadowBounds();
+            CascadedShadows::InvalidateStaticCache();
+        }
+
+        CascadedShadows::Update(m_pGameCamera->GetPos(), m_pGameCamera->GetTarget(), m_persProjInfo,
+                                m_directionalLight.Direction);
+
+        TextureLoader::Update();
+        TextureStreamer::Update();
+        TextureResidency::Update();
+        UniformBuffers::Update();
+
+        if (ClusteredLights::IsEnabled()) {
+            ClusteredLights::Update(p.GetViewTrans(), m_persProjInfo);
+        }
+
+        m_pEffect->BeginTextureFeedback();
+
+        if (m_benchmark) {
+            m_gpuTimer.Begin();
+            RenderMeshes(NumInstances, WVPMatrics, WorldMatrices);
+            m_gpuTimer.End();
+            UpdateBenchmark();
+        }
+        else {
+            RenderMeshes(NumInstances, WVPMatrics, WorldMatrices);
+        }
+
+        TextureStreamer::EndFeedback();
         
         RenderFPS();
         
         glutSwapBuffers();
     }
 
+    // With deferred shading the draws fill the G-buffer and the lights then run once
+    // per covered pixel, however many draws touched it
+    void RenderMeshes(unsigned int NumInstances, const Matrix4f* pWVPMatrices, const Matrix4f* pWorldMatrices)
+    {
+        if (CascadedShadows::IsEnabled()) {
+            RenderShadows(NumInstances, pWorldMatrices);
+        }
+
+        // The instances keep their index, and so their tint, when the others are culled
+        const unsigned int* pInstanceIndices = NULL;
+
+        // Only the main pass is culled, the hidden instances still cast shadows
+        if (m_occlusionCulling) {
+            NumInstances = CullInstances(NumInstances, pWVPMatrices, pWorldMatrices);
+            pWVPMatrices = &m_visibleWVPMatrices[0];
+            pWorldMatrices = &m_visibleWorldMatrices[0];
+            pInstanceIndices = &m_visibleInstances[0];
+        }
+
+        if (m_visibilityShading) {
+            if (RenderVisibility(NumInstances, pWVPMatrices, pWorldMatrices, pInstanceIndices)) {
+                return;
+            }
+
+            printf("The mesh doesn't fit in the visibility buffer, using forward shading\n");
+            m_visibilityShading = false;
+            m_pEffect->SetPass(LIGHTING_PASS_FORWARD);
+        }
+
+        if (m_deferredShading) {
+            m_gbuffer.BindForWriting();
+            glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+        }
+
+        if (m_depthPrepass) {
+            RenderDepthPrepass(NumInstances, pWVPMatrices, pWorldMatrices);
+        }
+
+        m_pMesh->Render(NumInstances, pWVPMatrices, pWorldMatrices, m_pEffect, pInstanceIndices);
+
+        if (m_depthPrepass) {
+            GLState::DepthFunc(GL_LESS);
+            GLState::DepthMask(GL_TRUE);
+        }
+
+        if (!m_deferredShading) {
+            return;
+        }
+
+        m_gbuffer.BindForReading();
+        m_pEffect->SetPass(LIGHTING_PASS_DEFERRED);
+        m_pEffect->Enable();
+
+        GLState::Disable(GL_DEPTH_TEST);
+        GLState::BindVertexArray(0);
+        GLState::SetVertexAttribArrays(0);
+        glDrawArrays(GL_TRIANGLES, 0, 3);
+        GLState::Enable(GL_DEPTH_TEST);
+    }
+
+    // The draws only write the triangle and the instance of every pixel and the resolve
+    // shades each covered pixel once from the mesh buffers, so the cost of the shading
+    // doesn't grow with the number of triangles. No depth prepass is needed.
+    bool RenderVisibility(unsigned int NumInstances, const Matrix4f* pWVPMatrices, const Matrix4f* pWorldMatrices,
+                          const unsigned int* pInstanceIndices)
+    {
+        m_visibilityBuffer.BindForWriting();
+
+        if (!m_pVisibilityPass->Enable() ||
+            !m_pMesh->RenderVisibility(NumInstances, pWVPMatrices, pWorldMatrices, m_pVisibilityPass, pInstanceIndices)) {
+            glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
+            return false;
+        }
+
+        m_visibilityBuffer.BindForReading();
+        m_pEffect->SetPass(LIGHTING_PASS_VISIBILITY);
+        m_pMesh->ResolveVisibility(m_pVisibilityPass, m_pEffect);
+
+        return true;
+    }
+
+    // Tests the instances against the nearest ones on the CPU and packs the matrices and
+    // the indices of those that may be visible
+    unsigned int CullInstances(unsigned int NumInstances, const Matrix4f* pWVPMatrices, const Matrix4f* pWorldMatrices)
+    {
+        m_visibleWVPMatrices.resize(NUM_INSTANCES);
+        m_visibleWorldMatrices.resize(NUM_INSTANCES);
+        m_visibleInstances.resize(NUM_INSTANCES);
+
+        Vector3f BoxMin, BoxMax;
+
+        if (!m_pMesh->GetBounds(BoxMin, BoxMax)) {
+            return 0;
+        }
+
+        // The occluder grows while the mesh streams in
+        if (!m_occluderReady) {
+            std::vector<Vector3f> Positions;
+            std::vector<unsigned int> Indices;
+            m_pMesh->GetOccluder(Positions, Indices);
+            OcclusionCuller::SetOccluder(Positions, Indices);
+            m_occluderReady = !m_pMesh->IsStreaming();
+        }
+
+        unsigned char Visible[NUM_INSTANCES];
+        OcclusionCuller::Cull(NumInstances, pWVPMatrices, BoxMin, BoxMax, Visible);
+
+        unsigned int NumVisible = 0;
+
+        for (unsigned int i = 0 ; i < NumInstances ; i++) {
+            if (Visible[i]) {
+                m_visibleWVPMatrices[NumVisible] = pWVPMatrices[i];
+                m_visibleWorldMatrices[NumVisible] = pWorldMatrices[i];
+                m_visibleInstances[NumVisible] = i;
+                NumVisible++;
+            }
+        }
+
+        return NumVisible;
+    }
+
+    // Looks up the cell of the camera in the potentially visible sets of the static
+    // scene and restricts the mesh to its sub-meshes. Outside the cells, or with the
+    // sets switched off, everything is drawn.
+    void UpdateVisibleSet()
+    {
+        // The sets are only good for the scene they were baked for
+        if (!m_visibleSets.IsEmpty() && m_pMesh->GetNumEntries() > 0 && m_visibleSets.NumEntries != m_pMesh->GetNumEntries()) {
+            printf("'%s' was baked for another scene\n", m_pvsFile.c_str());
+            m_visibleSets = PotentiallyVisibleSet();
+        }
+
+        const int Cell = m_visibleSets.GetCell(m_pGameCamera->GetPos());
+
+        m_pMesh->SetVisibleEntries(m_usePVS ? m_visibleSets.GetVisibleEntries(m_pGameCamera->GetPos()) : NULL);
+
+        if (Cell != m_pvsCell && Cell >= 0) {
+            printf("View cell %d, %u of %u sub-meshes potentially visible\n", Cell,
+                   m_visibleSets.CountVisibleEntries(Cell), m_visibleSets.NumEntries);
+        }
+
+        m_pvsCell = Cell;
+    }
+
+    // The static scene is bounded by what has been loaded of it
+    void UpdateShadowBounds()
+    {
+        // Around the grid of spiders with room for their size and their motion
+        Vector3f SceneMin(-2.0f, -3.0f, -2.0f);
+        Vector3f SceneMax(NUM_COLS + 1.0f, 8.0f, NUM_ROWS + 1.0f);
+
+        if (!m_sceneFile.empty() && !m_pMesh->GetBounds(SceneMin, SceneMax)) {
+            return;
+        }
+
+        CascadedShadows::SetSceneBounds(SceneMin, SceneMax);
+    }
+
+    // The instances that don't move are cached by the shadows, only the others are drawn
+    // into the cascades every frame
+    void RenderShadows(unsigned int NumInstances, const Matrix4f* pWorldMatrices)
+    {
+        m_staticWorldMatrices.clear();
+        m_dynamicWorldMatrices.clear();
+
+        for (unsigned int i = 0 ; i < NumInstances ; i++) {
+            if (m_velocity[i] == 0.0f || !m_sceneFile.empty()) {
+                m_staticWorldMatrices.push_back(pWorldMatrices[i]);
+            }
+            else {
+                m_dynamicWorldMatrices.push_back(pWorldMatrices[i]);
+            }
+        }
+
+        CascadedShadows::Render(m_pMesh,
+                                m_staticWorldMatrices.size(), m_staticWorldMatrices.empty() ? NULL : &m_staticWorldMatrices[0],
+                                m_dynamicWorldMatrices.size(), m_dynamicWorldMatrices.empty() ? NULL : &m_dynamicWorldMatrices[0]);
+    }
+
+    // Lays down the depth of the scene with the cheap program so the expensive one runs
+    // once per pixel. The main pass must then match it exactly and leave it as is.
+    void RenderDepthPrepass(unsigned int NumInstances, const Matrix4f* pWVPMatrices, const Matrix4f* pWorldMatrices)
+    {
+        GLState::ColorMask(GL_FALSE);
+        m_pDepthPass->Enable();
+        m_pMesh->RenderDepth(NumInstances, pWVPMatrices, pWorldMatrices);
+        GLState::ColorMask(GL_TRUE);
+
+        GLState::DepthFunc(GL_EQUAL);
+        GLState::DepthMask(GL_FALSE);
+    }
+
+
     virtual void IdleCB()
     {
         RenderSceneCB();
@@ -187,6 +665,49 @@ public:
             case 'q':
                 glutLeaveMainLoop();
                 break;
+
+            case 'a':
+                {
+                    // Cycle through 1x, 2x, 4x, 8x and 16x anisotropic filtering
+                    SamplerDesc Sampler = SamplerCache::GetDefault();
+                    Sampler.MaxAnisotropy = (Sampler.MaxAnisotropy >= 16.0f) ? 1.0f : Sampler.MaxAnisotropy * 2.0f;
+                    SamplerCache::SetDefault(Sampler);
+                    printf("Anisotropic filtering %.0fx\n", Sampler.MaxAnisotropy);
+                }
+                break;
+
+            case 'g':
+                m_deferredShading = !m_deferredShading;
+                printf("%s shading\n", m_deferredShading ? "Deferred" : "Forward");
+                break;
+
+            case 'v':
+                m_visibilityShading = !m_visibilityShading;
+                printf("Visibility buffer %s\n", m_visibilityShading ? "on" : "off");
+                break;
+
+            case 'o':
+                m_occlusionCulling = !m_occlusionCulling;
+                printf("Occlusion culling %s\n", m_occlusionCulling ? "on" : "off");
+                OcclusionCuller::ResetStats();
+                break;
+
+            case 'm':
+                if (m_pMesh->SetMeshletCulling(!m_meshletCulling)) {
+                    m_meshletCulling = !m_meshletCulling;
+                    printf("Meshlet culling %s\n", m_meshletCulling ? "on" : "off");
+                }
+                break;
+
+            case 'p':
+                m_usePVS = !m_usePVS;
+                printf("Potentially visible sets %s\n", m_usePVS ? "on" : "off");
+                break;
+
+            case 'z':
+                m_depthPrepass = !m_depthPrepass;
+                printf("Depth prepass %s\n", m_depthPrepass ? "on" : "off");
+                break;
         }
     }
 
@@ -214,20 +735,83 @@ private:
             m_fps = (float)m_frameCount * 1000.0f / (time - m_time);
             m_time = time;
             m_frameCount = 0;
+
+            const OcclusionCuller::Stats& Stats = OcclusionCuller::GetStats();
+
+            if (m_occlusionCulling && Stats.NumFrames > 0) {
+                printf("Occlusion culling: raster %.2f ms, test %.2f ms, %u occluder triangles, %.1f%% outside the frustum, %.1f%% occluded\n",
+                       Stats.RasterMs / Stats.NumFrames, Stats.TestMs / Stats.NumFrames, Stats.NumOccluderTriangles,
+                       100.0f * Stats.NumFrustumCulled / Stats.NumTested, 100.0f * Stats.NumOccluded / Stats.NumTested);
+                OcclusionCuller::ResetStats();
+            }
         }
     }
     
     
     void RenderFPS()
     {
-        char text[32];
-        SNPRINTF(text, sizeof(text), "FPS: %.2f", m_fps);
+        char text[64];
+        SNPRINTF(text, sizeof(text), "FPS: %.2f Textures: %u MB", m_fps,
+                 (unsigned int)(TextureResidency::GetResidentBytes() >> 20));
 #ifdef FREETYPE
         m_fontRenderer.RenderText(10, 10, text);        
+        // The font renderer changes state behind the cache's back
+        GLState::Invalidate();
 #endif
     }
     
     
+    void SetBenchmarkMode(unsigned int Mode)
+    {
+        SamplerDesc Sampler;
+        Sampler.Filter = BenchmarkModes[Mode].Filter;
+        Sampler.MaxAnisotropy = BenchmarkModes[Mode].MaxAnisotropy;
+        SamplerCache::SetDefault(Sampler);
+
+        m_benchmarkMode = Mode;
+        m_benchmarkFrame = 0;
+        m_benchmarkTime = 0.0;
+        m_benchmarkSamples = 0;
+        GLState::ResetStats();
+    }
+
+
+    // Averages the GPU time of the mesh pass over BENCHMARK_FRAMES frames for every
+    // filtering mode. The results lag behind so the first frames of a mode are skipped.
+    void UpdateBenchmark()
+    {
+        double Milliseconds = 0.0;
+
+        while (m_gpuTimer.GetResult(Milliseconds)) {
+            if (m_benchmarkFrame >= BENCHMARK_WARMUP_FRAMES) {
+                m_benchmarkTime += Milliseconds;
+                m_benchmarkSamples++;
+            }
+        }
+
+        // Keep warming up until every texture is resident
+        if (m_benchmarkFrame + 1 == BENCHMARK_WARMUP_FRAMES && TextureLoader::IsBusy()) {
+            return;
+        }
+
+        if (++m_benchmarkFrame < BENCHMARK_WARMUP_FRAMES + BENCHMARK_FRAMES) {
+            return;
+        }
+
+        printf("%-30s %.3f ms, %u state calls/frame (%u filtered)\n", BenchmarkModes[m_benchmarkMode].pName,
+               m_benchmarkSamples > 0 ? m_benchmarkTime / m_benchmarkSamples : 0.0,
+               GLState::GetNumIssued() / m_benchmarkFrame,
+               GLState::GetNumEliminated() / m_benchmarkFrame);
+
+        if (m_benchmarkMode + 1 < ARRAY_SIZE_IN_ELEMENTS(BenchmarkModes)) {
+            SetBenchmarkMode(m_benchmarkMode + 1);
+        }
+        else {
+            glutLeaveMainLoop();
+        }
+    }
+    
+    
     void CalcPositions()
     {
         for (unsigned int i = 0; i < NUM_ROWS ; i++) {
@@ -236,7 +820,7 @@ private:
                 m_positions[Index].x = (float)j;
                 m_positions[Index].y = RandomFloat() * 5.0f;
                 m_positions[Index].z = (float)i;
-                m_velocity[Index] = RandomFloat();
+                m_velocity[Index] = (m_staticFraction > 0.0f && RandomFloat() < m_staticFraction) ? 0.0f : RandomFloat();
                 if (i & 1) {
                     m_velocity[Index] *= (-1.0f);
                 }
@@ -244,7 +828,41 @@ private:
         }                   
     }
 
+
+    // Scatters the point lights over the spiders, UpdatePointLights moves them in circles
+    void InitPointLights()
+    {
+        m_lightCenters.resize(m_pointLights.size());
+
+        for (unsigned int i = 0 ; i < m_pointLights.size() ; i++) {
+            m_lightCenters[i] = Vector3f(RandomFloat() * (NUM_COLS + 2) - 1.0f,
+                                         RandomFloat() * 6.0f,
+                                         RandomFloat() * (NUM_ROWS + 2) - 1.0f);
+
+            PointLight& Light = m_pointLights[i];
+            Light.Color = Vector3f(RandomFloat(), RandomFloat(), RandomFloat());
+            Light.DiffuseIntensity = 1.5f;
+            Light.Attenuation.Exp = 40.0f;
+        }
+    }
+
+
+    void UpdatePointLights()
+    {
+        if (m_pointLights.empty()) {
+            return;
+        }
+
+        for (unsigned int i = 0 ; i < m_pointLights.size() ; i++) {
+            const float Angle = m_scale * 20.0f + (float)i;
+            m_pointLights[i].Position = m_lightCenters[i] + Vector3f(cosf(Angle), 0.0f, sinf(Angle));
+        }
+
+        m_pEffect->SetPointLights(m_pointLights.size(), &m_pointLights[0]);
+    }
+
     LightingTechnique* m_pEffect;
+    DepthPassTechnique* m_pDepthPass;
     Camera* m_pGameCamera;
     float m_scale;
     DirectionalLight m_directionalLight;
@@ -256,6 +874,39 @@ private:
     int m_time;
     int m_frameCount;
     float m_fps;    
+    GPUTimer m_gpuTimer;
+    bool m_benchmark;
+    bool m_textureStreaming;
+    bool m_clusteredLighting;
+    bool m_deferredShading;
+    GBuffer m_gbuffer;
+    bool m_visibilityShading;
+    VisibilityBuffer m_visibilityBuffer;
+    VisibilityTechnique* m_pVisibilityPass;
+    bool m_depthPrepass;
+    bool m_shadows;
+    bool m_occlusionCulling;
+    bool m_meshletCulling;
+    bool m_occluderReady;
+    std::vector<Matrix4f> m_visibleWVPMatrices;
+    std::vector<Matrix4f> m_visibleWorldMatrices;
+    std::vector<unsigned int> m_visibleInstances;
+    std::string m_probeFile;
+    std::string m_sceneFile;        // the static scene drawn in place of the spiders
+    std::string m_pvsFile;
+    bool m_streamMesh;
+    float m_staticFraction;         // of the spiders that stand still, see RenderShadows
+    PotentiallyVisibleSet m_visibleSets;
+    bool m_usePVS;
+    int m_pvsCell;
+    std::vector<Matrix4f> m_staticWorldMatrices;
+    std::vector<Matrix4f> m_dynamicWorldMatrices;
+    std::vector<PointLight> m_pointLights;
+    std::vector<Vector3f> m_lightCenters;
+    unsigned int m_benchmarkMode;
+    unsigned int m_benchmarkFrame;
+    double m_benchmarkTime;
+    unsigned int m_benchmarkSamples;
     Vector3f m_positions[NUM_INSTANCES];            
     float m_velocity[NUM_INSTANCES];
 };
@@ -263,7 +914,88 @@ private:
 
 int main(int argc, char** argv)
 {
-    Magick::InitializeMagick(*argv);
+    // Offline mode: compress the given images into KTX2 files next to them
+    if (argc > 1 && strcmp(argv[1], "--cook") == 0) {
+        return TextureCooker::CookFiles(argc - 2, argv + 2) ? 0 : 1;
+    }
+
+    // Offline mode: bake the irradiance probes of the scene in argv[2] into argv[3]
+    const bool BakeProbes = argc > 3 && strcmp(argv[1], "--bake-probes") == 0;
+
+    // Offline mode: bake the potentially visible sets of the scene in argv[2] into argv[3]
+    const bool BakePVS = argc > 3 && strcmp(argv[1], "--bake-pvs") == 0;
+
+    // Benchmark mode: compare the GPU time of the texture filtering modes and exit
+    bool Benchmark = false;
+    unsigned int TextureBudgetMB = TEXTURE_BUDGET_MB;
+    bool TextureStreaming = true;
+    unsigned int NumPointLights = 0;
+    bool ClusteredLighting = true;
+    bool DeferredShading = false;
+    bool VisibilityShading = false;
+    bool DepthPrepass = false;
+    bool Shadows = true;
+    bool OcclusionCulling = false;
+    bool MeshletCulling = false;
+    std::string ProbeFile;
+    std::string SceneFile;
+    std::string PVSFile;
+    bool StreamMesh = false;
+    float StaticFraction = 0.0f;
+
+    for (int i = 1 ; i < argc ; i++) {
+        if (strcmp(argv[i], "--bench") == 0) {
+            Benchmark = true;
+        }
+        else if (strcmp(argv[i], "--texture-budget") == 0 && i + 1 < argc) {
+            TextureBudgetMB = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--no-texture-streaming") == 0) {
+            TextureStreaming = false;
+        }
+        else if (strcmp(argv[i], "--lights") == 0 && i + 1 < argc) {
+            NumPointLights = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--no-clustered-lights") == 0) {
+            ClusteredLighting = false;
+        }
+        else if (strcmp(argv[i], "--deferred") == 0) {
+            DeferredShading = true;
+        }
+        else if (strcmp(argv[i], "--visibility") == 0) {
+            VisibilityShading = true;
+        }
+        else if (strcmp(argv[i], "--depth-prepass") == 0) {
+            DepthPrepass = true;
+        }
+        else if (strcmp(argv[i], "--no-shadows") == 0) {
+            Shadows = false;
+        }
+        else if (strcmp(argv[i], "--occlusion-culling") == 0) {
+            OcclusionCulling = true;
+        }
+        else if (strcmp(argv[i], "--meshlet-culling") == 0) {
+            MeshletCulling = true;
+        }
+        else if (strcmp(argv[i], "--probes") == 0 && i + 1 < argc) {
+            ProbeFile = argv[++i];
+        }
+        else if (strcmp(argv[i], "--scene") == 0 && i + 1 < argc) {
+            SceneFile = argv[++i];
+        }
+        else if (strcmp(argv[i], "--pvs") == 0 && i + 1 < argc) {
+            PVSFile = argv[++i];
+        }
+        else if (strcmp(argv[i], "--stream") == 0) {
+            StreamMesh = true;
+        }
+        else if (strcmp(argv[i], "--static-fraction") == 0 && i + 1 < argc) {
+            StaticFraction = atof(argv[++i]);
+        }
+    }
+
+    TextureResidency::SetBudget((size_t)TextureBudgetMB << 20);
+
     GLUTBackendInit(argc, argv);
 
     if (!GLUTBackendCreateWindow(WINDOW_WIDTH, WINDOW_HEIGHT, 32, false, "Tutorial 33")) {
@@ -272,7 +1004,21 @@ int main(int argc, char** argv)
     
     SRANDOM;
 
-    Tutorial33* pApp = new Tutorial33();
+    Tutorial33* pApp = new Tutorial33(Benchmark, TextureStreaming, NumPointLights, ClusteredLighting, DeferredShading,
+                                      VisibilityShading, DepthPrepass, Shadows, OcclusionCulling, MeshletCulling, ProbeFile,
+                                      SceneFile, PVSFile, StreamMesh, StaticFraction);
+
+    if (BakeProbes) {
+        const bool Ret = pApp->BakeProbes(argv[2], argv[3]);
+        delete pApp;
+        return Ret ? 0 : 1;
+    }
+
+    if (BakePVS) {
+        const bool Ret = pApp->BakePVS(argv[2], argv[3]);
+        delete pApp;
+        return Ret ? 0 : 1;
+    }
 
     if (!pApp->Init()) {
         return 1;
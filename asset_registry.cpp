@@ -0,0 +1,259 @@
+/*
+
+	Copyright 2011 Etay Meiri
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#pragma once
+#include <stdio.h>
+#include <assert.h>
+#include <stdlib.h>
+#include <ctype.h>
+#include <limits.h>
+
+#include "util.h"
+#include "asset_registry.h"
+#include "texture.h"
+#include "texture_loader.h"
+#include "mesh.h"
+
+std::mutex AssetRegistry::s_mutex;
+std::map<std::string, unsigned long long> AssetRegistry::s_contentHashes;
+AssetRegistry::TextureMap AssetRegistry::s_textures;
+AssetRegistry::MeshMap AssetRegistry::s_meshes;
+
+
+bool AssetRegistry::GetCanonicalPath(const std::string& FileName, std::string& CanonicalPath)
+{
+#ifdef WIN32
+    char Path[_MAX_PATH];
+
+    if (_fullpath(Path, FileName.c_str(), sizeof(Path)) == NULL) {
+        return false;
+    }
+
+    // Paths are case insensitive on Windows and both kinds of slashes are accepted
+    for (char* p = Path ; *p ; p++) {
+        *p = (*p == '\\') ? '/' : (char)tolower(*p);
+    }
+#else
+    char Path[PATH_MAX];
+
+    if (realpath(FileName.c_str(), Path) == NULL) {
+        return false;
+    }
+#endif
+
+    CanonicalPath = Path;
+
+    return true;
+}
+
+
+// 64 bit FNV-1a of the file contents. The result is cached per canonical path
+// so each file is only hashed once.
+bool AssetRegistry::GetContentHash(const std::string& CanonicalPath, unsigned long long& Hash)
+{
+    {
+        std::lock_guard<std::mutex> Lock(s_mutex);
+
+        std::map<std::string, unsigned long long>::const_iterator it = s_contentHashes.find(CanonicalPath);
+
+        if (it != s_contentHashes.end()) {
+            Hash = it->second;
+            return true;
+        }
+    }
+
+    // Hash outside of the lock so that threads don't wait on each other's I/O
+
+    FILE* f = fopen(CanonicalPath.c_str(), "rb");
+
+    if (!f) {
+        return false;
+    }
+
+    Hash = 14695981039346656037ULL;
+
+    unsigned char Buffer[64 * 1024];
+    size_t BytesRead;
+
+    while ((BytesRead = fread(Buffer, 1, sizeof(Buffer), f)) > 0) {
+        for (size_t i = 0 ; i < BytesRead ; i++) {
+            Hash ^= Buffer[i];
+            Hash *= 1099511628211ULL;
+        }
+    }
+
+    fclose(f);
+
+    std::lock_guard<std::mutex> Lock(s_mutex);
+
+    s_contentHashes[CanonicalPath] = Hash;
+
+    return true;
+}
+
+
+Texture* AssetRegistry::AcquireTexture(GLenum TextureTarget, const std::string& FileName)
+{
+    bool NeedsLoad = false;
+
+    Texture* pTexture = AcquireTexture(TextureTarget, FileName, NeedsLoad);
+
+    if (pTexture && NeedsLoad && !pTexture->Load()) {
+        ReleaseTexture(pTexture);
+        return NULL;
+    }
+
+    return pTexture;
+}
+
+
+Texture* AssetRegistry::AcquireTexture(GLenum TextureTarget, const std::string& FileName, bool& NeedsLoad)
+{
+    NeedsLoad = false;
+
+    std::string CanonicalPath;
+    unsigned long long Hash;
+
+    if (!GetCanonicalPath(FileName, CanonicalPath) || !GetContentHash(CanonicalPath, Hash)) {
+        printf("Error opening texture '%s'\n", FileName.c_str());
+        return NULL;
+    }
+
+    char Key[64];
+    snprintf(Key, sizeof(Key), "%x:%016llx", TextureTarget, Hash);
+
+    std::lock_guard<std::mutex> Lock(s_mutex);
+
+    AssetEntry<Texture>& Entry = s_textures[Key];
+
+    if (!Entry.pAsset) {
+        Entry.pAsset = new Texture(TextureTarget, FileName);
+        NeedsLoad = true;
+    }
+
+    Entry.RefCount++;
+
+    return Entry.pAsset;
+}
+
+
+Texture* AssetRegistry::AcquireTextureAsync(GLenum TextureTarget, const std::string& FileName, float Priority)
+{
+    bool NeedsLoad = false;
+
+    Texture* pTexture = AcquireTexture(TextureTarget, FileName, NeedsLoad);
+
+    if (pTexture && NeedsLoad) {
+        TextureLoader::Load(pTexture, Priority);
+    }
+
+    return pTexture;
+}
+
+
+void AssetRegistry::ReleaseTexture(Texture* pTexture)
+{
+    if (!pTexture) {
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> Lock(s_mutex);
+
+        TextureMap::iterator it = s_textures.begin();
+
+        while (it != s_textures.end() && it->second.pAsset != pTexture) {
+            it++;
+        }
+
+        if (it == s_textures.end()) {
+            assert(0);
+            return;
+        }
+
+        assert(it->second.RefCount > 0);
+
+        if (--it->second.RefCount > 0) {
+            return;
+        }
+
+        s_textures.erase(it);
+    }
+
+    // The texture may still be queued or decoding in TextureLoader
+    TextureLoader::Cancel(pTexture);
+    delete pTexture;
+}
+
+
+Mesh* AssetRegistry::AcquireMesh(const std::string& FileName, bool Streaming)
+{
+    std::string CanonicalPath;
+    unsigned long long Hash;
+
+    if (!GetCanonicalPath(FileName, CanonicalPath) || !GetContentHash(CanonicalPath, Hash)) {
+        printf("Error opening mesh '%s'\n", FileName.c_str());
+        return NULL;
+    }
+
+    char HashString[32];
+    snprintf(HashString, sizeof(HashString), ":%016llx", Hash);
+    const std::string Key = CanonicalPath + HashString;
+
+    AssetEntry<Mesh>& Entry = s_meshes[Key];
+
+    if (!Entry.pAsset) {
+        Mesh* pMesh = new Mesh();
+
+        const bool Loaded = Streaming ? pMesh->LoadMeshStreaming(FileName) : pMesh->LoadMesh(FileName);
+
+        if (!Loaded) {
+            delete pMesh;
+            s_meshes.erase(Key);
+            return NULL;
+        }
+
+        Entry.pAsset = pMesh;
+    }
+
+    Entry.RefCount++;
+
+    return Entry.pAsset;
+}
+
+
+void AssetRegistry::ReleaseMesh(Mesh* pMesh)
+{
+    if (!pMesh) {
+        return;
+    }
+
+    for (MeshMap::iterator it = s_meshes.begin() ; it != s_meshes.end() ; it++) {
+        if (it->second.pAsset == pMesh) {
+            assert(it->second.RefCount > 0);
+
+            if (--it->second.RefCount == 0) {
+                delete pMesh;
+                s_meshes.erase(it);
+            }
+
+            return;
+        }
+    }
+
+    assert(0);
+}
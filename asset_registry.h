@@ -0,0 +1,88 @@
+/*
+
+	Copyright 2011 Etay Meiri
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef ASSET_REGISTRY_H
+#define	ASSET_REGISTRY_H
+
+#include <map>
+#include <string>
+#include <mutex>
+#include <GL/glew.h>
+
+class Texture;
+class Mesh;
+
+// Shares textures and meshes between all of their users. Every Acquire call must be
+// matched by a Release call and the asset (including its GPU memory) is freed when
+// the last user releases it.
+//
+// Textures are keyed by the hash of the file contents so the same image reached through
+// different paths, or stored twice in the Content tree, is only loaded once. Meshes are
+// keyed by canonical path plus content hash since the materials of a mesh are resolved
+// relative to its directory.
+//
+// Textures may be acquired from any thread through the deferred variant. Everything
+// else, including every release, must happen on the GL thread.
+class AssetRegistry
+{
+public:
+    static Texture* AcquireTexture(GLenum TextureTarget, const std::string& FileName);
+
+    // Returns the shared texture without loading it. When NeedsLoad is set the caller
+    // created the texture and is responsible for decoding and uploading it.
+    static Texture* AcquireTexture(GLenum TextureTarget, const std::string& FileName, bool& NeedsLoad);
+
+    // Returns the shared texture right away and leaves its loading to TextureLoader.
+    // Must be called on the GL thread.
+    static Texture* AcquireTextureAsync(GLenum TextureTarget, const std::string& FileName, float Priority = 0.0f);
+
+    static void ReleaseTexture(Texture* pTexture);
+
+    // With Streaming a new mesh is returned right away and fills in over the following
+    // frames, see Mesh::LoadMeshStreaming. A mesh that is already loaded is shared as is.
+    static Mesh* AcquireMesh(const std::string& FileName, bool Streaming = false);
+
+    static void ReleaseMesh(Mesh* pMesh);
+
+private:
+    static bool GetCanonicalPath(const std::string& FileName, std::string& CanonicalPath);
+    static bool GetContentHash(const std::string& CanonicalPath, unsigned long long& Hash);
+
+    template <typename T>
+    struct AssetEntry {
+        AssetEntry()
+        {
+            pAsset = NULL;
+            RefCount = 0;
+        }
+
+        T* pAsset;
+        unsigned int RefCount;
+    };
+
+    typedef std::map<std::string, AssetEntry<Texture> > TextureMap;
+    typedef std::map<std::string, AssetEntry<Mesh> > MeshMap;
+
+    static std::mutex s_mutex;
+    static std::map<std::string, unsigned long long> s_contentHashes;
+    static TextureMap s_textures;
+    static MeshMap s_meshes;
+};
+
+
+#endif	/* ASSET_REGISTRY_H */
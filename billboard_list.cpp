@@ -19,78 +19,84 @@
 #include "util.h"
 #include "engine_common.h"
 #include "billboard_list.h"
+#include "gl_state.h"
 
 #define NUM_ROWS 10
 #define NUM_COLUMNS 10
 
+struct Billboard
+{
+    Vector3f Pos;
+    float Layer;
+};
+
 
 BillboardList::BillboardList()
 {
-    m_pTexture = NULL;
     m_VB = INVALID_OGL_VALUE;
 }
 
 
 BillboardList::~BillboardList()
 {
-    SAFE_DELETE(m_pTexture);
-    
     if (m_VB != INVALID_OGL_VALUE)
     {
-        glDeleteBuffers(1, &m_VB);
+        GLState::DeleteBuffers(1, &m_VB);
     }
 }
     
     
-bool BillboardList::Init(const std::string& TexFilename)
+bool BillboardList::Init(const std::vector<std::string>& TexFilenames)
 {
-    m_pTexture = new Texture(GL_TEXTURE_2D, TexFilename.c_str());
-        
-    if (!m_pTexture->Load()) {
+    // The program is built by the driver while the sprites load
+    if (!m_technique.Init()) {
         return false;
     }
 
-    CreatePositionBuffer();
-    
-    if (!m_technique.Init()) {
+    if (!m_sprites.Init(TexFilenames)) {
         return false;
     }
+
+    CreatePositionBuffer();
     
-    return true;
+    return m_technique.Wait();
 }
 
 
 void BillboardList::CreatePositionBuffer()
 {    
-    Vector3f Positions[NUM_ROWS * NUM_COLUMNS];
+    Billboard Billboards[NUM_ROWS * NUM_COLUMNS];
     
     for (unsigned int j = 0 ; j < NUM_ROWS ; j++) {
         for (unsigned int i = 0 ; i < NUM_COLUMNS ; i++) {
             Vector3f Pos((float)i, 0.0f, (float)j);            
-            Positions[j * NUM_COLUMNS + i] = Pos;
+            Billboards[j * NUM_COLUMNS + i].Pos = Pos;
+            Billboards[j * NUM_COLUMNS + i].Layer = (float)((j * NUM_COLUMNS + i) % m_sprites.GetNumLayers());
         }
     }
 
-    glGenBuffers(1, &m_VB);
-  	glBindBuffer(GL_ARRAY_BUFFER, m_VB);
-	glBufferData(GL_ARRAY_BUFFER, sizeof(Positions), &Positions[0], GL_STATIC_DRAW);
+    m_VB = GLState::CreateBuffer();
+	GLState::BufferData(m_VB, sizeof(Billboards), &Billboards[0], GL_STATIC_DRAW);
 }
 
 
 void BillboardList::Render(const Matrix4f& VP, const Vector3f& CameraPos)
 {
+    FrameUniforms& Frame = UniformBuffers::EditFrame();
+    Frame.VP = VP;
+    Frame.EyeWorldPos = CameraPos;
+    UniformBuffers::Update();
+
     m_technique.Enable();
-    m_technique.SetVP(VP);
-    m_technique.SetCameraPosition(CameraPos);
     
-    m_pTexture->Bind(COLOR_TEXTURE_UNIT);
+    // Every sprite type in one bind and one draw
+    m_sprites.Bind(COLOR_TEXTURE_UNIT);
     
-    glEnableVertexAttribArray(0);
+    GLState::SetVertexAttribArrays(0x3);
     
-    glBindBuffer(GL_ARRAY_BUFFER, m_VB);
-    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 0, 0);   // position
+    GLState::BindBuffer(GL_ARRAY_BUFFER, m_VB);
+    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(Billboard), 0);                  // position
+    glVertexAttribPointer(1, 1, GL_FLOAT, GL_FALSE, sizeof(Billboard), (const GLvoid*)12);  // layer
     
     glDrawArrays(GL_POINTS, 0, NUM_ROWS * NUM_COLUMNS);
-    
-    glDisableVertexAttribArray(0);
 }
\ No newline at end of file
@@ -20,11 +20,16 @@
 #define	BILLBOARD_LIST_H
 
 #include <string>
+#include <vector>
 
 #include "texture.h"
+#include "sprite_array.h"
 #include "billboard_technique.h"
 #include "billboard_technique.cpp"
 #include "texture.cpp"
+#include "asset_registry.cpp"
+#include "texture_loader.cpp"
+#include "sprite_array.cpp"
 #include "math_3d.h"
 #include "math_3d.cpp"
 
@@ -34,7 +39,8 @@ public:
     BillboardList();    
     ~BillboardList();
     
-    bool Init(const std::string& TexFilename);
+    // Billboard i uses sprite i % TexFilenames.size()
+    bool Init(const std::vector<std::string>& TexFilenames);
     
     void Render(const Matrix4f& VP, const Vector3f& CameraPos);
 
@@ -42,7 +48,7 @@ private:
     void CreatePositionBuffer();
     
     GLuint m_VB;
-    Texture* m_pTexture;
+    SpriteArray m_sprites;
     BillboardTechnique m_technique;
 };
 
@@ -43,18 +43,18 @@ bool BillboardTechnique::Init()
         return false;
     }
 
-    if (!Finalize()) {
-        return false;
-    }
+    return Finalize();
+}
+
+
+bool BillboardTechnique::OnFinalized()
+{
+    UniformBuffers::BindBlocks(m_shaderProg);
 
-    m_VPLocation = GetUniformLocation("gVP");
-    m_cameraPosLocation = GetUniformLocation("gCameraPos");
     m_colorMapLocation = GetUniformLocation("gColorMap");
     m_billboardSizeLocation = GetUniformLocation("gBillboardSize");
 
-    if (m_VPLocation == INVALID_UNIFORM_LOCATION ||
-        m_cameraPosLocation == INVALID_UNIFORM_LOCATION ||
-        m_billboardSizeLocation == INVALID_UNIFORM_LOCATION ||
+    if (m_billboardSizeLocation == INVALID_UNIFORM_LOCATION ||
         m_colorMapLocation == INVALID_UNIFORM_LOCATION) {
         return false;        
     }
@@ -63,18 +63,6 @@ bool BillboardTechnique::Init()
 }
     
     
-void BillboardTechnique::SetVP(const Matrix4f& VP)
-{
-    glUniformMatrix4fv(m_VPLocation, 1, GL_TRUE, (const GLfloat*)VP.m);    
-}
-
-
-void BillboardTechnique::SetCameraPosition(const Vector3f& Pos)
-{
-    glUniform3f(m_cameraPosLocation, Pos.x, Pos.y, Pos.z);
-}
-
-
 void BillboardTechnique::SetColorTextureUnit(unsigned int TextureUnit)
 {
     glUniform1i(m_colorMapLocation, TextureUnit);
@@ -22,7 +22,9 @@
 #include "technique.cpp"
 #include "math_3d.h"
 #include "math_3d.cpp"
+#include "uniform_buffers.h"
 
+// Reads the view projection and the camera position from the shared frame block
 class BillboardTechnique : public Technique 
 {
 public:
@@ -30,16 +32,14 @@ public:
     BillboardTechnique();
  
     virtual bool Init();
+
+    virtual bool OnFinalized();
     
-    void SetVP(const Matrix4f& VP);
-    void SetCameraPosition(const Vector3f& Pos);
     void SetColorTextureUnit(unsigned int TextureUnit);
     void SetBillboardSize(float BillboardSize);
     
 private:
 
-    GLuint m_VPLocation;
-    GLuint m_cameraPosLocation;
     GLuint m_colorMapLocation;
     GLuint m_billboardSizeLocation;
 
@@ -47,10 +47,14 @@ private:
 #version 330                                                                        \n\
                                                                                     \n\
 layout (location = 0) in vec3 Position;                                             \n\
+layout (location = 1) in float Layer;                                               \n\
+                                                                                    \n\
+out float Layer0;                                                                   \n\
                                                                                     \n\
 void main()                                                                         \n\
 {                                                                                   \n\
     gl_Position = vec4(Position, 1.0);                                              \n\
+    Layer0 = Layer;                                                                 \n\
 }                                                                                   \n\
 ";
 
@@ -62,38 +66,46 @@ layout(points) in;
 layout(triangle_strip) out;                                                         \n\
 layout(max_vertices = 4) out;                                                       \n\
                                                                                     \n\
-uniform mat4 gVP;                                                                   \n\
-uniform vec3 gCameraPos;                                                            \n\
+"
+UNIFORM_BLOCKS_GLSL
+"                                                                                   \n\
 uniform float gBillboardSize;                                                       \n\
                                                                                     \n\
+in float Layer0[];                                                                  \n\
+                                                                                    \n\
 out vec2 TexCoord;                                                                  \n\
+flat out float Layer;                                                               \n\
                                                                                     \n\
 void main()                                                                         \n\
 {                                                                                   \n\
     vec3 Pos = gl_in[0].gl_Position.xyz;                                            \n\
-    vec3 toCamera = normalize(gCameraPos - Pos);                                    \n\
+    vec3 toCamera = normalize(gEyeWorldPos - Pos);                                  \n\
     vec3 up = vec3(0.0, 1.0, 0.0);                                                  \n\
     vec3 right = cross(toCamera, up) * gBillboardSize;                              \n\
                                                                                     \n\
     Pos -= right;                                                                   \n\
     gl_Position = gVP * vec4(Pos, 1.0);                                             \n\
     TexCoord = vec2(0.0, 0.0);                                                      \n\
+    Layer = Layer0[0];                                                              \n\
     EmitVertex();                                                                   \n\
                                                                                     \n\
     Pos.y += gBillboardSize;                                                        \n\
     gl_Position = gVP * vec4(Pos, 1.0);                                             \n\
     TexCoord = vec2(0.0, 1.0);                                                      \n\
+    Layer = Layer0[0];                                                              \n\
     EmitVertex();                                                                   \n\
                                                                                     \n\
     Pos.y -= gBillboardSize;                                                        \n\
     Pos += right;                                                                   \n\
     gl_Position = gVP * vec4(Pos, 1.0);                                             \n\
     TexCoord = vec2(1.0, 0.0);                                                      \n\
+    Layer = Layer0[0];                                                              \n\
     EmitVertex();                                                                   \n\
                                                                                     \n\
     Pos.y += gBillboardSize;                                                        \n\
     gl_Position = gVP * vec4(Pos, 1.0);                                             \n\
     TexCoord = vec2(1.0, 1.0);                                                      \n\
+    Layer = Layer0[0];                                                              \n\
     EmitVertex();                                                                   \n\
                                                                                     \n\
     EndPrimitive();                                                                 \n\
@@ -103,14 +115,15 @@ void main()
     const char* pFS = "                                                          \n\
 #version 330                                                                        \n\
                                                                                     \n\
-uniform sampler2D gColorMap;                                                        \n\
+uniform sampler2DArray gColorMap;                                                   \n\
                                                                                     \n\
 in vec2 TexCoord;                                                                   \n\
+flat in float Layer;                                                                \n\
 out vec4 FragColor;                                                                 \n\
                                                                                     \n\
 void main()                                                                         \n\
 {                                                                                   \n\
-    FragColor = texture2D(gColorMap, TexCoord);                                     \n\
+    FragColor = texture(gColorMap, vec3(TexCoord, Layer));                          \n\
                                                                                     \n\
     if (FragColor.r >= 0.9 && FragColor.g >= 0.9 && FragColor.b >= 0.9) {           \n\
         discard;                                                                    \n\
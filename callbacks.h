@@ -36,5 +36,14 @@ public:
     virtual void MouseCB(int Button, int State, int x, int y) = 0;
 };
 
+// Lets the caller of Mesh::Render adapt the program to every draw, e.g. pick a
+// permutation without the texture for the materials that have none
+class IRenderCallbacks
+{
+public:
+
+    virtual void DrawStartCB(unsigned int MaterialIndex, bool Textured) = 0;
+};
+
 #endif	/* I3DAPPLICATION_H */
 
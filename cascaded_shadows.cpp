@@ -0,0 +1,334 @@
+/*
+
+	Copyright 2011 Etay Meiri
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <float.h>
+#include <algorithm>
+
+#include "cascaded_shadows.h"
+#include "shadow_technique.h"
+#include "mesh.h"
+#include "engine_common.h"
+#include "gl_state.h"
+#include "util.h"
+
+#include "shadow_technique.cpp"
+
+// Slope scaled offset of the caster depth against shadow acne
+#define SHADOW_OFFSET_FACTOR 2.0f
+#define SHADOW_OFFSET_UNITS  4.0f
+
+ShadowTechnique* CascadedShadows::s_pTechnique = NULL;
+GLuint CascadedShadows::s_shadowMap = 0;
+GLuint CascadedShadows::s_staticMap = 0;
+GLuint CascadedShadows::s_shadowFBO = 0;
+GLuint CascadedShadows::s_staticFBO = 0;
+Vector3f CascadedShadows::s_sceneMin(0.0f, 0.0f, 0.0f);
+Vector3f CascadedShadows::s_sceneMax(0.0f, 0.0f, 0.0f);
+Matrix4f CascadedShadows::s_cachedVP[NUM_SHADOW_CASCADES];
+bool CascadedShadows::s_dirty[NUM_SHADOW_CASCADES];
+
+
+bool CascadedShadows::Init()
+{
+    if (s_pTechnique) {
+        return true;
+    }
+
+    s_shadowMap = CreateMap(true);
+    s_shadowFBO = CreateFramebuffer(s_shadowMap);
+
+    if (GLEW_ARB_copy_image && GLEW_ARB_clear_texture) {
+        s_staticMap = CreateMap(false);
+        s_staticFBO = CreateFramebuffer(s_staticMap);
+    }
+    else {
+        printf("Shadow caching requires ARB_copy_image and ARB_clear_texture, rendering all the casters every frame\n");
+    }
+
+    if (s_shadowFBO == 0 || (s_staticMap != 0 && s_staticFBO == 0)) {
+        Shutdown();
+        return false;
+    }
+
+    s_pTechnique = new ShadowTechnique();
+
+    if (!s_pTechnique->Init() || !s_pTechnique->Wait()) {
+        printf("Error initializing the shadow technique\n");
+        Shutdown();
+        return false;
+    }
+
+    InvalidateStaticCache();
+
+    return GLCheckError();
+}
+
+
+// The shadow map is sampled with hardware comparison and bilinear filtering, the cache
+// is only rendered to and copied from
+GLuint CascadedShadows::CreateMap(bool Compare)
+{
+    GLuint Texture = GLState::CreateTexture(GL_TEXTURE_2D_ARRAY);
+    GLState::BindTextureForEdit(Texture);
+    glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, GL_DEPTH_COMPONENT32F, SHADOW_MAP_SIZE, SHADOW_MAP_SIZE, NUM_SHADOW_CASCADES,
+                 0, GL_DEPTH_COMPONENT, GL_FLOAT, NULL);
+    GLState::TextureParameteri(Texture, GL_TEXTURE_MIN_FILTER, Compare ? GL_LINEAR : GL_NEAREST);
+    GLState::TextureParameteri(Texture, GL_TEXTURE_MAG_FILTER, Compare ? GL_LINEAR : GL_NEAREST);
+    GLState::TextureParameteri(Texture, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    GLState::TextureParameteri(Texture, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+
+    if (Compare) {
+        GLState::TextureParameteri(Texture, GL_TEXTURE_COMPARE_MODE, GL_COMPARE_REF_TO_TEXTURE);
+        GLState::TextureParameteri(Texture, GL_TEXTURE_COMPARE_FUNC, GL_LEQUAL);
+    }
+
+    return Texture;
+}
+
+
+// Attaches every layer of the texture so gl_Layer selects the cascade. Returns 0 on
+// failure.
+GLuint CascadedShadows::CreateFramebuffer(GLuint DepthTexture)
+{
+    GLuint FBO;
+    glGenFramebuffers(1, &FBO);
+    glBindFramebuffer(GL_DRAW_FRAMEBUFFER, FBO);
+    glFramebufferTexture(GL_DRAW_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, DepthTexture, 0);
+    glDrawBuffer(GL_NONE);
+
+    const GLenum Status = glCheckFramebufferStatus(GL_DRAW_FRAMEBUFFER);
+
+    glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
+
+    if (Status != GL_FRAMEBUFFER_COMPLETE) {
+        fprintf(stderr, "Shadow map framebuffer error, status: 0x%x\n", Status);
+        glDeleteFramebuffers(1, &FBO);
+        return 0;
+    }
+
+    return FBO;
+}
+
+
+void CascadedShadows::SetSceneBounds(const Vector3f& Min, const Vector3f& Max)
+{
+    s_sceneMin = Min;
+    s_sceneMax = Max;
+}
+
+
+void CascadedShadows::InvalidateStaticCache()
+{
+    for (unsigned int i = 0 ; i < NUM_SHADOW_CASCADES ; i++) {
+        s_dirty[i] = true;
+    }
+}
+
+
+// Each cascade is a square around the bounding sphere of its slice of the view frustum.
+// The sphere only depends on the projection so the size of the cascade never changes,
+// and its center is snapped to steps of whole texels, so the cascade only moves when
+// the camera has moved a step.
+void CascadedShadows::Update(const Vector3f& EyePos, const Vector3f& ViewDir, const PersProjInfo& Proj,
+                             const Vector3f& LightDir)
+{
+    if (!s_pTechnique) {
+        return;
+    }
+
+    Vector3f Dir = ViewDir;
+    Dir.Normalize();
+
+    Vector3f LightZ = LightDir;
+    LightZ.Normalize();
+
+    Matrix4f LightView;
+    LightView.InitCameraTransform(LightZ, fabsf(LightZ.y) > 0.99f ? Vector3f(1.0f, 0.0f, 0.0f) : Vector3f(0.0f, 1.0f, 0.0f));
+
+    // The depth range covers the whole scene whatever the camera sees
+    float MinZ = FLT_MAX;
+    float MaxZ = -FLT_MAX;
+
+    for (unsigned int i = 0 ; i < 8 ; i++) {
+        const Vector4f Corner((i & 1) ? s_sceneMax.x : s_sceneMin.x,
+                              (i & 2) ? s_sceneMax.y : s_sceneMin.y,
+                              (i & 4) ? s_sceneMax.z : s_sceneMin.z,
+                              1.0f);
+        const float z = (LightView * Corner).z;
+        MinZ = std::min(MinZ, z);
+        MaxZ = std::max(MaxZ, z);
+    }
+
+    const float TanHalfFOV = tanf(ToRadian(Proj.FOV / 2.0f));
+    const float AspectRatio = Proj.Width / Proj.Height;
+
+    // Squared distance of the corners of the frustum from its axis, per unit of depth
+    const float k = TanHalfFOV * TanHalfFOV * (1.0f + AspectRatio * AspectRatio);
+
+    bool Changed = false;
+    float Near = Proj.zNear;
+
+    for (unsigned int i = 0 ; i < NUM_SHADOW_CASCADES ; i++) {
+        const float t = (float)(i + 1) / NUM_SHADOW_CASCADES;
+        const float LogSplit = Proj.zNear * powf(Proj.zFar / Proj.zNear, t);
+        const float UniformSplit = Proj.zNear + (Proj.zFar - Proj.zNear) * t;
+        const float Far = SHADOW_SPLIT_LAMBDA * LogSplit + (1.0f - SHADOW_SPLIT_LAMBDA) * UniformSplit;
+
+        // The center of the sphere is on the axis, as far from the near corners as from
+        // the far ones
+        const float Center = std::min((1.0f + k) * (Near + Far) / 2.0f, Far);
+        const float Radius = sqrtf((Far - Center) * (Far - Center) + k * Far * Far);
+
+        const float HalfSize = Radius * (1.0f + SHADOW_CASCADE_SNAP);
+        const float TexelSize = 2.0f * HalfSize / SHADOW_MAP_SIZE;
+        const float Step = TexelSize * std::max(floorf(Radius * SHADOW_CASCADE_SNAP / TexelSize), 1.0f);
+
+        const Vector3f Pos = EyePos + Dir * Center;
+        const Vector4f LightPos = LightView * Vector4f(Pos.x, Pos.y, Pos.z, 1.0f);
+        const float x = floorf(LightPos.x / Step + 0.5f) * Step;
+        const float y = floorf(LightPos.y / Step + 0.5f) * Step;
+
+        Matrix4f Ortho;
+        Ortho.m[0][0] = 1.0f / HalfSize; Ortho.m[0][1] = 0.0f;            Ortho.m[0][2] = 0.0f;                 Ortho.m[0][3] = -x / HalfSize;
+        Ortho.m[1][0] = 0.0f;            Ortho.m[1][1] = 1.0f / HalfSize; Ortho.m[1][2] = 0.0f;                 Ortho.m[1][3] = -y / HalfSize;
+        Ortho.m[2][0] = 0.0f;            Ortho.m[2][1] = 0.0f;            Ortho.m[2][2] = 2.0f / (MaxZ - MinZ); Ortho.m[2][3] = -(MaxZ + MinZ) / (MaxZ - MinZ);
+        Ortho.m[3][0] = 0.0f;            Ortho.m[3][1] = 0.0f;            Ortho.m[3][2] = 0.0f;                 Ortho.m[3][3] = 1.0f;
+
+        const Matrix4f VP = Ortho * LightView;
+
+        if (memcmp(&VP, &s_cachedVP[i], sizeof(Matrix4f)) != 0) {
+            s_cachedVP[i] = VP;
+            s_dirty[i] = true;
+            Changed = true;
+        }
+
+        Near = Far;
+    }
+
+    // Editing the block uploads it, so leave it alone while the cascades stand still
+    if (Changed) {
+        LightUniforms& Lights = UniformBuffers::EditLights();
+
+        for (unsigned int i = 0 ; i < NUM_SHADOW_CASCADES ; i++) {
+            Lights.ShadowCascadeVP[i] = s_cachedVP[i];
+            Lights.ShadowTexelSize[i] = 2.0f / (SHADOW_MAP_SIZE * s_cachedVP[i].m[0][0]);
+        }
+    }
+}
+
+
+void CascadedShadows::RenderCasters(Mesh* pMesh, unsigned int NumInstances, const Matrix4f* pWorldMats,
+                                    unsigned int FirstCascade, unsigned int NumCascades)
+{
+    if (NumInstances == 0) {
+        return;
+    }
+
+    s_pTechnique->SetCascades(FirstCascade, NumCascades);
+    pMesh->RenderDepth(NumInstances, pWorldMats, pWorldMats, NumCascades);
+}
+
+
+void CascadedShadows::Render(Mesh* pMesh, unsigned int NumStatic, const Matrix4f* pStaticWorldMats,
+                             unsigned int NumDynamic, const Matrix4f* pDynamicWorldMats)
+{
+    if (!s_pTechnique) {
+        return;
+    }
+
+    GLint Viewport[4];
+    glGetIntegerv(GL_VIEWPORT, Viewport);
+    glViewport(0, 0, SHADOW_MAP_SIZE, SHADOW_MAP_SIZE);
+
+    // The casters in front of the near plane of a cascade are flattened onto it
+    // instead of being clipped away
+    GLState::Enable(GL_DEPTH_CLAMP);
+    GLState::Enable(GL_POLYGON_OFFSET_FILL);
+    glPolygonOffset(SHADOW_OFFSET_FACTOR, SHADOW_OFFSET_UNITS);
+
+    GLState::DepthFunc(GL_LESS);
+    GLState::DepthMask(GL_TRUE);
+
+    s_pTechnique->Enable();
+
+    if (s_staticMap != 0) {
+        // The stale cascades are refreshed by one pass over the range that holds them
+        unsigned int First = NUM_SHADOW_CASCADES;
+        unsigned int Last = 0;
+
+        for (unsigned int i = 0 ; i < NUM_SHADOW_CASCADES ; i++) {
+            if (s_dirty[i]) {
+                First = std::min(First, i);
+                Last = i;
+                s_dirty[i] = false;
+            }
+        }
+
+        if (First <= Last) {
+            const unsigned int Count = Last - First + 1;
+            const GLfloat ClearDepth = 1.0f;
+            glClearTexSubImage(s_staticMap, 0, 0, 0, First, SHADOW_MAP_SIZE, SHADOW_MAP_SIZE, Count,
+                               GL_DEPTH_COMPONENT, GL_FLOAT, &ClearDepth);
+
+            glBindFramebuffer(GL_DRAW_FRAMEBUFFER, s_staticFBO);
+            RenderCasters(pMesh, NumStatic, pStaticWorldMats, First, Count);
+        }
+
+        glCopyImageSubData(s_staticMap, GL_TEXTURE_2D_ARRAY, 0, 0, 0, 0,
+                           s_shadowMap, GL_TEXTURE_2D_ARRAY, 0, 0, 0, 0,
+                           SHADOW_MAP_SIZE, SHADOW_MAP_SIZE, NUM_SHADOW_CASCADES);
+
+        glBindFramebuffer(GL_DRAW_FRAMEBUFFER, s_shadowFBO);
+    }
+    else {
+        glBindFramebuffer(GL_DRAW_FRAMEBUFFER, s_shadowFBO);
+        glClear(GL_DEPTH_BUFFER_BIT);
+        RenderCasters(pMesh, NumStatic, pStaticWorldMats, 0, NUM_SHADOW_CASCADES);
+    }
+
+    RenderCasters(pMesh, NumDynamic, pDynamicWorldMats, 0, NUM_SHADOW_CASCADES);
+
+    glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
+    glViewport(Viewport[0], Viewport[1], Viewport[2], Viewport[3]);
+
+    GLState::Disable(GL_POLYGON_OFFSET_FILL);
+    GLState::Disable(GL_DEPTH_CLAMP);
+
+    GLState::BindTexture(SHADOW_TEXTURE_UNIT_INDEX, GL_TEXTURE_2D_ARRAY, s_shadowMap);
+}
+
+
+void CascadedShadows::Shutdown()
+{
+    SAFE_DELETE(s_pTechnique);
+
+    GLuint FBOs[] = { s_shadowFBO, s_staticFBO };
+    glDeleteFramebuffers(ARRAY_SIZE_IN_ELEMENTS(FBOs), FBOs);
+
+    GLuint Textures[] = { s_shadowMap, s_staticMap };
+    GLState::DeleteTextures(ARRAY_SIZE_IN_ELEMENTS(Textures), Textures);
+
+    s_shadowFBO = 0;
+    s_staticFBO = 0;
+    s_shadowMap = 0;
+    s_staticMap = 0;
+}
@@ -0,0 +1,95 @@
+/*
+
+	Copyright 2011 Etay Meiri
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef CASCADED_SHADOWS_H
+#define	CASCADED_SHADOWS_H
+
+#include <GL/glew.h>
+
+#include "math_3d.h"
+#include "uniform_buffers.h"
+
+// Width and height of every cascade
+#define SHADOW_MAP_SIZE 1024
+
+// Blend between the logarithmic (1) and the uniform (0) split of the view distance
+#define SHADOW_SPLIT_LAMBDA 0.8f
+
+// A cascade moves in steps of this fraction of its radius and covers that much more,
+// so its matrix and the cached static depth stay valid while the camera moves within
+// a step
+#define SHADOW_CASCADE_SNAP 0.125f
+
+class Mesh;
+class ShadowTechnique;
+
+// Cascaded shadow maps of the directional light. The view distance is split in
+// NUM_SHADOW_CASCADES ranges, each covered by a fixed size square of a layer of a
+// depth texture array. All the cascades are rendered in a single layered pass.
+//
+// The depth of the static casters is rendered into a second array and only for the
+// cascades whose matrix changed. Every frame that array is copied to the shadow map and
+// only the dynamic casters are drawn on top. The cache needs ARB_copy_image and
+// ARB_clear_texture, without them everything is rendered every frame. GL thread only.
+class CascadedShadows
+{
+public:
+    static bool Init();
+
+    static bool IsEnabled() { return s_pTechnique != NULL; }
+
+    // Box around everything that casts or receives shadows. It bounds the depth range
+    // of the cascades, which must not change with the camera for the cache to work.
+    static void SetSceneBounds(const Vector3f& Min, const Vector3f& Max);
+
+    // Fits the cascades to the camera and writes them to the light uniform block. Call
+    // once per frame before UniformBuffers::Update. ViewDir and LightDir need not be
+    // normalized.
+    static void Update(const Vector3f& EyePos, const Vector3f& ViewDir, const PersProjInfo& Proj,
+                       const Vector3f& LightDir);
+
+    // The static casters changed, e.g. more of the mesh was streamed in
+    static void InvalidateStaticCache();
+
+    // Renders the casters of pMesh into the cascades and leaves the shadow map bound to
+    // SHADOW_TEXTURE_UNIT_INDEX. The matrices are world matrices. The static ones are
+    // only read when a cascade has to be refreshed but must not change in between.
+    static void Render(Mesh* pMesh, unsigned int NumStatic, const Matrix4f* pStaticWorldMats,
+                       unsigned int NumDynamic, const Matrix4f* pDynamicWorldMats);
+
+    static void Shutdown();
+
+private:
+    static GLuint CreateMap(bool Compare);
+    static GLuint CreateFramebuffer(GLuint DepthTexture);
+    static void RenderCasters(Mesh* pMesh, unsigned int NumInstances, const Matrix4f* pWorldMats,
+                              unsigned int FirstCascade, unsigned int NumCascades);
+
+    static ShadowTechnique* s_pTechnique;
+    static GLuint s_shadowMap;
+    static GLuint s_staticMap;              // 0 without the cache
+    static GLuint s_shadowFBO;
+    static GLuint s_staticFBO;
+    static Vector3f s_sceneMin;
+    static Vector3f s_sceneMax;
+    static Matrix4f s_cachedVP[NUM_SHADOW_CASCADES];
+    static bool s_dirty[NUM_SHADOW_CASCADES];
+};
+
+
+#endif	/* CASCADED_SHADOWS_H */
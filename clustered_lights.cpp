@@ -0,0 +1,216 @@
+/*
+
+	Copyright 2011 Etay Meiri
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+#include <stdio.h>
+#include <math.h>
+#include <float.h>
+#include <algorithm>
+
+#include "clustered_lights.h"
+#include "light_cluster_technique.h"
+#include "gl_state.h"
+#include "util.h"
+
+#include "light_cluster_technique.cpp"
+
+LightClusterTechnique* ClusteredLights::s_pTechnique = NULL;
+std::vector<UniformPointLight> ClusteredLights::s_pointLights;
+std::vector<UniformSpotLight> ClusteredLights::s_spotLights;
+bool ClusteredLights::s_dirty = true;
+GLuint ClusteredLights::s_pointLightBuffer = 0;
+GLuint ClusteredLights::s_spotLightBuffer = 0;
+GLuint ClusteredLights::s_sphereBuffer = 0;
+GLuint ClusteredLights::s_countBuffer = 0;
+GLuint ClusteredLights::s_indexBuffer = 0;
+
+// Below 1/256 of its intensity a light doesn't change the 8 bit color anymore
+#define LIGHT_CUTOFF 256.0f
+
+bool ClusteredLights::Init()
+{
+    if (s_pTechnique) {
+        return true;
+    }
+
+    if (!GLEW_ARB_compute_shader || !GLEW_ARB_shader_storage_buffer_object || !GLEW_ARB_program_interface_query) {
+        printf("Clustered lighting requires compute shaders and shader storage buffers\n");
+        return false;
+    }
+
+    GLuint Buffers[5];
+    GLState::CreateBuffers(ARRAY_SIZE_IN_ELEMENTS(Buffers), Buffers);
+    s_pointLightBuffer = Buffers[0];
+    s_spotLightBuffer = Buffers[1];
+    s_sphereBuffer = Buffers[2];
+    s_countBuffer = Buffers[3];
+    s_indexBuffer = Buffers[4];
+
+    // Written by the binning pass, read by the lighting shader
+    GLState::BufferData(s_countBuffer, NUM_CLUSTERS * 2 * sizeof(GLuint), NULL, GL_DYNAMIC_COPY);
+    GLState::BufferData(s_indexBuffer, NUM_CLUSTERS * CLUSTER_MAX_LIGHTS * sizeof(GLuint), NULL, GL_DYNAMIC_COPY);
+    GLState::BindBufferBase(GL_SHADER_STORAGE_BUFFER, CLUSTER_COUNT_BINDING, s_countBuffer);
+    GLState::BindBufferBase(GL_SHADER_STORAGE_BUFFER, CLUSTER_INDEX_BINDING, s_indexBuffer);
+
+    UploadLights();
+
+    s_pTechnique = new LightClusterTechnique();
+
+    if (!s_pTechnique->Init() || !s_pTechnique->Wait()) {
+        printf("Error initializing the light clustering technique\n");
+        Shutdown();
+        return false;
+    }
+
+    return true;
+}
+
+
+UniformPointLight* ClusteredLights::EditPointLights(unsigned int NumLights)
+{
+    s_pointLights.resize(NumLights);
+    s_dirty = true;
+
+    return NumLights > 0 ? &s_pointLights[0] : NULL;
+}
+
+
+UniformSpotLight* ClusteredLights::EditSpotLights(unsigned int NumLights)
+{
+    s_spotLights.resize(NumLights);
+    s_dirty = true;
+
+    return NumLights > 0 ? &s_spotLights[0] : NULL;
+}
+
+
+// Distance at which the brightest channel of the light drops below the cutoff. The spot
+// lights use the sphere of their point light.
+float ClusteredLights::CalcLightRadius(const UniformPointLight& Light)
+{
+    const UniformAttenuation& Atten = Light.Atten;
+    const float MaxChannel = std::max(std::max(Light.Base.Color.x, Light.Base.Color.y), Light.Base.Color.z);
+    const float Intensity = MaxChannel * (Light.Base.AmbientIntensity + Light.Base.DiffuseIntensity);
+    const float c = Atten.Constant - LIGHT_CUTOFF * Intensity;
+
+    if (c >= 0.0f) {
+        return 0.0f;
+    }
+
+    if (Atten.Exp > 0.0f) {
+        return (-Atten.Linear + sqrtf(Atten.Linear * Atten.Linear - 4.0f * Atten.Exp * c)) / (2.0f * Atten.Exp);
+    }
+
+    if (Atten.Linear > 0.0f) {
+        return -c / Atten.Linear;
+    }
+
+    // Reaches everything
+    return FLT_MAX;
+}
+
+
+// The buffers are respecified with the new contents so the draws of the previous frame
+// keep theirs. They never get empty since a binding needs storage behind it.
+void ClusteredLights::UploadLights()
+{
+    const size_t NumPointLights = s_pointLights.size();
+    const size_t NumSpotLights = s_spotLights.size();
+
+    std::vector<Vector4f> Spheres(std::max(NumPointLights + NumSpotLights, (size_t)1));
+
+    for (size_t i = 0 ; i < NumPointLights ; i++) {
+        const UniformPointLight& Light = s_pointLights[i];
+        Spheres[i] = Vector4f(Light.Position.x, Light.Position.y, Light.Position.z, CalcLightRadius(Light));
+    }
+
+    for (size_t i = 0 ; i < NumSpotLights ; i++) {
+        const UniformPointLight& Light = s_spotLights[i].Base;
+        Spheres[NumPointLights + i] = Vector4f(Light.Position.x, Light.Position.y, Light.Position.z, CalcLightRadius(Light));
+    }
+
+    GLState::BufferData(s_pointLightBuffer, std::max(NumPointLights, (size_t)1) * sizeof(UniformPointLight),
+                        NumPointLights > 0 ? &s_pointLights[0] : NULL, GL_STREAM_DRAW);
+    GLState::BufferData(s_spotLightBuffer, std::max(NumSpotLights, (size_t)1) * sizeof(UniformSpotLight),
+                        NumSpotLights > 0 ? &s_spotLights[0] : NULL, GL_STREAM_DRAW);
+    GLState::BufferData(s_sphereBuffer, Spheres.size() * sizeof(Vector4f), &Spheres[0], GL_STREAM_DRAW);
+
+    // The bindings take the new size
+    GLState::BindBufferBase(GL_SHADER_STORAGE_BUFFER, CLUSTER_POINT_LIGHT_BINDING, s_pointLightBuffer);
+    GLState::BindBufferBase(GL_SHADER_STORAGE_BUFFER, CLUSTER_SPOT_LIGHT_BINDING, s_spotLightBuffer);
+    GLState::BindBufferBase(GL_SHADER_STORAGE_BUFFER, CLUSTER_SPHERE_BINDING, s_sphereBuffer);
+
+    s_dirty = false;
+}
+
+
+bool ClusteredLights::Update(const Matrix4f& View, const PersProjInfo& Proj)
+{
+    if (!s_pTechnique) {
+        return false;
+    }
+
+    if (s_dirty) {
+        UploadLights();
+    }
+
+    s_pTechnique->Enable();
+    s_pTechnique->SetView(View);
+    s_pTechnique->SetProjection(Proj);
+    s_pTechnique->SetNumLights(s_pointLights.size(), s_spotLights.size());
+
+    glDispatchCompute(1, 1, CLUSTER_GRID_Z);
+
+    // The lighting shader reads the lists
+    glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+
+    return GLCheckError();
+}
+
+
+void ClusteredLights::BindBlocks(GLuint Program)
+{
+    const char* pNames[] = { "ClusterPointLights", "ClusterSpotLights", "LightSpheres", "ClusterCounts", "ClusterIndices" };
+    const GLuint Bindings[] = { CLUSTER_POINT_LIGHT_BINDING, CLUSTER_SPOT_LIGHT_BINDING, CLUSTER_SPHERE_BINDING,
+                                CLUSTER_COUNT_BINDING, CLUSTER_INDEX_BINDING };
+
+    for (unsigned int i = 0 ; i < ARRAY_SIZE_IN_ELEMENTS(pNames) ; i++) {
+        const GLuint Index = glGetProgramResourceIndex(Program, GL_SHADER_STORAGE_BLOCK, pNames[i]);
+
+        // The blocks that the program doesn't use are optimized away
+        if (Index != GL_INVALID_INDEX) {
+            glShaderStorageBlockBinding(Program, Index, Bindings[i]);
+        }
+    }
+}
+
+
+void ClusteredLights::Shutdown()
+{
+    SAFE_DELETE(s_pTechnique);
+
+    GLuint Buffers[] = { s_pointLightBuffer, s_spotLightBuffer, s_sphereBuffer, s_countBuffer, s_indexBuffer };
+    GLState::DeleteBuffers(ARRAY_SIZE_IN_ELEMENTS(Buffers), Buffers);
+
+    s_pointLightBuffer = 0;
+    s_spotLightBuffer = 0;
+    s_sphereBuffer = 0;
+    s_countBuffer = 0;
+    s_indexBuffer = 0;
+    s_dirty = true;
+}
@@ -0,0 +1,140 @@
+/*
+
+	Copyright 2011 Etay Meiri
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef CLUSTERED_LIGHTS_H
+#define	CLUSTERED_LIGHTS_H
+
+#include <vector>
+#include <GL/glew.h>
+
+#include "math_3d.h"
+#include "uniform_buffers.h"
+
+// The view frustum is split in CLUSTER_GRID_X * CLUSTER_GRID_Y screen tiles and
+// CLUSTER_GRID_Z depth slices. A cluster keeps at most CLUSTER_MAX_LIGHTS lights.
+#define CLUSTER_GRID_X      16
+#define CLUSTER_GRID_Y      8
+#define CLUSTER_GRID_Z      24
+#define CLUSTER_MAX_LIGHTS  256
+
+#define NUM_CLUSTERS (CLUSTER_GRID_X * CLUSTER_GRID_Y * CLUSTER_GRID_Z)
+
+// Shader storage bindings, after the ones of the meshlet culling
+#define CLUSTER_POINT_LIGHT_BINDING  3
+#define CLUSTER_SPOT_LIGHT_BINDING   4
+#define CLUSTER_SPHERE_BINDING       5
+#define CLUSTER_COUNT_BINDING        6
+#define CLUSTER_INDEX_BINDING        7
+
+// GLSL of the grid size, shared by the binning and the lighting shaders
+#define CLUSTER_GRID_GLSL "                                                         \n\
+#define CLUSTER_GRID_X " UNIFORM_TO_STRING(CLUSTER_GRID_X) "                        \n\
+#define CLUSTER_GRID_Y " UNIFORM_TO_STRING(CLUSTER_GRID_Y) "                        \n\
+#define CLUSTER_GRID_Z " UNIFORM_TO_STRING(CLUSTER_GRID_Z) "                        \n\
+#define CLUSTER_MAX_LIGHTS " UNIFORM_TO_STRING(CLUSTER_MAX_LIGHTS) "                \n\
+"
+
+// GLSL of the light lists, spliced into the lighting shader after UNIFORM_BLOCKS_GLSL.
+// The shader needs GL_ARB_shader_storage_buffer_object. GetCluster maps a fragment to
+// the index of its cluster, whose lights are
+// gClusterIndices[Cluster * CLUSTER_MAX_LIGHTS + i] with the point lights for i below
+// gClusterCounts[Cluster].x and the spot lights after them up to gClusterCounts[Cluster].y.
+#define CLUSTERED_LIGHTS_GLSL CLUSTER_GRID_GLSL "                                   \n\
+layout (std140) readonly buffer ClusterPointLights                                  \n\
+{                                                                                   \n\
+    PointLight gClusterPointLights[];                                               \n\
+};                                                                                  \n\
+                                                                                    \n\
+layout (std140) readonly buffer ClusterSpotLights                                   \n\
+{                                                                                   \n\
+    SpotLight gClusterSpotLights[];                                                 \n\
+};                                                                                  \n\
+                                                                                    \n\
+layout (std430) readonly buffer ClusterCounts                                       \n\
+{                                                                                   \n\
+    uvec2 gClusterCounts[];                                                         \n\
+};                                                                                  \n\
+                                                                                    \n\
+layout (std430) readonly buffer ClusterIndices                                      \n\
+{                                                                                   \n\
+    uint gClusterIndices[];                                                         \n\
+};                                                                                  \n\
+                                                                                    \n\
+// The slices are spaced exponentially between the near and the far plane           \n\
+uint GetCluster(vec4 FragCoord)                                                     \n\
+{                                                                                   \n\
+    float Ndc = FragCoord.z * 2.0 - 1.0;                                            \n\
+    float ViewZ = 2.0 * gZNear * gZFar / (gZFar + gZNear - Ndc * (gZFar - gZNear)); \n\
+    float Slice = log(ViewZ / gZNear) / log(gZFar / gZNear) * CLUSTER_GRID_Z;       \n\
+    uvec2 Tile = uvec2(FragCoord.xy / gScreenSize * vec2(CLUSTER_GRID_X, CLUSTER_GRID_Y));\n\
+                                                                                    \n\
+    uint z = min(uint(max(Slice, 0.0)), uint(CLUSTER_GRID_Z - 1));                  \n\
+    uint y = min(Tile.y, uint(CLUSTER_GRID_Y - 1));                                 \n\
+    uint x = min(Tile.x, uint(CLUSTER_GRID_X - 1));                                 \n\
+                                                                                    \n\
+    return (z * CLUSTER_GRID_Y + y) * CLUSTER_GRID_X + x;                           \n\
+}                                                                                   \n\
+"
+
+class LightClusterTechnique;
+
+// Clustered forward lighting. The point and spot lights live in shader storage buffers
+// instead of the light uniform block, so their number is only limited by memory. Every
+// frame a compute pass bins the bounding spheres of the lights into the clusters of
+// the view frustum and the lighting shader then evaluates only the lights of the
+// cluster of the fragment. GL thread only.
+class ClusteredLights
+{
+public:
+    // Returns false if the GL lacks compute shaders or shader storage buffers, the
+    // lights then stay in the uniform block
+    static bool Init();
+
+    static bool IsEnabled() { return s_pTechnique != NULL; }
+
+    // Resize the light lists and return them for writing. Like the uniform blocks they
+    // are uploaded by Update.
+    static UniformPointLight* EditPointLights(unsigned int NumLights);
+    static UniformSpotLight* EditSpotLights(unsigned int NumLights);
+
+    // Uploads the lights that changed and bins them for the given camera. Call once per
+    // frame before drawing, View is the world to camera transformation.
+    static bool Update(const Matrix4f& View, const PersProjInfo& Proj);
+
+    // Points the light buffers that the program uses to their binding. Call after linking.
+    static void BindBlocks(GLuint Program);
+
+    static void Shutdown();
+
+private:
+    static float CalcLightRadius(const UniformPointLight& Light);
+    static void UploadLights();
+
+    static LightClusterTechnique* s_pTechnique;
+    static std::vector<UniformPointLight> s_pointLights;
+    static std::vector<UniformSpotLight> s_spotLights;
+    static bool s_dirty;
+    static GLuint s_pointLightBuffer;
+    static GLuint s_spotLightBuffer;
+    static GLuint s_sphereBuffer;
+    static GLuint s_countBuffer;
+    static GLuint s_indexBuffer;
+};
+
+
+#endif	/* CLUSTERED_LIGHTS_H */
@@ -0,0 +1,64 @@
+/*
+
+	Copyright 2011 Etay Meiri
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+#include "depth_pass_technique.h"
+#include "util.h"
+
+static const char* pDepthPassVS = "                                                 \n\
+#version 410                                                                        \n\
+                                                                                    \n\
+layout (location = 0) in vec3 Position;                                             \n\
+layout (location = 3) in mat4 WVP;                                                  \n\
+                                                                                    \n\
+invariant gl_Position;                                                              \n\
+                                                                                    \n\
+void main()                                                                         \n\
+{                                                                                   \n\
+    gl_Position = WVP * vec4(Position, 1.0);                                        \n\
+}";
+
+static const char* pDepthPassFS = "                                                 \n\
+#version 410                                                                        \n\
+                                                                                    \n\
+void main()                                                                         \n\
+{                                                                                   \n\
+}";
+
+
+DepthPassTechnique::DepthPassTechnique()
+{
+}
+
+
+bool DepthPassTechnique::Init()
+{
+    if (!Technique::Init()) {
+        return false;
+    }
+
+    if (!AddShader(GL_VERTEX_SHADER, pDepthPassVS)) {
+        return false;
+    }
+
+    if (!AddShader(GL_FRAGMENT_SHADER, pDepthPassFS)) {
+        return false;
+    }
+
+    return Finalize();
+}
@@ -0,0 +1,37 @@
+/*
+
+	Copyright 2011 Etay Meiri
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef DEPTH_PASS_TECHNIQUE_H
+#define	DEPTH_PASS_TECHNIQUE_H
+
+#include "technique.h"
+
+// Writes the depth of the meshes and nothing else, for the prepass. It reads only the
+// position and the WVP instance matrix, see Mesh::RenderDepth. Its gl_Position is
+// declared invariant like the one of the lighting technique so the main pass can test
+// against the prepass with GL_EQUAL.
+class DepthPassTechnique : public Technique
+{
+public:
+    DepthPassTechnique();
+
+    virtual bool Init();
+};
+
+
+#endif	/* DEPTH_PASS_TECHNIQUE_H */
@@ -18,6 +18,31 @@
 #define RANDOM_TEXTURE_UNIT_INDEX       3
 #define DISPLACEMENT_TEXTURE_UNIT       GL_TEXTURE4
 #define DISPLACEMENT_TEXTURE_UNIT_INDEX 4
+#define GBUFFER_ALBEDO_TEXTURE_UNIT     GL_TEXTURE5
+#define GBUFFER_ALBEDO_TEXTURE_UNIT_INDEX 5
+#define GBUFFER_NORMAL_TEXTURE_UNIT     GL_TEXTURE6
+#define GBUFFER_NORMAL_TEXTURE_UNIT_INDEX 6
+#define GBUFFER_DEPTH_TEXTURE_UNIT      GL_TEXTURE7
+#define GBUFFER_DEPTH_TEXTURE_UNIT_INDEX 7
+#define PROBE_TEXTURE_UNIT              GL_TEXTURE8
+#define PROBE_TEXTURE_UNIT_INDEX        8
+#define VISIBILITY_TEXTURE_UNIT         GL_TEXTURE9
+#define VISIBILITY_TEXTURE_UNIT_INDEX   9
+
+// The mesh buffers read by the visibility buffer resolve, see Mesh::ResolveVisibility
+#define MESH_ENTRY_TEXTURE_UNIT_INDEX   10
+#define MESH_INDEX_TEXTURE_UNIT_INDEX   11
+#define MESH_POS_TEXTURE_UNIT_INDEX     12
+#define MESH_NORMAL_TEXTURE_UNIT_INDEX  13
+#define MESH_TEXCOORD_TEXTURE_UNIT_INDEX 14
+#define MESH_WORLD_TEXTURE_UNIT_INDEX   15
+#define MESH_INSTANCE_TEXTURE_UNIT_INDEX 16
+
+#define TEXTURE_FEEDBACK_IMAGE_UNIT     0
+
+#define FRAME_UNIFORM_BINDING           0
+#define LIGHT_UNIFORM_BINDING           1
+#define MATERIAL_UNIFORM_BINDING        2
 
 
 
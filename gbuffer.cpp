@@ -0,0 +1,113 @@
+/*
+
+	Copyright 2011 Etay Meiri
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+#include <stdio.h>
+#include <string.h>
+
+#include "gbuffer.h"
+#include "engine_common.h"
+#include "gl_state.h"
+#include "util.h"
+
+GBuffer::GBuffer()
+{
+    m_fbo = 0;
+    m_depthTexture = 0;
+    ZERO_MEM(m_textures);
+}
+
+
+GBuffer::~GBuffer()
+{
+    if (m_fbo != 0) {
+        glDeleteFramebuffers(1, &m_fbo);
+    }
+
+    if (m_textures[0] != 0) {
+        GLState::DeleteTextures(ARRAY_SIZE_IN_ELEMENTS(m_textures), m_textures);
+    }
+
+    if (m_depthTexture != 0) {
+        GLState::DeleteTextures(1, &m_depthTexture);
+    }
+}
+
+
+// The light pass reads single texels, so the textures have no mipmaps and no filtering
+static GLuint CreateTarget(GLenum InternalFormat, GLenum Format, GLenum Type, unsigned int Width, unsigned int Height)
+{
+    GLuint Texture = GLState::CreateTexture(GL_TEXTURE_2D);
+    GLState::BindTextureForEdit(Texture);
+    glTexImage2D(GL_TEXTURE_2D, 0, InternalFormat, Width, Height, 0, Format, Type, NULL);
+    GLState::TextureParameteri(Texture, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    GLState::TextureParameteri(Texture, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+
+    return Texture;
+}
+
+
+bool GBuffer::Init(unsigned int WindowWidth, unsigned int WindowHeight)
+{
+    m_textures[GBUFFER_TEXTURE_TYPE_ALBEDO] = CreateTarget(GL_RGBA8, GL_RGBA, GL_UNSIGNED_BYTE, WindowWidth, WindowHeight);
+    m_textures[GBUFFER_TEXTURE_TYPE_NORMAL] = CreateTarget(GL_RG16F, GL_RG, GL_FLOAT, WindowWidth, WindowHeight);
+    m_depthTexture = CreateTarget(GL_DEPTH_COMPONENT32F, GL_DEPTH_COMPONENT, GL_FLOAT, WindowWidth, WindowHeight);
+
+    glGenFramebuffers(1, &m_fbo);
+    glBindFramebuffer(GL_DRAW_FRAMEBUFFER, m_fbo);
+
+    for (unsigned int i = 0 ; i < ARRAY_SIZE_IN_ELEMENTS(m_textures) ; i++) {
+        glFramebufferTexture2D(GL_DRAW_FRAMEBUFFER, GL_COLOR_ATTACHMENT0 + i, GL_TEXTURE_2D, m_textures[i], 0);
+    }
+
+    glFramebufferTexture2D(GL_DRAW_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, m_depthTexture, 0);
+
+    const GLenum DrawBuffers[] = { GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1 };
+    glDrawBuffers(ARRAY_SIZE_IN_ELEMENTS(DrawBuffers), DrawBuffers);
+
+    const GLenum Status = glCheckFramebufferStatus(GL_DRAW_FRAMEBUFFER);
+
+    glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
+
+    if (Status != GL_FRAMEBUFFER_COMPLETE) {
+        fprintf(stderr, "G-buffer error, status: 0x%x\n", Status);
+        return false;
+    }
+
+    return GLCheckError();
+}
+
+
+void GBuffer::BindForWriting()
+{
+    glBindFramebuffer(GL_DRAW_FRAMEBUFFER, m_fbo);
+}
+
+
+void GBuffer::BindForReading()
+{
+    glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
+
+    const GLuint Units[] = { GBUFFER_ALBEDO_TEXTURE_UNIT_INDEX, GBUFFER_NORMAL_TEXTURE_UNIT_INDEX };
+
+    for (unsigned int i = 0 ; i < ARRAY_SIZE_IN_ELEMENTS(m_textures) ; i++) {
+        GLState::BindTexture(Units[i], GL_TEXTURE_2D, m_textures[i]);
+    }
+
+    GLState::BindTexture(GBUFFER_DEPTH_TEXTURE_UNIT_INDEX, GL_TEXTURE_2D, m_depthTexture);
+}
@@ -0,0 +1,54 @@
+/*
+
+	Copyright 2011 Etay Meiri
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef GBUFFER_H
+#define	GBUFFER_H
+
+#include <GL/glew.h>
+
+// Render targets of the deferred shading. The albedo is RGBA8, the normal is packed
+// in two half floats (octahedral encoding) and the position comes back from the depth.
+class GBuffer
+{
+public:
+    enum GBUFFER_TEXTURE_TYPE {
+        GBUFFER_TEXTURE_TYPE_ALBEDO,
+        GBUFFER_TEXTURE_TYPE_NORMAL,
+        GBUFFER_NUM_TEXTURES
+    };
+
+    GBuffer();
+
+    ~GBuffer();
+
+    bool Init(unsigned int WindowWidth, unsigned int WindowHeight);
+
+    // The draws that follow fill the G-buffer
+    void BindForWriting();
+
+    // Back to the default framebuffer with the G-buffer on the GBUFFER_*_TEXTURE_UNITs
+    void BindForReading();
+
+private:
+    GLuint m_fbo;
+    GLuint m_textures[GBUFFER_NUM_TEXTURES];
+    GLuint m_depthTexture;
+};
+
+
+#endif	/* GBUFFER_H */
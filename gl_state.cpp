@@ -0,0 +1,599 @@
+/*
+
+	Copyright 2011 Etay Meiri
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include "gl_state.h"
+
+#define GL_STATE_UNKNOWN 0xFFFFFFFF
+
+GLuint GLState::s_program = GL_STATE_UNKNOWN;
+GLuint GLState::s_VAO = GL_STATE_UNKNOWN;
+GLuint GLState::s_buffers[NUM_BUFFER_TARGETS];
+GLuint GLState::s_activeUnit = GL_STATE_UNKNOWN;
+GLuint GLState::s_textures[GL_STATE_MAX_TEXTURE_UNITS][NUM_TEXTURE_TARGETS];
+GLuint GLState::s_samplers[GL_STATE_MAX_TEXTURE_UNITS];
+std::map<GLenum, bool> GLState::s_caps;
+GLuint GLState::s_depthFunc = GL_STATE_UNKNOWN;
+GLuint GLState::s_depthMask = GL_STATE_UNKNOWN;
+GLuint GLState::s_colorMask = GL_STATE_UNKNOWN;
+std::map<GLuint, unsigned int> GLState::s_attribArrays;
+std::map<GLuint, GLenum> GLState::s_textureTargets;
+unsigned int GLState::s_numIssued = 0;
+unsigned int GLState::s_numEliminated = 0;
+
+
+void GLState::Invalidate()
+{
+    s_program = GL_STATE_UNKNOWN;
+    s_VAO = GL_STATE_UNKNOWN;
+    s_activeUnit = GL_STATE_UNKNOWN;
+
+    for (unsigned int i = 0 ; i < NUM_BUFFER_TARGETS ; i++) {
+        s_buffers[i] = GL_STATE_UNKNOWN;
+    }
+
+    for (unsigned int i = 0 ; i < GL_STATE_MAX_TEXTURE_UNITS ; i++) {
+        for (unsigned int j = 0 ; j < NUM_TEXTURE_TARGETS ; j++) {
+            s_textures[i][j] = GL_STATE_UNKNOWN;
+        }
+
+        s_samplers[i] = GL_STATE_UNKNOWN;
+    }
+
+    s_caps.clear();
+    s_depthFunc = GL_STATE_UNKNOWN;
+    s_depthMask = GL_STATE_UNKNOWN;
+    s_colorMask = GL_STATE_UNKNOWN;
+    s_attribArrays.clear();
+}
+
+
+void GLState::ResetStats()
+{
+    s_numIssued = 0;
+    s_numEliminated = 0;
+}
+
+
+// -1 for the targets that aren't cached
+int GLState::GetBufferTargetIndex(GLenum Target)
+{
+    switch (Target) {
+        case GL_ARRAY_BUFFER:
+            return 0;
+        case GL_COPY_WRITE_BUFFER:
+            return 1;
+        case GL_PIXEL_PACK_BUFFER:
+            return 2;
+        case GL_PIXEL_UNPACK_BUFFER:
+            return 3;
+        case GL_DRAW_INDIRECT_BUFFER:
+            return 4;
+        case GL_UNIFORM_BUFFER:
+            return 5;
+        case GL_SHADER_STORAGE_BUFFER:
+            return 6;
+        default:
+            return -1;
+    }
+}
+
+
+int GLState::GetTextureTargetIndex(GLenum Target)
+{
+    switch (Target) {
+        case GL_TEXTURE_1D:
+            return 0;
+        case GL_TEXTURE_2D:
+            return 1;
+        case GL_TEXTURE_2D_ARRAY:
+            return 2;
+        case GL_TEXTURE_3D:
+            return 3;
+        case GL_TEXTURE_BUFFER:
+            return 4;
+        default:
+            return -1;
+    }
+}
+
+
+void GLState::UseProgram(GLuint Program)
+{
+    if (Program == s_program) {
+        s_numEliminated++;
+        return;
+    }
+
+    glUseProgram(Program);
+    s_program = Program;
+    s_numIssued++;
+}
+
+
+// Only asks the GL, which may stall, after Invalidate
+GLuint GLState::GetProgram()
+{
+    if (s_program == GL_STATE_UNKNOWN) {
+        GLint Program = 0;
+        glGetIntegerv(GL_CURRENT_PROGRAM, &Program);
+        s_program = Program;
+    }
+
+    return s_program;
+}
+
+
+void GLState::BindVertexArray(GLuint VAO)
+{
+    if (VAO == s_VAO) {
+        s_numEliminated++;
+        return;
+    }
+
+    glBindVertexArray(VAO);
+    s_VAO = VAO;
+    s_numIssued++;
+}
+
+
+void GLState::BindBuffer(GLenum Target, GLuint Buffer)
+{
+    const int Index = GetBufferTargetIndex(Target);
+
+    if (Index != -1 && s_buffers[Index] == Buffer) {
+        s_numEliminated++;
+        return;
+    }
+
+    glBindBuffer(Target, Buffer);
+    s_numIssued++;
+
+    if (Index != -1) {
+        s_buffers[Index] = Buffer;
+    }
+}
+
+
+// The indexed binds replace the generic binding too
+void GLState::BindBufferBase(GLenum Target, GLuint Index, GLuint Buffer)
+{
+    glBindBufferBase(Target, Index, Buffer);
+
+    const int TargetIndex = GetBufferTargetIndex(Target);
+
+    if (TargetIndex != -1) {
+        s_buffers[TargetIndex] = Buffer;
+    }
+}
+
+
+void GLState::BindBufferRange(GLenum Target, GLuint Index, GLuint Buffer, GLintptr Offset, GLsizeiptr Size)
+{
+    glBindBufferRange(Target, Index, Buffer, Offset, Size);
+
+    const int TargetIndex = GetBufferTargetIndex(Target);
+
+    if (TargetIndex != -1) {
+        s_buffers[TargetIndex] = Buffer;
+    }
+}
+
+
+void GLState::ActiveTexture(GLuint Unit)
+{
+    if (Unit == s_activeUnit) {
+        s_numEliminated++;
+        return;
+    }
+
+    glActiveTexture(GL_TEXTURE0 + Unit);
+    s_activeUnit = Unit;
+    s_numIssued++;
+}
+
+
+void GLState::BindTexture(GLuint Unit, GLenum Target, GLuint Texture)
+{
+    const int Index = (Unit < GL_STATE_MAX_TEXTURE_UNITS) ? GetTextureTargetIndex(Target) : -1;
+
+    if (Index != -1 && s_textures[Unit][Index] == Texture) {
+        s_numEliminated++;
+        return;
+    }
+
+    // Binding zero this way would clear every target of the unit
+    if (GLEW_ARB_direct_state_access && Texture != 0) {
+        glBindTextureUnit(Unit, Texture);
+    }
+    else {
+        ActiveTexture(Unit);
+        glBindTexture(Target, Texture);
+    }
+
+    s_numIssued++;
+
+    if (Index != -1) {
+        s_textures[Unit][Index] = Texture;
+    }
+}
+
+
+void GLState::BindSampler(GLuint Unit, GLuint Sampler)
+{
+    if (Unit < GL_STATE_MAX_TEXTURE_UNITS && s_samplers[Unit] == Sampler) {
+        s_numEliminated++;
+        return;
+    }
+
+    glBindSampler(Unit, Sampler);
+    s_numIssued++;
+
+    if (Unit < GL_STATE_MAX_TEXTURE_UNITS) {
+        s_samplers[Unit] = Sampler;
+    }
+}
+
+
+void GLState::SetCap(GLenum Cap, bool Enabled)
+{
+    std::map<GLenum, bool>::iterator it = s_caps.find(Cap);
+
+    if (it != s_caps.end() && it->second == Enabled) {
+        s_numEliminated++;
+        return;
+    }
+
+    if (Enabled) {
+        glEnable(Cap);
+    }
+    else {
+        glDisable(Cap);
+    }
+
+    s_caps[Cap] = Enabled;
+    s_numIssued++;
+}
+
+
+void GLState::Enable(GLenum Cap)
+{
+    SetCap(Cap, true);
+}
+
+
+void GLState::Disable(GLenum Cap)
+{
+    SetCap(Cap, false);
+}
+
+
+void GLState::DepthFunc(GLenum Func)
+{
+    if (s_depthFunc == Func) {
+        s_numEliminated++;
+        return;
+    }
+
+    glDepthFunc(Func);
+    s_depthFunc = Func;
+    s_numIssued++;
+}
+
+
+void GLState::DepthMask(GLboolean Write)
+{
+    if (s_depthMask == Write) {
+        s_numEliminated++;
+        return;
+    }
+
+    glDepthMask(Write);
+    s_depthMask = Write;
+    s_numIssued++;
+}
+
+
+// All four channels at once, nothing masks them separately
+void GLState::ColorMask(GLboolean Write)
+{
+    if (s_colorMask == Write) {
+        s_numEliminated++;
+        return;
+    }
+
+    glColorMask(Write, Write, Write, Write);
+    s_colorMask = Write;
+    s_numIssued++;
+}
+
+
+// A VAO starts with every array disabled. Only the first 16 attributes are handled,
+// which is the minimum the GL supports.
+void GLState::SetVertexAttribArrays(unsigned int Mask)
+{
+    const GLuint VAO = s_VAO;
+    std::map<GLuint, unsigned int>::iterator it = s_attribArrays.find(VAO);
+    const bool Known = (VAO != GL_STATE_UNKNOWN) && (it != s_attribArrays.end());
+    const unsigned int Current = Known ? it->second : ~Mask;
+
+    for (unsigned int i = 0 ; i < 16 ; i++) {
+        const unsigned int Bit = 1 << i;
+
+        if ((Current & Bit) == (Mask & Bit)) {
+            if (Known) {
+                s_numEliminated++;
+            }
+            continue;
+        }
+
+        if (Mask & Bit) {
+            glEnableVertexAttribArray(i);
+        }
+        else {
+            glDisableVertexAttribArray(i);
+        }
+
+        s_numIssued++;
+    }
+
+    if (VAO != GL_STATE_UNKNOWN) {
+        s_attribArrays[VAO] = Mask;
+    }
+}
+
+
+void GLState::DeleteBuffers(GLsizei Count, const GLuint* pBuffers)
+{
+    for (GLsizei i = 0 ; i < Count ; i++) {
+        for (unsigned int j = 0 ; j < NUM_BUFFER_TARGETS ; j++) {
+            if (s_buffers[j] == pBuffers[i]) {
+                s_buffers[j] = 0;
+            }
+        }
+    }
+
+    glDeleteBuffers(Count, pBuffers);
+}
+
+
+void GLState::DeleteTextures(GLsizei Count, const GLuint* pTextures)
+{
+    for (GLsizei i = 0 ; i < Count ; i++) {
+        for (unsigned int j = 0 ; j < GL_STATE_MAX_TEXTURE_UNITS ; j++) {
+            for (unsigned int k = 0 ; k < NUM_TEXTURE_TARGETS ; k++) {
+                if (s_textures[j][k] == pTextures[i]) {
+                    s_textures[j][k] = 0;
+                }
+            }
+        }
+
+        s_textureTargets.erase(pTextures[i]);
+    }
+
+    glDeleteTextures(Count, pTextures);
+}
+
+
+void GLState::DeleteVertexArrays(GLsizei Count, const GLuint* pVAOs)
+{
+    for (GLsizei i = 0 ; i < Count ; i++) {
+        if (s_VAO == pVAOs[i]) {
+            s_VAO = 0;
+        }
+
+        s_attribArrays.erase(pVAOs[i]);
+    }
+
+    glDeleteVertexArrays(Count, pVAOs);
+}
+
+
+// A program in use is only deleted once it is replaced, until then it stays current
+void GLState::DeleteProgram(GLuint Program)
+{
+    glDeleteProgram(Program);
+}
+
+
+void GLState::CreateBuffers(GLsizei Count, GLuint* pBuffers)
+{
+    if (GLEW_ARB_direct_state_access) {
+        glCreateBuffers(Count, pBuffers);
+        return;
+    }
+
+    // The names become buffers when they are first bound
+    glGenBuffers(Count, pBuffers);
+
+    for (GLsizei i = 0 ; i < Count ; i++) {
+        BindBuffer(GL_COPY_WRITE_BUFFER, pBuffers[i]);
+    }
+}
+
+
+GLuint GLState::CreateBuffer()
+{
+    GLuint Buffer = 0;
+    CreateBuffers(1, &Buffer);
+    return Buffer;
+}
+
+
+void GLState::BufferData(GLuint Buffer, GLsizeiptr Size, const void* pData, GLenum Usage)
+{
+    if (GLEW_ARB_direct_state_access) {
+        glNamedBufferData(Buffer, Size, pData, Usage);
+    }
+    else {
+        BindBuffer(GL_COPY_WRITE_BUFFER, Buffer);
+        glBufferData(GL_COPY_WRITE_BUFFER, Size, pData, Usage);
+    }
+}
+
+
+void GLState::BufferStorage(GLuint Buffer, GLsizeiptr Size, const void* pData, GLbitfield Flags)
+{
+    if (GLEW_ARB_direct_state_access) {
+        glNamedBufferStorage(Buffer, Size, pData, Flags);
+    }
+    else {
+        BindBuffer(GL_COPY_WRITE_BUFFER, Buffer);
+        glBufferStorage(GL_COPY_WRITE_BUFFER, Size, pData, Flags);
+    }
+}
+
+
+void* GLState::MapBufferRange(GLuint Buffer, GLintptr Offset, GLsizeiptr Length, GLbitfield Access)
+{
+    if (GLEW_ARB_direct_state_access) {
+        return glMapNamedBufferRange(Buffer, Offset, Length, Access);
+    }
+
+    BindBuffer(GL_COPY_WRITE_BUFFER, Buffer);
+    return glMapBufferRange(GL_COPY_WRITE_BUFFER, Offset, Length, Access);
+}
+
+
+// False when the contents were lost while mapped
+bool GLState::UnmapBuffer(GLuint Buffer)
+{
+    if (GLEW_ARB_direct_state_access) {
+        return glUnmapNamedBuffer(Buffer) == GL_TRUE;
+    }
+
+    BindBuffer(GL_COPY_WRITE_BUFFER, Buffer);
+    return glUnmapBuffer(GL_COPY_WRITE_BUFFER) == GL_TRUE;
+}
+
+
+GLuint GLState::CreateTexture(GLenum Target)
+{
+    GLuint Texture = 0;
+
+    if (GLEW_ARB_direct_state_access) {
+        glCreateTextures(Target, 1, &Texture);
+    }
+    else {
+        glGenTextures(1, &Texture);
+    }
+
+    s_textureTargets[Texture] = Target;
+
+    if (!GLEW_ARB_direct_state_access) {
+        BindTextureForEdit(Texture);
+    }
+
+    return Texture;
+}
+
+
+void GLState::BindTextureForEdit(GLuint Texture)
+{
+    BindTexture(GL_STATE_EDIT_TEXTURE_UNIT, s_textureTargets[Texture], Texture);
+
+    // The edits go to the active unit
+    ActiveTexture(GL_STATE_EDIT_TEXTURE_UNIT);
+}
+
+
+void GLState::TextureParameteri(GLuint Texture, GLenum Name, GLint Value)
+{
+    if (GLEW_ARB_direct_state_access) {
+        glTextureParameteri(Texture, Name, Value);
+    }
+    else {
+        BindTextureForEdit(Texture);
+        glTexParameteri(s_textureTargets[Texture], Name, Value);
+    }
+}
+
+
+void GLState::TextureParameterf(GLuint Texture, GLenum Name, GLfloat Value)
+{
+    if (GLEW_ARB_direct_state_access) {
+        glTextureParameterf(Texture, Name, Value);
+    }
+    else {
+        BindTextureForEdit(Texture);
+        glTexParameterf(s_textureTargets[Texture], Name, Value);
+    }
+}
+
+
+void GLState::TextureSubImage2D(GLuint Texture, GLint Level, GLint x, GLint y, GLsizei Width, GLsizei Height,
+                                GLenum Format, GLenum Type, const void* pPixels)
+{
+    if (GLEW_ARB_direct_state_access) {
+        glTextureSubImage2D(Texture, Level, x, y, Width, Height, Format, Type, pPixels);
+    }
+    else {
+        BindTextureForEdit(Texture);
+        glTexSubImage2D(s_textureTargets[Texture], Level, x, y, Width, Height, Format, Type, pPixels);
+    }
+}
+
+
+void GLState::TextureSubImage3D(GLuint Texture, GLint Level, GLint x, GLint y, GLint z, GLsizei Width, GLsizei Height,
+                                GLsizei Depth, GLenum Format, GLenum Type, const void* pPixels)
+{
+    if (GLEW_ARB_direct_state_access) {
+        glTextureSubImage3D(Texture, Level, x, y, z, Width, Height, Depth, Format, Type, pPixels);
+    }
+    else {
+        BindTextureForEdit(Texture);
+        glTexSubImage3D(s_textureTargets[Texture], Level, x, y, z, Width, Height, Depth, Format, Type, pPixels);
+    }
+}
+
+
+void GLState::GenerateTextureMipmap(GLuint Texture)
+{
+    if (GLEW_ARB_direct_state_access) {
+        glGenerateTextureMipmap(Texture);
+    }
+    else {
+        BindTextureForEdit(Texture);
+        glGenerateMipmap(s_textureTargets[Texture]);
+    }
+}
+
+
+void GLState::TextureBuffer(GLuint Texture, GLenum InternalFormat, GLuint Buffer)
+{
+    if (GLEW_ARB_direct_state_access) {
+        glTextureBuffer(Texture, InternalFormat, Buffer);
+    }
+    else {
+        BindTextureForEdit(Texture);
+        glTexBuffer(GL_TEXTURE_BUFFER, InternalFormat, Buffer);
+    }
+}
+
+
+void GLState::GetTextureImage(GLuint Texture, GLint Level, GLenum Format, GLenum Type, GLsizei Size, void* pPixels)
+{
+    if (GLEW_ARB_direct_state_access) {
+        glGetTextureImage(Texture, Level, Format, Type, Size, pPixels);
+    }
+    else {
+        BindTextureForEdit(Texture);
+        glGetTexImage(s_textureTargets[Texture], Level, Format, Type, pPixels);
+    }
+}
@@ -0,0 +1,131 @@
+/*
+
+	Copyright 2011 Etay Meiri
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef GL_STATE_H
+#define	GL_STATE_H
+
+#include <map>
+#include <GL/glew.h>
+
+#define GL_STATE_MAX_TEXTURE_UNITS  32
+
+// The fallbacks of the resource helpers bind here, none of the programs samples from it
+#define GL_STATE_EDIT_TEXTURE_UNIT  (GL_STATE_MAX_TEXTURE_UNITS - 1)
+
+// Filters out the binds and enables that wouldn't change anything. It only knows about
+// the changes made through it, so the code that renders goes through here and code that
+// doesn't (e.g. a text renderer) must be followed by Invalidate. GL thread only.
+//
+// The resource helpers use direct state access when the driver has it, so creating and
+// filling objects leaves the bindings of the draws alone. Without it they bind the object
+// to GL_COPY_WRITE_BUFFER or to the edit texture unit, which the cache keeps track of.
+class GLState
+{
+public:
+    // Forgets everything. Call once the context is created and after anything that
+    // changes the state behind the back of the cache.
+    static void Invalidate();
+
+    static void UseProgram(GLuint Program);
+    static GLuint GetProgram();
+    static void BindVertexArray(GLuint VAO);
+
+    // The element array buffer belongs to the VAO and isn't cached
+    static void BindBuffer(GLenum Target, GLuint Buffer);
+    static void BindBufferBase(GLenum Target, GLuint Index, GLuint Buffer);
+    static void BindBufferRange(GLenum Target, GLuint Index, GLuint Buffer, GLintptr Offset, GLsizeiptr Size);
+
+    static void BindTexture(GLuint Unit, GLenum Target, GLuint Texture);
+    static void BindSampler(GLuint Unit, GLuint Sampler);
+
+    static void Enable(GLenum Cap);
+    static void Disable(GLenum Cap);
+
+    static void DepthFunc(GLenum Func);
+    static void DepthMask(GLboolean Write);
+    static void ColorMask(GLboolean Write);
+
+    // Enables the vertex attribute arrays of the bound VAO whose bit is set in Mask and
+    // disables the others
+    static void SetVertexAttribArrays(unsigned int Mask);
+
+    // Deleted objects are unbound by the GL, and their names may come back
+    static void DeleteBuffers(GLsizei Count, const GLuint* pBuffers);
+    static void DeleteTextures(GLsizei Count, const GLuint* pTextures);
+    static void DeleteVertexArrays(GLsizei Count, const GLuint* pVAOs);
+    static void DeleteProgram(GLuint Program);
+
+    static void CreateBuffers(GLsizei Count, GLuint* pBuffers);
+    static GLuint CreateBuffer();
+    static void BufferData(GLuint Buffer, GLsizeiptr Size, const void* pData, GLenum Usage);
+    static void BufferStorage(GLuint Buffer, GLsizeiptr Size, const void* pData, GLbitfield Flags);
+    static void* MapBufferRange(GLuint Buffer, GLintptr Offset, GLsizeiptr Length, GLbitfield Access);
+    static bool UnmapBuffer(GLuint Buffer);
+
+    static GLuint CreateTexture(GLenum Target);
+    static void TextureParameteri(GLuint Texture, GLenum Name, GLint Value);
+    static void TextureParameterf(GLuint Texture, GLenum Name, GLfloat Value);
+    static void TextureSubImage2D(GLuint Texture, GLint Level, GLint x, GLint y, GLsizei Width, GLsizei Height,
+                                  GLenum Format, GLenum Type, const void* pPixels);
+    static void TextureSubImage3D(GLuint Texture, GLint Level, GLint x, GLint y, GLint z, GLsizei Width, GLsizei Height,
+                                  GLsizei Depth, GLenum Format, GLenum Type, const void* pPixels);
+    static void GenerateTextureMipmap(GLuint Texture);
+
+    // Makes a GL_TEXTURE_BUFFER texture read the texels from Buffer
+    static void TextureBuffer(GLuint Texture, GLenum InternalFormat, GLuint Buffer);
+    static void GetTextureImage(GLuint Texture, GLint Level, GLenum Format, GLenum Type, GLsizei Size, void* pPixels);
+
+    // Binds the texture to the edit unit for the glTexImage* calls, which have no direct
+    // state access version. The levels of the streamed textures are allocated one by one
+    // so they can't use immutable storage.
+    static void BindTextureForEdit(GLuint Texture);
+
+    // Calls that reached the driver and calls that were filtered out, since ResetStats
+    static unsigned int GetNumIssued() { return s_numIssued; }
+    static unsigned int GetNumEliminated() { return s_numEliminated; }
+    static void ResetStats();
+
+private:
+    static int GetBufferTargetIndex(GLenum Target);
+    static int GetTextureTargetIndex(GLenum Target);
+    static void ActiveTexture(GLuint Unit);
+    static void SetCap(GLenum Cap, bool Enabled);
+
+    enum {
+        NUM_BUFFER_TARGETS = 7,
+        NUM_TEXTURE_TARGETS = 5
+    };
+
+    static GLuint s_program;
+    static GLuint s_VAO;
+    static GLuint s_buffers[NUM_BUFFER_TARGETS];
+    static GLuint s_activeUnit;
+    static GLuint s_textures[GL_STATE_MAX_TEXTURE_UNITS][NUM_TEXTURE_TARGETS];
+    static GLuint s_samplers[GL_STATE_MAX_TEXTURE_UNITS];
+    static std::map<GLenum, bool> s_caps;
+    static GLuint s_depthFunc;
+    static GLuint s_depthMask;
+    static GLuint s_colorMask;
+    static std::map<GLuint, unsigned int> s_attribArrays;    // per VAO
+    static std::map<GLuint, GLenum> s_textureTargets;        // of CreateTexture
+    static unsigned int s_numIssued;
+    static unsigned int s_numEliminated;
+};
+
+
+#endif	/* GL_STATE_H */
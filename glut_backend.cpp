@@ -21,6 +21,7 @@
 #include <GL/freeglut.h>
 
 #include "glut_backend.h"
+#include "gl_state.h"
 
 // Points to the object implementing the ICallbacks interface which was delivered to
 // GLUTBackendRun(). All events are forwarded to this object.
@@ -101,6 +102,8 @@ bool GLUTBackendCreateWindow(unsigned int Width, unsigned int Height, unsigned i
         return false;
     }
 
+    GLState::Invalidate();
+
     return true;
 }
 
@@ -114,8 +117,8 @@ void GLUTBackendRun(ICallbacks* pCallbacks)
     glClearColor(0.0f, 0.0f, 0.0f, 0.0f);
     glFrontFace(GL_CW);
     glCullFace(GL_BACK);
-    glEnable(GL_CULL_FACE);
-    glEnable(GL_DEPTH_TEST);
+    GLState::Enable(GL_CULL_FACE);
+    GLState::Enable(GL_DEPTH_TEST);
 
     s_pCallbacks = pCallbacks;
     InitCallbacks();
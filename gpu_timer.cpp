@@ -0,0 +1,85 @@
+/*
+
+	Copyright 2011 Etay Meiri
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#pragma once
+#include "gpu_timer.h"
+#include "util.h"
+
+GPUTimer::GPUTimer()
+{
+    ZERO_MEM(m_queries);
+    m_head = 0;
+    m_tail = 0;
+}
+
+
+GPUTimer::~GPUTimer()
+{
+    if (m_queries[0] != 0) {
+        glDeleteQueries(GPU_TIMER_QUERIES, m_queries);
+    }
+}
+
+
+bool GPUTimer::Init()
+{
+    glGenQueries(GPU_TIMER_QUERIES, m_queries);
+
+    return GLCheckError();
+}
+
+
+void GPUTimer::Begin()
+{
+    if (m_head - m_tail == GPU_TIMER_QUERIES) {
+        m_tail++;
+    }
+
+    glBeginQuery(GL_TIME_ELAPSED, m_queries[m_head % GPU_TIMER_QUERIES]);
+}
+
+
+void GPUTimer::End()
+{
+    glEndQuery(GL_TIME_ELAPSED);
+    m_head++;
+}
+
+
+bool GPUTimer::GetResult(double& Milliseconds)
+{
+    if (m_tail == m_head) {
+        return false;
+    }
+
+    const GLuint Query = m_queries[m_tail % GPU_TIMER_QUERIES];
+    GLint Available = 0;
+
+    glGetQueryObjectiv(Query, GL_QUERY_RESULT_AVAILABLE, &Available);
+
+    if (!Available) {
+        return false;
+    }
+
+    GLuint64 Nanoseconds = 0;
+    glGetQueryObjectui64v(Query, GL_QUERY_RESULT, &Nanoseconds);
+
+    Milliseconds = Nanoseconds / 1000000.0;
+    m_tail++;
+
+    return true;
+}
@@ -0,0 +1,52 @@
+/*
+
+	Copyright 2011 Etay Meiri
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef GPU_TIMER_H
+#define	GPU_TIMER_H
+
+#include <GL/glew.h>
+
+#define GPU_TIMER_QUERIES 4
+
+// Measures the GPU time between Begin and End with a ring of timer queries so that
+// reading the results never stalls the pipeline. Results arrive a few frames late.
+class GPUTimer
+{
+public:
+    GPUTimer();
+
+    ~GPUTimer();
+
+    bool Init();
+
+    // Drops the oldest measurement if none of the queries has been read back yet
+    void Begin();
+
+    void End();
+
+    // Returns the oldest finished measurement, false if there is none yet
+    bool GetResult(double& Milliseconds);
+
+private:
+    GLuint m_queries[GPU_TIMER_QUERIES];
+    unsigned int m_head;    // next query to begin
+    unsigned int m_tail;    // oldest query not read back
+};
+
+
+#endif	/* GPU_TIMER_H */
@@ -0,0 +1,466 @@
+/*
+
+	Copyright 2011 Etay Meiri
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#pragma once
+#include <stdio.h>
+#include <string.h>
+#include <ctype.h>
+#include <algorithm>
+#include <Magick++.h>
+
+#include "image_decoder.h"
+#include "jpeg_decoder.cpp"
+#include "png_decoder.cpp"
+
+std::once_flag ImageDecoder::s_magickInit;
+
+static unsigned int ImageReadU16(const unsigned char* p)
+{
+    return p[0] | (p[1] << 8);
+}
+
+
+static unsigned int ImageReadU32(const unsigned char* p)
+{
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((unsigned int)p[3] << 24);
+}
+
+
+// Expands a 5-5-5 pixel, red in the high bits
+static void ImageExpand555(unsigned int Value, unsigned char* pOut)
+{
+    pOut[0] = (unsigned char)((((Value >> 10) & 31) * 255 + 15) / 31);
+    pOut[1] = (unsigned char)((((Value >> 5) & 31) * 255 + 15) / 31);
+    pOut[2] = (unsigned char)(((Value & 31) * 255 + 15) / 31);
+}
+
+
+bool ImageDecoder::Load(const std::string& FileName, unsigned int& Width, unsigned int& Height, std::vector<unsigned char>& Pixels)
+{
+    FILE* f = fopen(FileName.c_str(), "rb");
+
+    if (!f) {
+        printf("Error loading image '%s': cannot open the file\n", FileName.c_str());
+        return false;
+    }
+
+    std::vector<unsigned char> File;
+
+    fseek(f, 0, SEEK_END);
+    long Size = ftell(f);
+    fseek(f, 0, SEEK_SET);
+
+    if (Size > 0) {
+        File.resize(Size);
+
+        if (fread(&File[0], 1, Size, f) != (size_t)Size) {
+            File.clear();
+        }
+    }
+
+    fclose(f);
+
+    if (File.size() < 4) {
+        printf("Error loading image '%s': the file is truncated\n", FileName.c_str());
+        return false;
+    }
+
+    const unsigned char* pData = &File[0];
+    bool Ret = false;
+
+    std::string Extension = FileName.substr(FileName.find_last_of('.') + 1);
+
+    for (unsigned int i = 0 ; i < Extension.size() ; i++) {
+        Extension[i] = (char)tolower(Extension[i]);
+    }
+
+    // TGA files have no signature, the others are recognized by their first bytes
+    if (pData[0] == 0xFF && pData[1] == 0xD8) {
+        Ret = DecodeJPEG(pData, File.size(), Width, Height, Pixels);
+    }
+    else if (pData[0] == 0x89 && memcmp(&pData[1], "PNG", 3) == 0) {
+        Ret = DecodePNG(pData, File.size(), Width, Height, Pixels);
+    }
+    else if (pData[0] == 'B' && pData[1] == 'M') {
+        Ret = DecodeBMP(pData, File.size(), Width, Height, Pixels);
+    }
+    else if (pData[0] == 0x0A && Extension == "pcx") {
+        Ret = DecodePCX(pData, File.size(), Width, Height, Pixels);
+    }
+    else if (Extension == "tga") {
+        Ret = DecodeTGA(pData, File.size(), Width, Height, Pixels);
+    }
+
+    if (!Ret) {
+        Ret = LoadWithMagick(FileName, Width, Height, Pixels);
+    }
+
+    return Ret;
+}
+
+
+bool ImageDecoder::DecodeTGA(const unsigned char* pData, size_t Size, unsigned int& Width, unsigned int& Height, std::vector<unsigned char>& Pixels)
+{
+    if (Size < 18) {
+        return false;
+    }
+
+    const unsigned int IdLength = pData[0];
+    const unsigned int ColorMapType = pData[1];
+    const unsigned int ImageType = pData[2];
+    const unsigned int ColorMapStart = ImageReadU16(&pData[3]);
+    const unsigned int ColorMapLength = ImageReadU16(&pData[5]);
+    const unsigned int ColorMapBits = pData[7];
+    const unsigned int ImageWidth = ImageReadU16(&pData[12]);
+    const unsigned int ImageHeight = ImageReadU16(&pData[14]);
+    const unsigned int Bits = pData[16];
+    const unsigned int Descriptor = pData[17];
+
+    const bool RLE = (ImageType & 8) != 0;
+    const unsigned int BaseType = ImageType & 7;
+
+    if ((BaseType != 1 && BaseType != 2 && BaseType != 3) || (ImageType & ~11u) != 0 ||
+        ImageWidth == 0 || ImageHeight == 0) {
+        return false;
+    }
+
+    if ((BaseType == 1 && (ColorMapType != 1 || Bits != 8)) ||
+        (BaseType == 2 && Bits != 15 && Bits != 16 && Bits != 24 && Bits != 32) ||
+        (BaseType == 3 && Bits != 8)) {
+        return false;
+    }
+
+    const unsigned int PixelBytes = (Bits + 7) / 8;
+    const unsigned int ColorMapBytes = (ColorMapType == 1) ? (ColorMapBits + 7) / 8 : 0;
+    size_t Pos = 18 + IdLength + (size_t)ColorMapLength * ColorMapBytes;
+
+    if (Pos > Size || (ColorMapType == 1 && ColorMapBits != 15 && ColorMapBits != 16 && ColorMapBits != 24 && ColorMapBits != 32)) {
+        return false;
+    }
+
+    const unsigned char* pColorMap = &pData[18 + IdLength];
+
+    // Gather the stored pixels in file order, expanding the runs
+    const size_t NumPixels = (size_t)ImageWidth * ImageHeight;
+    std::vector<unsigned char> Stored(NumPixels * PixelBytes);
+
+    if (!RLE) {
+        if (Stored.size() > Size - Pos) {
+            return false;
+        }
+
+        memcpy(&Stored[0], &pData[Pos], Stored.size());
+    }
+    else {
+        size_t Count = 0;
+
+        while (Count < NumPixels) {
+            if (Pos >= Size) {
+                return false;
+            }
+
+            const unsigned int Packet = pData[Pos++];
+            const size_t RunLength = std::min<size_t>((Packet & 0x7F) + 1, NumPixels - Count);
+
+            if (Packet & 0x80) {
+                if (PixelBytes > Size - Pos) {
+                    return false;
+                }
+
+                for (size_t i = 0 ; i < RunLength ; i++) {
+                    memcpy(&Stored[(Count + i) * PixelBytes], &pData[Pos], PixelBytes);
+                }
+
+                Pos += PixelBytes;
+            }
+            else {
+                if (RunLength * PixelBytes > Size - Pos) {
+                    return false;
+                }
+
+                memcpy(&Stored[Count * PixelBytes], &pData[Pos], RunLength * PixelBytes);
+                Pos += RunLength * PixelBytes;
+            }
+
+            Count += RunLength;
+        }
+    }
+
+    // Like ImageMagick, the alpha bits are ignored unless the descriptor counts them
+    const bool UseAlpha = (Descriptor & 0x0F) != 0;
+
+    const bool TopDown = (Descriptor & 0x20) != 0;
+    const bool RightToLeft = (Descriptor & 0x10) != 0;
+
+    Pixels.resize(NumPixels * 4);
+
+    for (unsigned int y = 0 ; y < ImageHeight ; y++) {
+        const unsigned int Row = TopDown ? y : ImageHeight - 1 - y;
+        const unsigned char* pIn = &Stored[(size_t)y * ImageWidth * PixelBytes];
+
+        for (unsigned int x = 0 ; x < ImageWidth ; x++, pIn += PixelBytes) {
+            const unsigned int Column = RightToLeft ? ImageWidth - 1 - x : x;
+            unsigned char* pOut = &Pixels[((size_t)Row * ImageWidth + Column) * 4];
+            const unsigned char* pColor = pIn;
+            unsigned int ColorBits = Bits;
+
+            if (BaseType == 1) {
+                if (pIn[0] < ColorMapStart || pIn[0] - ColorMapStart >= ColorMapLength) {
+                    return false;
+                }
+
+                pColor = &pColorMap[(pIn[0] - ColorMapStart) * ColorMapBytes];
+                ColorBits = ColorMapBits;
+            }
+
+            if (BaseType == 3) {
+                pOut[0] = pOut[1] = pOut[2] = pIn[0];
+                pOut[3] = 255;
+            }
+            else if (ColorBits <= 16) {
+                const unsigned int Value = ImageReadU16(pColor);
+                ImageExpand555(Value, pOut);
+                pOut[3] = (ColorBits == 16 && UseAlpha && !(Value & 0x8000)) ? 0 : 255;
+            }
+            else {
+                pOut[0] = pColor[2];
+                pOut[1] = pColor[1];
+                pOut[2] = pColor[0];
+                pOut[3] = (ColorBits == 32 && UseAlpha) ? pColor[3] : 255;
+            }
+        }
+    }
+
+    Width = ImageWidth;
+    Height = ImageHeight;
+
+    return true;
+}
+
+
+// Uncompressed files with a BITMAPINFOHEADER or one of its later versions
+bool ImageDecoder::DecodeBMP(const unsigned char* pData, size_t Size, unsigned int& Width, unsigned int& Height, std::vector<unsigned char>& Pixels)
+{
+    if (Size < 54) {
+        return false;
+    }
+
+    const size_t PixelOffset = ImageReadU32(&pData[10]);
+    const unsigned int HeaderSize = ImageReadU32(&pData[14]);
+    const int ImageWidth = (int)ImageReadU32(&pData[18]);
+    const int SignedHeight = (int)ImageReadU32(&pData[22]);
+    const unsigned int Bits = ImageReadU16(&pData[28]);
+    const unsigned int Compression = ImageReadU32(&pData[30]);
+    unsigned int NumColors = ImageReadU32(&pData[46]);
+
+    // Checked before it is negated, -INT_MIN overflows
+    if (SignedHeight < -32768 || SignedHeight > 32768) {
+        return false;
+    }
+
+    const bool TopDown = SignedHeight < 0;
+    const unsigned int ImageHeight = TopDown ? -SignedHeight : SignedHeight;
+
+    if (HeaderSize < 40 || Compression != 0 || ImageWidth <= 0 || ImageHeight == 0 || ImageWidth > 32768 ||
+        (Bits != 1 && Bits != 4 && Bits != 8 && Bits != 16 && Bits != 24 && Bits != 32)) {
+        return false;
+    }
+
+    if (NumColors == 0 && Bits <= 8) {
+        NumColors = 1 << Bits;
+    }
+
+    const size_t PaletteOffset = 14 + HeaderSize;
+    const size_t RowBytes = (((size_t)ImageWidth * Bits + 31) / 32) * 4;
+
+    if (Bits <= 8 && (NumColors > 256 || PaletteOffset + NumColors * 4 > Size)) {
+        return false;
+    }
+
+    if (PixelOffset > Size || RowBytes * ImageHeight > Size - PixelOffset) {
+        return false;
+    }
+
+    Pixels.resize((size_t)ImageWidth * ImageHeight * 4);
+
+    for (unsigned int y = 0 ; y < ImageHeight ; y++) {
+        const unsigned int Row = TopDown ? y : ImageHeight - 1 - y;
+        const unsigned char* pIn = &pData[PixelOffset + y * RowBytes];
+        unsigned char* pOut = &Pixels[(size_t)Row * ImageWidth * 4];
+
+        for (int x = 0 ; x < ImageWidth ; x++, pOut += 4) {
+            if (Bits <= 8) {
+                const unsigned int Bit = x * Bits;
+                const unsigned int Index = (pIn[Bit >> 3] >> (8 - Bits - (Bit & 7))) & ((1 << Bits) - 1);
+                const unsigned char* pColor = &pData[PaletteOffset + Index * 4];
+
+                // Indices past the palette read as black
+                if (Index < NumColors) {
+                    pOut[0] = pColor[2];
+                    pOut[1] = pColor[1];
+                    pOut[2] = pColor[0];
+                }
+                else {
+                    pOut[0] = pOut[1] = pOut[2] = 0;
+                }
+            }
+            else if (Bits == 16) {
+                ImageExpand555(ImageReadU16(&pIn[x * 2]), pOut);
+            }
+            else {
+                const unsigned char* pColor = &pIn[x * (Bits / 8)];
+
+                pOut[0] = pColor[2];
+                pOut[1] = pColor[1];
+                pOut[2] = pColor[0];
+            }
+
+            // The fourth byte of 32 bit BI_RGB pixels is unused
+            pOut[3] = 255;
+        }
+    }
+
+    Width = ImageWidth;
+    Height = ImageHeight;
+
+    return true;
+}
+
+
+// RLE encoded files with 8 bits per plane: one plane and a trailing palette, or
+// separate red, green, blue (and alpha) planes
+bool ImageDecoder::DecodePCX(const unsigned char* pData, size_t Size, unsigned int& Width, unsigned int& Height, std::vector<unsigned char>& Pixels)
+{
+    if (Size < 128) {
+        return false;
+    }
+
+    const unsigned int Encoding = pData[2];
+    const unsigned int Bits = pData[3];
+    const int MinX = ImageReadU16(&pData[4]);
+    const int MinY = ImageReadU16(&pData[6]);
+    const int MaxX = ImageReadU16(&pData[8]);
+    const int MaxY = ImageReadU16(&pData[10]);
+    const unsigned int Planes = pData[65];
+    const unsigned int PlaneBytes = ImageReadU16(&pData[66]);
+
+    if (Encoding != 1 || Bits != 8 || MaxX < MinX || MaxY < MinY ||
+        (Planes != 1 && Planes != 3 && Planes != 4)) {
+        return false;
+    }
+
+    const unsigned int ImageWidth = MaxX - MinX + 1;
+    const unsigned int ImageHeight = MaxY - MinY + 1;
+
+    if (PlaneBytes < ImageWidth) {
+        return false;
+    }
+
+    const unsigned char* pPalette = NULL;
+
+    if (Planes == 1) {
+        if (Size < 128 + 769 || pData[Size - 769] != 0x0C) {
+            return false;
+        }
+
+        pPalette = &pData[Size - 768];
+    }
+
+    // Runs may cross the scan lines, the whole image is expanded in one go
+    const size_t LineBytes = (size_t)Planes * PlaneBytes;
+    std::vector<unsigned char> Lines(LineBytes * ImageHeight);
+    const size_t End = pPalette ? Size - 769 : Size;
+    size_t Pos = 128;
+    size_t Count = 0;
+
+    while (Count < Lines.size()) {
+        if (Pos >= End) {
+            return false;
+        }
+
+        unsigned int Value = pData[Pos++];
+        size_t RunLength = 1;
+
+        if ((Value & 0xC0) == 0xC0) {
+            if (Pos >= End) {
+                return false;
+            }
+
+            RunLength = std::min<size_t>(Value & 0x3F, Lines.size() - Count);
+            Value = pData[Pos++];
+        }
+
+        memset(&Lines[Count], Value, RunLength);
+        Count += RunLength;
+    }
+
+    Pixels.resize((size_t)ImageWidth * ImageHeight * 4);
+
+    for (unsigned int y = 0 ; y < ImageHeight ; y++) {
+        const unsigned char* pLine = &Lines[y * LineBytes];
+        unsigned char* pOut = &Pixels[(size_t)y * ImageWidth * 4];
+
+        for (unsigned int x = 0 ; x < ImageWidth ; x++, pOut += 4) {
+            if (pPalette) {
+                memcpy(pOut, &pPalette[pLine[x] * 3], 3);
+                pOut[3] = 255;
+            }
+            else {
+                pOut[0] = pLine[x];
+                pOut[1] = pLine[PlaneBytes + x];
+                pOut[2] = pLine[PlaneBytes * 2 + x];
+                pOut[3] = (Planes == 4) ? pLine[PlaneBytes * 3 + x] : 255;
+            }
+        }
+    }
+
+    Width = ImageWidth;
+    Height = ImageHeight;
+
+    return true;
+}
+
+
+void ImageDecoder::InitMagick()
+{
+    Magick::InitializeMagick(NULL);
+}
+
+
+bool ImageDecoder::LoadWithMagick(const std::string& FileName, unsigned int& Width, unsigned int& Height, std::vector<unsigned char>& Pixels)
+{
+    std::call_once(s_magickInit, InitMagick);
+
+    try {
+        Magick::Image Image(FileName);
+        Magick::Blob Blob;
+
+        Image.write(&Blob, "RGBA");
+
+        const unsigned char* pBlob = (const unsigned char*)Blob.data();
+
+        Width = Image.columns();
+        Height = Image.rows();
+        Pixels.assign(pBlob, pBlob + Blob.length());
+    }
+    catch (Magick::Error& Error) {
+        printf("Error loading image '%s': %s\n", FileName.c_str(), Error.what());
+        return false;
+    }
+
+    return true;
+}
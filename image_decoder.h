@@ -0,0 +1,48 @@
+/*
+
+	Copyright 2011 Etay Meiri
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef IMAGE_DECODER_H
+#define	IMAGE_DECODER_H
+
+#include <string>
+#include <vector>
+#include <mutex>
+
+// Reads an image file into 8 bit RGBA rows, top row first, the layout the textures
+// upload. JPEG, PNG, TGA, BMP and PCX files are decoded here; other formats and the
+// variants the native decoders reject go through ImageMagick, which is only
+// initialized the first time it is needed.
+//
+// Load may be called from several threads at once.
+class ImageDecoder
+{
+public:
+    static bool Load(const std::string& FileName, unsigned int& Width, unsigned int& Height, std::vector<unsigned char>& Pixels);
+
+private:
+    static bool DecodeTGA(const unsigned char* pData, size_t Size, unsigned int& Width, unsigned int& Height, std::vector<unsigned char>& Pixels);
+    static bool DecodeBMP(const unsigned char* pData, size_t Size, unsigned int& Width, unsigned int& Height, std::vector<unsigned char>& Pixels);
+    static bool DecodePCX(const unsigned char* pData, size_t Size, unsigned int& Width, unsigned int& Height, std::vector<unsigned char>& Pixels);
+    static bool LoadWithMagick(const std::string& FileName, unsigned int& Width, unsigned int& Height, std::vector<unsigned char>& Pixels);
+    static void InitMagick();
+
+    static std::once_flag s_magickInit;
+};
+
+
+#endif	/* IMAGE_DECODER_H */
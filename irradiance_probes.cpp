@@ -0,0 +1,167 @@
+/*
+
+	Copyright 2011 Etay Meiri
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#pragma once
+#include <stdio.h>
+#include <string.h>
+
+#include "irradiance_probes.h"
+#include "uniform_buffers.h"
+#include "engine_common.h"
+#include "gl_state.h"
+#include "util.h"
+
+#define PROBE_VOLUME_MAGIC 0x56504853   // "SHPV"
+
+// Header of the probe volume files, followed by the coefficients of ProbeVolume as floats
+struct ProbeVolumeHeader {
+    unsigned int Magic;
+    unsigned int Res[3];
+    float Min[3];
+    float Max[3];
+};
+
+GLuint IrradianceProbes::s_texture = 0;
+
+
+Vector3f ProbeVolume::GetProbePos(unsigned int x, unsigned int y, unsigned int z) const
+{
+    const Vector3f Size = Max - Min;
+
+    return Vector3f(Min.x + Size.x * x / (Res[0] - 1),
+                    Min.y + Size.y * y / (Res[1] - 1),
+                    Min.z + Size.z * z / (Res[2] - 1));
+}
+
+
+bool IrradianceProbes::Load(const std::string& FileName)
+{
+    FILE* f = fopen(FileName.c_str(), "rb");
+
+    if (!f) {
+        fprintf(stderr, "Error opening '%s'\n", FileName.c_str());
+        return false;
+    }
+
+    ProbeVolumeHeader Header;
+    ProbeVolume Volume;
+    bool Ret = fread(&Header, sizeof(Header), 1, f) == 1 && Header.Magic == PROBE_VOLUME_MAGIC;
+
+    if (Ret) {
+        for (unsigned int i = 0 ; i < 3 ; i++) {
+            Volume.Res[i] = Header.Res[i];
+            Ret = Ret && Header.Res[i] >= 2 && Header.Res[i] <= 1024;
+        }
+
+        Volume.Min = Vector3f(Header.Min[0], Header.Min[1], Header.Min[2]);
+        Volume.Max = Vector3f(Header.Max[0], Header.Max[1], Header.Max[2]);
+    }
+
+    if (Ret) {
+        Volume.Coeffs.resize(Volume.GetNumProbes() * PROBE_SH_COEFFS);
+        Ret = fread(&Volume.Coeffs[0], sizeof(Vector3f), Volume.Coeffs.size(), f) == Volume.Coeffs.size();
+    }
+
+    fclose(f);
+
+    if (!Ret) {
+        fprintf(stderr, "'%s' is not a valid probe volume\n", FileName.c_str());
+        return false;
+    }
+
+    return SetVolume(Volume);
+}
+
+
+bool IrradianceProbes::Save(const std::string& FileName, const ProbeVolume& Volume)
+{
+    FILE* f = fopen(FileName.c_str(), "wb");
+
+    if (!f) {
+        fprintf(stderr, "Error creating '%s'\n", FileName.c_str());
+        return false;
+    }
+
+    ProbeVolumeHeader Header;
+    Header.Magic = PROBE_VOLUME_MAGIC;
+    memcpy(Header.Res, Volume.Res, sizeof(Header.Res));
+    memcpy(Header.Min, &Volume.Min, sizeof(Header.Min));
+    memcpy(Header.Max, &Volume.Max, sizeof(Header.Max));
+
+    const bool Ret = fwrite(&Header, sizeof(Header), 1, f) == 1 &&
+                     fwrite(&Volume.Coeffs[0], sizeof(Vector3f), Volume.Coeffs.size(), f) == Volume.Coeffs.size();
+
+    fclose(f);
+
+    if (!Ret) {
+        fprintf(stderr, "Error writing '%s'\n", FileName.c_str());
+    }
+
+    return Ret;
+}
+
+
+bool IrradianceProbes::SetVolume(const ProbeVolume& Volume)
+{
+    if (Volume.Coeffs.size() != Volume.GetNumProbes() * PROBE_SH_COEFFS) {
+        return false;
+    }
+
+    const unsigned int Width = Volume.Res[0] * PROBE_TEXELS;
+    std::vector<float> Texels(Width * Volume.Res[1] * Volume.Res[2] * 4, 0.0f);
+
+    // The 27 floats of a probe run through its texels, the last channel is left over
+    for (unsigned int i = 0 ; i < Volume.GetNumProbes() ; i++) {
+        const unsigned int x = i % Volume.Res[0];
+        const unsigned int Row = i / Volume.Res[0];
+        const float* pCoeffs = &Volume.Coeffs[i * PROBE_SH_COEFFS].x;
+
+        for (unsigned int j = 0 ; j < PROBE_SH_COEFFS * 3 ; j++) {
+            const unsigned int Texel = Row * Width + (j / 4) * Volume.Res[0] + x;
+            Texels[Texel * 4 + j % 4] = pCoeffs[j];
+        }
+    }
+
+    if (s_texture == 0) {
+        s_texture = GLState::CreateTexture(GL_TEXTURE_3D);
+        GLState::TextureParameteri(s_texture, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        GLState::TextureParameteri(s_texture, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        GLState::TextureParameteri(s_texture, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        GLState::TextureParameteri(s_texture, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        GLState::TextureParameteri(s_texture, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+    }
+
+    GLState::BindTextureForEdit(s_texture);
+    glTexImage3D(GL_TEXTURE_3D, 0, GL_RGBA16F, Width, Volume.Res[1], Volume.Res[2], 0, GL_RGBA, GL_FLOAT, &Texels[0]);
+    GLState::BindTexture(PROBE_TEXTURE_UNIT_INDEX, GL_TEXTURE_3D, s_texture);
+
+    const Vector3f Size = Volume.Max - Volume.Min;
+    LightUniforms& Lights = UniformBuffers::EditLights();
+    Lights.ProbeVolumeMin = Vector4f(Volume.Min.x, Volume.Min.y, Volume.Min.z, 0.0f);
+    Lights.ProbeVolumeInvSize = Vector4f(1.0f / Size.x, 1.0f / Size.y, 1.0f / Size.z, 0.0f);
+
+    return GLCheckError();
+}
+
+
+void IrradianceProbes::Shutdown()
+{
+    if (s_texture != 0) {
+        GLState::DeleteTextures(1, &s_texture);
+        s_texture = 0;
+    }
+}
@@ -0,0 +1,74 @@
+/*
+
+	Copyright 2011 Etay Meiri
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef IRRADIANCE_PROBES_H
+#define	IRRADIANCE_PROBES_H
+
+#include <string>
+#include <vector>
+#include <GL/glew.h>
+
+#include "math_3d.h"
+
+// Coefficients of the L2 spherical harmonics of a probe, per color channel
+#define PROBE_SH_COEFFS 9
+
+// RGBA texels that hold the coefficients of a probe in the volume texture
+#define PROBE_TEXELS 7
+
+// A grid of probes that spans a box, the corner probes sit on the corners of the box.
+// The coefficients are those of the irradiance divided by pi, so evaluating them for
+// a normal gives the factor the albedo is lit by (see ProbeBaker).
+struct ProbeVolume {
+    unsigned int Res[3];                // probes along x, y and z, at least 2
+    Vector3f Min;
+    Vector3f Max;
+    std::vector<Vector3f> Coeffs;       // PROBE_SH_COEFFS per probe, x runs fastest
+
+    unsigned int GetNumProbes() const { return Res[0] * Res[1] * Res[2]; }
+
+    Vector3f GetProbePos(unsigned int x, unsigned int y, unsigned int z) const;
+};
+
+// Baked diffuse lighting of the static scene. The lighting technique replaces the
+// ambient term of the directional light by the irradiance of the volume, trilinearly
+// interpolated between the probes around the point and clamped to the box. The volume
+// is a 3D texture PROBE_TEXELS times as wide as the grid: texel i of every probe is in
+// the i-th block of columns, so the blocks filter independently. GL thread only.
+class IrradianceProbes
+{
+public:
+    // Reads a volume written by Save and makes it current
+    static bool Load(const std::string& FileName);
+
+    static bool Save(const std::string& FileName, const ProbeVolume& Volume);
+
+    // Uploads the volume, binds it to PROBE_TEXTURE_UNIT_INDEX and writes its box to the
+    // light uniform block
+    static bool SetVolume(const ProbeVolume& Volume);
+
+    static bool IsEnabled() { return s_texture != 0; }
+
+    static void Shutdown();
+
+private:
+    static GLuint s_texture;
+};
+
+
+#endif	/* IRRADIANCE_PROBES_H */
@@ -0,0 +1,1131 @@
+/*
+
+	Copyright 2011 Etay Meiri
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#pragma once
+#include <string.h>
+#include <math.h>
+#include <algorithm>
+#include <emmintrin.h>
+
+#include "jpeg_decoder.h"
+
+#define JPEG_FAST_BITS 9
+
+// Position of the n-th zigzag coefficient in the block. The tail catches the runs of
+// corrupt files that go past the last coefficient.
+static const unsigned char JPEGNaturalOrder[64 + 16] = {
+     0,  1,  8, 16,  9,  2,  3, 10, 17, 24, 32, 25, 18, 11,  4,  5,
+    12, 19, 26, 33, 40, 48, 41, 34, 27, 20, 13,  6,  7, 14, 21, 28,
+    35, 42, 49, 56, 57, 50, 43, 36, 29, 22, 15, 23, 30, 37, 44, 51,
+    58, 59, 52, 45, 38, 31, 39, 46, 53, 60, 61, 54, 47, 55, 62, 63,
+    63, 63, 63, 63, 63, 63, 63, 63, 63, 63, 63, 63, 63, 63, 63, 63
+};
+
+
+struct JPEGHuffman {
+    unsigned char Fast[1 << JPEG_FAST_BITS];    // index in Values for the short codes, 255 otherwise
+    short FastAC[1 << JPEG_FAST_BITS];          // value << 8 | run << 4 | bits when the code and its
+                                                // value fit in the lookup, 0 otherwise
+    unsigned char Values[256];
+    unsigned char Sizes[256];
+    unsigned int MaxCode[18];                   // first code past each length, left aligned on 16 bits
+    int Delta[17];                              // index in Values minus code, per length
+};
+
+
+struct JPEGComponent {
+    unsigned int Id;
+    unsigned int H;
+    unsigned int V;
+    unsigned int QuantTable;
+    unsigned int DCTable;
+    unsigned int ACTable;
+    unsigned int Width;             // in samples
+    unsigned int Height;
+    unsigned int BlocksW;           // covering whole MCUs
+    unsigned int BlocksH;
+    int DCPred;
+    std::vector<short> Coefs;       // 64 per block, natural order, not dequantized
+    std::vector<unsigned char> Plane;
+};
+
+
+// Matrix of the 1D inverse DCT, A[u][x] = C(u) / 2 * cos((2x + 1) * u * pi / 16)
+struct JPEGIDCTMatrix {
+    JPEGIDCTMatrix()
+    {
+        for (unsigned int u = 0 ; u < 8 ; u++) {
+            const float C = (u == 0) ? sqrtf(0.5f) : 1.0f;
+
+            for (unsigned int x = 0 ; x < 8 ; x++) {
+                A[u][x] = C / 2.0f * cosf((2.0f * x + 1.0f) * u * 3.14159265f / 16.0f);
+            }
+        }
+    }
+
+    float A[8][8];
+};
+
+static const JPEGIDCTMatrix JPEGIDCT;
+
+
+class JPEGDecoder
+{
+public:
+    JPEGDecoder(const unsigned char* pData, size_t Size)
+    {
+        m_pData = pData;
+        m_size = Size;
+        m_pos = 0;
+        m_width = 0;
+        m_height = 0;
+        m_progressive = false;
+        m_transform = -1;
+        m_restartInterval = 0;
+        m_hMax = 1;
+        m_vMax = 1;
+        m_mcusX = 0;
+        m_mcusY = 0;
+        memset(m_quant, 0, sizeof(m_quant));
+        memset(m_huffmanDefined, 0, sizeof(m_huffmanDefined));
+        ResetBits();
+    }
+
+    bool Decode(unsigned int& Width, unsigned int& Height, std::vector<unsigned char>& Pixels);
+
+private:
+    unsigned int ReadU16(size_t Pos) const
+    {
+        return (m_pData[Pos] << 8) | m_pData[Pos + 1];
+    }
+
+    bool ReadQuantTables(size_t Pos, size_t End);
+    bool ReadHuffmanTables(size_t Pos, size_t End);
+    bool ReadFrame(size_t Pos, size_t End);
+    bool ReadScan(size_t Pos, size_t End);
+    bool DecodeBlock(JPEGComponent& Comp, short* pBlock);
+    void Restart();
+    void Output(std::vector<unsigned char>& Pixels);
+    void Upsample(const JPEGComponent& Comp, std::vector<unsigned char>& Full) const;
+
+    void ResetBits()
+    {
+        m_bits = 0;
+        m_numBits = 0;
+        m_marker = false;
+        m_eobRun = 0;
+    }
+
+    // Keeps at least 25 bits in the buffer. Zeros are shifted in once a marker is
+    // reached, the marker itself is left for the parser.
+    void FillBits()
+    {
+        while (m_numBits <= 24) {
+            unsigned int Byte = 0;
+
+            if (!m_marker && m_pos < m_size) {
+                Byte = m_pData[m_pos];
+
+                if (Byte == 0xFF) {
+                    const unsigned int Next = (m_pos + 1 < m_size) ? m_pData[m_pos + 1] : 0xD9;
+
+                    if (Next == 0) {
+                        m_pos += 2;
+                    }
+                    else {
+                        m_marker = true;
+                        Byte = 0;
+                    }
+                }
+                else {
+                    m_pos++;
+                }
+            }
+
+            m_bits |= Byte << (24 - m_numBits);
+            m_numBits += 8;
+        }
+    }
+
+    unsigned int GetBits(unsigned int Count)
+    {
+        if (Count == 0) {
+            return 0;
+        }
+
+        FillBits();
+
+        const unsigned int Value = m_bits >> (32 - Count);
+        m_bits <<= Count;
+        m_numBits -= Count;
+
+        return Value;
+    }
+
+    static int Extend(unsigned int Value, unsigned int Count)
+    {
+        return (Count == 0) ? 0 : (Value < (1u << (Count - 1))) ? (int)Value - (1 << Count) + 1 : (int)Value;
+    }
+
+    // Returns -1 for an invalid code
+    int DecodeSymbol(const JPEGHuffman& Table)
+    {
+        FillBits();
+
+        const unsigned int k = Table.Fast[m_bits >> (32 - JPEG_FAST_BITS)];
+
+        if (k != 255) {
+            const unsigned int Size = Table.Sizes[k];
+            m_bits <<= Size;
+            m_numBits -= Size;
+            return Table.Values[k];
+        }
+
+        const unsigned int Code16 = m_bits >> 16;
+        unsigned int Size = JPEG_FAST_BITS + 1;
+
+        while (Code16 >= Table.MaxCode[Size]) {
+            Size++;
+        }
+
+        if (Size > 16) {
+            return -1;
+        }
+
+        const int Index = (int)(m_bits >> (32 - Size)) + Table.Delta[Size];
+
+        if (Index < 0 || Index > 255) {
+            return -1;
+        }
+
+        m_bits <<= Size;
+        m_numBits -= Size;
+
+        return Table.Values[Index];
+    }
+
+    const unsigned char* m_pData;
+    size_t m_size;
+    size_t m_pos;
+    unsigned int m_width;
+    unsigned int m_height;
+    bool m_progressive;
+    int m_transform;                    // from the Adobe segment, -1 if there is none
+    unsigned int m_restartInterval;
+    unsigned int m_hMax;
+    unsigned int m_vMax;
+    unsigned int m_mcusX;
+    unsigned int m_mcusY;
+    unsigned short m_quant[4][64];      // natural order
+    JPEGHuffman m_huffman[8];           // DC tables then AC tables
+    bool m_huffmanDefined[8];
+    std::vector<JPEGComponent> m_components;
+
+    // Current scan
+    unsigned int m_bits;
+    unsigned int m_numBits;
+    bool m_marker;
+    unsigned int m_eobRun;
+    unsigned int m_spectralStart;
+    unsigned int m_spectralEnd;
+    unsigned int m_approxHigh;
+    unsigned int m_approxLow;
+};
+
+
+bool JPEGDecoder::ReadQuantTables(size_t Pos, size_t End)
+{
+    while (Pos < End) {
+        const unsigned int Precision = m_pData[Pos] >> 4;
+        const unsigned int Id = m_pData[Pos] & 15;
+        Pos++;
+
+        if (Id > 3 || Pos + (Precision ? 128 : 64) > End) {
+            return false;
+        }
+
+        for (unsigned int i = 0 ; i < 64 ; i++) {
+            m_quant[Id][JPEGNaturalOrder[i]] = Precision ? ReadU16(Pos + i * 2) : m_pData[Pos + i];
+        }
+
+        Pos += Precision ? 128 : 64;
+    }
+
+    return true;
+}
+
+
+bool JPEGDecoder::ReadHuffmanTables(size_t Pos, size_t End)
+{
+    while (Pos + 17 <= End) {
+        const unsigned int Class = m_pData[Pos] >> 4;
+        const unsigned int Id = m_pData[Pos] & 15;
+
+        if (Class > 1 || Id > 3) {
+            return false;
+        }
+
+        JPEGHuffman& Table = m_huffman[Class * 4 + Id];
+        const unsigned char* pCounts = &m_pData[Pos + 1];
+        unsigned int NumValues = 0;
+
+        for (unsigned int i = 0 ; i < 16 ; i++) {
+            NumValues += pCounts[i];
+        }
+
+        Pos += 17;
+
+        if (NumValues > 256 || Pos + NumValues > End) {
+            return false;
+        }
+
+        memcpy(Table.Values, &m_pData[Pos], NumValues);
+        Pos += NumValues;
+
+        // Canonical codes, shortest first
+        unsigned int Code = 0;
+        unsigned int k = 0;
+
+        for (unsigned int Size = 1 ; Size <= 16 ; Size++) {
+            Table.Delta[Size] = (int)k - (int)Code;
+
+            for (unsigned int i = 0 ; i < pCounts[Size - 1] ; i++) {
+                Table.Sizes[k++] = Size;
+                Code++;
+            }
+
+            if (Code > (1u << Size)) {
+                return false;
+            }
+
+            Table.MaxCode[Size] = Code << (16 - Size);
+            Code <<= 1;
+        }
+
+        Table.MaxCode[17] = 0xFFFFFFFF;
+
+        memset(Table.Fast, 255, sizeof(Table.Fast));
+        Code = 0;
+        k = 0;
+
+        for (unsigned int Size = 1 ; Size <= 16 ; Size++) {
+            for (unsigned int i = 0 ; i < pCounts[Size - 1] ; i++, k++, Code++) {
+                if (Size <= JPEG_FAST_BITS) {
+                    const unsigned int First = Code << (JPEG_FAST_BITS - Size);
+
+                    for (unsigned int j = 0 ; j < (1u << (JPEG_FAST_BITS - Size)) ; j++) {
+                        Table.Fast[First + j] = (unsigned char)k;
+                    }
+                }
+            }
+
+            Code <<= 1;
+        }
+
+        // AC symbols whose value bits follow the code within the lookup are decoded at once
+        memset(Table.FastAC, 0, sizeof(Table.FastAC));
+
+        for (unsigned int i = 0 ; i < (1 << JPEG_FAST_BITS) ; i++) {
+            const unsigned int Index = Table.Fast[i];
+
+            if (Index == 255) {
+                continue;
+            }
+
+            const unsigned int Run = Table.Values[Index] >> 4;
+            const unsigned int Bits = Table.Values[Index] & 15;
+            const unsigned int Size = Table.Sizes[Index];
+
+            if (Bits != 0 && Size + Bits <= JPEG_FAST_BITS) {
+                const unsigned int Raw = ((i << Size) & ((1 << JPEG_FAST_BITS) - 1)) >> (JPEG_FAST_BITS - Bits);
+                const int Value = Extend(Raw, Bits);
+
+                if (Value >= -128 && Value <= 127) {
+                    Table.FastAC[i] = (short)(Value * 256 + Run * 16 + Size + Bits);
+                }
+            }
+        }
+
+        m_huffmanDefined[Class * 4 + Id] = true;
+    }
+
+    return Pos == End;
+}
+
+
+bool JPEGDecoder::ReadFrame(size_t Pos, size_t End)
+{
+    if (!m_components.empty() || Pos + 6 > End || m_pData[Pos] != 8) {
+        return false;
+    }
+
+    m_height = ReadU16(Pos + 1);
+    m_width = ReadU16(Pos + 3);
+    const unsigned int NumComponents = m_pData[Pos + 5];
+    Pos += 6;
+
+    if (m_width == 0 || m_height == 0 || (NumComponents != 1 && NumComponents != 3) ||
+        Pos + NumComponents * 3 > End) {
+        return false;
+    }
+
+    m_components.resize(NumComponents);
+
+    for (unsigned int i = 0 ; i < NumComponents ; i++) {
+        JPEGComponent& Comp = m_components[i];
+        Comp.Id = m_pData[Pos];
+        Comp.H = m_pData[Pos + 1] >> 4;
+        Comp.V = m_pData[Pos + 1] & 15;
+        Comp.QuantTable = m_pData[Pos + 2];
+        Comp.DCTable = 0;
+        Comp.ACTable = 0;
+        Comp.DCPred = 0;
+        Pos += 3;
+
+        if (Comp.H < 1 || Comp.H > 4 || Comp.V < 1 || Comp.V > 4 || Comp.QuantTable > 3) {
+            return false;
+        }
+
+        m_hMax = std::max(m_hMax, Comp.H);
+        m_vMax = std::max(m_vMax, Comp.V);
+    }
+
+    // A single component is not interleaved, its MCU is one block whatever the factors
+    if (NumComponents == 1) {
+        m_components[0].H = m_components[0].V = 1;
+        m_hMax = m_vMax = 1;
+    }
+
+    m_mcusX = (m_width + 8 * m_hMax - 1) / (8 * m_hMax);
+    m_mcusY = (m_height + 8 * m_vMax - 1) / (8 * m_vMax);
+
+    for (unsigned int i = 0 ; i < NumComponents ; i++) {
+        JPEGComponent& Comp = m_components[i];
+        Comp.Width = (m_width * Comp.H + m_hMax - 1) / m_hMax;
+        Comp.Height = (m_height * Comp.V + m_vMax - 1) / m_vMax;
+        Comp.BlocksW = m_mcusX * Comp.H;
+        Comp.BlocksH = m_mcusY * Comp.V;
+        Comp.Coefs.assign((size_t)Comp.BlocksW * Comp.BlocksH * 64, 0);
+    }
+
+    return true;
+}
+
+
+void JPEGDecoder::Restart()
+{
+    ResetBits();
+
+    while (m_pos + 1 < m_size && !(m_pData[m_pos] == 0xFF && m_pData[m_pos + 1] >= 0xD0 && m_pData[m_pos + 1] <= 0xD7)) {
+        m_pos++;
+    }
+
+    m_pos += 2;
+
+    for (unsigned int i = 0 ; i < m_components.size() ; i++) {
+        m_components[i].DCPred = 0;
+    }
+}
+
+
+bool JPEGDecoder::DecodeBlock(JPEGComponent& Comp, short* pBlock)
+{
+    const JPEGHuffman& DC = m_huffman[Comp.DCTable];
+    const JPEGHuffman& AC = m_huffman[4 + Comp.ACTable];
+
+    if (!m_progressive) {
+        const int t = DecodeSymbol(DC);
+
+        if (t < 0 || t > 16) {
+            return false;
+        }
+
+        Comp.DCPred += Extend(GetBits(t), t);
+        pBlock[0] = (short)Comp.DCPred;
+
+        for (unsigned int k = 1 ; k < 64 ; k++) {
+            FillBits();
+
+            const int Fast = AC.FastAC[m_bits >> (32 - JPEG_FAST_BITS)];
+
+            if (Fast != 0) {
+                k += (Fast >> 4) & 15;
+                m_bits <<= Fast & 15;
+                m_numBits -= Fast & 15;
+                pBlock[JPEGNaturalOrder[k]] = (short)(Fast >> 8);
+                continue;
+            }
+
+            const int rs = DecodeSymbol(AC);
+
+            if (rs < 0) {
+                return false;
+            }
+
+            const unsigned int r = rs >> 4;
+            const unsigned int s = rs & 15;
+
+            if (s != 0) {
+                k += r;
+                pBlock[JPEGNaturalOrder[k]] = (short)Extend(GetBits(s), s);
+            }
+            else if (r == 15) {
+                k += 15;
+            }
+            else {
+                break;
+            }
+        }
+
+        return true;
+    }
+
+    if (m_spectralStart == 0) {
+        // DC scans, first pass or refinement bit
+        if (m_approxHigh == 0) {
+            const int t = DecodeSymbol(DC);
+
+            if (t < 0 || t > 16) {
+                return false;
+            }
+
+            Comp.DCPred += Extend(GetBits(t), t);
+            pBlock[0] = (short)(Comp.DCPred * (1 << m_approxLow));
+        }
+        else if (GetBits(1)) {
+            pBlock[0] |= (short)(1 << m_approxLow);
+        }
+
+        return true;
+    }
+
+    if (m_approxHigh == 0) {
+        // AC first pass
+        if (m_eobRun > 0) {
+            m_eobRun--;
+            return true;
+        }
+
+        for (unsigned int k = m_spectralStart ; k <= m_spectralEnd ; k++) {
+            FillBits();
+
+            const int Fast = AC.FastAC[m_bits >> (32 - JPEG_FAST_BITS)];
+
+            if (Fast != 0) {
+                k += (Fast >> 4) & 15;
+                m_bits <<= Fast & 15;
+                m_numBits -= Fast & 15;
+                pBlock[JPEGNaturalOrder[k]] = (short)((Fast >> 8) * (1 << m_approxLow));
+                continue;
+            }
+
+            const int rs = DecodeSymbol(AC);
+
+            if (rs < 0) {
+                return false;
+            }
+
+            const unsigned int r = rs >> 4;
+            const unsigned int s = rs & 15;
+
+            if (s != 0) {
+                k += r;
+                pBlock[JPEGNaturalOrder[k]] = (short)(Extend(GetBits(s), s) * (1 << m_approxLow));
+            }
+            else if (r == 15) {
+                k += 15;
+            }
+            else {
+                m_eobRun = (1 << r) - 1 + GetBits(r);
+                break;
+            }
+        }
+
+        return true;
+    }
+
+    // AC refinement. Every coefficient that is already non zero gets a correction bit,
+    // the new ones are placed after skipping r zero coefficients.
+    const int p1 = 1 << m_approxLow;
+    const int m1 = -1 * (1 << m_approxLow);
+    unsigned int k = m_spectralStart;
+
+    if (m_eobRun == 0) {
+        for ( ; k <= m_spectralEnd ; k++) {
+            const int rs = DecodeSymbol(AC);
+
+            if (rs < 0) {
+                return false;
+            }
+
+            int r = rs >> 4;
+            int s = rs & 15;
+
+            if (s != 0) {
+                s = GetBits(1) ? p1 : m1;
+            }
+            else if (r != 15) {
+                m_eobRun = (1 << r) + GetBits(r);
+                break;
+            }
+
+            while (k <= m_spectralEnd) {
+                short& Coef = pBlock[JPEGNaturalOrder[k]];
+
+                if (Coef != 0) {
+                    if (GetBits(1) && (Coef & p1) == 0) {
+                        Coef += (Coef >= 0) ? p1 : m1;
+                    }
+                }
+                else if (--r < 0) {
+                    break;
+                }
+
+                k++;
+            }
+
+            if (s != 0) {
+                pBlock[JPEGNaturalOrder[k]] = (short)s;
+            }
+        }
+    }
+
+    if (m_eobRun > 0) {
+        for ( ; k <= m_spectralEnd ; k++) {
+            short& Coef = pBlock[JPEGNaturalOrder[k]];
+
+            if (Coef != 0 && GetBits(1) && (Coef & p1) == 0) {
+                Coef += (Coef >= 0) ? p1 : m1;
+            }
+        }
+
+        m_eobRun--;
+    }
+
+    return true;
+}
+
+
+bool JPEGDecoder::ReadScan(size_t Pos, size_t End)
+{
+    if (m_components.empty() || Pos >= End) {
+        return false;
+    }
+
+    const unsigned int NumScanComponents = m_pData[Pos++];
+    JPEGComponent* pScanComponents[4];
+
+    if (NumScanComponents < 1 || NumScanComponents > 4 || Pos + NumScanComponents * 2 + 3 > End) {
+        return false;
+    }
+
+    for (unsigned int i = 0 ; i < NumScanComponents ; i++) {
+        const unsigned int Id = m_pData[Pos];
+        const unsigned int Tables = m_pData[Pos + 1];
+        Pos += 2;
+
+        pScanComponents[i] = NULL;
+
+        for (unsigned int j = 0 ; j < m_components.size() ; j++) {
+            if (m_components[j].Id == Id) {
+                pScanComponents[i] = &m_components[j];
+            }
+        }
+
+        if (!pScanComponents[i] || (Tables >> 4) > 3 || (Tables & 15) > 3) {
+            return false;
+        }
+
+        pScanComponents[i]->DCTable = Tables >> 4;
+        pScanComponents[i]->ACTable = Tables & 15;
+    }
+
+    m_spectralStart = m_pData[Pos];
+    m_spectralEnd = m_pData[Pos + 1];
+    m_approxHigh = m_pData[Pos + 2] >> 4;
+    m_approxLow = m_pData[Pos + 2] & 15;
+
+    if (!m_progressive) {
+        m_spectralStart = 0;
+        m_spectralEnd = 63;
+        m_approxHigh = m_approxLow = 0;
+    }
+    else if (m_spectralEnd > 63 || m_spectralStart > m_spectralEnd || m_approxLow > 13 ||
+             (m_spectralStart > 0 && NumScanComponents != 1)) {
+        return false;
+    }
+
+    // The tables of the scan must exist
+    for (unsigned int i = 0 ; i < NumScanComponents ; i++) {
+        const bool NeedsDC = m_spectralStart == 0 && m_approxHigh == 0;
+        const bool NeedsAC = m_spectralEnd > 0;
+
+        if ((NeedsDC && !m_huffmanDefined[pScanComponents[i]->DCTable]) ||
+            (NeedsAC && !m_huffmanDefined[4 + pScanComponents[i]->ACTable])) {
+            return false;
+        }
+
+        pScanComponents[i]->DCPred = 0;
+    }
+
+    m_pos = End;
+    ResetBits();
+
+    unsigned int NumMCUs = 0;
+
+    if (NumScanComponents == 1) {
+        // Not interleaved: the MCU is a single block and only the blocks that hold
+        // samples are coded
+        JPEGComponent& Comp = *pScanComponents[0];
+        const unsigned int BlocksW = (Comp.Width + 7) / 8;
+        const unsigned int BlocksH = (Comp.Height + 7) / 8;
+
+        for (unsigned int y = 0 ; y < BlocksH ; y++) {
+            for (unsigned int x = 0 ; x < BlocksW ; x++) {
+                if (m_restartInterval > 0 && NumMCUs > 0 && NumMCUs % m_restartInterval == 0) {
+                    Restart();
+                }
+
+                if (!DecodeBlock(Comp, &Comp.Coefs[((size_t)y * Comp.BlocksW + x) * 64])) {
+                    return false;
+                }
+
+                NumMCUs++;
+            }
+        }
+    }
+    else {
+        for (unsigned int my = 0 ; my < m_mcusY ; my++) {
+            for (unsigned int mx = 0 ; mx < m_mcusX ; mx++) {
+                if (m_restartInterval > 0 && NumMCUs > 0 && NumMCUs % m_restartInterval == 0) {
+                    Restart();
+                }
+
+                for (unsigned int i = 0 ; i < NumScanComponents ; i++) {
+                    JPEGComponent& Comp = *pScanComponents[i];
+
+                    for (unsigned int v = 0 ; v < Comp.V ; v++) {
+                        for (unsigned int h = 0 ; h < Comp.H ; h++) {
+                            const size_t Block = (size_t)(my * Comp.V + v) * Comp.BlocksW + mx * Comp.H + h;
+
+                            if (!DecodeBlock(Comp, &Comp.Coefs[Block * 64])) {
+                                return false;
+                            }
+                        }
+                    }
+                }
+
+                NumMCUs++;
+            }
+        }
+    }
+
+    return true;
+}
+
+
+// Coefficient Lane of F times a row of the IDCT matrix
+#define JPEG_IDCT_TERM(F, Lane, A) _mm_mul_ps(_mm_shuffle_ps(F, F, _MM_SHUFFLE(Lane, Lane, Lane, Lane)), A)
+
+// Dequantizes and transforms a block as two passes of 8x8 matrix products,
+// T = F * A then f = A^T * T, four columns per SSE register. Rows of zero
+// coefficients are skipped and blocks with only a DC coefficient, the most common
+// case, are filled directly.
+static void JPEGInverseDCT(const short* pCoefs, const float* pQuant, unsigned char* pOut, unsigned int Stride)
+{
+    const __m128i Zero = _mm_setzero_si128();
+    __m128i Rows[8];
+    __m128i AC = _mm_and_si128(_mm_loadu_si128((const __m128i*)pCoefs), _mm_set_epi16(-1, -1, -1, -1, -1, -1, -1, 0));
+
+    for (unsigned int u = 0 ; u < 8 ; u++) {
+        Rows[u] = _mm_loadu_si128((const __m128i*)(pCoefs + u * 8));
+
+        if (u > 0) {
+            AC = _mm_or_si128(AC, Rows[u]);
+        }
+    }
+
+    if (_mm_movemask_epi8(_mm_cmpeq_epi8(AC, Zero)) == 0xFFFF) {
+        const float DC = pCoefs[0] * pQuant[0] * JPEGIDCT.A[0][0] * JPEGIDCT.A[0][0] + 128.0f;
+        const __m128i Value = _mm_set1_epi8((char)std::min(std::max(_mm_cvtss_si32(_mm_set_ss(DC)), 0), 255));
+
+        for (unsigned int y = 0 ; y < 8 ; y++) {
+            _mm_storel_epi64((__m128i*)(pOut + y * Stride), Value);
+        }
+
+        return;
+    }
+
+    __m128 T[8][2];
+    bool RowUsed[8];
+
+    for (unsigned int u = 0 ; u < 8 ; u++) {
+        RowUsed[u] = _mm_movemask_epi8(_mm_cmpeq_epi8(Rows[u], Zero)) != 0xFFFF;
+
+        if (!RowUsed[u]) {
+            continue;
+        }
+
+        // Sign extended to 32 bits and dequantized
+        const __m128 F0 = _mm_mul_ps(_mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpacklo_epi16(Zero, Rows[u]), 16)), _mm_loadu_ps(pQuant + u * 8));
+        const __m128 F1 = _mm_mul_ps(_mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpackhi_epi16(Zero, Rows[u]), 16)), _mm_loadu_ps(pQuant + u * 8 + 4));
+
+        for (unsigned int Half = 0 ; Half < 2 ; Half++) {
+            const __m128 A0 = _mm_loadu_ps(&JPEGIDCT.A[0][Half * 4]);
+            const __m128 A1 = _mm_loadu_ps(&JPEGIDCT.A[1][Half * 4]);
+            const __m128 A2 = _mm_loadu_ps(&JPEGIDCT.A[2][Half * 4]);
+            const __m128 A3 = _mm_loadu_ps(&JPEGIDCT.A[3][Half * 4]);
+            const __m128 A4 = _mm_loadu_ps(&JPEGIDCT.A[4][Half * 4]);
+            const __m128 A5 = _mm_loadu_ps(&JPEGIDCT.A[5][Half * 4]);
+            const __m128 A6 = _mm_loadu_ps(&JPEGIDCT.A[6][Half * 4]);
+            const __m128 A7 = _mm_loadu_ps(&JPEGIDCT.A[7][Half * 4]);
+
+            T[u][Half] = _mm_add_ps(_mm_add_ps(_mm_add_ps(JPEG_IDCT_TERM(F0, 0, A0), JPEG_IDCT_TERM(F0, 1, A1)),
+                                               _mm_add_ps(JPEG_IDCT_TERM(F0, 2, A2), JPEG_IDCT_TERM(F0, 3, A3))),
+                                    _mm_add_ps(_mm_add_ps(JPEG_IDCT_TERM(F1, 0, A4), JPEG_IDCT_TERM(F1, 1, A5)),
+                                               _mm_add_ps(JPEG_IDCT_TERM(F1, 2, A6), JPEG_IDCT_TERM(F1, 3, A7))));
+        }
+    }
+
+    for (unsigned int y = 0 ; y < 8 ; y++) {
+        // Level shift back to unsigned samples
+        __m128 Left = _mm_set1_ps(128.0f);
+        __m128 Right = Left;
+
+        for (unsigned int u = 0 ; u < 8 ; u++) {
+            if (RowUsed[u]) {
+                const __m128 a = _mm_set1_ps(JPEGIDCT.A[u][y]);
+                Left = _mm_add_ps(Left, _mm_mul_ps(a, T[u][0]));
+                Right = _mm_add_ps(Right, _mm_mul_ps(a, T[u][1]));
+            }
+        }
+
+        const __m128i Words = _mm_packs_epi32(_mm_cvtps_epi32(Left), _mm_cvtps_epi32(Right));
+        _mm_storel_epi64((__m128i*)(pOut + y * Stride), _mm_packus_epi16(Words, Words));
+    }
+}
+
+
+// Four pixels per iteration. The packed result holds R0-3 G0-3 B0-3 A0-3 and is
+// interleaved into RGBA with two rounds of unpacking.
+static void JPEGYCbCrToRGBA(const unsigned char* pY, const unsigned char* pCb, const unsigned char* pCr, unsigned char* pOut, unsigned int Count)
+{
+    const __m128i Zero = _mm_setzero_si128();
+    const __m128 Half = _mm_set1_ps(128.0f);
+    const __m128i Alpha = _mm_set1_epi32(255);
+    unsigned int i = 0;
+
+    for ( ; i + 4 <= Count ; i += 4) {
+        int y, cb, cr;
+        memcpy(&y, pY + i, 4);
+        memcpy(&cb, pCb + i, 4);
+        memcpy(&cr, pCr + i, 4);
+
+        const __m128 Y = _mm_cvtepi32_ps(_mm_unpacklo_epi16(_mm_unpacklo_epi8(_mm_cvtsi32_si128(y), Zero), Zero));
+        const __m128 Cb = _mm_sub_ps(_mm_cvtepi32_ps(_mm_unpacklo_epi16(_mm_unpacklo_epi8(_mm_cvtsi32_si128(cb), Zero), Zero)), Half);
+        const __m128 Cr = _mm_sub_ps(_mm_cvtepi32_ps(_mm_unpacklo_epi16(_mm_unpacklo_epi8(_mm_cvtsi32_si128(cr), Zero), Zero)), Half);
+
+        const __m128 R = _mm_add_ps(Y, _mm_mul_ps(Cr, _mm_set1_ps(1.402f)));
+        const __m128 G = _mm_sub_ps(Y, _mm_add_ps(_mm_mul_ps(Cb, _mm_set1_ps(0.344136f)), _mm_mul_ps(Cr, _mm_set1_ps(0.714136f))));
+        const __m128 B = _mm_add_ps(Y, _mm_mul_ps(Cb, _mm_set1_ps(1.772f)));
+
+        const __m128i RG = _mm_packs_epi32(_mm_cvtps_epi32(R), _mm_cvtps_epi32(G));
+        const __m128i BA = _mm_packs_epi32(_mm_cvtps_epi32(B), Alpha);
+        const __m128i Planar = _mm_packus_epi16(RG, BA);
+
+        const __m128i RGPairs = _mm_unpacklo_epi8(Planar, _mm_srli_si128(Planar, 4));
+        const __m128i BAPairs = _mm_unpacklo_epi8(_mm_srli_si128(Planar, 8), _mm_srli_si128(Planar, 12));
+        _mm_storeu_si128((__m128i*)(pOut + i * 4), _mm_unpacklo_epi16(RGPairs, BAPairs));
+    }
+
+    for ( ; i < Count ; i++) {
+        const float Y = pY[i];
+        const float Cb = pCb[i] - 128.0f;
+        const float Cr = pCr[i] - 128.0f;
+        const float RGB[3] = { Y + 1.402f * Cr, Y - 0.344136f * Cb - 0.714136f * Cr, Y + 1.772f * Cb };
+
+        for (unsigned int c = 0 ; c < 3 ; c++) {
+            pOut[i * 4 + c] = (unsigned char)std::min(std::max(RGB[c] + 0.5f, 0.0f), 255.0f);
+        }
+
+        pOut[i * 4 + 3] = 255;
+    }
+}
+
+
+// Brings a component to the size of the image. 2:1 factors use the triangle filter
+// of libjpeg ("fancy upsampling"), the rest is replicated.
+void JPEGDecoder::Upsample(const JPEGComponent& Comp, std::vector<unsigned char>& Full) const
+{
+    const unsigned int Stride = Comp.BlocksW * 8;
+    const unsigned int ScaleX = m_hMax / Comp.H;
+    const unsigned int ScaleY = m_vMax / Comp.V;
+    const bool Fancy = (ScaleX <= 2 && ScaleY <= 2 && m_hMax % Comp.H == 0 && m_vMax % Comp.V == 0);
+
+    Full.resize((size_t)m_width * m_height);
+
+    std::vector<int> ColSums(Comp.Width);
+    std::vector<unsigned char> Row(Comp.Width * 2 + 2);
+
+    for (unsigned int y = 0 ; y < m_height ; y++) {
+        unsigned char* pOut = &Full[(size_t)y * m_width];
+
+        if (!Fancy) {
+            const unsigned char* pIn = &Comp.Plane[(size_t)(y * Comp.V / m_vMax) * Stride];
+
+            for (unsigned int x = 0 ; x < m_width ; x++) {
+                pOut[x] = pIn[x * Comp.H / m_hMax];
+            }
+
+            continue;
+        }
+
+        // Vertical pass: 3/4 of the nearest row and 1/4 of the other neighbour
+        const unsigned int InRow = y / ScaleY;
+        const unsigned char* pNear = &Comp.Plane[(size_t)InRow * Stride];
+
+        if (ScaleY == 2) {
+            const unsigned int FarRow = (y & 1) ? std::min(InRow + 1, Comp.Height - 1) : (InRow > 0 ? InRow - 1 : 0);
+            const unsigned char* pFar = &Comp.Plane[(size_t)FarRow * Stride];
+
+            for (unsigned int x = 0 ; x < Comp.Width ; x++) {
+                ColSums[x] = pNear[x] * 3 + pFar[x];
+            }
+        }
+        else {
+            for (unsigned int x = 0 ; x < Comp.Width ; x++) {
+                ColSums[x] = pNear[x];
+            }
+        }
+
+        if (ScaleX == 1) {
+            // 1/4 rounded alternately up and down like libjpeg
+            const int Bias = (y & 1) ? 2 : 1;
+
+            for (unsigned int x = 0 ; x < m_width ; x++) {
+                pOut[x] = (ScaleY == 2) ? (unsigned char)((ColSums[x] + Bias) >> 2) : (unsigned char)ColSums[x];
+            }
+
+            continue;
+        }
+
+        // Horizontal pass, same weights
+        const unsigned int Last = Comp.Width - 1;
+        const int Shift = (ScaleY == 2) ? 4 : 2;
+        const int RoundEven = (ScaleY == 2) ? 8 : 1;
+        const int RoundOdd = (ScaleY == 2) ? 7 : 2;
+
+        Row[0] = (unsigned char)((ColSums[0] * 4 + RoundEven) >> Shift);
+        Row[Last * 2 + 1] = (unsigned char)((ColSums[Last] * 4 + RoundOdd) >> Shift);
+
+        if (Last > 0) {
+            Row[1] = (unsigned char)((ColSums[0] * 3 + ColSums[1] + RoundOdd) >> Shift);
+            Row[Last * 2] = (unsigned char)((ColSums[Last] * 3 + ColSums[Last - 1] + RoundEven) >> Shift);
+        }
+
+        for (unsigned int x = 1 ; x < Last ; x++) {
+            const int This = ColSums[x] * 3;
+
+            Row[x * 2] = (unsigned char)((This + ColSums[x - 1] + RoundEven) >> Shift);
+            Row[x * 2 + 1] = (unsigned char)((This + ColSums[x + 1] + RoundOdd) >> Shift);
+        }
+
+        memcpy(pOut, &Row[0], m_width);
+    }
+}
+
+
+void JPEGDecoder::Output(std::vector<unsigned char>& Pixels)
+{
+    for (unsigned int i = 0 ; i < m_components.size() ; i++) {
+        JPEGComponent& Comp = m_components[i];
+        const unsigned int Stride = Comp.BlocksW * 8;
+        float Quant[64];
+
+        for (unsigned int j = 0 ; j < 64 ; j++) {
+            Quant[j] = m_quant[Comp.QuantTable][j];
+        }
+
+        Comp.Plane.resize((size_t)Stride * Comp.BlocksH * 8);
+
+        for (unsigned int y = 0 ; y < Comp.BlocksH ; y++) {
+            for (unsigned int x = 0 ; x < Comp.BlocksW ; x++) {
+                JPEGInverseDCT(&Comp.Coefs[((size_t)y * Comp.BlocksW + x) * 64], Quant,
+                               &Comp.Plane[(size_t)y * 8 * Stride + x * 8], Stride);
+            }
+        }
+
+        std::vector<short>().swap(Comp.Coefs);
+    }
+
+    Pixels.resize((size_t)m_width * m_height * 4);
+
+    if (m_components.size() == 1) {
+        const JPEGComponent& Comp = m_components[0];
+
+        for (unsigned int y = 0 ; y < m_height ; y++) {
+            const unsigned char* pIn = &Comp.Plane[(size_t)y * Comp.BlocksW * 8];
+            unsigned char* pOut = &Pixels[(size_t)y * m_width * 4];
+
+            for (unsigned int x = 0 ; x < m_width ; x++) {
+                pOut[x * 4] = pOut[x * 4 + 1] = pOut[x * 4 + 2] = pIn[x];
+                pOut[x * 4 + 3] = 255;
+            }
+        }
+
+        return;
+    }
+
+    std::vector<unsigned char> Full[3];
+
+    for (unsigned int i = 0 ; i < 3 ; i++) {
+        Upsample(m_components[i], Full[i]);
+        std::vector<unsigned char>().swap(m_components[i].Plane);
+    }
+
+    // Adobe files say whether they are RGB, the others are YCbCr unless the component
+    // ids spell it
+    const bool RGB = (m_transform == 0) ||
+                     (m_transform < 0 && m_components[0].Id == 'R' && m_components[1].Id == 'G' && m_components[2].Id == 'B');
+
+    for (unsigned int y = 0 ; y < m_height ; y++) {
+        const size_t Offset = (size_t)y * m_width;
+        unsigned char* pOut = &Pixels[Offset * 4];
+
+        if (RGB) {
+            for (unsigned int x = 0 ; x < m_width ; x++) {
+                pOut[x * 4] = Full[0][Offset + x];
+                pOut[x * 4 + 1] = Full[1][Offset + x];
+                pOut[x * 4 + 2] = Full[2][Offset + x];
+                pOut[x * 4 + 3] = 255;
+            }
+        }
+        else {
+            JPEGYCbCrToRGBA(&Full[0][Offset], &Full[1][Offset], &Full[2][Offset], pOut, m_width);
+        }
+    }
+}
+
+
+bool JPEGDecoder::Decode(unsigned int& Width, unsigned int& Height, std::vector<unsigned char>& Pixels)
+{
+    if (m_size < 4 || m_pData[0] != 0xFF || m_pData[1] != 0xD8) {
+        return false;
+    }
+
+    m_pos = 2;
+    bool HasScan = false;
+
+    for (;;) {
+        // Skip the fill bytes and whatever is left of the last entropy coded segment
+        while (m_pos + 1 < m_size && !(m_pData[m_pos] == 0xFF && m_pData[m_pos + 1] != 0 && m_pData[m_pos + 1] != 0xFF &&
+                                       (m_pData[m_pos + 1] < 0xD0 || m_pData[m_pos + 1] > 0xD7))) {
+            m_pos++;
+        }
+
+        if (m_pos + 1 >= m_size) {
+            break;
+        }
+
+        const unsigned int Marker = m_pData[m_pos + 1];
+        m_pos += 2;
+
+        if (Marker == 0xD9) {
+            break;
+        }
+
+        if (m_pos + 2 > m_size) {
+            return false;
+        }
+
+        const size_t Length = ReadU16(m_pos);
+        const size_t Start = m_pos + 2;
+        const size_t End = m_pos + Length;
+
+        if (Length < 2 || End > m_size) {
+            return false;
+        }
+
+        m_pos = End;
+
+        bool Ret = true;
+
+        switch (Marker) {
+            case 0xC0:      // baseline
+            case 0xC1:      // extended sequential, Huffman
+                Ret = ReadFrame(Start, End);
+                break;
+
+            case 0xC2:      // progressive, Huffman
+                m_progressive = true;
+                Ret = ReadFrame(Start, End);
+                break;
+
+            case 0xC4:
+                Ret = ReadHuffmanTables(Start, End);
+                break;
+
+            case 0xDB:
+                Ret = ReadQuantTables(Start, End);
+                break;
+
+            case 0xDD:
+                Ret = (Length == 4);
+                m_restartInterval = Ret ? ReadU16(Start) : 0;
+                break;
+
+            case 0xDA:
+                Ret = ReadScan(Start, End);
+                HasScan = true;
+                break;
+
+            case 0xEE:      // Adobe
+                if (Length >= 14 && memcmp(&m_pData[Start], "Adobe", 5) == 0) {
+                    m_transform = m_pData[Start + 11];
+                }
+                break;
+
+            default:
+                // Lossless, hierarchical and arithmetic coded frames are not supported
+                Ret = !(Marker >= 0xC3 && Marker <= 0xCF);
+                break;
+        }
+
+        if (!Ret) {
+            return false;
+        }
+    }
+
+    if (!HasScan) {
+        return false;
+    }
+
+    Output(Pixels);
+
+    Width = m_width;
+    Height = m_height;
+
+    return true;
+}
+
+
+bool DecodeJPEG(const unsigned char* pData, size_t Size, unsigned int& Width, unsigned int& Height, std::vector<unsigned char>& Pixels)
+{
+    JPEGDecoder Decoder(pData, Size);
+
+    return Decoder.Decode(Width, Height, Pixels);
+}
@@ -0,0 +1,31 @@
+/*
+
+	Copyright 2011 Etay Meiri
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef JPEG_DECODER_H
+#define	JPEG_DECODER_H
+
+#include <vector>
+#include <stddef.h>
+
+// Decodes baseline and progressive JPEG files (grayscale, YCbCr and RGB, any chroma
+// subsampling) into 8 bit RGBA rows, top row first. Returns false for everything else,
+// including arithmetic coding, 12 bit samples and CMYK, so that the caller can fall
+// back to a general purpose library.
+bool DecodeJPEG(const unsigned char* pData, size_t Size, unsigned int& Width, unsigned int& Height, std::vector<unsigned char>& Pixels);
+
+#endif	/* JPEG_DECODER_H */
@@ -0,0 +1,302 @@
+/*
+
+	Copyright 2011 Etay Meiri
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#pragma once
+#include <stdio.h>
+#include <string.h>
+#include "ktx2.h"
+
+static const unsigned char KTX2Identifier[12] = { 0xAB, 0x4B, 0x54, 0x58, 0x20, 0x32, 0x30, 0xBB, 0x0D, 0x0A, 0x1A, 0x0A };
+
+// Data format descriptor constants (Khronos Data Format Specification 1.3)
+#define KHR_DF_VERSION               2
+#define KHR_DF_MODEL_BC1A            128
+#define KHR_DF_MODEL_BC3             130
+#define KHR_DF_MODEL_BC5             132
+#define KHR_DF_MODEL_BC7             134
+#define KHR_DF_PRIMARIES_BT709       1
+#define KHR_DF_TRANSFER_LINEAR       1
+#define KHR_DF_CHANNEL_BC1A_COLOR    0
+#define KHR_DF_CHANNEL_BC1A_ALPHA    1
+#define KHR_DF_CHANNEL_BC3_COLOR     0
+#define KHR_DF_CHANNEL_BC3_ALPHA     15
+#define KHR_DF_CHANNEL_BC5_RED       0
+#define KHR_DF_CHANNEL_BC5_GREEN     1
+#define KHR_DF_CHANNEL_BC7_COLOR     0
+
+// The 64 bit fields of the header are not naturally aligned in the file
+#pragma pack(push, 4)
+struct KTX2Header {
+    unsigned int VkFormat;
+    unsigned int TypeSize;
+    unsigned int PixelWidth;
+    unsigned int PixelHeight;
+    unsigned int PixelDepth;
+    unsigned int LayerCount;
+    unsigned int FaceCount;
+    unsigned int LevelCount;
+    unsigned int SupercompressionScheme;
+    unsigned int DfdByteOffset;
+    unsigned int DfdByteLength;
+    unsigned int KvdByteOffset;
+    unsigned int KvdByteLength;
+    unsigned long long SgdByteOffset;
+    unsigned long long SgdByteLength;
+};
+#pragma pack(pop)
+
+struct KTX2LevelIndex {
+    unsigned long long ByteOffset;
+    unsigned long long ByteLength;
+    unsigned long long UncompressedByteLength;
+};
+
+static_assert(sizeof(KTX2Header) == 68, "KTX2Header must match the file layout");
+static_assert(sizeof(KTX2LevelIndex) == 24, "KTX2LevelIndex must match the file layout");
+
+
+// Returns the size of a 4x4 block, 0 for the formats that are not supported
+static unsigned int GetBlockSize(unsigned int VkFormat)
+{
+    switch (VkFormat) {
+        case VK_FORMAT_BC1_RGB_UNORM_BLOCK:
+        case VK_FORMAT_BC1_RGBA_UNORM_BLOCK:
+            return 8;
+
+        case VK_FORMAT_BC3_UNORM_BLOCK:
+        case VK_FORMAT_BC5_UNORM_BLOCK:
+        case VK_FORMAT_BC7_UNORM_BLOCK:
+            return 16;
+
+        default:
+            return 0;
+    }
+}
+
+
+bool ReadKTX2(const std::string& FileName, KTX2Image& Image)
+{
+    FILE* f = fopen(FileName.c_str(), "rb");
+
+    if (!f) {
+        return false;
+    }
+
+    std::vector<unsigned char> File;
+
+    fseek(f, 0, SEEK_END);
+    long Size = ftell(f);
+    fseek(f, 0, SEEK_SET);
+
+    if (Size > 0) {
+        File.resize(Size);
+
+        if (fread(&File[0], 1, Size, f) != (size_t)Size) {
+            File.clear();
+        }
+    }
+
+    fclose(f);
+
+    KTX2Header Header;
+
+    if (File.size() < sizeof(KTX2Identifier) + sizeof(Header) ||
+        memcmp(&File[0], KTX2Identifier, sizeof(KTX2Identifier)) != 0) {
+        printf("Error loading '%s': not a KTX2 file\n", FileName.c_str());
+        return false;
+    }
+
+    memcpy(&Header, &File[sizeof(KTX2Identifier)], sizeof(Header));
+
+    const unsigned int BlockSize = GetBlockSize(Header.VkFormat);
+    const unsigned int NumLevels = (Header.LevelCount > 0) ? Header.LevelCount : 1;
+    const size_t LevelIndexOffset = sizeof(KTX2Identifier) + sizeof(Header);
+
+    if (BlockSize == 0 || Header.SupercompressionScheme != 0 || Header.PixelDepth != 0 ||
+        Header.LayerCount > 1 || Header.FaceCount != 1 || Header.PixelWidth == 0 || Header.PixelHeight == 0 ||
+        NumLevels > 32 || LevelIndexOffset + sizeof(KTX2LevelIndex) * NumLevels > File.size()) {
+        printf("Error loading '%s': unsupported KTX2 image\n", FileName.c_str());
+        return false;
+    }
+
+    Image.VkFormat = Header.VkFormat;
+    Image.Levels.resize(NumLevels);
+
+    size_t PackedSize = 0;
+
+    for (unsigned int i = 0 ; i < NumLevels ; i++) {
+        KTX2LevelIndex Index;
+        memcpy(&Index, &File[LevelIndexOffset + sizeof(Index) * i], sizeof(Index));
+
+        KTX2Level& Level = Image.Levels[i];
+        Level.Width = (Header.PixelWidth >> i) > 0 ? (Header.PixelWidth >> i) : 1;
+        Level.Height = (Header.PixelHeight >> i) > 0 ? (Header.PixelHeight >> i) : 1;
+        Level.Offset = PackedSize;
+        Level.Size = Index.ByteLength;
+
+        const size_t ExpectedSize = (size_t)((Level.Width + 3) / 4) * ((Level.Height + 3) / 4) * BlockSize;
+
+        if (Level.Size != ExpectedSize || Index.ByteOffset + Index.ByteLength > File.size()) {
+            printf("Error loading '%s': corrupt mip level %d\n", FileName.c_str(), i);
+            return false;
+        }
+
+        PackedSize += Level.Size;
+    }
+
+    // Only the levels are kept, packed one after the other so that they can be copied
+    // into a pixel buffer as a whole
+    Image.Data.resize(PackedSize);
+
+    for (unsigned int i = 0 ; i < NumLevels ; i++) {
+        KTX2LevelIndex Index;
+        memcpy(&Index, &File[LevelIndexOffset + sizeof(Index) * i], sizeof(Index));
+        memcpy(&Image.Data[Image.Levels[i].Offset], &File[Index.ByteOffset], Index.ByteLength);
+    }
+
+    return true;
+}
+
+
+static void AppendU32(std::vector<unsigned char>& Out, unsigned int Value)
+{
+    for (unsigned int i = 0 ; i < 4 ; i++) {
+        Out.push_back((Value >> (i * 8)) & 0xFF);
+    }
+}
+
+
+// Builds the basic data format descriptor block. Every compressed channel is a
+// 64 bit sample at its position inside the 4x4 block.
+static void AppendDFD(std::vector<unsigned char>& Out, unsigned int VkFormat)
+{
+    unsigned int ColorModel = 0;
+    unsigned int Channels[2];
+    unsigned int NumSamples = 1;
+
+    switch (VkFormat) {
+        case VK_FORMAT_BC1_RGB_UNORM_BLOCK:
+            ColorModel = KHR_DF_MODEL_BC1A;
+            Channels[0] = KHR_DF_CHANNEL_BC1A_COLOR;
+            break;
+
+        case VK_FORMAT_BC1_RGBA_UNORM_BLOCK:
+            ColorModel = KHR_DF_MODEL_BC1A;
+            Channels[0] = KHR_DF_CHANNEL_BC1A_ALPHA;
+            break;
+
+        case VK_FORMAT_BC3_UNORM_BLOCK:
+            ColorModel = KHR_DF_MODEL_BC3;
+            Channels[0] = KHR_DF_CHANNEL_BC3_ALPHA;
+            Channels[1] = KHR_DF_CHANNEL_BC3_COLOR;
+            NumSamples = 2;
+            break;
+
+        case VK_FORMAT_BC5_UNORM_BLOCK:
+            ColorModel = KHR_DF_MODEL_BC5;
+            Channels[0] = KHR_DF_CHANNEL_BC5_RED;
+            Channels[1] = KHR_DF_CHANNEL_BC5_GREEN;
+            NumSamples = 2;
+            break;
+
+        case VK_FORMAT_BC7_UNORM_BLOCK:
+            ColorModel = KHR_DF_MODEL_BC7;
+            Channels[0] = KHR_DF_CHANNEL_BC7_COLOR;
+            // BC7 is described by a single 128 bit sample
+            break;
+    }
+
+    const unsigned int BlockSize = 24 + 16 * NumSamples;
+    const unsigned int BytesPlane0 = GetBlockSize(VkFormat);
+    const unsigned int SampleBits = BytesPlane0 * 8 / NumSamples;
+
+    AppendU32(Out, 4 + BlockSize);                              // dfdTotalSize
+    AppendU32(Out, 0);                                          // vendorId, descriptorType
+    AppendU32(Out, KHR_DF_VERSION | (BlockSize << 16));         // versionNumber, descriptorBlockSize
+    AppendU32(Out, ColorModel | (KHR_DF_PRIMARIES_BT709 << 8) | (KHR_DF_TRANSFER_LINEAR << 16));
+    AppendU32(Out, 3 | (3 << 8));                               // texelBlockDimension - 1
+    AppendU32(Out, BytesPlane0);                                // bytesPlane0-3
+    AppendU32(Out, 0);                                          // bytesPlane4-7
+
+    for (unsigned int i = 0 ; i < NumSamples ; i++) {
+        AppendU32(Out, (SampleBits * i) | ((SampleBits - 1) << 16) | (Channels[i] << 24));
+        AppendU32(Out, 0);                                      // samplePosition
+        AppendU32(Out, 0);                                      // sampleLower
+        AppendU32(Out, 0xFFFFFFFF);                             // sampleUpper
+    }
+}
+
+
+bool WriteKTX2(const std::string& FileName, const KTX2Image& Image)
+{
+    const unsigned int BlockSize = GetBlockSize(Image.VkFormat);
+
+    if (BlockSize == 0 || Image.Levels.empty()) {
+        return false;
+    }
+
+    const unsigned int NumLevels = Image.Levels.size();
+    std::vector<unsigned char> DFD;
+    AppendDFD(DFD, Image.VkFormat);
+
+    KTX2Header Header;
+    memset(&Header, 0, sizeof(Header));
+    Header.VkFormat = Image.VkFormat;
+    Header.TypeSize = 1;
+    Header.PixelWidth = Image.Levels[0].Width;
+    Header.PixelHeight = Image.Levels[0].Height;
+    Header.FaceCount = 1;
+    Header.LevelCount = NumLevels;
+    Header.DfdByteOffset = sizeof(KTX2Identifier) + sizeof(Header) + sizeof(KTX2LevelIndex) * NumLevels;
+    Header.DfdByteLength = DFD.size();
+
+    // The levels are stored from the smallest to the largest, each one aligned to the
+    // least common multiple of the block size and 4
+    std::vector<KTX2LevelIndex> LevelIndex(NumLevels);
+    size_t Offset = Header.DfdByteOffset + DFD.size();
+
+    for (int i = NumLevels - 1 ; i >= 0 ; i--) {
+        Offset = (Offset + BlockSize - 1) / BlockSize * BlockSize;
+        LevelIndex[i].ByteOffset = Offset;
+        LevelIndex[i].ByteLength = Image.Levels[i].Size;
+        LevelIndex[i].UncompressedByteLength = Image.Levels[i].Size;
+        Offset += Image.Levels[i].Size;
+    }
+
+    std::vector<unsigned char> File(Offset, 0);
+    memcpy(&File[0], KTX2Identifier, sizeof(KTX2Identifier));
+    memcpy(&File[sizeof(KTX2Identifier)], &Header, sizeof(Header));
+    memcpy(&File[sizeof(KTX2Identifier) + sizeof(Header)], &LevelIndex[0], sizeof(KTX2LevelIndex) * NumLevels);
+    memcpy(&File[Header.DfdByteOffset], &DFD[0], DFD.size());
+
+    for (unsigned int i = 0 ; i < NumLevels ; i++) {
+        memcpy(&File[LevelIndex[i].ByteOffset], &Image.Data[Image.Levels[i].Offset], Image.Levels[i].Size);
+    }
+
+    FILE* f = fopen(FileName.c_str(), "wb");
+
+    if (!f) {
+        printf("Error creating '%s'\n", FileName.c_str());
+        return false;
+    }
+
+    const bool Ret = fwrite(&File[0], 1, File.size(), f) == File.size();
+
+    fclose(f);
+
+    return Ret;
+}
@@ -0,0 +1,59 @@
+/*
+
+	Copyright 2011 Etay Meiri
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef KTX2_H
+#define	KTX2_H
+
+#include <string>
+#include <vector>
+
+// Vulkan format numbers of the block compressed formats that are cooked or loaded
+#define VK_FORMAT_BC1_RGB_UNORM_BLOCK  131
+#define VK_FORMAT_BC1_RGBA_UNORM_BLOCK 133
+#define VK_FORMAT_BC3_UNORM_BLOCK      137
+#define VK_FORMAT_BC5_UNORM_BLOCK      141
+#define VK_FORMAT_BC7_UNORM_BLOCK      145
+
+struct KTX2Level {
+    unsigned int Width;
+    unsigned int Height;
+    size_t Offset;      // in KTX2Image::Data
+    size_t Size;
+};
+
+// A 2D block compressed image with its mip chain. Level 0 is the largest one.
+struct KTX2Image {
+    KTX2Image()
+    {
+        VkFormat = 0;
+    }
+
+    unsigned int VkFormat;
+    std::vector<KTX2Level> Levels;
+    std::vector<unsigned char> Data;
+};
+
+// Reads a KTX2 file without supercompression. Only 2D images (no arrays, cube maps
+// or 3D textures) in one of the formats above are accepted.
+bool ReadKTX2(const std::string& FileName, KTX2Image& Image);
+
+// Writes the image along with the data format descriptor of its format
+bool WriteKTX2(const std::string& FileName, const KTX2Image& Image);
+
+
+#endif	/* KTX2_H */
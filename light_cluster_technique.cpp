@@ -0,0 +1,170 @@
+/*
+
+	Copyright 2011 Etay Meiri
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+#include <math.h>
+
+#include "light_cluster_technique.h"
+#include "clustered_lights.h"
+#include "util.h"
+
+static const char* pLightClusterCS = "                                                          \n\
+#version 430                                                                        \n\
+"
+CLUSTER_GRID_GLSL
+"                                                                                   \n\
+layout (local_size_x = CLUSTER_GRID_X, local_size_y = CLUSTER_GRID_Y) in;           \n\
+                                                                                    \n\
+// World space center and radius, the point lights then the spot lights             \n\
+layout (std430) readonly buffer LightSpheres                                        \n\
+{                                                                                   \n\
+    vec4 gLightSpheres[];                                                           \n\
+};                                                                                  \n\
+                                                                                    \n\
+layout (std430) writeonly buffer ClusterCounts                                      \n\
+{                                                                                   \n\
+    uvec2 gClusterCounts[];                                                         \n\
+};                                                                                  \n\
+                                                                                    \n\
+layout (std430) writeonly buffer ClusterIndices                                     \n\
+{                                                                                   \n\
+    uint gClusterIndices[];                                                         \n\
+};                                                                                  \n\
+                                                                                    \n\
+uniform mat4 gView;                                                                 \n\
+uniform vec4 gProjParams;          // tan(FOV / 2) * aspect ratio, tan(FOV / 2), near, far\n\
+uniform uint gNumPointLights;                                                       \n\
+uniform uint gNumLights;                                                            \n\
+                                                                                    \n\
+shared vec4 Spheres[CLUSTER_GRID_X * CLUSTER_GRID_Y];                               \n\
+                                                                                    \n\
+void main()                                                                         \n\
+{                                                                                   \n\
+    uvec3 Id = uvec3(gl_LocalInvocationID.xy, gl_WorkGroupID.z);                    \n\
+    uint Cluster = (Id.z * CLUSTER_GRID_Y + Id.y) * CLUSTER_GRID_X + Id.x;          \n\
+                                                                                    \n\
+    // View space box of the cluster, the camera looks down +z                      \n\
+    float Near = gProjParams.z * pow(gProjParams.w / gProjParams.z, float(Id.z) / CLUSTER_GRID_Z);\n\
+    float Far = gProjParams.z * pow(gProjParams.w / gProjParams.z, float(Id.z + 1) / CLUSTER_GRID_Z);\n\
+    vec2 TileMin = (vec2(Id.xy) / vec2(CLUSTER_GRID_X, CLUSTER_GRID_Y) * 2.0 - 1.0) * gProjParams.xy;\n\
+    vec2 TileMax = (vec2(Id.xy + 1) / vec2(CLUSTER_GRID_X, CLUSTER_GRID_Y) * 2.0 - 1.0) * gProjParams.xy;\n\
+    vec3 BoxMin = vec3(min(TileMin * Near, TileMin * Far), Near);                   \n\
+    vec3 BoxMax = vec3(max(TileMax * Near, TileMax * Far), Far);                    \n\
+                                                                                    \n\
+    uint First = Cluster * CLUSTER_MAX_LIGHTS;                                      \n\
+    uint NumPointLights = 0;                                                        \n\
+    uint NumLights = 0;                                                             \n\
+    uint BatchSize = gl_WorkGroupSize.x * gl_WorkGroupSize.y;                       \n\
+                                                                                    \n\
+    for (uint Batch = 0 ; Batch < gNumLights ; Batch += BatchSize) {                \n\
+        // Every invocation moves one light of the batch to view space              \n\
+        uint Light = Batch + gl_LocalInvocationIndex;                               \n\
+                                                                                    \n\
+        if (Light < gNumLights) {                                                   \n\
+            vec4 Sphere = gLightSpheres[Light];                                     \n\
+            Spheres[gl_LocalInvocationIndex] = vec4((gView * vec4(Sphere.xyz, 1.0)).xyz, Sphere.w);\n\
+        }                                                                           \n\
+                                                                                    \n\
+        barrier();                                                                  \n\
+                                                                                    \n\
+        uint BatchEnd = min(BatchSize, gNumLights - Batch);                         \n\
+                                                                                    \n\
+        for (uint i = 0 ; i < BatchEnd && NumLights < CLUSTER_MAX_LIGHTS ; i++) {   \n\
+            vec3 Delta = Spheres[i].xyz - clamp(Spheres[i].xyz, BoxMin, BoxMax);    \n\
+                                                                                    \n\
+            if (dot(Delta, Delta) <= Spheres[i].w * Spheres[i].w) {                 \n\
+                // The point lights come first so their indices are in front of the list\n\
+                Light = Batch + i;                                                  \n\
+                                                                                    \n\
+                if (Light < gNumPointLights) {                                      \n\
+                    gClusterIndices[First + NumLights] = Light;                     \n\
+                    NumPointLights++;                                               \n\
+                }                                                                   \n\
+                else {                                                              \n\
+                    gClusterIndices[First + NumLights] = Light - gNumPointLights;   \n\
+                }                                                                   \n\
+                                                                                    \n\
+                NumLights++;                                                        \n\
+            }                                                                       \n\
+        }                                                                           \n\
+                                                                                    \n\
+        barrier();                                                                  \n\
+    }                                                                               \n\
+                                                                                    \n\
+    gClusterCounts[Cluster] = uvec2(NumPointLights, NumLights);                     \n\
+}";
+
+
+LightClusterTechnique::LightClusterTechnique()
+{
+}
+
+
+bool LightClusterTechnique::Init()
+{
+    if (!Technique::Init()) {
+        return false;
+    }
+
+    if (!AddShader(GL_COMPUTE_SHADER, pLightClusterCS)) {
+        return false;
+    }
+
+    return Finalize();
+}
+
+
+bool LightClusterTechnique::OnFinalized()
+{
+    ClusteredLights::BindBlocks(m_shaderProg);
+
+    m_viewLocation = GetUniformLocation("gView");
+    m_projParamsLocation = GetUniformLocation("gProjParams");
+    m_numPointLightsLocation = GetUniformLocation("gNumPointLights");
+    m_numLightsLocation = GetUniformLocation("gNumLights");
+
+    if (m_viewLocation == INVALID_UNIFORM_LOCATION ||
+        m_projParamsLocation == INVALID_UNIFORM_LOCATION ||
+        m_numPointLightsLocation == INVALID_UNIFORM_LOCATION ||
+        m_numLightsLocation == INVALID_UNIFORM_LOCATION) {
+        return false;
+    }
+
+    return GLCheckError();
+}
+
+
+void LightClusterTechnique::SetView(const Matrix4f& View)
+{
+    glUniformMatrix4fv(m_viewLocation, 1, GL_TRUE, (const GLfloat*)View.m);
+}
+
+
+void LightClusterTechnique::SetProjection(const PersProjInfo& Proj)
+{
+    const float TanHalfFOV = tanf(ToRadian(Proj.FOV / 2.0f));
+
+    glUniform4f(m_projParamsLocation, TanHalfFOV * Proj.Width / Proj.Height, TanHalfFOV, Proj.zNear, Proj.zFar);
+}
+
+
+void LightClusterTechnique::SetNumLights(unsigned int NumPointLights, unsigned int NumSpotLights)
+{
+    glUniform1ui(m_numPointLightsLocation, NumPointLights);
+    glUniform1ui(m_numLightsLocation, NumPointLights + NumSpotLights);
+}
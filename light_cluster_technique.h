@@ -0,0 +1,48 @@
+/*
+
+	Copyright 2011 Etay Meiri
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef LIGHT_CLUSTER_TECHNIQUE_H
+#define	LIGHT_CLUSTER_TECHNIQUE_H
+
+#include "technique.h"
+#include "math_3d.h"
+
+// Compute pass that finds the lights whose bounding sphere touches each cluster and
+// writes their indices to the cluster. One work group handles a depth slice.
+class LightClusterTechnique : public Technique
+{
+public:
+    LightClusterTechnique();
+
+    virtual bool Init();
+
+    virtual bool OnFinalized();
+
+    void SetView(const Matrix4f& View);
+    void SetProjection(const PersProjInfo& Proj);
+    void SetNumLights(unsigned int NumPointLights, unsigned int NumSpotLights);
+
+private:
+    GLuint m_viewLocation;
+    GLuint m_projParamsLocation;
+    GLuint m_numPointLightsLocation;
+    GLuint m_numLightsLocation;
+};
+
+
+#endif	/* LIGHT_CLUSTER_TECHNIQUE_H */
@@ -18,10 +18,18 @@
 
 #include <limits.h>
 #include <string.h>
+#include <string>
+#include <algorithm>
 
 #include "math_3d.h"
 #include "lighting_technique.h"
 #include "util.h"
+#include "engine_common.h"
+#include "texture_streamer.h"
+#include "clustered_lights.h"
+#include "cascaded_shadows.h"
+#include "irradiance_probes.h"
+#include "visibility_technique.h"
 
 static const char* pVS = "                                                          \n\
 #version 410                                                                        \n\
@@ -31,80 +39,188 @@ layout (location = 1) in vec2 TexCoord;
 layout (location = 2) in vec3 Normal;                                               \n\
 layout (location = 3) in mat4 WVP;                                                  \n\
 layout (location = 7) in mat4 World;                                                \n\
+layout (location = 11) in uint Instance;    // of the caller, see Mesh::Render      \n\
                                                                                     \n\
+#ifdef DEFERRED_LIGHTING                                                            \n\
+// A triangle that covers the screen, drawn without vertex arrays                   \n\
+void main()                                                                         \n\
+{                                                                                   \n\
+    vec2 Corner = vec2((gl_VertexID << 1) & 2, gl_VertexID & 2);                    \n\
+    gl_Position = vec4(Corner * 2.0 - 1.0, 0.0, 1.0);                               \n\
+}                                                                                   \n\
+#elif defined(VISIBILITY_RESOLVE)                                                   \n\
+"
+VISIBILITY_GLSL
+"                                                                                    \n\
+// The same at the depth of the material of the draw, which is all that tells its   \n\
+// vertex IDs apart, see Mesh::ResolveVisibility                                    \n\
+void main()                                                                         \n\
+{                                                                                   \n\
+    int Corner = gl_VertexID % 3;                                                   \n\
+    vec2 Pos = vec2((Corner << 1) & 2, Corner & 2);                                 \n\
+    float Depth = GetMaterialDepth(uint(gl_VertexID / 3));                          \n\
+    gl_Position = vec4(Pos * 2.0 - 1.0, Depth * 2.0 - 1.0, 1.0);                    \n\
+}                                                                                   \n\
+#else                                                                               \n\
 out vec2 TexCoord0;                                                                 \n\
 out vec3 Normal0;                                                                   \n\
 out vec3 WorldPos0;                                                                 \n\
 flat out int InstanceID;                                                            \n\
                                                                                     \n\
+// Matches the depth prepass bit for bit, see DepthPassTechnique                    \n\
+invariant gl_Position;                                                              \n\
+                                                                                    \n\
 void main()                                                                         \n\
 {                                                                                   \n\
     gl_Position = WVP * vec4(Position, 1.0);                                        \n\
     TexCoord0   = TexCoord;                                                         \n\
     Normal0     = (World * vec4(Normal, 0.0)).xyz;                                  \n\
     WorldPos0   = (World * vec4(Position, 1.0)).xyz;                                \n\
-    InstanceID = gl_InstanceID;                                                     \n\
-}";
+    InstanceID = int(Instance);                                                     \n\
+}                                                                                   \n\
+#endif";
 
 static const char* pFS = "                                                          \n\
 #version 410                                                                        \n\
                                                                                     \n\
-const int MAX_POINT_LIGHTS = 2;                                                     \n\
-const int MAX_SPOT_LIGHTS = 2;                                                      \n\
+#ifdef CLUSTERED_LIGHTS                                                             \n\
+#extension GL_ARB_shader_storage_buffer_object : require                            \n\
+#endif                                                                              \n\
                                                                                     \n\
+#ifdef TEXTURE_FEEDBACK                                                             \n\
+#extension GL_ARB_shader_image_load_store : require                                 \n\
+#extension GL_ARB_texture_query_lod : require                                       \n\
+                                                                                    \n\
+layout(early_fragment_tests) in;                                                    \n\
+                                                                                    \n\
+layout(r32ui) uniform writeonly uimage2D gFeedbackImage;                            \n\
+uniform ivec2 gFeedbackTexture;    // slot + 1 (0 for none), base level             \n\
+uniform ivec2 gFeedbackTile;       // pixel of the tiles that write                 \n\
+#endif                                                                              \n\
+                                                                                    \n\
+#ifdef DEFERRED_LIGHTING                                                            \n\
+uniform sampler2D gAlbedoMap;                                                       \n\
+uniform sampler2D gNormalMap;                                                       \n\
+uniform sampler2D gDepthMap;                                                        \n\
+#elif defined(VISIBILITY_RESOLVE)                                                   \n\
+uniform usampler2D gVisibilityMap;                                                  \n\
+uniform usamplerBuffer gMeshEntries;                                                \n\
+uniform usamplerBuffer gMeshIndices;                                                \n\
+uniform samplerBuffer gMeshPositions;                                               \n\
+uniform samplerBuffer gMeshNormals;                                                 \n\
+uniform samplerBuffer gMeshTexCoords;                                               \n\
+uniform samplerBuffer gMeshWorldMats;                                               \n\
+uniform usamplerBuffer gMeshInstances;                                              \n\
+                                                                                    \n\
+// Written by LoadVisibleTriangle in place of the inputs of the forward shading     \n\
+vec2 TexCoord0;                                                                     \n\
+vec2 TexCoordDx;        // to the next pixel to the right and up, for the texture level\n\
+vec2 TexCoordDy;                                                                    \n\
+vec3 Normal0;                                                                       \n\
+vec3 WorldPos0;                                                                     \n\
+int InstanceID;                                                                     \n\
+float Depth0;                                                                       \n\
+#else                                                                               \n\
 in vec2 TexCoord0;                                                                  \n\
 in vec3 Normal0;                                                                    \n\
 in vec3 WorldPos0;                                                                  \n\
 flat in int InstanceID;                                                             \n\
+#endif                                                                              \n\
                                                                                     \n\
-out vec4 FragColor;                                                                 \n\
-                                                                                    \n\
-struct BaseLight                                                                    \n\
-{                                                                                   \n\
-    vec3 Color;                                                                     \n\
-    float AmbientIntensity;                                                         \n\
-    float DiffuseIntensity;                                                         \n\
-};                                                                                  \n\
-                                                                                    \n\
-struct DirectionalLight                                                             \n\
-{                                                                                   \n\
-    BaseLight Base;                                                                 \n\
-    vec3 Direction;                                                                 \n\
-};                                                                                  \n\
+layout (location = 0) out vec4 FragColor;      // the albedo in the G-buffer pass   \n\
                                                                                     \n\
-struct Attenuation                                                                  \n\
-{                                                                                   \n\
-    float Constant;                                                                 \n\
-    float Linear;                                                                   \n\
-    float Exp;                                                                      \n\
-};                                                                                  \n\
+#ifdef GBUFFER                                                                      \n\
+layout (location = 1) out vec2 PackedNormal;                                        \n\
+#endif                                                                              \n\
                                                                                     \n\
-struct PointLight                                                                           \n\
+"
+UNIFORM_BLOCKS_GLSL
+VISIBILITY_GLSL
+"                                                                                   \n\
+#ifdef CLUSTERED_LIGHTS                                                                     \n\
+"
+CLUSTERED_LIGHTS_GLSL
+"                                                                                   \n\
+#endif                                                                                      \n\
+                                                                                            \n\
+#ifdef TEXTURED                                                                             \n\
+uniform sampler2D gColorMap;                                                                \n\
+#endif                                                                                      \n\
+                                                                                            \n\
+#ifdef SHADOWS                                                                              \n\
+uniform sampler2DArrayShadow gShadowMap;                                                    \n\
+                                                                                            \n\
+// Looks the point up in the first cascade that holds it. The four taps are each            \n\
+// filtered by the hardware over 2x2 texels. Pushing the point along the normal by a        \n\
+// texel keeps the surfaces from shadowing themselves.                                      \n\
+float CalcShadowFactor(vec3 WorldPos, vec3 Normal)                                          \n\
 {                                                                                           \n\
-    BaseLight Base;                                                                         \n\
-    vec3 Position;                                                                          \n\
-    Attenuation Atten;                                                                      \n\
-};                                                                                          \n\
+    vec2 Margin = 1.5 / vec2(textureSize(gShadowMap, 0).xy);                                \n\
+                                                                                            \n\
+    for (int i = 0 ; i < NUM_SHADOW_CASCADES ; i++) {                                       \n\
+        vec4 Pos = gShadowCascadeVP[i] * vec4(WorldPos + Normal * gShadowTexelSize[i], 1.0);\n\
+        vec3 Coord = Pos.xyz * 0.5 + 0.5;                                                   \n\
+                                                                                            \n\
+        if (all(greaterThan(Coord.xy, Margin)) && all(lessThan(Coord.xy, 1.0 - Margin))) {  \n\
+            vec2 Offset = Margin / 3.0;                                                     \n\
+            float Depth = min(Coord.z, 1.0);                                                \n\
+            float Sum = texture(gShadowMap, vec4(Coord.xy + vec2(-Offset.x, -Offset.y), i, Depth)) +\n\
+                        texture(gShadowMap, vec4(Coord.xy + vec2( Offset.x, -Offset.y), i, Depth)) +\n\
+                        texture(gShadowMap, vec4(Coord.xy + vec2(-Offset.x,  Offset.y), i, Depth)) +\n\
+                        texture(gShadowMap, vec4(Coord.xy + vec2( Offset.x,  Offset.y), i, Depth));\n\
+            return Sum * 0.25;                                                              \n\
+        }                                                                                   \n\
+    }                                                                                       \n\
                                                                                             \n\
-struct SpotLight                                                                            \n\
+    // Beyond the last cascade                                                              \n\
+    return 1.0;                                                                             \n\
+}                                                                                           \n\
+#endif                                                                                      \n\
+                                                                                            \n\
+#ifdef PROBES                                                                               \n\
+uniform sampler3D gProbeVolume;                                                             \n\
+                                                                                            \n\
+const int PROBE_TEXELS = 7;                                                                 \n\
+                                                                                            \n\
+// The baked irradiance over pi for the normal, see IrradianceProbes. Each texel of a       \n\
+// probe is interpolated between the 8 probes around the point by the hardware.             \n\
+vec3 CalcProbeIrradiance(vec3 WorldPos, vec3 n)                                             \n\
 {                                                                                           \n\
-    PointLight Base;                                                                        \n\
-    vec3 Direction;                                                                         \n\
-    float Cutoff;                                                                           \n\
-};                                                                                          \n\
-                                                                                            \n\
-uniform int gNumPointLights;                                                                \n\
-uniform int gNumSpotLights;                                                                 \n\
-uniform DirectionalLight gDirectionalLight;                                                 \n\
-uniform PointLight gPointLights[MAX_POINT_LIGHTS];                                          \n\
-uniform SpotLight gSpotLights[MAX_SPOT_LIGHTS];                                             \n\
-uniform sampler2D gColorMap;                                                                \n\
-uniform vec3 gEyeWorldPos;                                                                  \n\
-uniform float gMatSpecularIntensity;                                                        \n\
-uniform float gSpecularPower;                                                               \n\
-uniform vec4 gColor[4];                                                                     \n\
+    vec3 Size = vec3(textureSize(gProbeVolume, 0));                                         \n\
+    vec3 Res = vec3(Size.x / PROBE_TEXELS, Size.yz);                                        \n\
+    vec3 Coord = clamp((WorldPos - gProbeVolumeMin.xyz) * gProbeVolumeInvSize.xyz, 0.0, 1.0);\n\
+    Coord = (Coord * (Res - 1.0) + 0.5) / Size;                                             \n\
+                                                                                            \n\
+    vec4 t[PROBE_TEXELS];                                                                   \n\
+                                                                                            \n\
+    for (int i = 0 ; i < PROBE_TEXELS ; i++) {                                              \n\
+        t[i] = texture(gProbeVolume, Coord + vec3(float(i) / PROBE_TEXELS, 0.0, 0.0));      \n\
+    }                                                                                       \n\
+                                                                                            \n\
+    // In the order of the basis functions below                                            \n\
+    vec3 c0 = t[0].rgb;                                                                     \n\
+    vec3 c1 = vec3(t[0].a, t[1].rg);                                                        \n\
+    vec3 c2 = vec3(t[1].ba, t[2].r);                                                        \n\
+    vec3 c3 = t[2].gba;                                                                     \n\
+    vec3 c4 = t[3].rgb;                                                                     \n\
+    vec3 c5 = vec3(t[3].a, t[4].rg);                                                        \n\
+    vec3 c6 = vec3(t[4].ba, t[5].r);                                                        \n\
+    vec3 c7 = t[5].gba;                                                                     \n\
+    vec3 c8 = t[6].rgb;                                                                     \n\
+                                                                                            \n\
+    vec3 Irradiance = c0 * 0.282095 +                                                       \n\
+                      (c1 * n.y + c2 * n.z + c3 * n.x) * 0.488603 +                         \n\
+                      (c4 * n.x * n.y + c5 * n.y * n.z + c7 * n.x * n.z) * 1.092548 +       \n\
+                      c6 * 0.315392 * (3.0 * n.z * n.z - 1.0) +                             \n\
+                      c8 * 0.546274 * (n.x * n.x - n.y * n.y);                              \n\
                                                                                             \n\
-vec4 CalcLightInternal(BaseLight Light, vec3 LightDirection, vec3 Normal)                   \n\
+    return max(Irradiance, 0.0);                                                            \n\
+}                                                                                           \n\
+#endif                                                                                      \n\
+                                                                                            \n\
+// Visibility scales the diffuse and specular terms, the ambient one always gets through    \n\
+vec4 CalcLightInternal(BaseLight Light, vec3 LightDirection, vec3 WorldPos, vec3 Normal,    \n\
+                        float Visibility)                                                   \n\
 {                                                                                           \n\
     vec4 AmbientColor = vec4(Light.Color, 1.0f) * Light.AmbientIntensity;                   \n\
     float DiffuseFactor = dot(Normal, -LightDirection);                                     \n\
@@ -115,7 +231,8 @@ vec4 CalcLightInternal(BaseLight Light, vec3 LightDirection, vec3 Normal)
     if (DiffuseFactor > 0) {                                                                \n\
         DiffuseColor = vec4(Light.Color, 1.0f) * Light.DiffuseIntensity * DiffuseFactor;    \n\
                                                                                             \n\
-        vec3 VertexToEye = normalize(gEyeWorldPos - WorldPos0);                             \n\
+#ifdef SPECULAR                                                                             \n\
+        vec3 VertexToEye = normalize(gEyeWorldPos - WorldPos);                              \n\
         vec3 LightReflect = normalize(reflect(LightDirection, Normal));                     \n\
         float SpecularFactor = dot(VertexToEye, LightReflect);                              \n\
         SpecularFactor = pow(SpecularFactor, gSpecularPower);                               \n\
@@ -123,23 +240,44 @@ vec4 CalcLightInternal(BaseLight Light, vec3 LightDirection, vec3 Normal)
             SpecularColor = vec4(Light.Color, 1.0f) *                                       \n\
                             gMatSpecularIntensity * SpecularFactor;                         \n\
         }                                                                                   \n\
+#endif                                                                                      \n\
     }                                                                                       \n\
                                                                                             \n\
-    return (AmbientColor + DiffuseColor + SpecularColor);                                   \n\
+    return AmbientColor + (DiffuseColor + SpecularColor) * Visibility;                      \n\
 }                                                                                           \n\
                                                                                             \n\
-vec4 CalcDirectionalLight(vec3 Normal)                                                      \n\
+vec4 CalcDirectionalLight(vec3 WorldPos, vec3 Normal)                                       \n\
 {                                                                                           \n\
-    return CalcLightInternal(gDirectionalLight.Base, gDirectionalLight.Direction, Normal);  \n\
+#ifdef SHADOWS                                                                              \n\
+    float Visibility = CalcShadowFactor(WorldPos, Normal);                                  \n\
+#else                                                                                       \n\
+    float Visibility = 1.0;                                                                 \n\
+#endif                                                                                      \n\
+                                                                                            \n\
+    BaseLight Light = gDirectionalLight.Base;                                               \n\
+                                                                                            \n\
+#ifdef PROBES                                                                               \n\
+    // The probes take the place of the constant ambient term                               \n\
+    Light.AmbientIntensity = 0.0;                                                           \n\
+#endif                                                                                      \n\
+                                                                                            \n\
+    vec4 Color = CalcLightInternal(Light, gDirectionalLight.Direction, WorldPos, Normal,    \n\
+                                   Visibility);                                             \n\
+                                                                                            \n\
+#ifdef PROBES                                                                               \n\
+    Color.rgb += CalcProbeIrradiance(WorldPos, Normal);                                     \n\
+#endif                                                                                      \n\
+                                                                                            \n\
+    return Color;                                                                           \n\
 }                                                                                           \n\
                                                                                             \n\
-vec4 CalcPointLight(PointLight l, vec3 Normal)                                              \n\
+vec4 CalcPointLight(PointLight l, vec3 WorldPos, vec3 Normal)                               \n\
 {                                                                                           \n\
-    vec3 LightDirection = WorldPos0 - l.Position;                                           \n\
+    vec3 LightDirection = WorldPos - l.Position;                                            \n\
     float Distance = length(LightDirection);                                                \n\
     LightDirection = normalize(LightDirection);                                             \n\
                                                                                             \n\
-    vec4 Color = CalcLightInternal(l.Base, LightDirection, Normal);                         \n\
+    vec4 Color = CalcLightInternal(l.Base, LightDirection, WorldPos, Normal, 1.0);          \n\
     float Attenuation =  l.Atten.Constant +                                                 \n\
                          l.Atten.Linear * Distance +                                        \n\
                          l.Atten.Exp * Distance * Distance;                                 \n\
@@ -147,13 +285,13 @@ vec4 CalcPointLight(PointLight l, vec3 Normal)
     return Color / Attenuation;                                                             \n\
 }                                                                                           \n\
                                                                                             \n\
-vec4 CalcSpotLight(SpotLight l, vec3 Normal)                                                \n\
+vec4 CalcSpotLight(SpotLight l, vec3 WorldPos, vec3 Normal)                                 \n\
 {                                                                                           \n\
-    vec3 LightToPixel = normalize(WorldPos0 - l.Base.Position);                             \n\
+    vec3 LightToPixel = normalize(WorldPos - l.Base.Position);                              \n\
     float SpotFactor = dot(LightToPixel, l.Direction);                                      \n\
                                                                                             \n\
     if (SpotFactor > l.Cutoff) {                                                            \n\
-        vec4 Color = CalcPointLight(l.Base, Normal);                                        \n\
+        vec4 Color = CalcPointLight(l.Base, WorldPos, Normal);                              \n\
         return Color * (1.0 - (1.0 - SpotFactor) * 1.0/(1.0 - l.Cutoff));                   \n\
     }                                                                                       \n\
     else {                                                                                  \n\
@@ -161,26 +299,226 @@ vec4 CalcSpotLight(SpotLight l, vec3 Normal)
     }                                                                                       \n\
 }                                                                                           \n\
                                                                                             \n\
-void main()                                                                                 \n\
+vec4 CalcTotalLight(vec3 WorldPos, vec3 Normal, vec4 FragCoord)                             \n\
 {                                                                                           \n\
-    vec3 Normal = normalize(Normal0);                                                       \n\
-    vec4 TotalLight = CalcDirectionalLight(Normal);                                         \n\
+    vec4 TotalLight = CalcDirectionalLight(WorldPos, Normal);                               \n\
+                                                                                            \n\
+    // The counts are constants of the permutation so the loops unroll                      \n\
+#if NUM_POINT_LIGHTS > 0                                                                    \n\
+    for (int i = 0 ; i < NUM_POINT_LIGHTS ; i++) {                                          \n\
+        TotalLight += CalcPointLight(gPointLights[i], WorldPos, Normal);                    \n\
+    }                                                                                       \n\
+#endif                                                                                      \n\
+                                                                                            \n\
+#if NUM_SPOT_LIGHTS > 0                                                                     \n\
+    for (int i = 0 ; i < NUM_SPOT_LIGHTS ; i++) {                                           \n\
+        TotalLight += CalcSpotLight(gSpotLights[i], WorldPos, Normal);                      \n\
+    }                                                                                       \n\
+#endif                                                                                      \n\
+                                                                                            \n\
+#ifdef CLUSTERED_LIGHTS                                                                     \n\
+    uint Cluster = GetCluster(FragCoord);                                                   \n\
+    uvec2 Counts = gClusterCounts[Cluster];                                                 \n\
+    uint First = Cluster * CLUSTER_MAX_LIGHTS;                                              \n\
                                                                                             \n\
-    for (int i = 0 ; i < gNumPointLights ; i++) {                                           \n\
-        TotalLight += CalcPointLight(gPointLights[i], Normal);                              \n\
+    for (uint i = 0 ; i < Counts.x ; i++) {                                                 \n\
+        TotalLight += CalcPointLight(gClusterPointLights[gClusterIndices[First + i]], WorldPos, Normal);\n\
     }                                                                                       \n\
                                                                                             \n\
-    for (int i = 0 ; i < gNumSpotLights ; i++) {                                            \n\
-        TotalLight += CalcSpotLight(gSpotLights[i], Normal);                                \n\
+    for (uint i = Counts.x ; i < Counts.y ; i++) {                                          \n\
+        TotalLight += CalcSpotLight(gClusterSpotLights[gClusterIndices[First + i]], WorldPos, Normal);\n\
     }                                                                                       \n\
+#endif                                                                                      \n\
                                                                                             \n\
-    FragColor = texture(gColorMap, TexCoord0.xy) * TotalLight * gColor[InstanceID % 4];     \n\
+    return TotalLight;                                                                      \n\
+}                                                                                           \n\
+                                                                                            \n\
+// Octahedral encoding, the unit sphere folded onto the [-1, 1] square                      \n\
+vec2 EncodeNormal(vec3 n)                                                                   \n\
+{                                                                                           \n\
+    n /= abs(n.x) + abs(n.y) + abs(n.z);                                                    \n\
+                                                                                            \n\
+    if (n.z < 0.0) {                                                                        \n\
+        n.xy = (1.0 - abs(n.yx)) * vec2(n.x >= 0.0 ? 1.0 : -1.0, n.y >= 0.0 ? 1.0 : -1.0);  \n\
+    }                                                                                       \n\
+                                                                                            \n\
+    return n.xy;                                                                            \n\
+}                                                                                           \n\
+                                                                                            \n\
+vec3 DecodeNormal(vec2 e)                                                                   \n\
+{                                                                                           \n\
+    vec3 n = vec3(e, 1.0 - abs(e.x) - abs(e.y));                                            \n\
+                                                                                            \n\
+    if (n.z < 0.0) {                                                                        \n\
+        n.xy = (1.0 - abs(n.yx)) * vec2(n.x >= 0.0 ? 1.0 : -1.0, n.y >= 0.0 ? 1.0 : -1.0);  \n\
+    }                                                                                       \n\
+                                                                                            \n\
+    return normalize(n);                                                                    \n\
+}                                                                                           \n\
+                                                                                            \n\
+#ifdef VISIBILITY_RESOLVE                                                                   \n\
+// Perspective correct barycentrics of the point p in the triangle n, all in NDC            \n\
+vec3 CalcBarycentrics(vec2 n0, vec2 n1, vec2 n2, vec3 InvW, vec2 p)                         \n\
+{                                                                                           \n\
+    vec2 e1 = n1 - n0;                                                                      \n\
+    vec2 e2 = n2 - n0;                                                                      \n\
+    vec2 d = p - n0;                                                                        \n\
+    float Det = e1.x * e2.y - e1.y * e2.x;                                                  \n\
+                                                                                            \n\
+    vec3 b;                                                                                 \n\
+    b.y = (d.x * e2.y - d.y * e2.x) / Det;                                                  \n\
+    b.z = (e1.x * d.y - e1.y * d.x) / Det;                                                  \n\
+    b.x = 1.0 - b.y - b.z;                                                                  \n\
+                                                                                            \n\
+    // Linear in screen space over w, like every attribute                                  \n\
+    b *= InvW;                                                                              \n\
+    return b / (b.x + b.y + b.z);                                                           \n\
+}                                                                                           \n\
+                                                                                            \n\
+// Fetches the triangle of the pixel from the mesh buffers and interpolates its             \n\
+// attributes the way the rasterizer would have. The neighbouring pixels fall on the        \n\
+// plane of the same triangle, which gives the derivatives for the texture level.           \n\
+void LoadVisibleTriangle()                                                                  \n\
+{                                                                                           \n\
+    uvec2 ID = texelFetch(gVisibilityMap, ivec2(gl_FragCoord.xy), 0).xy;                    \n\
+                                                                                            \n\
+    // Base index, base vertex, first instance and material                                 \n\
+    uvec4 Entry = texelFetch(gMeshEntries, int(ID.y >> VISIBILITY_ENTRY_SHIFT));            \n\
+    int Slot = int(Entry.z + (ID.y & VISIBILITY_INSTANCE_MASK));                            \n\
+    InstanceID = int(texelFetch(gMeshInstances, Slot).r);                                   \n\
+                                                                                            \n\
+    int Row = Slot * 4;                                                                     \n\
+    mat4 World = mat4(texelFetch(gMeshWorldMats, Row), texelFetch(gMeshWorldMats, Row + 1), \n\
+                      texelFetch(gMeshWorldMats, Row + 2), texelFetch(gMeshWorldMats, Row + 3));\n\
+                                                                                            \n\
+    mat3 Pos;                                                                               \n\
+    mat3 Normals;                                                                           \n\
+    mat3x2 TexCoords;                                                                       \n\
+    mat3x4 Clip;                                                                            \n\
+                                                                                            \n\
+    for (int i = 0 ; i < 3 ; i++) {                                                         \n\
+        int Vertex = int(texelFetch(gMeshIndices, int(Entry.x + ID.x * 3u) + i).r + Entry.y);\n\
+        Pos[i] = (World * vec4(texelFetch(gMeshPositions, Vertex).xyz, 1.0)).xyz;           \n\
+        Normals[i] = texelFetch(gMeshNormals, Vertex).xyz;                                  \n\
+        TexCoords[i] = texelFetch(gMeshTexCoords, Vertex).xy;                               \n\
+        Clip[i] = gVP * vec4(Pos[i], 1.0);                                                  \n\
+    }                                                                                       \n\
+                                                                                            \n\
+    vec3 InvW = 1.0 / vec3(Clip[0].w, Clip[1].w, Clip[2].w);                                \n\
+    vec2 n0 = Clip[0].xy * InvW.x;                                                          \n\
+    vec2 n1 = Clip[1].xy * InvW.y;                                                          \n\
+    vec2 n2 = Clip[2].xy * InvW.z;                                                          \n\
+                                                                                            \n\
+    vec2 PixelSize = 2.0 / gScreenSize;                                                     \n\
+    vec2 p = gl_FragCoord.xy * PixelSize - 1.0;                                             \n\
+    vec3 b = CalcBarycentrics(n0, n1, n2, InvW, p);                                         \n\
+    vec3 bx = CalcBarycentrics(n0, n1, n2, InvW, p + vec2(PixelSize.x, 0.0));               \n\
+    vec3 by = CalcBarycentrics(n0, n1, n2, InvW, p + vec2(0.0, PixelSize.y));               \n\
+                                                                                            \n\
+    TexCoord0 = TexCoords * b;                                                              \n\
+    TexCoordDx = TexCoords * bx - TexCoord0;                                                \n\
+    TexCoordDy = TexCoords * by - TexCoord0;                                                \n\
+    Normal0 = (World * vec4(Normals * b, 0.0)).xyz;                                         \n\
+    WorldPos0 = Pos * b;                                                                    \n\
+                                                                                            \n\
+    vec4 ClipPos = Clip * b;                                                                \n\
+    Depth0 = ClipPos.z / ClipPos.w * 0.5 + 0.5;                                             \n\
+}                                                                                           \n\
+#endif                                                                                      \n\
+                                                                                            \n\
+void main()                                                                                 \n\
+{                                                                                           \n\
+#ifdef DEFERRED_LIGHTING                                                                    \n\
+    ivec2 Pixel = ivec2(gl_FragCoord.xy);                                                   \n\
+    float Depth = texelFetch(gDepthMap, Pixel, 0).r;                                        \n\
+                                                                                            \n\
+    // Nothing was drawn here                                                               \n\
+    if (Depth == 1.0) {                                                                     \n\
+        discard;                                                                            \n\
+    }                                                                                       \n\
+                                                                                            \n\
+    vec4 Clip = vec4(gl_FragCoord.xy / gScreenSize * 2.0 - 1.0, Depth * 2.0 - 1.0, 1.0);    \n\
+    vec4 WorldPos = gInvVP * Clip;                                                          \n\
+    vec3 Normal = DecodeNormal(texelFetch(gNormalMap, Pixel, 0).xy);                        \n\
+    vec4 TotalLight = CalcTotalLight(WorldPos.xyz / WorldPos.w, Normal, vec4(gl_FragCoord.xy, Depth, 1.0));\n\
+                                                                                            \n\
+    FragColor = texelFetch(gAlbedoMap, Pixel, 0) * TotalLight;                              \n\
+#else                                                                                       \n\
+#ifdef VISIBILITY_RESOLVE                                                                   \n\
+    LoadVisibleTriangle();                                                                  \n\
+    vec4 FragCoord = vec4(gl_FragCoord.xy, Depth0, 1.0);                                    \n\
+#else                                                                                       \n\
+    vec4 FragCoord = gl_FragCoord;                                                          \n\
+#endif                                                                                      \n\
+                                                                                            \n\
+    vec3 Normal = normalize(Normal0);                                                       \n\
+                                                                                            \n\
+#if defined(TEXTURED) && defined(VISIBILITY_RESOLVE)                                        \n\
+    vec4 Albedo = textureGrad(gColorMap, TexCoord0, TexCoordDx, TexCoordDy);                \n\
+#elif defined(TEXTURED)                                                                     \n\
+    vec4 Albedo = texture(gColorMap, TexCoord0.xy);                                         \n\
+#else                                                                                       \n\
+    vec4 Albedo = vec4(1.0);                                                                \n\
+#endif                                                                                      \n\
+                                                                                            \n\
+    Albedo *= gColor[InstanceID % 4];                                                       \n\
+                                                                                            \n\
+#ifdef GBUFFER                                                                              \n\
+    FragColor = Albedo;                                                                     \n\
+    PackedNormal = EncodeNormal(Normal);                                                    \n\
+#else                                                                                       \n\
+    FragColor = Albedo * CalcTotalLight(WorldPos0, Normal, FragCoord);                      \n\
+#endif                                                                                      \n\
+                                                                                            \n\
+#ifdef TEXTURE_FEEDBACK                                                                     \n\
+    // Relative to the base level. Queried outside of the branch for the derivatives.       \n\
+#ifdef VISIBILITY_RESOLVE                                                                   \n\
+    vec2 Size = vec2(textureSize(gColorMap, 0));                                            \n\
+    vec2 Dx = TexCoordDx * Size;                                                            \n\
+    vec2 Dy = TexCoordDy * Size;                                                            \n\
+    float Lod = 0.5 * log2(max(dot(Dx, Dx), dot(Dy, Dy))) + gFeedbackTexture.y;             \n\
+#else                                                                                       \n\
+    float Lod = textureQueryLod(gColorMap, TexCoord0.xy).y + gFeedbackTexture.y;            \n\
+#endif                                                                                      \n\
+    ivec2 Pixel = ivec2(gl_FragCoord.xy);                                                   \n\
+                                                                                            \n\
+    if (gFeedbackTexture.x != 0 && Pixel % FEEDBACK_TILE == gFeedbackTile) {                \n\
+        uint Value = (uint(gFeedbackTexture.x) << 4) | uint(clamp(Lod, 0.0, 15.0));         \n\
+        imageStore(gFeedbackImage, Pixel / FEEDBACK_TILE, uvec4(Value));                    \n\
+    }                                                                                       \n\
+#endif                                                                                      \n\
+#endif                                                                                      \n\
 }";
 
 
 
+// Bits of the permutation keys. Key 0 is the textured one without specular and with
+// only the directional light, which Init builds. The clustered permutations take the
+// lights from the clusters and have no light counts. The G-buffer permutations don't
+// light, the deferred lighting one has no texture. The shadowed permutations sample the
+// cascades of CascadedShadows for the directional light, the probe ones take its ambient
+// term from IrradianceProbes. The visibility permutations shade the visibility buffer,
+// one material at a time.
+#define PERMUTATION_UNTEXTURED      0x1
+#define PERMUTATION_SPECULAR        0x2
+#define PERMUTATION_POINT_SHIFT     2       // 7 bits each for up to 64 lights
+#define PERMUTATION_SPOT_SHIFT      9
+#define PERMUTATION_CLUSTERED       0x10000
+#define PERMUTATION_GBUFFER         0x20000
+#define PERMUTATION_DEFERRED        0x40000
+#define PERMUTATION_SHADOWS         0x80000
+#define PERMUTATION_PROBES          0x100000
+#define PERMUTATION_VISIBILITY      0x200000
+
+
 LightingTechnique::LightingTechnique()
 {   
+    m_enabledProg = 0;
+    m_colorTextureUnit = 0;
+    m_numPointLights = 0;
+    m_numSpotLights = 0;
+    m_specular = false;
+    m_pass = LIGHTING_PASS_FORWARD;
 }
 
 bool LightingTechnique::Init()
@@ -197,199 +535,303 @@ bool LightingTechnique::Init()
         return false;
     }
 
-    if (!Finalize()) {
-        return false;
+    return Finalize();
+}
+
+
+std::string LightingTechnique::GetPermutationDefines(unsigned int Key) const
+{
+    char Defines[256];
+    SNPRINTF(Defines, sizeof(Defines), "#define NUM_POINT_LIGHTS %u\n#define NUM_SPOT_LIGHTS %u\n",
+             (Key >> PERMUTATION_POINT_SHIFT) & 0x7F, (Key >> PERMUTATION_SPOT_SHIFT) & 0x7F);
+
+    std::string Ret(Defines);
+
+    if (Key & PERMUTATION_SPECULAR) {
+        Ret += "#define SPECULAR\n";
     }
 
-    m_colorTextureLocation = GetUniformLocation("gColorMap");
-    m_eyeWorldPosLocation = GetUniformLocation("gEyeWorldPos");
-    m_dirLightLocation.Color = GetUniformLocation("gDirectionalLight.Base.Color");
-    m_dirLightLocation.AmbientIntensity = GetUniformLocation("gDirectionalLight.Base.AmbientIntensity");
-    m_dirLightLocation.Direction = GetUniformLocation("gDirectionalLight.Direction");
-    m_dirLightLocation.DiffuseIntensity = GetUniformLocation("gDirectionalLight.Base.DiffuseIntensity");
-    m_matSpecularIntensityLocation = GetUniformLocation("gMatSpecularIntensity");
-    m_matSpecularPowerLocation = GetUniformLocation("gSpecularPower");
-    m_numPointLightsLocation = GetUniformLocation("gNumPointLights");
-    m_numSpotLightsLocation = GetUniformLocation("gNumSpotLights");
-
-    if (m_dirLightLocation.AmbientIntensity == INVALID_UNIFORM_LOCATION ||
-        m_colorTextureLocation == INVALID_UNIFORM_LOCATION ||
-        m_eyeWorldPosLocation == INVALID_UNIFORM_LOCATION ||
-        m_dirLightLocation.Color == INVALID_UNIFORM_LOCATION ||
-        m_dirLightLocation.DiffuseIntensity == INVALID_UNIFORM_LOCATION ||
-        m_dirLightLocation.Direction == INVALID_UNIFORM_LOCATION ||
-        m_matSpecularIntensityLocation == INVALID_UNIFORM_LOCATION ||
-        m_matSpecularPowerLocation == INVALID_UNIFORM_LOCATION ||
-        m_numPointLightsLocation == INVALID_UNIFORM_LOCATION ||
-        m_numSpotLightsLocation == INVALID_UNIFORM_LOCATION) {
-        return false;
+    if (Key & PERMUTATION_CLUSTERED) {
+        Ret += "#define CLUSTERED_LIGHTS\n";
     }
 
-    for (unsigned int i = 0 ; i < ARRAY_SIZE_IN_ELEMENTS(m_pointLightsLocation) ; i++) {
-        char Name[128];
-        memset(Name, 0, sizeof(Name));
-        SNPRINTF(Name, sizeof(Name), "gPointLights[%d].Base.Color", i);
-        m_pointLightsLocation[i].Color = GetUniformLocation(Name);
+    if (Key & PERMUTATION_GBUFFER) {
+        Ret += "#define GBUFFER\n";
+    }
+
+    if (Key & PERMUTATION_SHADOWS) {
+        Ret += "#define SHADOWS\n";
+    }
 
-        SNPRINTF(Name, sizeof(Name), "gPointLights[%d].Base.AmbientIntensity", i);
-        m_pointLightsLocation[i].AmbientIntensity = GetUniformLocation(Name);
+    if (Key & PERMUTATION_PROBES) {
+        Ret += "#define PROBES\n";
+    }
 
-        SNPRINTF(Name, sizeof(Name), "gPointLights[%d].Position", i);
-        m_pointLightsLocation[i].Position = GetUniformLocation(Name);
+    if (Key & PERMUTATION_VISIBILITY) {
+        Ret += "#define VISIBILITY_RESOLVE\n";
+    }
 
-        SNPRINTF(Name, sizeof(Name), "gPointLights[%d].Base.DiffuseIntensity", i);
-        m_pointLightsLocation[i].DiffuseIntensity = GetUniformLocation(Name);
+    if (Key & PERMUTATION_DEFERRED) {
+        Ret += "#define DEFERRED_LIGHTING\n";
+    }
+    else if (!(Key & PERMUTATION_UNTEXTURED)) {
+        Ret += "#define TEXTURED\n";
 
-        SNPRINTF(Name, sizeof(Name), "gPointLights[%d].Atten.Constant", i);
-        m_pointLightsLocation[i].Atten.Constant = GetUniformLocation(Name);
+        // The feedback of the texture streamer is compiled in only when it is on
+        if (TextureStreamer::IsEnabled()) {
+            SNPRINTF(Defines, sizeof(Defines), "#define TEXTURE_FEEDBACK\n#define FEEDBACK_TILE %d\n", STREAMING_FEEDBACK_TILE);
+            Ret += Defines;
+        }
+    }
 
-        SNPRINTF(Name, sizeof(Name), "gPointLights[%d].Atten.Linear", i);
-        m_pointLightsLocation[i].Atten.Linear = GetUniformLocation(Name);
+    return Ret;
+}
 
-        SNPRINTF(Name, sizeof(Name), "gPointLights[%d].Atten.Exp", i);
-        m_pointLightsLocation[i].Atten.Exp = GetUniformLocation(Name);
 
-        if (m_pointLightsLocation[i].Color == INVALID_UNIFORM_LOCATION ||
-            m_pointLightsLocation[i].AmbientIntensity == INVALID_UNIFORM_LOCATION ||
-            m_pointLightsLocation[i].Position == INVALID_UNIFORM_LOCATION ||
-            m_pointLightsLocation[i].DiffuseIntensity == INVALID_UNIFORM_LOCATION ||
-            m_pointLightsLocation[i].Atten.Constant == INVALID_UNIFORM_LOCATION ||
-            m_pointLightsLocation[i].Atten.Linear == INVALID_UNIFORM_LOCATION ||
-            m_pointLightsLocation[i].Atten.Exp == INVALID_UNIFORM_LOCATION) {
-            return false;
-        }
+unsigned int LightingTechnique::GetPermutationKey(bool Textured) const
+{
+    if (m_pass == LIGHTING_PASS_GBUFFER) {
+        return Textured ? PERMUTATION_GBUFFER : (PERMUTATION_GBUFFER | PERMUTATION_UNTEXTURED);
     }
 
-    for (unsigned int i = 0 ; i < ARRAY_SIZE_IN_ELEMENTS(m_spotLightsLocation) ; i++) {
-        char Name[128];
-        memset(Name, 0, sizeof(Name));
-        SNPRINTF(Name, sizeof(Name), "gSpotLights[%d].Base.Base.Color", i);
-        m_spotLightsLocation[i].Color = GetUniformLocation(Name);
+    unsigned int Key = ClusteredLights::IsEnabled() ? PERMUTATION_CLUSTERED :
+                       (m_numPointLights << PERMUTATION_POINT_SHIFT) | (m_numSpotLights << PERMUTATION_SPOT_SHIFT);
 
-        SNPRINTF(Name, sizeof(Name), "gSpotLights[%d].Base.Base.AmbientIntensity", i);
-        m_spotLightsLocation[i].AmbientIntensity = GetUniformLocation(Name);
+    if (m_pass == LIGHTING_PASS_DEFERRED) {
+        Key |= PERMUTATION_DEFERRED;
+    }
+    else if (!Textured) {
+        Key |= PERMUTATION_UNTEXTURED;
+    }
 
-        SNPRINTF(Name, sizeof(Name), "gSpotLights[%d].Base.Position", i);
-        m_spotLightsLocation[i].Position = GetUniformLocation(Name);
+    if (m_pass == LIGHTING_PASS_VISIBILITY) {
+        Key |= PERMUTATION_VISIBILITY;
+    }
 
-        SNPRINTF(Name, sizeof(Name), "gSpotLights[%d].Direction", i);
-        m_spotLightsLocation[i].Direction = GetUniformLocation(Name);
+    if (m_specular) {
+        Key |= PERMUTATION_SPECULAR;
+    }
 
-        SNPRINTF(Name, sizeof(Name), "gSpotLights[%d].Cutoff", i);
-        m_spotLightsLocation[i].Cutoff = GetUniformLocation(Name);
+    if (CascadedShadows::IsEnabled()) {
+        Key |= PERMUTATION_SHADOWS;
+    }
 
-        SNPRINTF(Name, sizeof(Name), "gSpotLights[%d].Base.Base.DiffuseIntensity", i);
-        m_spotLightsLocation[i].DiffuseIntensity = GetUniformLocation(Name);
+    if (IrradianceProbes::IsEnabled()) {
+        Key |= PERMUTATION_PROBES;
+    }
 
-        SNPRINTF(Name, sizeof(Name), "gSpotLights[%d].Base.Atten.Constant", i);
-        m_spotLightsLocation[i].Atten.Constant = GetUniformLocation(Name);
+    return Key;
+}
 
-        SNPRINTF(Name, sizeof(Name), "gSpotLights[%d].Base.Atten.Linear", i);
-        m_spotLightsLocation[i].Atten.Linear = GetUniformLocation(Name);
 
-        SNPRINTF(Name, sizeof(Name), "gSpotLights[%d].Base.Atten.Exp", i);
-        m_spotLightsLocation[i].Atten.Exp = GetUniformLocation(Name);
+// Runs for every permutation. The samplers are set here since the permutations built
+// later may not be current when SetColorTextureUnit is called.
+bool LightingTechnique::OnFinalized()
+{
+    UniformBuffers::BindBlocks(m_shaderProg);
 
-        if (m_spotLightsLocation[i].Color == INVALID_UNIFORM_LOCATION ||
-            m_spotLightsLocation[i].AmbientIntensity == INVALID_UNIFORM_LOCATION ||
-            m_spotLightsLocation[i].Position == INVALID_UNIFORM_LOCATION ||
-            m_spotLightsLocation[i].Direction == INVALID_UNIFORM_LOCATION ||
-            m_spotLightsLocation[i].Cutoff == INVALID_UNIFORM_LOCATION ||
-            m_spotLightsLocation[i].DiffuseIntensity == INVALID_UNIFORM_LOCATION ||
-            m_spotLightsLocation[i].Atten.Constant == INVALID_UNIFORM_LOCATION ||
-            m_spotLightsLocation[i].Atten.Linear == INVALID_UNIFORM_LOCATION ||
-            m_spotLightsLocation[i].Atten.Exp == INVALID_UNIFORM_LOCATION) {
-            return false;
-        }
+    if (GetPermutation() & PERMUTATION_CLUSTERED) {
+        ClusteredLights::BindBlocks(m_shaderProg);
+    }
+
+    ProgramLocations& Locations = m_programLocations[m_shaderProg];
+    Locations.ColorMap = -1;
+    Locations.FeedbackTexture = -1;
+    Locations.FeedbackTile = -1;
+
+    if (GetPermutation() & PERMUTATION_SHADOWS) {
+        glProgramUniform1i(m_shaderProg, GetUniformLocation("gShadowMap"), SHADOW_TEXTURE_UNIT_INDEX);
+    }
+
+    if (GetPermutation() & PERMUTATION_PROBES) {
+        glProgramUniform1i(m_shaderProg, GetUniformLocation("gProbeVolume"), PROBE_TEXTURE_UNIT_INDEX);
     }
 
-    for (unsigned int i = 0; i < ARRAY_SIZE_IN_ELEMENTS(m_colorLocation) ; i++) {
-        char Name[32];
-        memset(Name, 0, sizeof(Name));
-        SNPRINTF(Name, sizeof(Name), "gColor[%d]", i);
-        
-        m_colorLocation[i] = GetUniformLocation(Name);
-        
-        if (m_colorLocation[i] == INVALID_UNIFORM_LOCATION) {
-            return false;            
+    if (GetPermutation() & PERMUTATION_VISIBILITY) {
+        glProgramUniform1i(m_shaderProg, GetUniformLocation("gVisibilityMap"), VISIBILITY_TEXTURE_UNIT_INDEX);
+        glProgramUniform1i(m_shaderProg, GetUniformLocation("gMeshEntries"), MESH_ENTRY_TEXTURE_UNIT_INDEX);
+        glProgramUniform1i(m_shaderProg, GetUniformLocation("gMeshIndices"), MESH_INDEX_TEXTURE_UNIT_INDEX);
+        glProgramUniform1i(m_shaderProg, GetUniformLocation("gMeshPositions"), MESH_POS_TEXTURE_UNIT_INDEX);
+        glProgramUniform1i(m_shaderProg, GetUniformLocation("gMeshNormals"), MESH_NORMAL_TEXTURE_UNIT_INDEX);
+        glProgramUniform1i(m_shaderProg, GetUniformLocation("gMeshWorldMats"), MESH_WORLD_TEXTURE_UNIT_INDEX);
+        glProgramUniform1i(m_shaderProg, GetUniformLocation("gMeshInstances"), MESH_INSTANCE_TEXTURE_UNIT_INDEX);
+
+        // Only the textured permutations interpolate the texture coordinates
+        if (!(GetPermutation() & PERMUTATION_UNTEXTURED)) {
+            glProgramUniform1i(m_shaderProg, GetUniformLocation("gMeshTexCoords"), MESH_TEXCOORD_TEXTURE_UNIT_INDEX);
         }
     }
-    
+
+    if (GetPermutation() & PERMUTATION_DEFERRED) {
+        glProgramUniform1i(m_shaderProg, GetUniformLocation("gAlbedoMap"), GBUFFER_ALBEDO_TEXTURE_UNIT_INDEX);
+        glProgramUniform1i(m_shaderProg, GetUniformLocation("gNormalMap"), GBUFFER_NORMAL_TEXTURE_UNIT_INDEX);
+        glProgramUniform1i(m_shaderProg, GetUniformLocation("gDepthMap"), GBUFFER_DEPTH_TEXTURE_UNIT_INDEX);
+        return true;
+    }
+
+    if (GetPermutation() & PERMUTATION_UNTEXTURED) {
+        return true;
+    }
+
+    Locations.ColorMap = GetUniformLocation("gColorMap");
+
+    if (Locations.ColorMap == -1) {
+        return false;
+    }
+
+    glProgramUniform1i(m_shaderProg, Locations.ColorMap, m_colorTextureUnit);
+
+    if (TextureStreamer::IsEnabled()) {
+        glProgramUniform1i(m_shaderProg, GetUniformLocation("gFeedbackImage"), TEXTURE_FEEDBACK_IMAGE_UNIT);
+        Locations.FeedbackTexture = GetUniformLocation("gFeedbackTexture");
+        Locations.FeedbackTile = GetUniformLocation("gFeedbackTile");
+    }
+
     return true;
 }
 
 
+bool LightingTechnique::Enable(bool Textured)
+{
+    if (!EnablePermutation(GetPermutationKey(Textured))) {
+        return false;
+    }
+
+    // The feedback uniforms of the previous program don't apply to this one
+    if (m_shaderProg != m_enabledProg) {
+        const ProgramLocations& Locations = m_programLocations[m_shaderProg];
+        TextureStreamer::SetFeedbackProgram(Locations.FeedbackTexture, Locations.FeedbackTile);
+        m_enabledProg = m_shaderProg;
+    }
+
+    return true;
+}
+
+
+void LightingTechnique::DrawStartCB(unsigned int /*MaterialIndex*/, bool Textured)
+{
+    Enable(Textured);
+}
+
+
+void LightingTechnique::SetPass(LightingPass Pass)
+{
+    m_pass = Pass;
+}
+
+
 void LightingTechnique::SetColorTextureUnit(unsigned int TextureUnit)
 {
-    glUniform1i(m_colorTextureLocation, TextureUnit);
+    m_colorTextureUnit = TextureUnit;
+
+    for (std::map<GLuint, ProgramLocations>::iterator it = m_programLocations.begin() ; it != m_programLocations.end() ; it++) {
+        if (it->second.ColorMap != -1) {
+            glProgramUniform1i(it->first, it->second.ColorMap, TextureUnit);
+        }
+    }
 }
 
 
-void LightingTechnique::SetDirectionalLight(const DirectionalLight& Light)
+void LightingTechnique::BeginTextureFeedback()
 {
-    glUniform3f(m_dirLightLocation.Color, Light.Color.x, Light.Color.y, Light.Color.z);
-    glUniform1f(m_dirLightLocation.AmbientIntensity, Light.AmbientIntensity);
-    Vector3f Direction = Light.Direction;
-    Direction.Normalize();
-    glUniform3f(m_dirLightLocation.Direction, Direction.x, Direction.y, Direction.z);
-    glUniform1f(m_dirLightLocation.DiffuseIntensity, Light.DiffuseIntensity);
+    const ProgramLocations& Locations = m_programLocations[m_shaderProg];
+    TextureStreamer::BeginFeedback(Locations.FeedbackTexture, Locations.FeedbackTile);
 }
 
 
-void LightingTechnique::SetEyeWorldPos(const Vector3f& EyeWorldPos)
+void LightingTechnique::SetDirectionalLight(const DirectionalLight& Light)
 {
-    glUniform3f(m_eyeWorldPosLocation, EyeWorldPos.x, EyeWorldPos.y, EyeWorldPos.z);
+    UniformDirectionalLight& Uniform = UniformBuffers::EditLights().DirectionalLight;
+
+    Uniform.Base.Color = Light.Color;
+    Uniform.Base.AmbientIntensity = Light.AmbientIntensity;
+    Uniform.Base.DiffuseIntensity = Light.DiffuseIntensity;
+    Uniform.Direction = Light.Direction;
+    Uniform.Direction.Normalize();
 }
 
 
 void LightingTechnique::SetMatSpecularIntensity(float Intensity)
 {
-    glUniform1f(m_matSpecularIntensityLocation, Intensity);
+    UniformBuffers::EditMaterial().SpecularIntensity = Intensity;
+    m_specular = Intensity > 0.0f;
 }
 
 
 void LightingTechnique::SetMatSpecularPower(float Power)
 {
-    glUniform1f(m_matSpecularPowerLocation, Power);
+    UniformBuffers::EditMaterial().SpecularPower = Power;
+}
+
+
+static void SetUniformPointLight(UniformPointLight& Uniform, const PointLight& Light)
+{
+    Uniform.Base.Color = Light.Color;
+    Uniform.Base.AmbientIntensity = Light.AmbientIntensity;
+    Uniform.Base.DiffuseIntensity = Light.DiffuseIntensity;
+    Uniform.Position = Light.Position;
+    Uniform.Atten.Constant = Light.Attenuation.Constant;
+    Uniform.Atten.Linear = Light.Attenuation.Linear;
+    Uniform.Atten.Exp = Light.Attenuation.Exp;
+}
+
+
+static void SetUniformSpotLight(UniformSpotLight& Uniform, const SpotLight& Light)
+{
+    SetUniformPointLight(Uniform.Base, Light);
+    Uniform.Direction = Light.Direction;
+    Uniform.Direction.Normalize();
+    Uniform.Cutoff = cosf(ToRadian(Light.Cutoff));
 }
 
 
+// The clustered lights have no limit, the uniform block keeps the first MAX_POINT_LIGHTS
 void LightingTechnique::SetPointLights(unsigned int NumLights, const PointLight* pLights)
 {
-    glUniform1i(m_numPointLightsLocation, NumLights);
+    if (ClusteredLights::IsEnabled()) {
+        UniformPointLight* pUniforms = ClusteredLights::EditPointLights(NumLights);
+
+        for (unsigned int i = 0 ; i < NumLights ; i++) {
+            SetUniformPointLight(pUniforms[i], pLights[i]);
+        }
+
+        return;
+    }
+
+    LightUniforms& Lights = UniformBuffers::EditLights();
+
+    Lights.NumPointLights = std::min(NumLights, (unsigned int)MAX_POINT_LIGHTS);
+    m_numPointLights = Lights.NumPointLights;
     
-    for (unsigned int i = 0 ; i < NumLights ; i++) {
-        glUniform3f(m_pointLightsLocation[i].Color, pLights[i].Color.x, pLights[i].Color.y, pLights[i].Color.z);
-        glUniform1f(m_pointLightsLocation[i].AmbientIntensity, pLights[i].AmbientIntensity);
-        glUniform1f(m_pointLightsLocation[i].DiffuseIntensity, pLights[i].DiffuseIntensity);
-        glUniform3f(m_pointLightsLocation[i].Position, pLights[i].Position.x, pLights[i].Position.y, pLights[i].Position.z);
-        glUniform1f(m_pointLightsLocation[i].Atten.Constant, pLights[i].Attenuation.Constant);
-        glUniform1f(m_pointLightsLocation[i].Atten.Linear, pLights[i].Attenuation.Linear);
-        glUniform1f(m_pointLightsLocation[i].Atten.Exp, pLights[i].Attenuation.Exp);
+    for (int i = 0 ; i < Lights.NumPointLights ; i++) {
+        SetUniformPointLight(Lights.PointLights[i], pLights[i]);
     }
 }
 
 void LightingTechnique::SetSpotLights(unsigned int NumLights, const SpotLight* pLights)
 {
-    glUniform1i(m_numSpotLightsLocation, NumLights);
-
-    for (unsigned int i = 0 ; i < NumLights ; i++) {
-        glUniform3f(m_spotLightsLocation[i].Color, pLights[i].Color.x, pLights[i].Color.y, pLights[i].Color.z);
-        glUniform1f(m_spotLightsLocation[i].AmbientIntensity, pLights[i].AmbientIntensity);
-        glUniform1f(m_spotLightsLocation[i].DiffuseIntensity, pLights[i].DiffuseIntensity);
-        glUniform3f(m_spotLightsLocation[i].Position,  pLights[i].Position.x, pLights[i].Position.y, pLights[i].Position.z);
-        Vector3f Direction = pLights[i].Direction;
-        Direction.Normalize();
-        glUniform3f(m_spotLightsLocation[i].Direction, Direction.x, Direction.y, Direction.z);
-        glUniform1f(m_spotLightsLocation[i].Cutoff, cosf(ToRadian(pLights[i].Cutoff)));
-        glUniform1f(m_spotLightsLocation[i].Atten.Constant, pLights[i].Attenuation.Constant);
-        glUniform1f(m_spotLightsLocation[i].Atten.Linear,   pLights[i].Attenuation.Linear);
-        glUniform1f(m_spotLightsLocation[i].Atten.Exp,      pLights[i].Attenuation.Exp);
+    if (ClusteredLights::IsEnabled()) {
+        UniformSpotLight* pUniforms = ClusteredLights::EditSpotLights(NumLights);
+
+        for (unsigned int i = 0 ; i < NumLights ; i++) {
+            SetUniformSpotLight(pUniforms[i], pLights[i]);
+        }
+
+        return;
+    }
+
+    LightUniforms& Lights = UniformBuffers::EditLights();
+
+    Lights.NumSpotLights = std::min(NumLights, (unsigned int)MAX_SPOT_LIGHTS);
+    m_numSpotLights = Lights.NumSpotLights;
+
+    for (int i = 0 ; i < Lights.NumSpotLights ; i++) {
+        SetUniformSpotLight(Lights.SpotLights[i], pLights[i]);
     }
 }
 
 
 void LightingTechnique::SetColor(unsigned int Index, const Vector4f& Color)
 {
-    glUniform4f(m_colorLocation[Index], Color.x, Color.y, Color.z, Color.w);
-}
\ No newline at end of file
+    UniformBuffers::EditMaterial().Colors[Index] = Color;
+}
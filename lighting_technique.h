@@ -20,6 +20,8 @@
 
 #include "technique.h"
 #include "math_3d.h"
+#include "uniform_buffers.h"
+#include "callbacks.h"
 
 #include "technique.cpp"
 #include "math_3d.cpp"
@@ -80,67 +82,75 @@ struct SpotLight : public PointLight
     }
 };
 
-class LightingTechnique : public Technique {
-public:
+enum LightingPass {
+    LIGHTING_PASS_FORWARD,          // lit draws
+    LIGHTING_PASS_GBUFFER,          // draws that fill the G-buffer
+    LIGHTING_PASS_DEFERRED,         // lights the G-buffer with a fullscreen triangle
+    LIGHTING_PASS_VISIBILITY        // shades the visibility buffer, see Mesh::ResolveVisibility
+};
 
-    static const unsigned int MAX_POINT_LIGHTS = 2;
-    static const unsigned int MAX_SPOT_LIGHTS = 2;
+// The lights and the material live in the shared uniform blocks, the setters only
+// change the CPU copy that UniformBuffers::Update uploads. The fragment shader is
+// specialized for the number of lights, the texture and the specular term, and
+// Enable picks the permutation that matches the current setters. When ClusteredLights
+// is enabled the point and spot lights go to its lists instead and the shader only
+// evaluates the lights of the cluster of the fragment. SetPass switches between the
+// forward shading, the two passes of the deferred shading and the resolve of the
+// visibility buffer, which share the shader.
+class LightingTechnique : public Technique, public IRenderCallbacks {
+public:
 
     LightingTechnique();
 
     virtual bool Init();
 
+    virtual bool OnFinalized();
+
+    // Builds the permutation on first use. Textured is false for the materials
+    // without a texture.
+    bool Enable(bool Textured = true);
+
+    // Pass the technique to Mesh::Render to switch permutations per material
+    virtual void DrawStartCB(unsigned int MaterialIndex, bool Textured);
+
+    // Takes effect at the next Enable
+    void SetPass(LightingPass Pass);
+
     void SetColorTextureUnit(unsigned int TextureUnit);
     void SetDirectionalLight(const DirectionalLight& Light);
     void SetPointLights(unsigned int NumLights, const PointLight* pLights);
     void SetSpotLights(unsigned int NumLights, const SpotLight* pLights);
-    void SetEyeWorldPos(const Vector3f& EyeWorldPos);
     void SetMatSpecularIntensity(float Intensity);
     void SetMatSpecularPower(float Power);
     void SetColor(unsigned int Index, const Vector4f& Color);
 
+    // Records the texture feedback of the next draws until TextureStreamer::EndFeedback.
+    // Does nothing when the streamer is off.
+    void BeginTextureFeedback();
+
+protected:
+
+    virtual std::string GetPermutationDefines(unsigned int Key) const;
+
 private:
 
-    GLuint m_colorTextureLocation;
-    GLuint m_eyeWorldPosLocation;
-    GLuint m_matSpecularIntensityLocation;
-    GLuint m_matSpecularPowerLocation;
-    GLuint m_numPointLightsLocation;
-    GLuint m_numSpotLightsLocation;
-    GLuint m_colorLocation[4];
-
-    struct {
-        GLuint Color;
-        GLuint AmbientIntensity;
-        GLuint DiffuseIntensity;
-        GLuint Direction;
-    } m_dirLightLocation;
-
-    struct {
-        GLuint Color;
-        GLuint AmbientIntensity;
-        GLuint DiffuseIntensity;
-        GLuint Position;
-        struct {
-            GLuint Constant;
-            GLuint Linear;
-            GLuint Exp;
-        } Atten;
-    } m_pointLightsLocation[MAX_POINT_LIGHTS];
-
-    struct {
-        GLuint Color;
-        GLuint AmbientIntensity;
-        GLuint DiffuseIntensity;
-        GLuint Position;
-        GLuint Direction;
-        GLuint Cutoff;
-        struct {
-            GLuint Constant;
-            GLuint Linear;
-            GLuint Exp;
-        } Atten;
-    } m_spotLightsLocation[MAX_SPOT_LIGHTS];
+    unsigned int GetPermutationKey(bool Textured) const;
+
+    // -1 for the uniforms a permutation doesn't have
+    struct ProgramLocations {
+        GLint ColorMap;
+        GLint FeedbackTexture;
+        GLint FeedbackTile;
+    };
+
+    std::map<GLuint, ProgramLocations> m_programLocations;
+    GLuint m_enabledProg;
+
+    unsigned int m_colorTextureUnit;
+    unsigned int m_numPointLights;
+    unsigned int m_numSpotLights;
+    bool m_specular;
+    LightingPass m_pass;
 };
 
 
@@ -17,6 +17,7 @@
 */
 #pragma once
 #include <stdlib.h>
+#include <algorithm>
 
 #include "util.h"
 #include "math_3d.h"
@@ -132,6 +133,49 @@ void Matrix4f::InitPersProjTransform(const PersProjInfo& p)
     m[3][0] = 0.0f;                   m[3][1] = 0.0f;            m[3][2] = 1.0f;            m[3][3] = 0.0;    
 }
 
+// Gauss-Jordan elimination with partial pivoting
+Matrix4f Matrix4f::Inverse() const
+{
+    Matrix4f a = *this;
+    Matrix4f Ret;
+    Ret.InitIdentity();
+
+    for (int Col = 0 ; Col < 4 ; Col++) {
+        int Pivot = Col;
+
+        for (int Row = Col + 1 ; Row < 4 ; Row++) {
+            if (fabsf(a.m[Row][Col]) > fabsf(a.m[Pivot][Col])) {
+                Pivot = Row;
+            }
+        }
+
+        for (int j = 0 ; j < 4 ; j++) {
+            std::swap(a.m[Col][j], a.m[Pivot][j]);
+            std::swap(Ret.m[Col][j], Ret.m[Pivot][j]);
+        }
+
+        const float Scale = 1.0f / a.m[Col][Col];
+
+        for (int j = 0 ; j < 4 ; j++) {
+            a.m[Col][j] *= Scale;
+            Ret.m[Col][j] *= Scale;
+        }
+
+        for (int Row = 0 ; Row < 4 ; Row++) {
+            if (Row != Col) {
+                const float Factor = a.m[Row][Col];
+
+                for (int j = 0 ; j < 4 ; j++) {
+                    a.m[Row][j] -= Factor * a.m[Col][j];
+                    Ret.m[Row][j] -= Factor * Ret.m[Col][j];
+                }
+            }
+        }
+    }
+
+    return Ret;
+}
+
 
 Quaternion::Quaternion(float _x, float _y, float _z, float _w)
 {
@@ -244,6 +244,9 @@ public:
     void InitTranslationTransform(float x, float y, float z);
     void InitCameraTransform(const Vector3f& Target, const Vector3f& Up);
     void InitPersProjTransform(const PersProjInfo& p);
+
+    // The matrix must not be singular
+    Matrix4f Inverse() const;
 };
 
 
@@ -17,8 +17,22 @@
 */
 
 #include <assert.h>
+#include <float.h>
+#include <algorithm>
+#include <functional>
+#if defined(_M_X64) || defined(_M_IX86) || defined(__SSE2__)
+#include <emmintrin.h>
+#define MESH_USE_SSE2
+#endif
 
+#include "engine_common.h"
 #include "mesh.h"
+#include "asset_registry.h"
+#include "texture_loader.h"
+#include "texture_streamer.h"
+#include "meshlet_cull_technique.h"
+#include "visibility_technique.h"
+#include "gl_state.h"
 
 using namespace std;
 
@@ -27,33 +41,144 @@ using namespace std;
 #define NORMAL_LOCATION 2
 #define WVP_LOCATION 3
 #define WORLD_LOCATION 7
+#define INSTANCE_LOCATION 11
+
+#define ASSIMP_LOAD_FLAGS (aiProcess_Triangulate | aiProcess_GenSmoothNormals | aiProcess_FlipUVs)
+
+static_assert(sizeof(aiVector3D) == sizeof(Vector3f), "aiVector3D must match the layout of Vector3f");
+
+
+// Allocates the storage of a static buffer and maps it for writing.
+// Immutable storage is used where available since the data never changes after the load.
+static void* MapStaticBuffer(GLuint Buffer, GLsizeiptr Size)
+{
+    if (GLEW_ARB_buffer_storage) {
+        GLState::BufferStorage(Buffer, Size, NULL, GL_MAP_WRITE_BIT);
+    }
+    else {
+        GLState::BufferData(Buffer, Size, NULL, GL_STATIC_DRAW);
+    }
+
+    return GLState::MapBufferRange(Buffer, 0, Size, GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+}
+
+
+// Allocates the storage of a buffer that stays mapped while the streaming threads fill it.
+// The mapping is coherent so the data written by the workers needs no explicit flush.
+static void* MapPersistentBuffer(GLuint Buffer, GLsizeiptr Size)
+{
+    const GLbitfield Flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+
+    GLState::BufferStorage(Buffer, Size, NULL, Flags);
+
+    return GLState::MapBufferRange(Buffer, 0, Size, Flags);
+}
+
+
+static bool UnmapStaticBuffer(GLuint Buffer, const void* pMapping)
+{
+    if (!pMapping) {
+        return true;
+    }
+
+    return GLState::UnmapBuffer(Buffer);
+}
+
+
+// Converts the (x, y, z) texture coordinates of Assimp into tightly packed (x, y) pairs.
+// The SSE2 path handles four vertices (three loads, two stores) per iteration.
+static void ConvertTexCoords(const aiVector3D* pSrc, Vector2f* pDst, unsigned int NumVertices)
+{
+    unsigned int i = 0;
+
+#ifdef MESH_USE_SSE2
+    const float* pIn = (const float*)pSrc;
+    float* pOut = (float*)pDst;
+
+    for ( ; i + 4 <= NumVertices ; i += 4) {
+        __m128 a = _mm_loadu_ps(pIn);       // x0 y0 z0 x1
+        __m128 b = _mm_loadu_ps(pIn + 4);   // y1 z1 x2 y2
+        __m128 c = _mm_loadu_ps(pIn + 8);   // z2 x3 y3 z3
+        __m128 t = _mm_shuffle_ps(a, b, _MM_SHUFFLE(0, 0, 3, 3));  // x1 x1 y1 y1
+        _mm_storeu_ps(pOut, _mm_shuffle_ps(a, t, _MM_SHUFFLE(2, 0, 1, 0)));     // x0 y0 x1 y1
+        _mm_storeu_ps(pOut + 4, _mm_shuffle_ps(b, c, _MM_SHUFFLE(2, 1, 3, 2))); // x2 y2 x3 y3
+        pIn += 12;
+        pOut += 8;
+    }
+#endif
+
+    for ( ; i < NumVertices ; i++) {
+        pDst[i] = Vector2f(pSrc[i].x, pSrc[i].y);
+    }
+}
 
 Mesh::Mesh()
 {
     m_VAO = 0;
+    m_depthVAO = 0;
     ZERO_MEM(m_Buffers);
+    ZERO_MEM(m_visibilityTextures);
+    m_numMeshlets = 0;
+    m_numMeshletCommands = 0;
+    m_numPlacementSlots = 1;
+    m_firstInstance = 0;
+    m_depthFirstInstance = 0;
+    m_depthDivisor = 1;
+    m_streamingState = STREAMING_NONE;
+    m_stopStreaming = false;
+    m_pImporter = NULL;
+    m_pStreamingScene = NULL;
+    m_numPendingJobs = 0;
+    memset(&m_streamingMapping, 0, sizeof(m_streamingMapping));
+    m_meshletCulling = false;
+    m_drawCommandCapacity = 0;
+    m_pMeshletCullTechnique = NULL;
+    m_pVisibleEntries = NULL;
 }
 
 
 Mesh::~Mesh()
 {
     Clear();
+
+    SAFE_DELETE(m_pMeshletCullTechnique);
 }
 
 
 void Mesh::Clear()
 {
+    StopStreaming();
+
     for (unsigned int i = 0 ; i < m_Textures.size() ; i++) {
-        SAFE_DELETE(m_Textures[i]);
+        AssetRegistry::ReleaseTexture(m_Textures[i]);
+    }
+
+    m_Textures.clear();
+
+    if (m_visibilityTextures[0] != 0) {
+        GLState::DeleteTextures(ARRAY_SIZE_IN_ELEMENTS(m_visibilityTextures), m_visibilityTextures);
+        ZERO_MEM(m_visibilityTextures);
     }
 
     if (m_Buffers[0] != 0) {
-        glDeleteBuffers(ARRAY_SIZE_IN_ELEMENTS(m_Buffers), m_Buffers);
+        GLState::DeleteBuffers(ARRAY_SIZE_IN_ELEMENTS(m_Buffers), m_Buffers);
+        ZERO_MEM(m_Buffers);
     }
+
+    m_Entries.clear();
+    m_materialSamplers.clear();
+    m_numMeshlets = 0;
+    m_numMeshletCommands = 0;
+    m_numPlacementSlots = 1;
+    m_firstInstance = 0;
+    m_depthFirstInstance = 0;
+    m_drawCommandCapacity = 0;
        
     if (m_VAO != 0) {
-        glDeleteVertexArrays(1, &m_VAO);
+        GLState::DeleteVertexArrays(1, &m_VAO);
+        GLState::DeleteVertexArrays(1, &m_depthVAO);
         m_VAO = 0;
+        m_depthVAO = 0;
     }
 }
 
@@ -63,17 +188,18 @@ bool Mesh::LoadMesh(const string& Filename)
     // Release the previously loaded mesh (if it exists)
     Clear();
  
-    // Create the VAO
+    // Create the VAOs
     glGenVertexArrays(1, &m_VAO);   
-    glBindVertexArray(m_VAO);
+    glGenVertexArrays(1, &m_depthVAO);
+    GLState::BindVertexArray(m_VAO);
     
     // Create the buffers for the vertices attributes
-    glGenBuffers(ARRAY_SIZE_IN_ELEMENTS(m_Buffers), m_Buffers);
+    GLState::CreateBuffers(ARRAY_SIZE_IN_ELEMENTS(m_Buffers), m_Buffers);
 
     bool Ret = false;
     Assimp::Importer Importer;
 
-    const aiScene* pScene = Importer.ReadFile(Filename.c_str(), aiProcess_Triangulate | aiProcess_GenSmoothNormals | aiProcess_FlipUVs);
+    const aiScene* pScene = Importer.ReadFile(Filename.c_str(), ASSIMP_LOAD_FLAGS);
     
     if (pScene) {
         Ret = InitFromScene(pScene, Filename);
@@ -83,201 +209,1703 @@ bool Mesh::LoadMesh(const string& Filename)
     }
 
     // Make sure the VAO is not changed from the outside
-    glBindVertexArray(0);	
+    GLState::BindVertexArray(0);
 
     return Ret;
 }
 
 bool Mesh::InitFromScene(const aiScene* pScene, const string& Filename)
 {  
-    m_Entries.resize(pScene->mNumMeshes);
     m_Textures.resize(pScene->mNumMaterials);
 
-    vector<Vector3f> Positions;
-    vector<Vector3f> Normals;
-    vector<Vector2f> TexCoords;
-    vector<unsigned int> Indices;
-
     unsigned int NumVertices = 0;
     unsigned int NumIndices = 0;
     
-    // Count the number of vertices and indices
-    for (unsigned int i = 0 ; i < m_Entries.size() ; i++) {
-        m_Entries[i].MaterialIndex = pScene->mMeshes[i]->mMaterialIndex;        
-        m_Entries[i].NumIndices = pScene->mMeshes[i]->mNumFaces * 3;
-        m_Entries[i].BaseVertex = NumVertices;
-        m_Entries[i].BaseIndex = NumIndices;
-        
-        NumVertices += pScene->mMeshes[i]->mNumVertices;
-        NumIndices  += m_Entries[i].NumIndices;
+    if (!InitEntries(pScene, m_Entries, NumVertices, NumIndices)) {
+        printf("Error parsing '%s': the scene has no geometry\n", Filename.c_str());
+        return false;
     }
+
+    InitPlacements(pScene, Filename);
     
-    // Reserve space in the vectors for the vertex attributes and indices
-    Positions.reserve(NumVertices);
-    Normals.reserve(NumVertices);
-    TexCoords.reserve(NumVertices);
-    Indices.reserve(NumIndices);
+    // Allocate the final storage of the vertex attributes and the indices and map it.
+    // The meshes are converted straight into the mappings so there is no intermediate copy.
+    Vector3f* pPositions = (Vector3f*)MapStaticBuffer(m_Buffers[POS_VB], sizeof(Vector3f) * NumVertices);
+    Vector2f* pTexCoords = (Vector2f*)MapStaticBuffer(m_Buffers[TEXCOORD_VB], sizeof(Vector2f) * NumVertices);
+    Vector3f* pNormals = (Vector3f*)MapStaticBuffer(m_Buffers[NORMAL_VB], sizeof(Vector3f) * NumVertices);
+    unsigned int* pIndices = (unsigned int*)MapStaticBuffer(m_Buffers[INDEX_BUFFER], sizeof(unsigned int) * NumIndices);
+
+    if (pPositions && pTexCoords && pNormals && pIndices) {
+        // Initialize the meshes in the scene one by one
+        for (unsigned int i = 0 ; i < m_Entries.size() ; i++) {
+            const aiMesh* paiMesh = pScene->mMeshes[m_Entries[i].MeshIndex];
+            InitMesh(paiMesh,
+                     pPositions + m_Entries[i].BaseVertex,
+                     pNormals + m_Entries[i].BaseVertex,
+                     pTexCoords + m_Entries[i].BaseVertex,
+                     pIndices + m_Entries[i].BaseIndex);
+        }
+    }
+
+    // Unmap everything that was mapped, even if one of the mappings has failed.
+    // glUnmapBuffer returns GL_FALSE if the contents were lost while mapped.
+    bool Ret = (pPositions && pTexCoords && pNormals && pIndices);
+    Ret = UnmapStaticBuffer(m_Buffers[POS_VB], pPositions) && Ret;
+    Ret = UnmapStaticBuffer(m_Buffers[TEXCOORD_VB], pTexCoords) && Ret;
+    Ret = UnmapStaticBuffer(m_Buffers[NORMAL_VB], pNormals) && Ret;
+    Ret = UnmapStaticBuffer(m_Buffers[INDEX_BUFFER], pIndices) && Ret;
+
+    if (!Ret) {
+        printf("Error uploading the vertex data of '%s'\n", Filename.c_str());
+        return false;
+    }
+
+    // Split the entries into meshlets for the GPU culling pass
+    vector<Meshlet> Meshlets;
 
-    // Initialize the meshes in the scene one by one
     for (unsigned int i = 0 ; i < m_Entries.size() ; i++) {
-        const aiMesh* paiMesh = pScene->mMeshes[i];
-        InitMesh(paiMesh, Positions, Normals, TexCoords, Indices);
+        m_Entries[i].FirstMeshlet = Meshlets.size();
+        InitMeshlets(pScene->mMeshes[m_Entries[i].MeshIndex], m_Entries[i], Meshlets);
+        m_Entries[i].NumMeshlets = Meshlets.size() - m_Entries[i].FirstMeshlet;
+        m_Entries[i].Resident = true;
     }
 
+    UploadMeshlets(Meshlets);
+
     if (!InitMaterials(pScene, Filename)) {
         return false;
     }
 
-    // Generate and populate the buffers with vertex attributes and the indices
-  	glBindBuffer(GL_ARRAY_BUFFER, m_Buffers[POS_VB]);
-    glBufferData(GL_ARRAY_BUFFER, sizeof(Positions[0]) * Positions.size(), &Positions[0], GL_STATIC_DRAW);
-    glEnableVertexAttribArray(POSITION_LOCATION);
-    glVertexAttribPointer(POSITION_LOCATION, 3, GL_FLOAT, GL_FALSE, 0, 0);    
+    InitVertexAttributes();
 
-    glBindBuffer(GL_ARRAY_BUFFER, m_Buffers[TEXCOORD_VB]);
-	glBufferData(GL_ARRAY_BUFFER, sizeof(TexCoords[0]) * TexCoords.size(), &TexCoords[0], GL_STATIC_DRAW);
-    glEnableVertexAttribArray(TEX_COORD_LOCATION);
-    glVertexAttribPointer(TEX_COORD_LOCATION, 2, GL_FLOAT, GL_FALSE, 0, 0);
+    return GLCheckError();
+}
 
-   	glBindBuffer(GL_ARRAY_BUFFER, m_Buffers[NORMAL_VB]);
-	glBufferData(GL_ARRAY_BUFFER, sizeof(Normals[0]) * Normals.size(), &Normals[0], GL_STATIC_DRAW);
-    glEnableVertexAttribArray(NORMAL_LOCATION);
-    glVertexAttribPointer(NORMAL_LOCATION, 3, GL_FLOAT, GL_FALSE, 0, 0);
 
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, m_Buffers[INDEX_BUFFER]);
-	glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(Indices[0]) * Indices.size(), &Indices[0], GL_STATIC_DRAW);
+// Position and orientation of a sub-mesh that do not depend on where the copy was
+// placed in the scene: the centroid and the principal axes of the vertices.
+struct RigidFrame {
+    double Center[3];
+    double Axes[3][3];      // rows, the identity when the principal axes are ambiguous
+    double Radius;          // largest distance of a vertex from the centroid
+};
 
-    glBindBuffer(GL_ARRAY_BUFFER, m_Buffers[WVP_MAT_VB]);
-    
-    for (unsigned int i = 0; i < 4 ; i++) {
-        glEnableVertexAttribArray(WVP_LOCATION + i);
-        glVertexAttribPointer(WVP_LOCATION + i, 4, GL_FLOAT, GL_FALSE, sizeof(Matrix4f), (const GLvoid*)(sizeof(GLfloat) * i * 4));
-        glVertexAttribDivisor(WVP_LOCATION + i, 1);
+
+// Diagonalizes the symmetric matrix A with Jacobi rotations. The eigenvectors end up
+// in the columns of V and the eigenvalues on the diagonal of A.
+static void JacobiEigen(double A[3][3], double V[3][3])
+{
+    for (int i = 0 ; i < 3 ; i++) {
+        for (int j = 0 ; j < 3 ; j++) {
+            V[i][j] = (i == j) ? 1.0 : 0.0;
+        }
     }
 
-    glBindBuffer(GL_ARRAY_BUFFER, m_Buffers[WORLD_MAT_VB]);
+    for (int Sweep = 0 ; Sweep < 32 ; Sweep++) {
+        const double OffDiagonal = fabs(A[0][1]) + fabs(A[0][2]) + fabs(A[1][2]);
+        const double Diagonal = fabs(A[0][0]) + fabs(A[1][1]) + fabs(A[2][2]);
 
-    for (unsigned int i = 0; i < 4 ; i++) {
-        glEnableVertexAttribArray(WORLD_LOCATION + i);
-        glVertexAttribPointer(WORLD_LOCATION + i, 4, GL_FLOAT, GL_FALSE, sizeof(Matrix4f), (const GLvoid*)(sizeof(GLfloat) * i * 4));
-        glVertexAttribDivisor(WORLD_LOCATION + i, 1);
+        if (OffDiagonal <= 1e-15 * Diagonal) {
+            break;
+        }
+
+        for (int p = 0 ; p < 2 ; p++) {
+            for (int q = p + 1 ; q < 3 ; q++) {
+                if (A[p][q] == 0.0) {
+                    continue;
+                }
+
+                const double Theta = (A[q][q] - A[p][p]) / (2.0 * A[p][q]);
+                const double t = (Theta >= 0.0 ? 1.0 : -1.0) / (fabs(Theta) + sqrt(Theta * Theta + 1.0));
+                const double c = 1.0 / sqrt(t * t + 1.0);
+                const double s = t * c;
+
+                for (int k = 0 ; k < 3 ; k++) {
+                    const double akp = A[k][p];
+                    const double akq = A[k][q];
+                    A[k][p] = c * akp - s * akq;
+                    A[k][q] = s * akp + c * akq;
+                }
+
+                for (int k = 0 ; k < 3 ; k++) {
+                    const double apk = A[p][k];
+                    const double aqk = A[q][k];
+                    A[p][k] = c * apk - s * aqk;
+                    A[q][k] = s * apk + c * aqk;
+                }
+
+                for (int k = 0 ; k < 3 ; k++) {
+                    const double vkp = V[k][p];
+                    const double vkq = V[k][q];
+                    V[k][p] = c * vkp - s * vkq;
+                    V[k][q] = s * vkp + c * vkq;
+                }
+            }
+        }
     }
-    
-    return GLCheckError();
 }
 
-void Mesh::InitMesh(const aiMesh* paiMesh,
-                    vector<Vector3f>& Positions,
-                    vector<Vector3f>& Normals,
-                    vector<Vector2f>& TexCoords,
-                    vector<unsigned int>& Indices)
-{    
-    const aiVector3D Zero3D(0.0f, 0.0f, 0.0f);
 
-    // Populate the vertex attribute vectors
-    for (unsigned int i = 0 ; i < paiMesh->mNumVertices ; i++) {
-        const aiVector3D* pPos      = &(paiMesh->mVertices[i]);
-        const aiVector3D* pNormal   = &(paiMesh->mNormals[i]);
-        const aiVector3D* pTexCoord = paiMesh->HasTextureCoords(0) ? &(paiMesh->mTextureCoords[0][i]) : &Zero3D;
+// The principal axes are sorted by variance and their signs are fixed by the skew of
+// the vertices along them. Symmetric meshes have no such frame and fall back to the
+// world axes, so only their translated copies are found.
+static void ComputeRigidFrame(const aiMesh* paiMesh, RigidFrame& Frame)
+{
+    const unsigned int NumVertices = paiMesh->mNumVertices;
+
+    memset(&Frame, 0, sizeof(Frame));
 
-        Positions.push_back(Vector3f(pPos->x, pPos->y, pPos->z));
-        Normals.push_back(Vector3f(pNormal->x, pNormal->y, pNormal->z));
-        TexCoords.push_back(Vector2f(pTexCoord->x, pTexCoord->y));
+    for (int i = 0 ; i < 3 ; i++) {
+        Frame.Axes[i][i] = 1.0;
     }
 
-    // Populate the index buffer
-    for (unsigned int i = 0 ; i < paiMesh->mNumFaces ; i++) {
-        const aiFace& Face = paiMesh->mFaces[i];
-        assert(Face.mNumIndices == 3);
-        Indices.push_back(Face.mIndices[0]);
-        Indices.push_back(Face.mIndices[1]);
-        Indices.push_back(Face.mIndices[2]);
+    if (NumVertices == 0) {
+        return;
+    }
+
+    for (unsigned int i = 0 ; i < NumVertices ; i++) {
+        const aiVector3D& v = paiMesh->mVertices[i];
+        Frame.Center[0] += v.x;
+        Frame.Center[1] += v.y;
+        Frame.Center[2] += v.z;
+    }
+
+    double Covariance[3][3] = { { 0.0 } };
+
+    for (int i = 0 ; i < 3 ; i++) {
+        Frame.Center[i] /= NumVertices;
+    }
+
+    for (unsigned int i = 0 ; i < NumVertices ; i++) {
+        const aiVector3D& v = paiMesh->mVertices[i];
+        const double d[3] = { v.x - Frame.Center[0], v.y - Frame.Center[1], v.z - Frame.Center[2] };
+
+        for (int j = 0 ; j < 3 ; j++) {
+            for (int k = 0 ; k < 3 ; k++) {
+                Covariance[j][k] += d[j] * d[k];
+            }
+        }
+
+        Frame.Radius = max(Frame.Radius, sqrt(d[0] * d[0] + d[1] * d[1] + d[2] * d[2]));
+    }
+
+    double V[3][3];
+    JacobiEigen(Covariance, V);
+
+    // Sort the axes by decreasing variance
+    int Order[3] = { 0, 1, 2 };
+
+    for (int i = 0 ; i < 2 ; i++) {
+        for (int j = i + 1 ; j < 3 ; j++) {
+            if (Covariance[Order[j]][Order[j]] > Covariance[Order[i]][Order[i]]) {
+                swap(Order[i], Order[j]);
+            }
+        }
+    }
+
+    const double e0 = Covariance[Order[0]][Order[0]];
+    const double e1 = Covariance[Order[1]][Order[1]];
+    const double e2 = Covariance[Order[2]][Order[2]];
+
+    if (e0 <= 0.0 || e0 - e1 < 1e-3 * e0 || e1 - e2 < 1e-3 * e0) {
+        return;
+    }
+
+    double Axes[3][3];
+
+    for (int i = 0 ; i < 2 ; i++) {
+        for (int k = 0 ; k < 3 ; k++) {
+            Axes[i][k] = V[k][Order[i]];
+        }
+
+        double Skew = 0.0;
+        double AbsSkew = 0.0;
+
+        for (unsigned int j = 0 ; j < NumVertices ; j++) {
+            const aiVector3D& v = paiMesh->mVertices[j];
+            const double d = (v.x - Frame.Center[0]) * Axes[i][0] +
+                             (v.y - Frame.Center[1]) * Axes[i][1] +
+                             (v.z - Frame.Center[2]) * Axes[i][2];
+            Skew += d * d * d;
+            AbsSkew += fabs(d * d * d);
+        }
+
+        if (fabs(Skew) < 1e-3 * AbsSkew) {
+            return;
+        }
+
+        if (Skew < 0.0) {
+            for (int k = 0 ; k < 3 ; k++) {
+                Axes[i][k] = -Axes[i][k];
+            }
+        }
     }
+
+    // The third axis completes a right handed frame so mirrored copies never match
+    Axes[2][0] = Axes[0][1] * Axes[1][2] - Axes[0][2] * Axes[1][1];
+    Axes[2][1] = Axes[0][2] * Axes[1][0] - Axes[0][0] * Axes[1][2];
+    Axes[2][2] = Axes[0][0] * Axes[1][1] - Axes[0][1] * Axes[1][0];
+
+    memcpy(Frame.Axes, Axes, sizeof(Axes));
 }
 
-bool Mesh::InitMaterials(const aiScene* pScene, const string& Filename)
+
+static void HashBytes(unsigned long long& Hash, const void* pData, size_t Size)
 {
-    // Extract the directory part from the file name
-    string::size_type SlashIndex = Filename.find_last_of("/");
-    string Dir;
+    const unsigned char* p = (const unsigned char*)pData;
 
-    if (SlashIndex == string::npos) {
-        Dir = ".";
+    for (size_t i = 0 ; i < Size ; i++) {
+        Hash ^= p[i];
+        Hash *= 0x100000001b3ULL;
     }
-    else if (SlashIndex == 0) {
-        Dir = "/";
+}
+
+
+// FNV-1a of the topology, the material and the quantized vertices expressed in the
+// rigid frame. Copies of a mesh land in the same bucket (unless a coordinate sits on
+// a quantization boundary, which only costs an instancing opportunity).
+static unsigned long long HashRigidMesh(const aiMesh* paiMesh, const RigidFrame& Frame)
+{
+    unsigned long long Hash = 0xcbf29ce484222325ULL;
+
+    HashBytes(Hash, &paiMesh->mMaterialIndex, sizeof(paiMesh->mMaterialIndex));
+    HashBytes(Hash, &paiMesh->mNumVertices, sizeof(paiMesh->mNumVertices));
+    HashBytes(Hash, &paiMesh->mNumFaces, sizeof(paiMesh->mNumFaces));
+
+    for (unsigned int i = 0 ; i < paiMesh->mNumFaces ; i++) {
+        HashBytes(Hash, paiMesh->mFaces[i].mIndices, sizeof(unsigned int) * paiMesh->mFaces[i].mNumIndices);
     }
-    else {
-        Dir = Filename.substr(0, SlashIndex);
+
+    const double Step = max(Frame.Radius * 1e-3, 1e-6);
+
+    for (unsigned int i = 0 ; i < paiMesh->mNumVertices ; i++) {
+        const aiVector3D& v = paiMesh->mVertices[i];
+        const double d[3] = { v.x - Frame.Center[0], v.y - Frame.Center[1], v.z - Frame.Center[2] };
+        long long q[3];
+
+        for (int j = 0 ; j < 3 ; j++) {
+            q[j] = llround((d[0] * Frame.Axes[j][0] + d[1] * Frame.Axes[j][1] + d[2] * Frame.Axes[j][2]) / Step);
+        }
+
+        HashBytes(Hash, q, sizeof(q));
     }
 
-    bool Ret = true;
+    if (paiMesh->HasTextureCoords(0)) {
+        for (unsigned int i = 0 ; i < paiMesh->mNumVertices ; i++) {
+            const aiVector3D& t = paiMesh->mTextureCoords[0][i];
+            const long long q[2] = { llround(t.x * 1024.0), llround(t.y * 1024.0) };
+            HashBytes(Hash, q, sizeof(q));
+        }
+    }
 
-    // Initialize the materials
-    for (unsigned int i = 0 ; i < pScene->mNumMaterials ; i++) {
-        const aiMaterial* pMaterial = pScene->mMaterials[i];
+    return Hash;
+}
 
-        m_Textures[i] = NULL;
 
-        if (pMaterial->GetTextureCount(aiTextureType_DIFFUSE) > 0) {
-            aiString Path;
+// Checks that B is A moved by a rigid transform, vertex by vertex, and returns the
+// transform from the object space of A to the one of B.
+static bool MatchRigidMesh(const aiMesh* pA, const RigidFrame& FrameA,
+                           const aiMesh* pB, const RigidFrame& FrameB,
+                           Matrix4f& Transform)
+{
+    if (pA->mMaterialIndex != pB->mMaterialIndex ||
+        pA->mNumVertices != pB->mNumVertices ||
+        pA->mNumFaces != pB->mNumFaces ||
+        pA->HasTextureCoords(0) != pB->HasTextureCoords(0) ||
+        fabs(FrameA.Radius - FrameB.Radius) > 1e-4 * FrameA.Radius + 1e-6) {
+        return false;
+    }
 
-            if (pMaterial->GetTexture(aiTextureType_DIFFUSE, 0, &Path, NULL, NULL, NULL, NULL, NULL) == AI_SUCCESS) {
-                string p(Path.data);
-                
-                if (p.substr(0, 2) == ".\\") {                    
-                    p = p.substr(2, p.size() - 2);
-                }
-                               
-                string FullPath = Dir + "/" + p;
-                    
-                m_Textures[i] = new Texture(GL_TEXTURE_2D, FullPath.c_str());
-
-                if (!m_Textures[i]->Load()) {
-                    printf("Error loading texture '%s'\n", FullPath.c_str());
-                    delete m_Textures[i];
-                    m_Textures[i] = NULL;
-                    Ret = false;
-                }
-                else {
-                    printf("Loaded texture '%s'\n", FullPath.c_str());
-                }
+    for (unsigned int i = 0 ; i < pA->mNumFaces ; i++) {
+        if (memcmp(pA->mFaces[i].mIndices, pB->mFaces[i].mIndices, sizeof(unsigned int) * 3) != 0) {
+            return false;
+        }
+    }
+
+    // Rotation = AxesB^T * AxesA, Translation = CenterB - Rotation * CenterA
+    double Rotation[3][3];
+    double Translation[3];
+
+    for (int i = 0 ; i < 3 ; i++) {
+        for (int j = 0 ; j < 3 ; j++) {
+            Rotation[i][j] = FrameB.Axes[0][i] * FrameA.Axes[0][j] +
+                             FrameB.Axes[1][i] * FrameA.Axes[1][j] +
+                             FrameB.Axes[2][i] * FrameA.Axes[2][j];
+        }
+    }
+
+    for (int i = 0 ; i < 3 ; i++) {
+        Translation[i] = FrameB.Center[i] - (Rotation[i][0] * FrameA.Center[0] +
+                                             Rotation[i][1] * FrameA.Center[1] +
+                                             Rotation[i][2] * FrameA.Center[2]);
+    }
+
+    const double Tolerance = 1e-4 * FrameA.Radius + 1e-6;
+
+    for (unsigned int i = 0 ; i < pA->mNumVertices ; i++) {
+        const aiVector3D& a = pA->mVertices[i];
+        const aiVector3D& b = pB->mVertices[i];
+        const aiVector3D& na = pA->mNormals[i];
+        const aiVector3D& nb = pB->mNormals[i];
+        const double p[3] = { b.x, b.y, b.z };
+        const double n[3] = { nb.x, nb.y, nb.z };
+
+        for (int j = 0 ; j < 3 ; j++) {
+            const double Pos = Rotation[j][0] * a.x + Rotation[j][1] * a.y + Rotation[j][2] * a.z + Translation[j];
+            const double Normal = Rotation[j][0] * na.x + Rotation[j][1] * na.y + Rotation[j][2] * na.z;
+
+            if (fabs(Pos - p[j]) > Tolerance || fabs(Normal - n[j]) > 1e-3) {
+                return false;
             }
         }
+
+        if (pA->HasTextureCoords(0) &&
+            (fabs(pA->mTextureCoords[0][i].x - pB->mTextureCoords[0][i].x) > 1e-5f ||
+             fabs(pA->mTextureCoords[0][i].y - pB->mTextureCoords[0][i].y) > 1e-5f)) {
+            return false;
+        }
     }
 
-    return Ret;
+    Transform.InitIdentity();
+
+    for (int i = 0 ; i < 3 ; i++) {
+        for (int j = 0 ; j < 3 ; j++) {
+            Transform.m[i][j] = (float)Rotation[i][j];
+        }
+
+        Transform.m[i][3] = (float)Translation[i];
+    }
+
+    return true;
 }
 
 
-void Mesh::Render(unsigned int NumInstances, const Matrix4f* WVPMats, const Matrix4f* WorldMats)
-{        
-    glBindBuffer(GL_ARRAY_BUFFER, m_Buffers[WVP_MAT_VB]);
-    glBufferData(GL_ARRAY_BUFFER, sizeof(Matrix4f) * NumInstances, WVPMats, GL_DYNAMIC_DRAW);
+// Lays out the entries of the scene back to back in the shared vertex and index
+// buffers and computes their bounding spheres. Sub-meshes that are rigidly moved
+// copies of an earlier one are not stored again but become placements of its entry.
+// Returns false if there is no geometry.
+bool Mesh::InitEntries(const aiScene* pScene, vector<MeshEntry>& Entries, unsigned int& NumVertices, unsigned int& NumIndices)
+{
+    Entries.clear();
 
-    glBindBuffer(GL_ARRAY_BUFFER, m_Buffers[WORLD_MAT_VB]);
-    glBufferData(GL_ARRAY_BUFFER, sizeof(Matrix4f) * NumInstances, WorldMats, GL_DYNAMIC_DRAW);
+    NumVertices = 0;
+    NumIndices = 0;
 
-    glBindVertexArray(m_VAO);
+    vector<RigidFrame> Frames(pScene->mNumMeshes);
+    map<unsigned long long, vector<unsigned int> > Buckets;     // hash -> entries
     
-    for (unsigned int i = 0 ; i < m_Entries.size() ; i++) {
-        const unsigned int MaterialIndex = m_Entries[i].MaterialIndex;
+    for (unsigned int i = 0 ; i < pScene->mNumMeshes ; i++) {
+        const aiMesh* paiMesh = pScene->mMeshes[i];
+
+        ComputeRigidFrame(paiMesh, Frames[i]);
+
+        vector<unsigned int>& Bucket = Buckets[HashRigidMesh(paiMesh, Frames[i])];
+        bool Instanced = false;
+
+        for (unsigned int j = 0 ; j < Bucket.size() && !Instanced ; j++) {
+            MeshEntry& Entry = Entries[Bucket[j]];
+            Matrix4f Placement;
+
+            if (MatchRigidMesh(pScene->mMeshes[Entry.MeshIndex], Frames[Entry.MeshIndex], paiMesh, Frames[i], Placement)) {
+                Entry.Placements.push_back(Placement);
+                Instanced = true;
+            }
+        }
 
-        assert(MaterialIndex < m_Textures.size());
+        if (Instanced) {
+            continue;
+        }
+
+        Bucket.push_back(Entries.size());
+        Entries.push_back(MeshEntry());
+
+        MeshEntry& Entry = Entries.back();
+        Entry.MeshIndex = i;
+        Entry.MaterialIndex = paiMesh->mMaterialIndex;        
+        Entry.NumIndices = paiMesh->mNumFaces * 3;
+        Entry.BaseVertex = NumVertices;
+        Entry.BaseIndex = NumIndices;
+        Entry.Placements.resize(1);
+        Entry.Placements[0].InitIdentity();
         
-        if (m_Textures[MaterialIndex]) {
-            m_Textures[MaterialIndex]->Bind(GL_TEXTURE0);
+        NumVertices += paiMesh->mNumVertices;
+        NumIndices  += Entry.NumIndices;
+
+        // Bounding box and the sphere around its center
+        Vector3f Min(FLT_MAX, FLT_MAX, FLT_MAX);
+        Vector3f Max(-FLT_MAX, -FLT_MAX, -FLT_MAX);
+
+        for (unsigned int j = 0 ; j < paiMesh->mNumVertices ; j++) {
+            const aiVector3D& v = paiMesh->mVertices[j];
+            Min = Vector3f(min(Min.x, v.x), min(Min.y, v.y), min(Min.z, v.z));
+            Max = Vector3f(max(Max.x, v.x), max(Max.y, v.y), max(Max.z, v.z));
         }
 
-		glDrawElementsInstancedBaseVertex(GL_TRIANGLES, 
-                                          m_Entries[i].NumIndices, 
-                                          GL_UNSIGNED_INT, 
-                                          (void*)(sizeof(unsigned int) * m_Entries[i].BaseIndex), 
-                                          NumInstances,
-                                          m_Entries[i].BaseVertex);
+        if (paiMesh->mNumVertices > 0) {
+            const Vector3f Extent = (Max - Min) * 0.5f;
+            Entry.Center = (Min + Max) * 0.5f;
+            Entry.Radius = sqrtf(Extent.x * Extent.x + Extent.y * Extent.y + Extent.z * Extent.z);
+            Entry.BoxMin = Min;
+            Entry.BoxMax = Max;
+        }
+    }
+
+    // The occluders are kept for the entries that are large compared to the whole mesh,
+    // with their copies counted in
+    Vector3f MeshMin(FLT_MAX, FLT_MAX, FLT_MAX);
+    Vector3f MeshMax(-FLT_MAX, -FLT_MAX, -FLT_MAX);
+
+    for (unsigned int i = 0 ; i < Entries.size() ; i++) {
+        const MeshEntry& Entry = Entries[i];
+
+        for (unsigned int j = 0 ; j < Entry.Placements.size() ; j++) {
+            for (unsigned int k = 0 ; k < 8 ; k++) {
+                const Vector4f Corner((k & 1) ? Entry.BoxMax.x : Entry.BoxMin.x,
+                                      (k & 2) ? Entry.BoxMax.y : Entry.BoxMin.y,
+                                      (k & 4) ? Entry.BoxMax.z : Entry.BoxMin.z,
+                                      1.0f);
+                const Vector4f c = Entry.Placements[j] * Corner;
+                MeshMin = Vector3f(min(MeshMin.x, c.x), min(MeshMin.y, c.y), min(MeshMin.z, c.z));
+                MeshMax = Vector3f(max(MeshMax.x, c.x), max(MeshMax.y, c.y), max(MeshMax.z, c.z));
+            }
+        }
+    }
+
+    const Vector3f MeshSize = MeshMax - MeshMin;
+    const float MeshDiagonal = sqrtf(MeshSize.x * MeshSize.x + MeshSize.y * MeshSize.y + MeshSize.z * MeshSize.z);
+
+    for (unsigned int i = 0 ; i < Entries.size() ; i++) {
+        if (Entries[i].Radius * 2.0f >= MeshDiagonal * MESH_OCCLUDER_MIN_SIZE) {
+            InitOccluder(pScene->mMeshes[Entries[i].MeshIndex], Entries[i]);
+        }
+    }
+
+    return NumVertices > 0 && NumIndices > 0;
+}
+
+
+// The occluder is the subset of the triangles of the entry with the largest area. Being
+// part of the real surface it never extends past it, so it hides nothing the mesh
+// doesn't; what the dropped triangles covered is simply not culled. Merging vertices
+// instead would give triangles that span the concave parts and the gaps of the mesh.
+void Mesh::InitOccluder(const aiMesh* paiMesh, MeshEntry& Entry)
+{
+    vector<pair<float, unsigned int> > Faces;   // twice the area, face
+
+    for (unsigned int i = 0 ; i < paiMesh->mNumFaces ; i++) {
+        const aiFace& Face = paiMesh->mFaces[i];
+
+        if (Face.mNumIndices != 3) {
+            continue;
+        }
+
+        const aiVector3D& v0 = paiMesh->mVertices[Face.mIndices[0]];
+        const aiVector3D& v1 = paiMesh->mVertices[Face.mIndices[1]];
+        const aiVector3D& v2 = paiMesh->mVertices[Face.mIndices[2]];
+        const Vector3f Normal = Vector3f(v1.x - v0.x, v1.y - v0.y, v1.z - v0.z).Cross(Vector3f(v2.x - v0.x, v2.y - v0.y, v2.z - v0.z));
+
+        Faces.push_back(make_pair(sqrtf(Normal.x * Normal.x + Normal.y * Normal.y + Normal.z * Normal.z), i));
+    }
+
+    const unsigned int NumFaces = min((unsigned int)Faces.size(), (unsigned int)MESH_OCCLUDER_MAX_TRIANGLES);
+    partial_sort(Faces.begin(), Faces.begin() + NumFaces, Faces.end(), greater<pair<float, unsigned int> >());
+
+    map<unsigned int, unsigned int> Remap;      // mesh vertex -> occluder vertex
+
+    for (unsigned int i = 0 ; i < NumFaces ; i++) {
+        const aiFace& Face = paiMesh->mFaces[Faces[i].second];
+
+        for (unsigned int j = 0 ; j < 3 ; j++) {
+            map<unsigned int, unsigned int>::iterator it = Remap.find(Face.mIndices[j]);
+
+            if (it == Remap.end()) {
+                const aiVector3D& v = paiMesh->mVertices[Face.mIndices[j]];
+                it = Remap.insert(make_pair(Face.mIndices[j], (unsigned int)Entry.OccluderPositions.size())).first;
+                Entry.OccluderPositions.push_back(Vector3f(v.x, v.y, v.z));
+            }
+
+            Entry.OccluderIndices.push_back(it->second);
+        }
+    }
+}
+
+
+// Repeated entries get a contiguous range of slots in the instance buffers, each one
+// holding the instance matrices of the caller combined with one placement.
+void Mesh::InitPlacements(const aiScene* pScene, const string& Filename)
+{
+    // Slot 0 holds the instance matrices of the caller as is
+    m_numPlacementSlots = 1;
+
+    for (unsigned int i = 0 ; i < m_Entries.size() ; i++) {
+        if (m_Entries[i].Placements.size() > 1) {
+            m_Entries[i].FirstPlacement = m_numPlacementSlots;
+            m_numPlacementSlots += m_Entries[i].Placements.size();
+        }
+        else {
+            m_Entries[i].FirstPlacement = 0;
+        }
+    }
+
+    if (m_Entries.size() < pScene->mNumMeshes) {
+        printf("'%s': %d sub-meshes are instances of %d unique ones\n", Filename.c_str(), pScene->mNumMeshes, (int)m_Entries.size());
+    }
+}
+
+
+// Fills in the placements and the command ranges of the meshlets and uploads them
+void Mesh::UploadMeshlets(vector<Meshlet>& Meshlets)
+{
+    m_numMeshlets = Meshlets.size();
+    m_numMeshletCommands = 0;
+
+    for (unsigned int i = 0 ; i < m_Entries.size() ; i++) {
+        MeshEntry& Entry = m_Entries[i];
+
+        Entry.FirstCommand = m_numMeshletCommands;
+
+        for (unsigned int j = Entry.FirstMeshlet ; j < Entry.FirstMeshlet + Entry.NumMeshlets ; j++) {
+            Meshlets[j].FirstPlacement = Entry.FirstPlacement;
+            Meshlets[j].NumPlacements = Entry.Placements.size();
+            Meshlets[j].FirstCommand = m_numMeshletCommands;
+            m_numMeshletCommands += Meshlets[j].NumPlacements;
+        }
     }
 
-    // Make sure the VAO is not changed from the outside    
-    glBindVertexArray(0);
+    if (m_numMeshlets == 0) {
+        return;
+    }
+
+    GLState::BufferData(m_Buffers[MESHLET_SB], sizeof(Meshlet) * m_numMeshlets, &Meshlets[0], GL_STATIC_DRAW);
 }
 
+
+// Sets up the vertex attributes of both VAOs on top of the buffers. Expects the VAO to
+// be bound and leaves it bound.
+void Mesh::InitVertexAttributes()
+{
+    // Position, texture coordinates, normal, the two matrices and the instance index
+    GLState::SetVertexAttribArrays(0xFFF);
+
+  	GLState::BindBuffer(GL_ARRAY_BUFFER, m_Buffers[POS_VB]);
+    glVertexAttribPointer(POSITION_LOCATION, 3, GL_FLOAT, GL_FALSE, 0, 0);    
+
+    GLState::BindBuffer(GL_ARRAY_BUFFER, m_Buffers[TEXCOORD_VB]);
+    glVertexAttribPointer(TEX_COORD_LOCATION, 2, GL_FLOAT, GL_FALSE, 0, 0);
+
+   	GLState::BindBuffer(GL_ARRAY_BUFFER, m_Buffers[NORMAL_VB]);
+    glVertexAttribPointer(NORMAL_LOCATION, 3, GL_FLOAT, GL_FALSE, 0, 0);
+
+    GLState::BindBuffer(GL_ELEMENT_ARRAY_BUFFER, m_Buffers[INDEX_BUFFER]);
+
+    for (unsigned int i = 0; i < 4 ; i++) {
+        glVertexAttribDivisor(WVP_LOCATION + i, 1);
+        glVertexAttribDivisor(WORLD_LOCATION + i, 1);
+    }
+
+    glVertexAttribDivisor(INSTANCE_LOCATION, 1);
+
+    m_firstInstance = 0xFFFFFFFF;
+    SetInstanceAttributes(0);
+
+    // The depth prepass fetches nothing but the positions and the WVP matrix
+    GLState::BindVertexArray(m_depthVAO);
+    GLState::SetVertexAttribArrays((1 << POSITION_LOCATION) | (0xF << WVP_LOCATION));
+
+    GLState::BindBuffer(GL_ARRAY_BUFFER, m_Buffers[POS_VB]);
+    glVertexAttribPointer(POSITION_LOCATION, 3, GL_FLOAT, GL_FALSE, 0, 0);
+
+    GLState::BindBuffer(GL_ELEMENT_ARRAY_BUFFER, m_Buffers[INDEX_BUFFER]);
+
+    for (unsigned int i = 0; i < 4 ; i++) {
+        glVertexAttribDivisor(WVP_LOCATION + i, 1);
+    }
+
+    m_depthDivisor = 1;
+    m_depthFirstInstance = 0xFFFFFFFF;
+    SetInstanceAttributes(0, true);
+
+    GLState::BindVertexArray(m_VAO);
+}
+
+
+// Points the instance attributes at the given instance of the matrix buffers. This is
+// how the repeated entries reach their slots without base instance support.
+// Expects the VAO, or the depth VAO when DepthOnly is set, to be bound.
+void Mesh::SetInstanceAttributes(unsigned int FirstInstance, bool DepthOnly)
+{
+    unsigned int& CurrentFirstInstance = DepthOnly ? m_depthFirstInstance : m_firstInstance;
+
+    if (FirstInstance == CurrentFirstInstance) {
+        return;
+    }
+
+    const GLsizeiptr Offset = sizeof(Matrix4f) * FirstInstance;
+
+    GLState::BindBuffer(GL_ARRAY_BUFFER, m_Buffers[WVP_MAT_VB]);
+    
+    for (unsigned int i = 0; i < 4 ; i++) {
+        glVertexAttribPointer(WVP_LOCATION + i, 4, GL_FLOAT, GL_FALSE, sizeof(Matrix4f), (const GLvoid*)(Offset + sizeof(GLfloat) * i * 4));
+    }
+
+    CurrentFirstInstance = FirstInstance;
+
+    if (DepthOnly) {
+        return;
+    }
+
+    GLState::BindBuffer(GL_ARRAY_BUFFER, m_Buffers[WORLD_MAT_VB]);
+
+    for (unsigned int i = 0; i < 4 ; i++) {
+        glVertexAttribPointer(WORLD_LOCATION + i, 4, GL_FLOAT, GL_FALSE, sizeof(Matrix4f), (const GLvoid*)(Offset + sizeof(GLfloat) * i * 4));
+    }
+
+    GLState::BindBuffer(GL_ARRAY_BUFFER, m_Buffers[INSTANCE_VB]);
+    glVertexAttribIPointer(INSTANCE_LOCATION, 1, GL_UNSIGNED_INT, 0, (const GLvoid*)(sizeof(unsigned int) * FirstInstance));
+}
+
+void Mesh::InitMesh(const aiMesh* paiMesh,
+                    Vector3f* pPositions,
+                    Vector3f* pNormals,
+                    Vector2f* pTexCoords,
+                    unsigned int* pIndices)
+{    
+    const unsigned int NumVertices = paiMesh->mNumVertices;
+
+    // aiVector3D and Vector3f share the same layout so the positions and the normals
+    // are copied as is
+    memcpy((void*)pPositions, paiMesh->mVertices, sizeof(Vector3f) * NumVertices);
+    memcpy((void*)pNormals, paiMesh->mNormals, sizeof(Vector3f) * NumVertices);
+
+    if (paiMesh->HasTextureCoords(0)) {
+        ConvertTexCoords(paiMesh->mTextureCoords[0], pTexCoords, NumVertices);
+    }
+    else {
+        std::fill(pTexCoords, pTexCoords + NumVertices, Vector2f(0.0f, 0.0f));
+    }
+
+    // Populate the index buffer. Every face owns a separate array of indices
+    // so this is a gather and it stays scalar.
+    for (unsigned int i = 0 ; i < paiMesh->mNumFaces ; i++) {
+        const aiFace& Face = paiMesh->mFaces[i];
+        assert(Face.mNumIndices == 3);
+        pIndices[0] = Face.mIndices[0];
+        pIndices[1] = Face.mIndices[1];
+        pIndices[2] = Face.mIndices[2];
+        pIndices += 3;
+    }
+}
+
+static inline float Dot(const Vector3f& a, const Vector3f& b)
+{
+    return a.x * b.x + a.y * b.y + a.z * b.z;
+}
+
+
+static inline Vector3f ToVector3f(const aiVector3D& v)
+{
+    return Vector3f(v.x, v.y, v.z);
+}
+
+
+// Counts the vertices of a face that are not referenced yet by the current meshlet
+static unsigned int CountNewVertices(const aiFace& Face, const vector<unsigned int>& VertexStamp, unsigned int Stamp)
+{
+    unsigned int NewVertices = 0;
+
+    for (unsigned int j = 0 ; j < 3 ; j++) {
+        const unsigned int Index = Face.mIndices[j];
+
+        if (VertexStamp[Index] != Stamp &&
+            (j < 1 || Face.mIndices[0] != Index) &&
+            (j < 2 || Face.mIndices[1] != Index)) {
+            NewVertices++;
+        }
+    }
+
+    return NewVertices;
+}
+
+
+// Greedily packs consecutive triangles into meshlets until either the vertex or the
+// triangle limit is reached. The triangles keep their order so every meshlet is a
+// contiguous range of the index buffer.
+void Mesh::InitMeshlets(const aiMesh* paiMesh, const MeshEntry& Entry, vector<Meshlet>& Meshlets)
+{
+    // Holds the id of the last meshlet that referenced each vertex
+    vector<unsigned int> VertexStamp(paiMesh->mNumVertices, 0xFFFFFFFF);
+    unsigned int Stamp = 0;
+    unsigned int FirstFace = 0;
+    unsigned int NumFaces = 0;
+    unsigned int NumVertices = 0;
+
+    for (unsigned int i = 0 ; i < paiMesh->mNumFaces ; i++) {
+        const aiFace& Face = paiMesh->mFaces[i];
+
+        unsigned int NewVertices = CountNewVertices(Face, VertexStamp, Stamp);
+
+        if (NumFaces == MESHLET_MAX_TRIANGLES || NumVertices + NewVertices > MESHLET_MAX_VERTICES) {
+            AddMeshlet(paiMesh, Entry, FirstFace, NumFaces, Meshlets);
+            Stamp++;
+            FirstFace = i;
+            NumFaces = 0;
+            NumVertices = 0;
+            NewVertices = CountNewVertices(Face, VertexStamp, Stamp);
+        }
+
+        for (unsigned int j = 0 ; j < 3 ; j++) {
+            VertexStamp[Face.mIndices[j]] = Stamp;
+        }
+
+        NumVertices += NewVertices;
+        NumFaces++;
+    }
+
+    if (NumFaces > 0) {
+        AddMeshlet(paiMesh, Entry, FirstFace, NumFaces, Meshlets);
+    }
+}
+
+
+void Mesh::AddMeshlet(const aiMesh* paiMesh, const MeshEntry& Entry, unsigned int FirstFace, unsigned int NumFaces, vector<Meshlet>& Meshlets)
+{
+    // Bounding sphere around the center of the bounding box
+    Vector3f Min(FLT_MAX, FLT_MAX, FLT_MAX);
+    Vector3f Max(-FLT_MAX, -FLT_MAX, -FLT_MAX);
+
+    for (unsigned int i = FirstFace ; i < FirstFace + NumFaces ; i++) {
+        for (unsigned int j = 0 ; j < 3 ; j++) {
+            const aiVector3D& v = paiMesh->mVertices[paiMesh->mFaces[i].mIndices[j]];
+            Min = Vector3f(min(Min.x, v.x), min(Min.y, v.y), min(Min.z, v.z));
+            Max = Vector3f(max(Max.x, v.x), max(Max.y, v.y), max(Max.z, v.z));
+        }
+    }
+
+    const Vector3f Center = (Min + Max) * 0.5f;
+    float RadiusSq = 0.0f;
+
+    // The cone axis is the average of the face normals. The geometric normals are
+    // flipped to agree with the vertex normals so the winding order does not matter.
+    vector<Vector3f> FaceNormals;
+    FaceNormals.reserve(NumFaces);
+    Vector3f Axis(0.0f, 0.0f, 0.0f);
+
+    for (unsigned int i = FirstFace ; i < FirstFace + NumFaces ; i++) {
+        const aiFace& Face = paiMesh->mFaces[i];
+        const Vector3f a = ToVector3f(paiMesh->mVertices[Face.mIndices[0]]);
+        const Vector3f b = ToVector3f(paiMesh->mVertices[Face.mIndices[1]]);
+        const Vector3f c = ToVector3f(paiMesh->mVertices[Face.mIndices[2]]);
+
+        RadiusSq = max(RadiusSq, Dot(a - Center, a - Center));
+        RadiusSq = max(RadiusSq, Dot(b - Center, b - Center));
+        RadiusSq = max(RadiusSq, Dot(c - Center, c - Center));
+
+        Vector3f Normal = (b - a).Cross(c - a);
+        const float Length = sqrtf(Dot(Normal, Normal));
+
+        if (Length < 1e-12f) {
+            continue;
+        }
+
+        Normal *= 1.0f / Length;
+
+        const Vector3f VertexNormal = ToVector3f(paiMesh->mNormals[Face.mIndices[0]]) +
+                                      ToVector3f(paiMesh->mNormals[Face.mIndices[1]]) +
+                                      ToVector3f(paiMesh->mNormals[Face.mIndices[2]]);
+
+        if (Dot(Normal, VertexNormal) < 0.0f) {
+            Normal *= -1.0f;
+        }
+
+        FaceNormals.push_back(Normal);
+        Axis += Normal;
+    }
+
+    float Cutoff = 1.0f;
+    const float AxisLength = sqrtf(Dot(Axis, Axis));
+
+    if (AxisLength > 1e-6f) {
+        Axis *= 1.0f / AxisLength;
+
+        float MinDot = 1.0f;
+
+        for (unsigned int i = 0 ; i < FaceNormals.size() ; i++) {
+            MinDot = min(MinDot, Dot(Axis, FaceNormals[i]));
+        }
+
+        // Wider cones than ~85 degrees are practically never back facing as a whole
+        if (MinDot > 0.1f) {
+            Cutoff = sqrtf(1.0f - MinDot * MinDot);
+        }
+    }
+
+    Meshlet m;
+    m.Sphere = Vector4f(Center.x, Center.y, Center.z, sqrtf(RadiusSq));
+    m.Cone = Vector4f(Axis.x, Axis.y, Axis.z, Cutoff);
+    m.FirstIndex = Entry.BaseIndex + FirstFace * 3;
+    m.NumIndices = NumFaces * 3;
+    m.BaseVertex = Entry.BaseVertex;
+    m.FirstPlacement = 0;
+    m.NumPlacements = 1;
+    m.FirstCommand = 0;
+    m.Padding[0] = m.Padding[1] = 0;
+
+    Meshlets.push_back(m);
+}
+
+
+// Extracts the directory part from the file name
+static string GetDirectory(const string& Filename)
+{
+    string::size_type SlashIndex = Filename.find_last_of("/");
+
+    if (SlashIndex == string::npos) {
+        return ".";
+    }
+    else if (SlashIndex == 0) {
+        return "/";
+    }
+
+    return Filename.substr(0, SlashIndex);
+}
+
+
+// Returns false if the material has no diffuse texture
+static bool GetDiffuseTexturePath(const aiMaterial* pMaterial, const string& Dir, string& FullPath)
+{
+    if (pMaterial->GetTextureCount(aiTextureType_DIFFUSE) == 0) {
+        return false;
+    }
+
+    aiString Path;
+
+    if (pMaterial->GetTexture(aiTextureType_DIFFUSE, 0, &Path, NULL, NULL, NULL, NULL, NULL) != AI_SUCCESS) {
+        return false;
+    }
+
+    string p(Path.data);
+    
+    if (p.substr(0, 2) == ".\\") {                    
+        p = p.substr(2, p.size() - 2);
+    }
+                   
+    FullPath = Dir + "/" + p;
+
+    return true;
+}
+
+
+bool Mesh::InitMaterials(const aiScene* pScene, const string& Filename)
+{
+    const string Dir = GetDirectory(Filename);
+
+    bool Ret = true;
+
+    // Initialize the materials
+    for (unsigned int i = 0 ; i < pScene->mNumMaterials ; i++) {
+        m_Textures[i] = NULL;
+
+        string FullPath;
+
+        if (GetDiffuseTexturePath(pScene->mMaterials[i], Dir, FullPath)) {
+            // Decoded in the background, the placeholder is drawn until then
+            m_Textures[i] = AssetRegistry::AcquireTextureAsync(GL_TEXTURE_2D, FullPath);
+
+            if (!m_Textures[i]) {
+                printf("Error loading texture '%s'\n", FullPath.c_str());
+                Ret = false;
+            }
+        }
+    }
+
+    return Ret;
+}
+
+
+bool Mesh::LoadMeshStreaming(const string& Filename)
+{
+    // Release the previously loaded mesh (if it exists)
+    Clear();
+
+    // The workers write straight into persistent mappings of the final buffers
+    if (!GLEW_ARB_buffer_storage) {
+        return LoadMesh(Filename);
+    }
+
+    glGenVertexArrays(1, &m_VAO);   
+    glGenVertexArrays(1, &m_depthVAO);
+    GLState::CreateBuffers(ARRAY_SIZE_IN_ELEMENTS(m_Buffers), m_Buffers);
+
+    m_streamingFilename = Filename;
+    m_pImporter = new Assimp::Importer();
+    m_streamingState = STREAMING_IMPORTING;
+    m_importThread = thread(&Mesh::ImportThread, this);
+
+    return true;
+}
+
+
+// Parses the file and lays out the entries. Only the bounds are known at the end
+// and the buffers are filled later by the streaming threads.
+void Mesh::ImportThread()
+{
+    const aiScene* pScene = m_pImporter->ReadFile(m_streamingFilename.c_str(), ASSIMP_LOAD_FLAGS);
+
+    if (!pScene) {
+        printf("Error parsing '%s': '%s'\n", m_streamingFilename.c_str(), m_pImporter->GetErrorString());
+        m_streamingState = STREAMING_FAILED;
+        return;
+    }
+
+    unsigned int NumVertices = 0;
+    unsigned int NumIndices = 0;
+
+    if (!InitEntries(pScene, m_importedEntries, NumVertices, NumIndices)) {
+        printf("Error parsing '%s': the scene has no geometry\n", m_streamingFilename.c_str());
+        m_streamingState = STREAMING_FAILED;
+        return;
+    }
+
+    m_pStreamingScene = pScene;
+    m_streamingState = STREAMING_IMPORTED;
+}
+
+
+void Mesh::UpdateStreaming(const Vector3f& CameraPos)
+{
+    {
+        lock_guard<mutex> Lock(m_streamingMutex);
+        m_streamingCameraPos = CameraPos;
+    }
+
+    switch (m_streamingState) {
+        case STREAMING_IMPORTED:
+            m_importThread.join();
+
+            if (!StartStreaming()) {
+                m_streamingState = STREAMING_FAILED;
+            }
+            break;
+
+        case STREAMING_LOADING:
+            ProcessStreamingResults();
+
+            if (m_numPendingJobs == 0) {
+                FinishStreaming();
+            }
+            break;
+
+        default:
+            break;
+    }
+}
+
+
+// Allocates and maps the buffers, queues the textures and starts the workers. Runs on the GL thread once the import has finished.
+bool Mesh::StartStreaming()
+{
+    const aiScene* pScene = m_pStreamingScene;
+
+    m_Entries.swap(m_importedEntries);
+    m_Textures.resize(pScene->mNumMaterials, NULL);
+
+    InitPlacements(pScene, m_streamingFilename);
+
+    const MeshEntry& Last = m_Entries.back();
+    const unsigned int NumVertices = Last.BaseVertex + pScene->mMeshes[Last.MeshIndex]->mNumVertices;
+    const unsigned int NumIndices = Last.BaseIndex + Last.NumIndices;
+
+    GLState::BindVertexArray(m_VAO);
+
+    m_streamingMapping.pPositions = (Vector3f*)MapPersistentBuffer(m_Buffers[POS_VB], sizeof(Vector3f) * NumVertices);
+    m_streamingMapping.pTexCoords = (Vector2f*)MapPersistentBuffer(m_Buffers[TEXCOORD_VB], sizeof(Vector2f) * NumVertices);
+    m_streamingMapping.pNormals = (Vector3f*)MapPersistentBuffer(m_Buffers[NORMAL_VB], sizeof(Vector3f) * NumVertices);
+    m_streamingMapping.pIndices = (unsigned int*)MapPersistentBuffer(m_Buffers[INDEX_BUFFER], sizeof(unsigned int) * NumIndices);
+
+    InitVertexAttributes();
+
+    // Make sure the VAO is not changed from the outside
+    GLState::BindVertexArray(0);
+
+    if (!m_streamingMapping.pPositions || !m_streamingMapping.pTexCoords ||
+        !m_streamingMapping.pNormals || !m_streamingMapping.pIndices) {
+        printf("Error mapping the vertex data of '%s'\n", m_streamingFilename.c_str());
+        return false;
+    }
+
+    // One job per entry. The workers are not running yet so the shared state needs
+    // no locking here.
+    m_materialEntries.assign(pScene->mNumMaterials, vector<unsigned int>());
+    m_entryMeshlets.assign(m_Entries.size(), vector<Meshlet>());
+
+    for (unsigned int i = 0 ; i < m_Entries.size() ; i++) {
+        m_streamingJobs.push_back(i);
+        m_materialEntries[m_Entries[i].MaterialIndex].push_back(i);
+    }
+
+    // The textures go to TextureLoader, the material nearest to the camera first
+    const string Dir = GetDirectory(m_streamingFilename);
+
+    for (unsigned int i = 0 ; i < pScene->mNumMaterials ; i++) {
+        string FullPath;
+
+        if (GetDiffuseTexturePath(pScene->mMaterials[i], Dir, FullPath)) {
+            float Distance = FLT_MAX;
+
+            for (unsigned int j = 0 ; j < m_materialEntries[i].size() ; j++) {
+                Distance = min(Distance, GetStreamingDistance(m_materialEntries[i][j]));
+            }
+
+            m_Textures[i] = AssetRegistry::AcquireTextureAsync(GL_TEXTURE_2D, FullPath, Distance);
+
+            if (!m_Textures[i]) {
+                printf("Error loading the texture of material %u in '%s'\n", i, m_streamingFilename.c_str());
+            }
+        }
+    }
+
+    m_numPendingJobs = m_streamingJobs.size();
+    m_streamingState = STREAMING_LOADING;
+
+    // Leave one core to the GL thread
+    const unsigned int NumCores = thread::hardware_concurrency();
+    const unsigned int NumThreads = min(max(NumCores, 2u) - 1, m_numPendingJobs);
+
+    for (unsigned int i = 0 ; i < NumThreads ; i++) {
+        m_streamingThreads.push_back(thread(&Mesh::StreamingThread, this));
+    }
+
+    return true;
+}
+
+
+// Distance from the camera to the bounding sphere of an entry. Expects the streaming
+// mutex to be held once the workers are running.
+float Mesh::GetStreamingDistance(unsigned int EntryIndex) const
+{
+    const MeshEntry& Entry = m_Entries[EntryIndex];
+    const Vector4f Center(Entry.Center.x, Entry.Center.y, Entry.Center.z, 1.0f);
+    float Distance = FLT_MAX;
+
+    for (unsigned int i = 0 ; i < Entry.Placements.size() ; i++) {
+        const Vector4f c = Entry.Placements[i] * Center;
+        const Vector3f d = Vector3f(c.x, c.y, c.z) - m_streamingCameraPos;
+        Distance = min(Distance, max(sqrtf(Dot(d, d)) - Entry.Radius, 0.0f));
+    }
+
+    return Distance;
+}
+
+
+// Takes the entry nearest to the camera until there is nothing left. The geometry is
+// written into the mappings here; the GL thread only has to publish the results.
+void Mesh::StreamingThread()
+{
+    while (!m_stopStreaming) {
+        unsigned int EntryIndex;
+
+        {
+            lock_guard<mutex> Lock(m_streamingMutex);
+
+            if (m_streamingJobs.empty()) {
+                break;
+            }
+
+            unsigned int Nearest = 0;
+            float NearestDistance = FLT_MAX;
+
+            for (unsigned int i = 0 ; i < m_streamingJobs.size() ; i++) {
+                const float Distance = GetStreamingDistance(m_streamingJobs[i]);
+
+                if (Distance < NearestDistance) {
+                    Nearest = i;
+                    NearestDistance = Distance;
+                }
+            }
+
+            EntryIndex = m_streamingJobs[Nearest];
+            m_streamingJobs[Nearest] = m_streamingJobs.back();
+            m_streamingJobs.pop_back();
+        }
+
+        const MeshEntry& Entry = m_Entries[EntryIndex];
+        const aiMesh* paiMesh = m_pStreamingScene->mMeshes[Entry.MeshIndex];
+        vector<Meshlet> Meshlets;
+
+        InitMesh(paiMesh,
+                 m_streamingMapping.pPositions + Entry.BaseVertex,
+                 m_streamingMapping.pNormals + Entry.BaseVertex,
+                 m_streamingMapping.pTexCoords + Entry.BaseVertex,
+                 m_streamingMapping.pIndices + Entry.BaseIndex);
+
+        InitMeshlets(paiMesh, Entry, Meshlets);
+
+        lock_guard<mutex> Lock(m_streamingMutex);
+
+        m_entryMeshlets[EntryIndex].swap(Meshlets);
+        m_streamingResults.push_back(EntryIndex);
+    }
+}
+
+
+// Publishes the finished entries. The mappings are coherent so an entry may be drawn
+// as soon as its worker is done.
+void Mesh::ProcessStreamingResults()
+{
+    vector<unsigned int> Results;
+
+    {
+        lock_guard<mutex> Lock(m_streamingMutex);
+        Results.swap(m_streamingResults);
+    }
+
+    for (unsigned int i = 0 ; i < Results.size() ; i++) {
+        m_Entries[Results[i]].Resident = true;
+        m_numPendingJobs--;
+    }
+}
+
+
+// Everything is resident. Releases the mappings and the scene and builds the meshlets
+// of the GPU culling pass from the pieces computed by the workers.
+void Mesh::FinishStreaming()
+{
+    for (unsigned int i = 0 ; i < m_streamingThreads.size() ; i++) {
+        m_streamingThreads[i].join();
+    }
+
+    m_streamingThreads.clear();
+
+    bool Ret = UnmapStaticBuffer(m_Buffers[POS_VB], m_streamingMapping.pPositions);
+    Ret = UnmapStaticBuffer(m_Buffers[TEXCOORD_VB], m_streamingMapping.pTexCoords) && Ret;
+    Ret = UnmapStaticBuffer(m_Buffers[NORMAL_VB], m_streamingMapping.pNormals) && Ret;
+    Ret = UnmapStaticBuffer(m_Buffers[INDEX_BUFFER], m_streamingMapping.pIndices) && Ret;
+
+    memset(&m_streamingMapping, 0, sizeof(m_streamingMapping));
+
+    if (!Ret) {
+        printf("Error uploading the vertex data of '%s'\n", m_streamingFilename.c_str());
+    }
+
+    vector<Meshlet> Meshlets;
+
+    for (unsigned int i = 0 ; i < m_Entries.size() ; i++) {
+        m_Entries[i].FirstMeshlet = Meshlets.size();
+        Meshlets.insert(Meshlets.end(), m_entryMeshlets[i].begin(), m_entryMeshlets[i].end());
+        m_Entries[i].NumMeshlets = Meshlets.size() - m_Entries[i].FirstMeshlet;
+    }
+
+    UploadMeshlets(Meshlets);
+
+    m_entryMeshlets.clear();
+    m_materialEntries.clear();
+    m_pStreamingScene = NULL;
+    SAFE_DELETE(m_pImporter);
+
+    m_streamingState = STREAMING_NONE;
+
+    printf("Finished streaming '%s'\n", m_streamingFilename.c_str());
+}
+
+
+// Waits for the background threads and drops whatever they produced that was not
+// published yet. Called on the GL thread.
+void Mesh::StopStreaming()
+{
+    m_stopStreaming = true;
+
+    if (m_importThread.joinable()) {
+        m_importThread.join();
+    }
+
+    for (unsigned int i = 0 ; i < m_streamingThreads.size() ; i++) {
+        m_streamingThreads[i].join();
+    }
+
+    m_streamingThreads.clear();
+
+    m_streamingResults.clear();
+    m_streamingJobs.clear();
+    m_entryMeshlets.clear();
+    m_materialEntries.clear();
+    m_importedEntries.clear();
+    m_numPendingJobs = 0;
+
+    // Deleting the buffers releases the mappings
+    memset(&m_streamingMapping, 0, sizeof(m_streamingMapping));
+
+    m_pStreamingScene = NULL;
+    SAFE_DELETE(m_pImporter);
+
+    m_stopStreaming = false;
+    m_streamingState = STREAMING_NONE;
+}
+
+
+bool Mesh::SetMeshletCulling(bool Enable)
+{
+    if (Enable && !m_pMeshletCullTechnique) {
+        if (!GLEW_ARB_compute_shader || !GLEW_ARB_shader_storage_buffer_object || !GLEW_ARB_multi_draw_indirect) {
+            printf("Meshlet culling requires compute shaders and multi draw indirect\n");
+            return false;
+        }
+
+        m_pMeshletCullTechnique = new MeshletCullTechnique();
+
+        if (!m_pMeshletCullTechnique->Init()) {
+            printf("Error initializing the meshlet culling technique\n");
+            SAFE_DELETE(m_pMeshletCullTechnique);
+            return false;
+        }
+    }
+
+    m_meshletCulling = Enable;
+
+    return true;
+}
+
+
+void Mesh::SetMaterialSampler(unsigned int MaterialIndex, const SamplerDesc& Desc)
+{
+    m_materialSamplers[MaterialIndex] = SamplerCache::GetSampler(Desc);
+}
+
+
+bool Mesh::GetBounds(Vector3f& Min, Vector3f& Max) const
+{
+    Min = Vector3f(FLT_MAX, FLT_MAX, FLT_MAX);
+    Max = Vector3f(-FLT_MAX, -FLT_MAX, -FLT_MAX);
+
+    for (unsigned int i = 0 ; i < m_Entries.size() ; i++) {
+        const MeshEntry& Entry = m_Entries[i];
+
+        if (!Entry.Resident) {
+            continue;
+        }
+
+        for (unsigned int j = 0 ; j < Entry.Placements.size() ; j++) {
+            for (unsigned int k = 0 ; k < 8 ; k++) {
+                const Vector4f Corner((k & 1) ? Entry.BoxMax.x : Entry.BoxMin.x,
+                                      (k & 2) ? Entry.BoxMax.y : Entry.BoxMin.y,
+                                      (k & 4) ? Entry.BoxMax.z : Entry.BoxMin.z,
+                                      1.0f);
+                const Vector4f c = Entry.Placements[j] * Corner;
+                Min = Vector3f(min(Min.x, c.x), min(Min.y, c.y), min(Min.z, c.z));
+                Max = Vector3f(max(Max.x, c.x), max(Max.y, c.y), max(Max.z, c.z));
+            }
+        }
+    }
+
+    return Min.x <= Max.x;
+}
+
+
+void Mesh::GetOccluder(vector<Vector3f>& Positions, vector<unsigned int>& Indices) const
+{
+    for (unsigned int i = 0 ; i < m_Entries.size() ; i++) {
+        const MeshEntry& Entry = m_Entries[i];
+
+        if (!Entry.Resident) {
+            continue;
+        }
+
+        for (unsigned int j = 0 ; j < Entry.Placements.size() ; j++) {
+            const unsigned int BaseVertex = Positions.size();
+
+            for (unsigned int k = 0 ; k < Entry.OccluderPositions.size() ; k++) {
+                const Vector3f& p = Entry.OccluderPositions[k];
+                const Vector4f c = Entry.Placements[j] * Vector4f(p.x, p.y, p.z, 1.0f);
+                Positions.push_back(Vector3f(c.x, c.y, c.z));
+            }
+
+            for (unsigned int k = 0 ; k < Entry.OccluderIndices.size() ; k++) {
+                Indices.push_back(BaseVertex + Entry.OccluderIndices[k]);
+            }
+        }
+    }
+}
+
+
+// Materials whose texture is still loading get the placeholder
+void Mesh::BindMaterial(unsigned int MaterialIndex)
+{
+    assert(MaterialIndex < m_Textures.size());
+
+    map<unsigned int, GLuint>::const_iterator it = m_materialSamplers.find(MaterialIndex);
+    GLState::BindSampler(COLOR_TEXTURE_UNIT_INDEX, (it != m_materialSamplers.end()) ? it->second : SamplerCache::GetDefaultSampler());
+
+    Texture* pTexture = m_Textures[MaterialIndex];
+
+    if (pTexture && pTexture->IsLoaded()) {
+        pTexture->Bind(GL_TEXTURE0);
+    }
+    else if (pTexture) {
+        GLState::BindTexture(COLOR_TEXTURE_UNIT_INDEX, GL_TEXTURE_2D, TextureLoader::GetPlaceholder());
+        TextureStreamer::OnBind(NULL);
+    }
+}
+
+
+// Builds the instance matrices of every placement slot. A placement moves the copy in
+// object space so it is applied before the matrices of the caller, and since those are
+// transposed for the upload the product is reversed: (WVP * P)^T = P^T * WVP^T.
+void Mesh::ExpandInstances(unsigned int NumInstances, const Matrix4f* WVPMats, const Matrix4f* WorldMats)
+{
+    m_expandedWVPMats.resize(NumInstances * m_numPlacementSlots);
+    m_expandedWorldMats.resize(NumInstances * m_numPlacementSlots);
+
+    memcpy(&m_expandedWVPMats[0], WVPMats, sizeof(Matrix4f) * NumInstances);
+    memcpy(&m_expandedWorldMats[0], WorldMats, sizeof(Matrix4f) * NumInstances);
+
+    for (unsigned int i = 0 ; i < m_Entries.size() ; i++) {
+        const MeshEntry& Entry = m_Entries[i];
+
+        if (Entry.FirstPlacement == 0) {
+            continue;
+        }
+
+        for (unsigned int j = 0 ; j < Entry.Placements.size() ; j++) {
+            const Matrix4f Placement = Entry.Placements[j].Transpose();
+            const unsigned int FirstInstance = (Entry.FirstPlacement + j) * NumInstances;
+
+            for (unsigned int k = 0 ; k < NumInstances ; k++) {
+                m_expandedWVPMats[FirstInstance + k] = Placement * WVPMats[k];
+                m_expandedWorldMats[FirstInstance + k] = Placement * WorldMats[k];
+            }
+        }
+    }
+}
+
+
+// The instance index goes with the matrices of every slot. Unlike gl_InstanceID it
+// is the same for all the copies of an instance, whatever draws them (the indirect
+// draws of the meshlets select the instance with the base instance, which leaves
+// gl_InstanceID at 0).
+void Mesh::UploadInstanceIndices(unsigned int NumInstances, const unsigned int* pInstanceIndices)
+{
+    m_instanceIndices.resize(NumInstances * m_numPlacementSlots);
+
+    for (unsigned int i = 0 ; i < m_instanceIndices.size() ; i++) {
+        m_instanceIndices[i] = pInstanceIndices ? pInstanceIndices[i % NumInstances] : i % NumInstances;
+    }
+
+    GLState::BufferData(m_Buffers[INSTANCE_VB], sizeof(unsigned int) * m_instanceIndices.size(), &m_instanceIndices[0], GL_DYNAMIC_DRAW);
+}
+
+
+void Mesh::Render(unsigned int NumInstances, const Matrix4f* WVPMats, const Matrix4f* WorldMats, IRenderCallbacks* pRenderCallbacks,
+                  const unsigned int* pInstanceIndices)
+{        
+    if (NumInstances == 0) {
+        return;
+    }
+
+    // Repeated geometry is drawn once per placement for each instance of the caller
+    if (m_numPlacementSlots > 1) {
+        ExpandInstances(NumInstances, WVPMats, WorldMats);
+        WVPMats = &m_expandedWVPMats[0];
+        WorldMats = &m_expandedWorldMats[0];
+    }
+
+    GLState::BufferData(m_Buffers[WVP_MAT_VB], sizeof(Matrix4f) * NumInstances * m_numPlacementSlots, WVPMats, GL_DYNAMIC_DRAW);
+    GLState::BufferData(m_Buffers[WORLD_MAT_VB], sizeof(Matrix4f) * NumInstances * m_numPlacementSlots, WorldMats, GL_DYNAMIC_DRAW);
+    UploadInstanceIndices(NumInstances, pInstanceIndices);
+
+    // Drawn without culling until the culling program is built
+    if (m_meshletCulling && m_numMeshlets > 0 && m_pMeshletCullTechnique->IsReady()) {
+        RenderMeshlets(NumInstances, pRenderCallbacks);
+        return;
+    }
+
+    GLState::BindVertexArray(m_VAO);
+    
+    for (unsigned int i = 0 ; i < m_Entries.size() ; i++) {
+        // While streaming only the entries that have reached the buffers are drawn, and
+        // only those in the visible set if there is one
+        if (!m_Entries[i].Resident || !IsEntryVisible(i)) {
+            continue;
+        }
+
+        if (pRenderCallbacks) {
+            pRenderCallbacks->DrawStartCB(m_Entries[i].MaterialIndex, m_Textures[m_Entries[i].MaterialIndex] != NULL);
+        }
+
+        BindMaterial(m_Entries[i].MaterialIndex);
+
+        SetInstanceAttributes(m_Entries[i].FirstPlacement * NumInstances);
+
+		glDrawElementsInstancedBaseVertex(GL_TRIANGLES, 
+                                          m_Entries[i].NumIndices, 
+                                          GL_UNSIGNED_INT, 
+                                          (void*)(sizeof(unsigned int) * m_Entries[i].BaseIndex), 
+                                          NumInstances * m_Entries[i].Placements.size(),
+                                          m_Entries[i].BaseVertex);
+    }
+
+    SetInstanceAttributes(0);
+
+    // Make sure the VAO and the sampler are not changed from the outside    
+    GLState::BindVertexArray(0);
+    GLState::BindSampler(COLOR_TEXTURE_UNIT_INDEX, 0);
+}
+
+
+void Mesh::RenderDepth(unsigned int NumInstances, const Matrix4f* WVPMats, const Matrix4f* WorldMats,
+                       unsigned int NumLayers)
+{
+    if (NumInstances == 0) {
+        return;
+    }
+
+    if (m_numPlacementSlots > 1) {
+        ExpandInstances(NumInstances, WVPMats, WorldMats);
+        WVPMats = &m_expandedWVPMats[0];
+    }
+
+    GLState::BufferData(m_Buffers[WVP_MAT_VB], sizeof(Matrix4f) * NumInstances * m_numPlacementSlots, WVPMats, GL_DYNAMIC_DRAW);
+
+    GLState::BindVertexArray(m_depthVAO);
+
+    if (NumLayers != m_depthDivisor) {
+        for (unsigned int i = 0; i < 4 ; i++) {
+            glVertexAttribDivisor(WVP_LOCATION + i, NumLayers);
+        }
+
+        m_depthDivisor = NumLayers;
+    }
+
+    for (unsigned int i = 0 ; i < m_Entries.size() ; i++) {
+        if (!m_Entries[i].Resident) {
+            continue;
+        }
+
+        SetInstanceAttributes(m_Entries[i].FirstPlacement * NumInstances, true);
+
+        glDrawElementsInstancedBaseVertex(GL_TRIANGLES,
+                                          m_Entries[i].NumIndices,
+                                          GL_UNSIGNED_INT,
+                                          (void*)(sizeof(unsigned int) * m_Entries[i].BaseIndex),
+                                          NumInstances * m_Entries[i].Placements.size() * NumLayers,
+                                          m_Entries[i].BaseVertex);
+    }
+
+    SetInstanceAttributes(0, true);
+
+    GLState::BindVertexArray(0);
+}
+
+
+bool Mesh::RenderVisibility(unsigned int NumInstances, const Matrix4f* WVPMats, const Matrix4f* WorldMats,
+                            VisibilityTechnique* pTechnique, const unsigned int* pInstanceIndices)
+{
+    if (NumInstances == 0) {
+        return true;
+    }
+
+    // An entry and an instance share the second ID, the last value of which means empty
+    if (m_Entries.size() >= VISIBILITY_MAX_ENTRIES || m_Textures.size() > VISIBILITY_MAX_MATERIALS ||
+        NumInstances * m_numPlacementSlots >= VISIBILITY_MAX_INSTANCES) {
+        return false;
+    }
+
+    if (m_numPlacementSlots > 1) {
+        ExpandInstances(NumInstances, WVPMats, WorldMats);
+        WVPMats = &m_expandedWVPMats[0];
+        WorldMats = &m_expandedWorldMats[0];
+    }
+
+    // The world matrices and the instance indices are only read by the resolve
+    GLState::BufferData(m_Buffers[WVP_MAT_VB], sizeof(Matrix4f) * NumInstances * m_numPlacementSlots, WVPMats, GL_DYNAMIC_DRAW);
+    GLState::BufferData(m_Buffers[WORLD_MAT_VB], sizeof(Matrix4f) * NumInstances * m_numPlacementSlots, WorldMats, GL_DYNAMIC_DRAW);
+    UploadInstanceIndices(NumInstances, pInstanceIndices);
+
+    // The first instance depends on the number of instances so the table is rebuilt
+    // every time. It is a few bytes per entry.
+    m_entryTable.resize(m_Entries.size() * 4);
+
+    for (unsigned int i = 0 ; i < m_Entries.size() ; i++) {
+        m_entryTable[i * 4] = m_Entries[i].BaseIndex;
+        m_entryTable[i * 4 + 1] = m_Entries[i].BaseVertex;
+        m_entryTable[i * 4 + 2] = m_Entries[i].FirstPlacement * NumInstances;
+        m_entryTable[i * 4 + 3] = m_Entries[i].MaterialIndex;
+    }
+
+    if (!m_entryTable.empty()) {
+        GLState::BufferData(m_Buffers[ENTRY_TB], sizeof(unsigned int) * m_entryTable.size(), &m_entryTable[0], GL_DYNAMIC_DRAW);
+    }
+
+    GLState::BindVertexArray(m_depthVAO);
+
+    if (m_depthDivisor != 1) {
+        for (unsigned int i = 0; i < 4 ; i++) {
+            glVertexAttribDivisor(WVP_LOCATION + i, 1);
+        }
+
+        m_depthDivisor = 1;
+    }
+
+    for (unsigned int i = 0 ; i < m_Entries.size() ; i++) {
+        if (!m_Entries[i].Resident || !IsEntryVisible(i)) {
+            continue;
+        }
+
+        pTechnique->SetEntry(i);
+
+        SetInstanceAttributes(m_Entries[i].FirstPlacement * NumInstances, true);
+
+        glDrawElementsInstancedBaseVertex(GL_TRIANGLES,
+                                          m_Entries[i].NumIndices,
+                                          GL_UNSIGNED_INT,
+                                          (void*)(sizeof(unsigned int) * m_Entries[i].BaseIndex),
+                                          NumInstances * m_Entries[i].Placements.size(),
+                                          m_Entries[i].BaseVertex);
+    }
+
+    SetInstanceAttributes(0, true);
+
+    GLState::BindVertexArray(0);
+
+    return true;
+}
+
+
+// The buffers are read through buffer textures, which follow the buffers when their
+// storage is reallocated
+void Mesh::InitVisibilityTextures()
+{
+    const GLuint Buffers[NUM_VISIBILITY_TEXTURES] = {
+        m_Buffers[ENTRY_TB], m_Buffers[INDEX_BUFFER], m_Buffers[POS_VB],
+        m_Buffers[NORMAL_VB], m_Buffers[TEXCOORD_VB], m_Buffers[WORLD_MAT_VB], m_Buffers[INSTANCE_VB]
+    };
+
+    const GLenum Formats[NUM_VISIBILITY_TEXTURES] = {
+        GL_RGBA32UI, GL_R32UI, GL_RGB32F, GL_RGB32F, GL_RG32F, GL_RGBA32F, GL_R32UI
+    };
+
+    for (unsigned int i = 0 ; i < NUM_VISIBILITY_TEXTURES ; i++) {
+        m_visibilityTextures[i] = GLState::CreateTexture(GL_TEXTURE_BUFFER);
+        GLState::TextureBuffer(m_visibilityTextures[i], Formats[i], Buffers[i]);
+    }
+}
+
+
+// The classification writes the depth of the material of every pixel and each material
+// then draws a fullscreen triangle at that depth with GL_EQUAL, so the early depth test
+// keeps the lighting program to the pixels of the material. Every covered pixel is
+// shaded once, whatever the number of triangles and draws behind it.
+void Mesh::ResolveVisibility(VisibilityTechnique* pTechnique, IRenderCallbacks* pRenderCallbacks)
+{
+    if (m_visibilityTextures[0] == 0) {
+        InitVisibilityTextures();
+    }
+
+    const GLuint Units[NUM_VISIBILITY_TEXTURES] = {
+        MESH_ENTRY_TEXTURE_UNIT_INDEX, MESH_INDEX_TEXTURE_UNIT_INDEX, MESH_POS_TEXTURE_UNIT_INDEX,
+        MESH_NORMAL_TEXTURE_UNIT_INDEX, MESH_TEXCOORD_TEXTURE_UNIT_INDEX, MESH_WORLD_TEXTURE_UNIT_INDEX,
+        MESH_INSTANCE_TEXTURE_UNIT_INDEX
+    };
+
+    for (unsigned int i = 0 ; i < NUM_VISIBILITY_TEXTURES ; i++) {
+        GLState::BindTexture(Units[i], GL_TEXTURE_BUFFER, m_visibilityTextures[i]);
+    }
+
+    GLState::BindVertexArray(0);
+    GLState::SetVertexAttribArrays(0);
+
+    if (!pTechnique->EnableClassification()) {
+        return;
+    }
+
+    GLState::ColorMask(GL_FALSE);
+    GLState::DepthFunc(GL_ALWAYS);
+    glDrawArrays(GL_TRIANGLES, 0, 3);
+    GLState::ColorMask(GL_TRUE);
+
+    GLState::DepthFunc(GL_EQUAL);
+    GLState::DepthMask(GL_FALSE);
+
+    m_resolvedMaterials.assign(m_Textures.size(), false);
+
+    for (unsigned int i = 0 ; i < m_Entries.size() ; i++) {
+        const unsigned int MaterialIndex = m_Entries[i].MaterialIndex;
+
+        if (!m_Entries[i].Resident || m_resolvedMaterials[MaterialIndex]) {
+            continue;
+        }
+
+        m_resolvedMaterials[MaterialIndex] = true;
+
+        if (pRenderCallbacks) {
+            pRenderCallbacks->DrawStartCB(MaterialIndex, m_Textures[MaterialIndex] != NULL);
+        }
+
+        BindMaterial(MaterialIndex);
+
+        glDrawArrays(GL_TRIANGLES, MaterialIndex * 3, 3);
+    }
+
+    GLState::DepthFunc(GL_LESS);
+    GLState::DepthMask(GL_TRUE);
+
+    // Make sure the sampler is not changed from the outside
+    GLState::BindSampler(COLOR_TEXTURE_UNIT_INDEX, 0);
+}
+
+
+// Runs the culling pass for every (meshlet, instance) pair and draws the survivors of
+// each entry with a single indirect call. The commands of an entry are contiguous since
+// its meshlets are.
+void Mesh::RenderMeshlets(unsigned int NumInstances, IRenderCallbacks* pRenderCallbacks)
+{
+    const unsigned int NumCommands = m_numMeshletCommands * NumInstances;
+
+    if (NumCommands > m_drawCommandCapacity) {
+        GLState::BufferData(m_Buffers[DRAW_CMD_VB], sizeof(DrawElementsIndirectCommand) * NumCommands, NULL, GL_DYNAMIC_COPY);
+        m_drawCommandCapacity = NumCommands;
+    }
+
+    // The culling pass replaces the program of the caller so restore it afterwards
+    const GLuint CurrentProgram = GLState::GetProgram();
+
+    m_pMeshletCullTechnique->Enable();
+    m_pMeshletCullTechnique->SetNumInstances(NumInstances);
+
+    GLState::BindBufferBase(GL_SHADER_STORAGE_BUFFER, MESHLET_BUFFER_BINDING, m_Buffers[MESHLET_SB]);
+    GLState::BindBufferBase(GL_SHADER_STORAGE_BUFFER, MESHLET_INSTANCE_BINDING, m_Buffers[WVP_MAT_VB]);
+    GLState::BindBufferBase(GL_SHADER_STORAGE_BUFFER, MESHLET_DRAW_COMMAND_BINDING, m_Buffers[DRAW_CMD_VB]);
+
+    glDispatchCompute(m_numMeshlets, 1, 1);
+
+    glMemoryBarrier(GL_COMMAND_BARRIER_BIT);
+
+    GLState::UseProgram(CurrentProgram);
+
+    GLState::BindVertexArray(m_VAO);
+    GLState::BindBuffer(GL_DRAW_INDIRECT_BUFFER, m_Buffers[DRAW_CMD_VB]);
+
+    for (unsigned int i = 0 ; i < m_Entries.size() ; i++) {
+        if (!IsEntryVisible(i)) {
+            continue;
+        }
+
+        if (pRenderCallbacks) {
+            pRenderCallbacks->DrawStartCB(m_Entries[i].MaterialIndex, m_Textures[m_Entries[i].MaterialIndex] != NULL);
+        }
+
+        BindMaterial(m_Entries[i].MaterialIndex);
+
+        const unsigned int FirstCommand = m_Entries[i].FirstCommand * NumInstances;
+
+        glMultiDrawElementsIndirect(GL_TRIANGLES,
+                                    GL_UNSIGNED_INT,
+                                    (void*)(sizeof(DrawElementsIndirectCommand) * FirstCommand),
+                                    m_Entries[i].NumMeshlets * m_Entries[i].Placements.size() * NumInstances,
+                                    0);
+    }
+
+    GLState::BindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+
+    // Make sure the VAO and the sampler are not changed from the outside
+    GLState::BindVertexArray(0);
+    GLState::BindSampler(COLOR_TEXTURE_UNIT_INDEX, 0);
+}
@@ -21,6 +21,9 @@
 
 #include <map>
 #include <vector>
+#include <thread>
+#include <mutex>
+#include <atomic>
 #include <GL/glew.h>
 #include <assimp/Importer.hpp>      // C++ importer interface
 #include <assimp/scene.h>       // Output data structure
@@ -29,6 +32,11 @@
 #include "util.h"
 #include "math_3d.h"
 #include "texture.h"
+#include "sampler_cache.h"
+#include "callbacks.h"
+
+class MeshletCullTechnique;
+class VisibilityTechnique;
 
 struct Vertex
 {
@@ -56,19 +64,97 @@ public:
 
     bool LoadMesh(const std::string& Filename);
 
-    void Render(unsigned int NumInstances, const Matrix4f* WVPMats, const Matrix4f* WorldMats);
+    // Returns immediately and loads the scene on background threads. Sub-meshes and
+    // textures are streamed in nearest-to-camera order and Render draws whatever is
+    // resident so far. Falls back to LoadMesh without ARB_buffer_storage.
+    bool LoadMeshStreaming(const std::string& Filename);
+
+    // Must be called once per frame on the GL thread while streaming. CameraPos is in
+    // the object space of the mesh.
+    void UpdateStreaming(const Vector3f& CameraPos);
+
+    bool IsStreaming() const { return m_streamingState != STREAMING_NONE && m_streamingState != STREAMING_FAILED; }
+
+    // pRenderCallbacks, when given, is told about each draw before its material is bound.
+    // pInstanceIndices, when given, are what the programs see as the index of each instance
+    // (e.g. for its tint) instead of its position in the arrays, so that the caller can
+    // drop instances without changing the others.
+    void Render(unsigned int NumInstances, const Matrix4f* WVPMats, const Matrix4f* WorldMats, IRenderCallbacks* pRenderCallbacks = NULL,
+                const unsigned int* pInstanceIndices = NULL);
+
+    // Draws the resident entries from the positions alone with the bound program, for a
+    // depth prepass. Takes the matrices Render is called with afterwards. Meshlets are
+    // not culled here since the main pass drawing less than the prepass is harmless.
+    // For layered rendering every instance is drawn NumLayers times in a row with the
+    // same matrix, the program derives the layer from gl_InstanceID.
+    void RenderDepth(unsigned int NumInstances, const Matrix4f* WVPMats, const Matrix4f* WorldMats,
+                     unsigned int NumLayers = 1);
+
+    // Draws the resident entries into the bound visibility buffer with the enabled
+    // VisibilityTechnique, from the positions alone like RenderDepth. Returns false,
+    // without drawing, when the mesh has too many entries, materials or instances for
+    // the IDs of the visibility buffer. pInstanceIndices is for the resolve, like in Render.
+    bool RenderVisibility(unsigned int NumInstances, const Matrix4f* WVPMats, const Matrix4f* WorldMats,
+                          VisibilityTechnique* pTechnique, const unsigned int* pInstanceIndices = NULL);
+
+    // Shades the visibility buffer of the last RenderVisibility, which must be on
+    // VISIBILITY_TEXTURE_UNIT, into the bound framebuffer and overwrites its depth.
+    // pRenderCallbacks is told about each material like in Render and the program it
+    // enables must draw a fullscreen triangle from gl_VertexID = 3 * material + corner.
+    // The triangles of the pixels are read from the mesh buffers on the MESH_*_TEXTURE_UNITs.
+    void ResolveVisibility(VisibilityTechnique* pTechnique, IRenderCallbacks* pRenderCallbacks);
+
+    // When enabled every frame starts with a compute pass that culls the meshlets
+    // of each instance and the survivors are drawn indirectly. Requires GL 4.3.
+    bool SetMeshletCulling(bool Enable);
+
+    // Samples the textures of a material with its own settings instead of the default
+    // of the SamplerCache, e.g. clamping for decals or no anisotropy for distant cards.
+    // Material indices belong to the loaded scene so this must follow the load.
+    void SetMaterialSampler(unsigned int MaterialIndex, const SamplerDesc& Desc);
+
+    // Sub-meshes of the scene once the rigid copies are merged, the ones the bits of
+    // SetVisibleEntries stand for
+    unsigned int GetNumEntries() const { return m_Entries.size(); }
+
+    // Restricts Render and RenderVisibility to the sub-meshes whose bit is set, e.g. the
+    // potentially visible set of the camera. NULL draws them all. The shadows and the
+    // depth prepass still draw everything. The bits are read at every draw and must
+    // outlive their use.
+    void SetVisibleEntries(const unsigned int* pBits) { m_pVisibleEntries = pBits; }
+
+    // Box around the resident sub-meshes in object space. False if there are none yet.
+    bool GetBounds(Vector3f& Min, Vector3f& Max) const;
+
+    // Appends the largest triangles of the large resident sub-meshes in object space, to
+    // be drawn by the OcclusionCuller. A subset of the mesh, so it never extends past it.
+    void GetOccluder(std::vector<Vector3f>& Positions, std::vector<unsigned int>& Indices) const;
 
 private:
     bool InitFromScene(const aiScene* pScene, const std::string& Filename);
+    void InitVertexAttributes();
+    void SetInstanceAttributes(unsigned int FirstInstance, bool DepthOnly = false);
+    void ExpandInstances(unsigned int NumInstances, const Matrix4f* WVPMats, const Matrix4f* WorldMats);
+    void UploadInstanceIndices(unsigned int NumInstances, const unsigned int* pInstanceIndices);
     void InitMesh(const aiMesh* paiMesh,
-                  std::vector<Vector3f>& Positions,
-                  std::vector<Vector3f>& Normals,
-                  std::vector<Vector2f>& TexCoords,
-                  std::vector<unsigned int>& Indices);
+                  Vector3f* pPositions,
+                  Vector3f* pNormals,
+                  Vector2f* pTexCoords,
+                  unsigned int* pIndices);
 
     bool InitMaterials(const aiScene* pScene, const std::string& Filename);
+    void BindMaterial(unsigned int MaterialIndex);
+    void RenderMeshlets(unsigned int NumInstances, IRenderCallbacks* pRenderCallbacks);
+    void InitVisibilityTextures();
     void Clear();
 
+    void ImportThread();
+    bool StartStreaming();
+    void StreamingThread();
+    void ProcessStreamingResults();
+    void FinishStreaming();
+    void StopStreaming();
+
 #define INVALID_MATERIAL 0xFFFFFFFF
    
 #define INDEX_BUFFER 0    
@@ -77,9 +163,36 @@ private:
 #define TEXCOORD_VB  3    
 #define WVP_MAT_VB   4
 #define WORLD_MAT_VB 5
+#define MESHLET_SB   6
+#define DRAW_CMD_VB  7
+#define ENTRY_TB     8
+#define INSTANCE_VB  9
+
+#define MESHLET_MAX_VERTICES  64
+#define MESHLET_MAX_TRIANGLES 124
+
+// The occluder of an entry keeps at most this many of its triangles. Only the entries
+// whose box diagonal is at least the given fraction of the one of the whole mesh get one.
+#define MESH_OCCLUDER_MAX_TRIANGLES 512
+#define MESH_OCCLUDER_MIN_SIZE      0.25f
 
     GLuint m_VAO;
-    GLuint m_Buffers[6];
+    GLuint m_depthVAO;                      // positions and WVP matrices only
+    GLuint m_Buffers[10];
+
+    // The buffers as seen by the visibility buffer resolve
+    enum VISIBILITY_TEXTURE_TYPE {
+        VISIBILITY_TEXTURE_ENTRIES,
+        VISIBILITY_TEXTURE_INDICES,
+        VISIBILITY_TEXTURE_POSITIONS,
+        VISIBILITY_TEXTURE_NORMALS,
+        VISIBILITY_TEXTURE_TEXCOORDS,
+        VISIBILITY_TEXTURE_WORLD_MATS,
+        VISIBILITY_TEXTURE_INSTANCES,
+        NUM_VISIBILITY_TEXTURES
+    };
+
+    GLuint m_visibilityTextures[NUM_VISIBILITY_TEXTURES];
 
     struct MeshEntry {
         MeshEntry()
@@ -88,16 +201,128 @@ private:
             BaseVertex = 0;
             BaseIndex = 0;
             MaterialIndex = INVALID_MATERIAL;
+            FirstMeshlet = 0;
+            NumMeshlets = 0;
+            FirstCommand = 0;
+            MeshIndex = 0;
+            FirstPlacement = 0;
+            Radius = 0.0f;
+            BoxMin = Vector3f(0.0f, 0.0f, 0.0f);
+            BoxMax = Vector3f(0.0f, 0.0f, 0.0f);
+            Resident = false;
         }
         
         unsigned int NumIndices;
 	unsigned int BaseVertex;
         unsigned int BaseIndex;
         unsigned int MaterialIndex;
+        unsigned int FirstMeshlet;
+        unsigned int NumMeshlets;
+        unsigned int FirstCommand;      // in units of the number of instances
+        unsigned int MeshIndex;         // the Assimp mesh the geometry comes from
+        unsigned int FirstPlacement;    // slot of the expanded instance matrices, 0 if not repeated
+        std::vector<Matrix4f> Placements;   // object space transforms of the copies in the scene
+        Vector3f Center;    // bounding sphere in object space
+        float Radius;
+        Vector3f BoxMin;    // and bounding box
+        Vector3f BoxMax;
+        bool Resident;      // the geometry is in the buffers and may be drawn
+        std::vector<Vector3f> OccluderPositions;    // largest triangles, empty for small entries
+        std::vector<unsigned int> OccluderIndices;
     };
+
+    // Layout of the commands consumed by glMultiDrawElementsIndirect
+    struct DrawElementsIndirectCommand {
+        GLuint Count;
+        GLuint InstanceCount;
+        GLuint FirstIndex;
+        GLuint BaseVertex;
+        GLuint BaseInstance;
+    };
+
+    // A cluster of up to MESHLET_MAX_TRIANGLES consecutive triangles of an entry
+    // together with its bounding sphere and normal cone. Matches the std430 layout
+    // of the culling shader.
+    struct Meshlet {
+        Vector4f Sphere;    // center, radius
+        Vector4f Cone;      // axis, cutoff (1.0 means the cone is never culled)
+        unsigned int FirstIndex;
+        unsigned int NumIndices;
+        unsigned int BaseVertex;
+        unsigned int FirstPlacement;
+        unsigned int NumPlacements;
+        unsigned int FirstCommand;
+        unsigned int Padding[2];
+    };
+
+    static bool InitEntries(const aiScene* pScene, std::vector<MeshEntry>& Entries, unsigned int& NumVertices, unsigned int& NumIndices);
+    static void InitOccluder(const aiMesh* paiMesh, MeshEntry& Entry);
+    static void InitMeshlets(const aiMesh* paiMesh, const MeshEntry& Entry, std::vector<Meshlet>& Meshlets);
+    static void AddMeshlet(const aiMesh* paiMesh, const MeshEntry& Entry, unsigned int FirstFace, unsigned int NumFaces, std::vector<Meshlet>& Meshlets);
+    void UploadMeshlets(std::vector<Meshlet>& Meshlets);
+    void InitPlacements(const aiScene* pScene, const std::string& Filename);
+    
+    enum StreamingState {
+        STREAMING_NONE,
+        STREAMING_IMPORTING,    // Assimp is parsing the file on the import thread
+        STREAMING_IMPORTED,     // the entries are known, waiting for the GL thread
+        STREAMING_LOADING,      // the workers are filling the buffers
+        STREAMING_FAILED
+    };
+
+    // Persistent mappings of the vertex and index buffers that the workers write into
+    struct StreamingMapping {
+        Vector3f* pPositions;
+        Vector3f* pNormals;
+        Vector2f* pTexCoords;
+        unsigned int* pIndices;
+    };
+
+    float GetStreamingDistance(unsigned int EntryIndex) const;
+
+    bool IsEntryVisible(unsigned int EntryIndex) const
+    {
+        return !m_pVisibleEntries || ((m_pVisibleEntries[EntryIndex / 32] >> (EntryIndex % 32)) & 1);
+    }
     
     std::vector<MeshEntry> m_Entries;
     std::vector<Texture*> m_Textures;
+    unsigned int m_numMeshlets;
+    unsigned int m_numMeshletCommands;      // in units of the number of instances
+    unsigned int m_numPlacementSlots;
+    unsigned int m_firstInstance;           // offset of the instance attributes in the VAO
+    unsigned int m_depthFirstInstance;      // and in the depth VAO
+    unsigned int m_depthDivisor;            // of the instance attributes in the depth VAO
+    std::vector<Matrix4f> m_expandedWVPMats;
+    std::vector<Matrix4f> m_expandedWorldMats;
+    std::vector<unsigned int> m_instanceIndices;    // of the caller, per slot of the matrices
+    std::vector<unsigned int> m_entryTable;         // base index, base vertex, first instance, material
+    std::vector<bool> m_resolvedMaterials;
+
+    std::atomic<int> m_streamingState;
+    std::atomic<bool> m_stopStreaming;
+    std::string m_streamingFilename;
+    Assimp::Importer* m_pImporter;
+    const aiScene* m_pStreamingScene;
+    std::thread m_importThread;
+    std::vector<std::thread> m_streamingThreads;
+    std::vector<MeshEntry> m_importedEntries;               // written by the import thread
+    std::vector<std::vector<unsigned int> > m_materialEntries;
+    StreamingMapping m_streamingMapping;
+    unsigned int m_numPendingJobs;                          // GL thread only
+    std::mutex m_streamingMutex;                            // protects everything below
+    Vector3f m_streamingCameraPos;
+    std::vector<unsigned int> m_streamingJobs;              // entries left to the workers
+    std::vector<unsigned int> m_streamingResults;
+    std::vector<std::vector<Meshlet> > m_entryMeshlets;
+
+    std::map<unsigned int, GLuint> m_materialSamplers;
+
+    const unsigned int* m_pVisibleEntries;
+
+    bool m_meshletCulling;
+    unsigned int m_drawCommandCapacity;
+    MeshletCullTechnique* m_pMeshletCullTechnique;
 };
 
 
@@ -0,0 +1,137 @@
+/*
+
+	Copyright 2011 Etay Meiri
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#pragma once
+#include "meshlet_cull_technique.h"
+#include "util.h"
+
+static const char* pCS = "                                                          \n\
+#version 430                                                                        \n\
+                                                                                    \n\
+layout (local_size_x = 64) in;                                                      \n\
+                                                                                    \n\
+struct Meshlet                                                                      \n\
+{                                                                                   \n\
+    vec4 Sphere;                                                                    \n\
+    vec4 Cone;                                                                      \n\
+    uint FirstIndex;                                                                \n\
+    uint NumIndices;                                                                \n\
+    uint BaseVertex;                                                                \n\
+    uint FirstPlacement;                                                            \n\
+    uint NumPlacements;                                                             \n\
+    uint FirstCommand;                                                              \n\
+    uint Padding[2];                                                                \n\
+};                                                                                  \n\
+                                                                                    \n\
+struct DrawCommand                                                                  \n\
+{                                                                                   \n\
+    uint Count;                                                                     \n\
+    uint InstanceCount;                                                             \n\
+    uint FirstIndex;                                                                \n\
+    uint BaseVertex;                                                                \n\
+    uint BaseInstance;                                                              \n\
+};                                                                                  \n\
+                                                                                    \n\
+layout (std430, binding = 0) readonly buffer Meshlets { Meshlet gMeshlets[]; };     \n\
+layout (std430, binding = 1) readonly buffer Instances { mat4 gWVP[]; };            \n\
+layout (std430, binding = 2) writeonly buffer Commands { DrawCommand gCommands[]; };\n\
+                                                                                    \n\
+uniform uint gNumInstances;                                                         \n\
+                                                                                    \n\
+bool IsVisible(Meshlet m, mat4 WVP)                                                 \n\
+{                                                                                   \n\
+    // The frustum planes in object space are sums/differences of the rows of WVP   \n\
+    mat4 Rows = transpose(WVP);                                                     \n\
+    vec4 Planes[6] = vec4[6](Rows[3] + Rows[0], Rows[3] - Rows[0],                  \n\
+                             Rows[3] + Rows[1], Rows[3] - Rows[1],                  \n\
+                             Rows[3] + Rows[2], Rows[3] - Rows[2]);                 \n\
+                                                                                    \n\
+    for (int i = 0 ; i < 6 ; i++) {                                                 \n\
+        float Distance = dot(Planes[i].xyz, m.Sphere.xyz) + Planes[i].w;            \n\
+        if (Distance < -m.Sphere.w * length(Planes[i].xyz)) {                       \n\
+            return false;                                                           \n\
+        }                                                                           \n\
+    }                                                                               \n\
+                                                                                    \n\
+    // The camera is the point that WVP maps to (0, 0, 1, 0)                        \n\
+    vec4 Eye = inverse(WVP) * vec4(0.0, 0.0, 1.0, 0.0);                             \n\
+    vec3 EyeToCenter = m.Sphere.xyz - Eye.xyz / Eye.w;                              \n\
+                                                                                    \n\
+    // Every triangle of the meshlet faces away from the camera                     \n\
+    if (dot(EyeToCenter, m.Cone.xyz) >= m.Cone.w * length(EyeToCenter) + m.Sphere.w) {\n\
+        return false;                                                               \n\
+    }                                                                               \n\
+                                                                                    \n\
+    return true;                                                                    \n\
+}                                                                                   \n\
+                                                                                    \n\
+void main()                                                                         \n\
+{                                                                                   \n\
+    uint MeshletIndex = gl_WorkGroupID.x;                                           \n\
+    Meshlet m = gMeshlets[MeshletIndex];                                            \n\
+                                                                                    \n\
+    // Repeated meshlets are culled once per placement of every instance            \n\
+    uint NumCommands = m.NumPlacements * gNumInstances;                             \n\
+                                                                                    \n\
+    for (uint i = gl_LocalInvocationID.x ; i < NumCommands ; i += gl_WorkGroupSize.x) {\n\
+        uint Instance = m.FirstPlacement * gNumInstances + i;                       \n\
+        uint CommandIndex = m.FirstCommand * gNumInstances + i;                     \n\
+        gCommands[CommandIndex].Count = m.NumIndices;                               \n\
+        gCommands[CommandIndex].InstanceCount = IsVisible(m, gWVP[Instance]) ? 1 : 0;\n\
+        gCommands[CommandIndex].FirstIndex = m.FirstIndex;                          \n\
+        gCommands[CommandIndex].BaseVertex = m.BaseVertex;                          \n\
+        // Offsets the instanced attributes, gl_InstanceID stays 0                  \n\
+        gCommands[CommandIndex].BaseInstance = Instance;                            \n\
+    }                                                                               \n\
+}";
+
+
+MeshletCullTechnique::MeshletCullTechnique()
+{
+}
+
+
+bool MeshletCullTechnique::Init()
+{
+    if (!Technique::Init()) {
+        return false;
+    }
+
+    if (!AddShader(GL_COMPUTE_SHADER, pCS)) {
+        return false;
+    }
+
+    return Finalize();
+}
+
+
+bool MeshletCullTechnique::OnFinalized()
+{
+    m_numInstancesLocation = GetUniformLocation("gNumInstances");
+
+    if (m_numInstancesLocation == INVALID_UNIFORM_LOCATION) {
+        return false;
+    }
+
+    return GLCheckError();
+}
+
+
+void MeshletCullTechnique::SetNumInstances(unsigned int NumInstances)
+{
+    glUniform1ui(m_numInstancesLocation, NumInstances);
+}
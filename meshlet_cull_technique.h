@@ -0,0 +1,47 @@
+/*
+
+	Copyright 2011 Etay Meiri
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef MESHLET_CULL_TECHNIQUE_H
+#define	MESHLET_CULL_TECHNIQUE_H
+
+#include "technique.h"
+
+#define MESHLET_BUFFER_BINDING       0
+#define MESHLET_INSTANCE_BINDING     1
+#define MESHLET_DRAW_COMMAND_BINDING 2
+
+// Compute pass that culls every (meshlet, instance) pair against the view frustum and
+// the normal cone of the meshlet and writes one indirect draw command per pair.
+// Culled pairs get an instance count of zero.
+class MeshletCullTechnique : public Technique
+{
+public:
+    MeshletCullTechnique();
+
+    virtual bool Init();
+
+    virtual bool OnFinalized();
+
+    void SetNumInstances(unsigned int NumInstances);
+
+private:
+    GLuint m_numInstancesLocation;
+};
+
+
+#endif	/* MESHLET_CULL_TECHNIQUE_H */
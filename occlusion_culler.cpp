@@ -0,0 +1,530 @@
+/*
+
+	Copyright 2011 Etay Meiri
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+#include <float.h>
+#include <math.h>
+#include <string.h>
+#include <algorithm>
+#include <chrono>
+#if defined(_M_X64) || defined(_M_IX86) || defined(__SSE2__)
+#include <emmintrin.h>
+#define OCCLUSION_USE_SSE2
+#endif
+
+#include "occlusion_culler.h"
+
+// Vertices and box corners closer to the camera plane than this (in clip space w) are
+// treated as crossing it
+#define OCCLUSION_NEAR_W 0.001f
+
+std::mutex OcclusionCuller::s_mutex;
+std::condition_variable OcclusionCuller::s_condition;
+std::condition_variable OcclusionCuller::s_doneCondition;
+std::vector<std::thread> OcclusionCuller::s_threads;
+bool OcclusionCuller::s_stop = false;
+unsigned int OcclusionCuller::s_generation = 0;
+OcclusionCuller::JobFunc OcclusionCuller::s_pJob = NULL;
+unsigned int OcclusionCuller::s_numJobs = 0;
+unsigned int OcclusionCuller::s_nextJob = 0;
+unsigned int OcclusionCuller::s_numDoneJobs = 0;
+std::vector<Vector3f> OcclusionCuller::s_positions;
+std::vector<unsigned int> OcclusionCuller::s_indices;
+std::vector<float> OcclusionCuller::s_depth;
+std::vector<float> OcclusionCuller::s_tileDepth;
+std::vector<OcclusionCuller::Triangle> OcclusionCuller::s_triangles;
+std::vector<unsigned int> OcclusionCuller::s_occluders;
+unsigned int OcclusionCuller::s_numInstances = 0;
+const Matrix4f* OcclusionCuller::s_pWVPMats = NULL;
+Vector3f OcclusionCuller::s_boxMin;
+Vector3f OcclusionCuller::s_boxMax;
+unsigned char* OcclusionCuller::s_pVisible = NULL;
+std::atomic<unsigned int> OcclusionCuller::s_numVisible(0);
+std::atomic<unsigned int> OcclusionCuller::s_numFrustumCulled(0);
+OcclusionCuller::Stats OcclusionCuller::s_stats;
+
+
+// The matrices are transposed so the rows are the columns of the WVP matrix
+static Vector4f OcclusionTransform(const Matrix4f& WVP, const Vector3f& p)
+{
+    return Vector4f(p.x * WVP.m[0][0] + p.y * WVP.m[1][0] + p.z * WVP.m[2][0] + WVP.m[3][0],
+                    p.x * WVP.m[0][1] + p.y * WVP.m[1][1] + p.z * WVP.m[2][1] + WVP.m[3][1],
+                    p.x * WVP.m[0][2] + p.y * WVP.m[1][2] + p.z * WVP.m[2][2] + WVP.m[3][2],
+                    p.x * WVP.m[0][3] + p.y * WVP.m[1][3] + p.z * WVP.m[2][3] + WVP.m[3][3]);
+}
+
+
+void OcclusionCuller::SetOccluder(const std::vector<Vector3f>& Positions, const std::vector<unsigned int>& Indices)
+{
+    s_positions = Positions;
+    s_indices = Indices;
+}
+
+
+unsigned int OcclusionCuller::Cull(unsigned int NumInstances, const Matrix4f* WVPMats,
+                                   const Vector3f& BoxMin, const Vector3f& BoxMax, unsigned char* pVisible)
+{
+    const std::chrono::steady_clock::time_point Start = std::chrono::steady_clock::now();
+
+    if (s_depth.empty()) {
+        s_depth.resize(OCCLUSION_BUFFER_WIDTH * OCCLUSION_BUFFER_HEIGHT);
+        s_tileDepth.resize((OCCLUSION_BUFFER_WIDTH / OCCLUSION_TILE_SIZE) * (OCCLUSION_BUFFER_HEIGHT / OCCLUSION_TILE_SIZE));
+    }
+
+    s_numInstances = NumInstances;
+    s_pWVPMats = WVPMats;
+    s_boxMin = BoxMin;
+    s_boxMax = BoxMax;
+    s_pVisible = pVisible;
+    s_numVisible = 0;
+    s_numFrustumCulled = 0;
+
+    // The occluders are the instances whose center is nearest to the camera
+    s_occluders.clear();
+
+    if (!s_indices.empty()) {
+        const Vector3f Center = (BoxMin + BoxMax) * 0.5f;
+        std::vector<std::pair<float, unsigned int> > Candidates;
+
+        for (unsigned int i = 0 ; i < NumInstances ; i++) {
+            const float w = OcclusionTransform(WVPMats[i], Center).w;
+
+            if (w > OCCLUSION_NEAR_W) {
+                Candidates.push_back(std::make_pair(w, i));
+            }
+        }
+
+        const unsigned int NumOccluders = std::min((unsigned int)Candidates.size(), (unsigned int)OCCLUSION_MAX_OCCLUDERS);
+        std::partial_sort(Candidates.begin(), Candidates.begin() + NumOccluders, Candidates.end());
+
+        for (unsigned int i = 0 ; i < NumOccluders ; i++) {
+            s_occluders.push_back(Candidates[i].second);
+        }
+    }
+
+    s_triangles.resize(s_occluders.size() * (s_indices.size() / 3));
+
+    RunJobs(SetupOccluder, s_occluders.size());
+    RunJobs(RasterizeBand, OCCLUSION_BUFFER_HEIGHT / (OCCLUSION_TILE_SIZE * OCCLUSION_BAND_TILES));
+
+    const std::chrono::steady_clock::time_point Rasterized = std::chrono::steady_clock::now();
+
+    RunJobs(TestInstances, (NumInstances + OCCLUSION_TEST_CHUNK - 1) / OCCLUSION_TEST_CHUNK);
+
+    const std::chrono::steady_clock::time_point End = std::chrono::steady_clock::now();
+
+    const std::chrono::duration<double, std::milli> RasterTime = Rasterized - Start;
+    const std::chrono::duration<double, std::milli> TestTime = End - Rasterized;
+    const unsigned int NumVisible = s_numVisible;
+
+    s_stats.RasterMs += RasterTime.count();
+    s_stats.TestMs += TestTime.count();
+    s_stats.NumFrames++;
+    s_stats.NumOccluderTriangles = s_triangles.size();
+    s_stats.NumTested += NumInstances;
+    s_stats.NumFrustumCulled += s_numFrustumCulled;
+    s_stats.NumOccluded += NumInstances - NumVisible - s_numFrustumCulled;
+
+    return NumVisible;
+}
+
+
+void OcclusionCuller::ResetStats()
+{
+    memset(&s_stats, 0, sizeof(s_stats));
+}
+
+
+// Hands out the jobs to the threads and takes part until all of them are done
+void OcclusionCuller::RunJobs(JobFunc pJob, unsigned int NumJobs)
+{
+    if (NumJobs == 0) {
+        return;
+    }
+
+    unsigned int Generation;
+
+    {
+        std::lock_guard<std::mutex> Lock(s_mutex);
+
+        // The threads are started on first use and the calling thread is the last worker
+        if (s_threads.empty()) {
+            const unsigned int NumThreads = std::max(std::thread::hardware_concurrency(), 2u) - 1;
+
+            s_stop = false;
+
+            for (unsigned int i = 0 ; i < NumThreads ; i++) {
+                s_threads.push_back(std::thread(&OcclusionCuller::WorkerThread));
+            }
+        }
+
+        s_pJob = pJob;
+        s_numJobs = NumJobs;
+        s_nextJob = 0;
+        s_numDoneJobs = 0;
+        Generation = ++s_generation;
+    }
+
+    s_condition.notify_all();
+
+    while (RunNextJob(Generation)) {
+    }
+
+    std::unique_lock<std::mutex> Lock(s_mutex);
+
+    while (s_numDoneJobs < s_numJobs) {
+        s_doneCondition.wait(Lock);
+    }
+}
+
+
+// Runs one job of the given batch. False once the batch has been handed out, a thread
+// that wakes up late must not take the jobs of the next one for its own.
+bool OcclusionCuller::RunNextJob(unsigned int Generation)
+{
+    std::unique_lock<std::mutex> Lock(s_mutex);
+
+    if (s_generation != Generation || s_nextJob >= s_numJobs) {
+        return false;
+    }
+
+    const JobFunc pJob = s_pJob;
+    const unsigned int Job = s_nextJob++;
+
+    Lock.unlock();
+    pJob(Job);
+    Lock.lock();
+
+    if (++s_numDoneJobs == s_numJobs) {
+        s_doneCondition.notify_all();
+    }
+
+    return true;
+}
+
+
+void OcclusionCuller::WorkerThread()
+{
+    unsigned int Generation = 0;
+
+    for (;;) {
+        {
+            std::unique_lock<std::mutex> Lock(s_mutex);
+
+            while (!s_stop && s_generation == Generation) {
+                s_condition.wait(Lock);
+            }
+
+            if (s_stop) {
+                break;
+            }
+
+            Generation = s_generation;
+        }
+
+        while (RunNextJob(Generation)) {
+        }
+    }
+}
+
+
+// Projects the triangles of one occluder instance into the buffer and computes their
+// edge functions
+void OcclusionCuller::SetupOccluder(unsigned int Occluder)
+{
+    const Matrix4f& WVP = s_pWVPMats[s_occluders[Occluder]];
+    const unsigned int NumTriangles = s_indices.size() / 3;
+    Triangle* pTriangles = &s_triangles[Occluder * NumTriangles];
+
+    // x and y in pixels, 1/w and 0 for the vertices that cross the camera plane
+    std::vector<Vector3f> Screen(s_positions.size());
+
+    for (unsigned int i = 0 ; i < s_positions.size() ; i++) {
+        const Vector4f Clip = OcclusionTransform(WVP, s_positions[i]);
+
+        if (Clip.w > OCCLUSION_NEAR_W) {
+            const float InvW = 1.0f / Clip.w;
+            Screen[i] = Vector3f((Clip.x * InvW * 0.5f + 0.5f) * OCCLUSION_BUFFER_WIDTH,
+                                 (Clip.y * InvW * 0.5f + 0.5f) * OCCLUSION_BUFFER_HEIGHT,
+                                 InvW);
+        }
+        else {
+            Screen[i] = Vector3f(0.0f, 0.0f, 0.0f);
+        }
+    }
+
+    for (unsigned int i = 0 ; i < NumTriangles ; i++) {
+        Triangle& Tri = pTriangles[i];
+        Vector3f v0 = Screen[s_indices[i * 3]];
+        Vector3f v1 = Screen[s_indices[i * 3 + 1]];
+        Vector3f v2 = Screen[s_indices[i * 3 + 2]];
+
+        // Empty unless it makes it to the end
+        Tri.MinX = 0;
+        Tri.MaxX = -1;
+        Tri.MinY = 0;
+        Tri.MaxY = -1;
+
+        if (v0.z == 0.0f || v1.z == 0.0f || v2.z == 0.0f) {
+            continue;
+        }
+
+        float Area = (v1.x - v0.x) * (v2.y - v0.y) - (v2.x - v0.x) * (v1.y - v0.y);
+
+        // Both faces are drawn
+        if (Area < 0.0f) {
+            std::swap(v1, v2);
+            Area = -Area;
+        }
+
+        if (Area < 1e-6f) {
+            continue;
+        }
+
+        const Vector3f* pVertices[3] = { &v0, &v1, &v2 };
+
+        // The edge opposite to vertex i goes from vertex i + 1 to i + 2 and is the
+        // barycentric weight of vertex i times the area. The neighbor across an edge
+        // gets exactly the opposite coefficients, so a pixel center is never missed by
+        // both.
+        for (unsigned int j = 0 ; j < 3 ; j++) {
+            const Vector3f& a = *pVertices[(j + 1) % 3];
+            const Vector3f& b = *pVertices[(j + 2) % 3];
+            Tri.Edge[j][0] = a.y - b.y;
+            Tri.Edge[j][1] = b.x - a.x;
+            Tri.Edge[j][2] = a.x * b.y - a.y * b.x;
+        }
+
+        for (unsigned int j = 0 ; j < 3 ; j++) {
+            Tri.Depth[j] = (v0.z * Tri.Edge[0][j] + v1.z * Tri.Edge[1][j] + v2.z * Tri.Edge[2][j]) / Area;
+        }
+
+        Tri.MinX = std::max((int)floorf(std::min(v0.x, std::min(v1.x, v2.x))), 0);
+        Tri.MinY = std::max((int)floorf(std::min(v0.y, std::min(v1.y, v2.y))), 0);
+        Tri.MaxX = std::min((int)ceilf(std::max(v0.x, std::max(v1.x, v2.x))), OCCLUSION_BUFFER_WIDTH - 1);
+        Tri.MaxY = std::min((int)ceilf(std::max(v0.y, std::max(v1.y, v2.y))), OCCLUSION_BUFFER_HEIGHT - 1);
+    }
+}
+
+
+// Clears a band of rows, draws the triangles that touch it and updates its tiles
+void OcclusionCuller::RasterizeBand(unsigned int Band)
+{
+    const int FirstRow = Band * OCCLUSION_BAND_TILES * OCCLUSION_TILE_SIZE;
+    const int EndRow = FirstRow + OCCLUSION_BAND_TILES * OCCLUSION_TILE_SIZE;
+
+    std::fill(s_depth.begin() + FirstRow * OCCLUSION_BUFFER_WIDTH, s_depth.begin() + EndRow * OCCLUSION_BUFFER_WIDTH, 0.0f);
+
+    for (unsigned int i = 0 ; i < s_triangles.size() ; i++) {
+        const Triangle& Tri = s_triangles[i];
+
+        if (Tri.MaxX >= Tri.MinX && Tri.MaxY >= FirstRow && Tri.MinY < EndRow) {
+            RasterizeTriangle(Tri, FirstRow, EndRow);
+        }
+    }
+
+    const int NumTilesX = OCCLUSION_BUFFER_WIDTH / OCCLUSION_TILE_SIZE;
+
+    for (int TileY = FirstRow / OCCLUSION_TILE_SIZE ; TileY < EndRow / OCCLUSION_TILE_SIZE ; TileY++) {
+        for (int TileX = 0 ; TileX < NumTilesX ; TileX++) {
+            float Farthest = FLT_MAX;
+
+            for (int y = TileY * OCCLUSION_TILE_SIZE ; y < (TileY + 1) * OCCLUSION_TILE_SIZE ; y++) {
+                const float* pRow = &s_depth[y * OCCLUSION_BUFFER_WIDTH + TileX * OCCLUSION_TILE_SIZE];
+
+                for (int x = 0 ; x < OCCLUSION_TILE_SIZE ; x++) {
+                    Farthest = std::min(Farthest, pRow[x]);
+                }
+            }
+
+            s_tileDepth[TileY * NumTilesX + TileX] = Farthest;
+        }
+    }
+}
+
+
+// Keeps the nearest depth of the pixels whose center is inside the triangle or on one
+// of its edges. The planes are evaluated from scratch at every pixel rather than
+// stepped, which would let the rounding open cracks between the triangles. The SSE2
+// path handles four pixels per iteration, starting from a multiple of four so that the
+// blocks never cross the end of a row.
+void OcclusionCuller::RasterizeTriangle(const Triangle& Tri, int FirstRow, int EndRow)
+{
+    const int MinY = std::max(Tri.MinY, FirstRow);
+    const int MaxY = std::min(Tri.MaxY, EndRow - 1);
+
+#ifdef OCCLUSION_USE_SSE2
+    const int StartX = Tri.MinX & ~3;
+    const __m128 Offsets = _mm_setr_ps(0.5f, 1.5f, 2.5f, 3.5f);
+    const __m128 Zero = _mm_setzero_ps();
+    const __m128 a0 = _mm_set1_ps(Tri.Edge[0][0]);
+    const __m128 a1 = _mm_set1_ps(Tri.Edge[1][0]);
+    const __m128 a2 = _mm_set1_ps(Tri.Edge[2][0]);
+    const __m128 az = _mm_set1_ps(Tri.Depth[0]);
+
+    for (int y = MinY ; y <= MaxY ; y++) {
+        const float py = y + 0.5f;
+        const __m128 c0 = _mm_set1_ps(Tri.Edge[0][1] * py + Tri.Edge[0][2]);
+        const __m128 c1 = _mm_set1_ps(Tri.Edge[1][1] * py + Tri.Edge[1][2]);
+        const __m128 c2 = _mm_set1_ps(Tri.Edge[2][1] * py + Tri.Edge[2][2]);
+        const __m128 cz = _mm_set1_ps(Tri.Depth[1] * py + Tri.Depth[2]);
+        float* pRow = &s_depth[y * OCCLUSION_BUFFER_WIDTH];
+
+        for (int x = StartX ; x <= Tri.MaxX ; x += 4) {
+            const __m128 px = _mm_add_ps(_mm_set1_ps((float)x), Offsets);
+            const __m128 e0 = _mm_add_ps(_mm_mul_ps(a0, px), c0);
+            const __m128 e1 = _mm_add_ps(_mm_mul_ps(a1, px), c1);
+            const __m128 e2 = _mm_add_ps(_mm_mul_ps(a2, px), c2);
+            const __m128 Inside = _mm_and_ps(_mm_and_ps(_mm_cmpge_ps(e0, Zero), _mm_cmpge_ps(e1, Zero)), _mm_cmpge_ps(e2, Zero));
+
+            if (_mm_movemask_ps(Inside) != 0) {
+                const __m128 z = _mm_add_ps(_mm_mul_ps(az, px), cz);
+                const __m128 Old = _mm_loadu_ps(pRow + x);
+                const __m128 Nearest = _mm_max_ps(Old, z);
+                _mm_storeu_ps(pRow + x, _mm_or_ps(_mm_and_ps(Inside, Nearest), _mm_andnot_ps(Inside, Old)));
+            }
+        }
+    }
+#else
+    for (int y = MinY ; y <= MaxY ; y++) {
+        const float py = y + 0.5f;
+        const float c0 = Tri.Edge[0][1] * py + Tri.Edge[0][2];
+        const float c1 = Tri.Edge[1][1] * py + Tri.Edge[1][2];
+        const float c2 = Tri.Edge[2][1] * py + Tri.Edge[2][2];
+        float* pRow = &s_depth[y * OCCLUSION_BUFFER_WIDTH];
+
+        for (int x = Tri.MinX ; x <= Tri.MaxX ; x++) {
+            const float px = x + 0.5f;
+
+            if (Tri.Edge[0][0] * px + c0 >= 0.0f && Tri.Edge[1][0] * px + c1 >= 0.0f && Tri.Edge[2][0] * px + c2 >= 0.0f) {
+                pRow[x] = std::max(pRow[x], Tri.Depth[0] * px + Tri.Depth[1] * py + Tri.Depth[2]);
+            }
+        }
+    }
+#endif
+}
+
+
+void OcclusionCuller::TestInstances(unsigned int Chunk)
+{
+    const unsigned int First = Chunk * OCCLUSION_TEST_CHUNK;
+    const unsigned int End = std::min(First + OCCLUSION_TEST_CHUNK, s_numInstances);
+    unsigned int NumVisible = 0;
+    unsigned int NumFrustumCulled = 0;
+
+    for (unsigned int i = First ; i < End ; i++) {
+        bool InFrustum;
+        const bool Visible = IsBoxVisible(s_pWVPMats[i], InFrustum);
+
+        s_pVisible[i] = Visible ? 1 : 0;
+        NumVisible += Visible ? 1 : 0;
+        NumFrustumCulled += InFrustum ? 0 : 1;
+    }
+
+    s_numVisible += NumVisible;
+    s_numFrustumCulled += NumFrustumCulled;
+}
+
+
+// The box is hidden if its nearest corner is behind the occluders over the whole
+// rectangle it covers on the screen. The tiles settle most of it, the pixels are only
+// read for the tiles that are not entirely in front.
+bool OcclusionCuller::IsBoxVisible(const Matrix4f& WVP, bool& InFrustum)
+{
+    float MinX = FLT_MAX;
+    float MinY = FLT_MAX;
+    float MaxX = -FLT_MAX;
+    float MaxY = -FLT_MAX;
+    float Nearest = 0.0f;
+    bool BeyondFar = true;
+
+    InFrustum = true;
+
+    for (unsigned int i = 0 ; i < 8 ; i++) {
+        const Vector3f Corner((i & 1) ? s_boxMax.x : s_boxMin.x,
+                              (i & 2) ? s_boxMax.y : s_boxMin.y,
+                              (i & 4) ? s_boxMax.z : s_boxMin.z);
+        const Vector4f Clip = OcclusionTransform(WVP, Corner);
+
+        if (Clip.w <= OCCLUSION_NEAR_W) {
+            return true;
+        }
+
+        const float InvW = 1.0f / Clip.w;
+        const float x = (Clip.x * InvW * 0.5f + 0.5f) * OCCLUSION_BUFFER_WIDTH;
+        const float y = (Clip.y * InvW * 0.5f + 0.5f) * OCCLUSION_BUFFER_HEIGHT;
+
+        MinX = std::min(MinX, x);
+        MinY = std::min(MinY, y);
+        MaxX = std::max(MaxX, x);
+        MaxY = std::max(MaxY, y);
+        Nearest = std::max(Nearest, InvW);
+        BeyondFar = BeyondFar && Clip.z > Clip.w;
+    }
+
+    if (MaxX < 0.0f || MaxY < 0.0f || MinX >= OCCLUSION_BUFFER_WIDTH || MinY >= OCCLUSION_BUFFER_HEIGHT || BeyondFar) {
+        InFrustum = false;
+        return false;
+    }
+
+    const int X0 = std::max((int)MinX, 0);
+    const int Y0 = std::max((int)MinY, 0);
+    const int X1 = std::min((int)MaxX, OCCLUSION_BUFFER_WIDTH - 1);
+    const int Y1 = std::min((int)MaxY, OCCLUSION_BUFFER_HEIGHT - 1);
+    const int NumTilesX = OCCLUSION_BUFFER_WIDTH / OCCLUSION_TILE_SIZE;
+
+    for (int TileY = Y0 / OCCLUSION_TILE_SIZE ; TileY <= Y1 / OCCLUSION_TILE_SIZE ; TileY++) {
+        for (int TileX = X0 / OCCLUSION_TILE_SIZE ; TileX <= X1 / OCCLUSION_TILE_SIZE ; TileX++) {
+            if (s_tileDepth[TileY * NumTilesX + TileX] > Nearest) {
+                continue;
+            }
+
+            const int TileX0 = std::max(TileX * OCCLUSION_TILE_SIZE, X0);
+            const int TileY0 = std::max(TileY * OCCLUSION_TILE_SIZE, Y0);
+            const int TileX1 = std::min((TileX + 1) * OCCLUSION_TILE_SIZE - 1, X1);
+            const int TileY1 = std::min((TileY + 1) * OCCLUSION_TILE_SIZE - 1, Y1);
+
+            for (int y = TileY0 ; y <= TileY1 ; y++) {
+                for (int x = TileX0 ; x <= TileX1 ; x++) {
+                    if (s_depth[y * OCCLUSION_BUFFER_WIDTH + x] <= Nearest) {
+                        return true;
+                    }
+                }
+            }
+        }
+    }
+
+    return false;
+}
+
+
+void OcclusionCuller::Shutdown()
+{
+    {
+        std::lock_guard<std::mutex> Lock(s_mutex);
+        s_stop = true;
+    }
+
+    s_condition.notify_all();
+
+    for (unsigned int i = 0 ; i < s_threads.size() ; i++) {
+        s_threads[i].join();
+    }
+
+    s_threads.clear();
+}
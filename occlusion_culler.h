@@ -0,0 +1,145 @@
+/*
+
+	Copyright 2011 Etay Meiri
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef OCCLUSION_CULLER_H
+#define	OCCLUSION_CULLER_H
+
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <condition_variable>
+
+#include "math_3d.h"
+
+// Resolution of the depth buffer the occluders are rasterized into. Both must be
+// multiples of the tile size.
+#define OCCLUSION_BUFFER_WIDTH  320
+#define OCCLUSION_BUFFER_HEIGHT 256
+
+// The coarse level holds the farthest depth of every tile of this many pixels square
+#define OCCLUSION_TILE_SIZE 8
+
+// Rows of tiles rasterized by one job
+#define OCCLUSION_BAND_TILES 4
+
+// Only the nearest instances are drawn as occluders
+#define OCCLUSION_MAX_OCCLUDERS 16
+
+// Instances tested by one job
+#define OCCLUSION_TEST_CHUNK 64
+
+// Culls the instances of a mesh against the nearest ones on the CPU, before their
+// matrices are handed to Mesh::Render. The occluder (the largest triangles of the mesh)
+// is rasterized by a pool of threads into a small depth buffer, each thread covering a
+// band of rows, and the bounding box of every instance is then tested against it,
+// first per tile and then per pixel.
+//
+// The buffer stores 1/w, so that it can be interpolated linearly in screen space, with
+// 0 for the empty pixels. Triangles and boxes that cross the camera plane are never
+// clipped: the triangles are dropped and the boxes are visible, which keeps the test
+// conservative. Call from one thread at a time.
+class OcclusionCuller
+{
+public:
+    struct Stats {
+        double RasterMs;
+        double TestMs;
+        unsigned int NumFrames;
+        unsigned int NumOccluderTriangles;  // per frame, all the occluders together
+        unsigned int NumTested;
+        unsigned int NumFrustumCulled;
+        unsigned int NumOccluded;
+    };
+
+    // Takes a copy of the triangles the occluder instances are drawn with, in the object
+    // space of the instances. They must not extend past the surface of the instances,
+    // or the visible instances behind that part are culled.
+    static void SetOccluder(const std::vector<Vector3f>& Positions, const std::vector<unsigned int>& Indices);
+
+    // Rasterizes the nearest instances as occluders and tests the box of every instance.
+    // The matrices are transposed like the ones of Mesh::Render and the box is in object
+    // space. Sets pVisible[i] to 0 or 1 and returns the number of visible instances.
+    static unsigned int Cull(unsigned int NumInstances, const Matrix4f* WVPMats,
+                             const Vector3f& BoxMin, const Vector3f& BoxMax, unsigned char* pVisible);
+
+    // Accumulated since the last ResetStats
+    static const Stats& GetStats() { return s_stats; }
+
+    static void ResetStats();
+
+    // Stops the threads. Must run before exiting.
+    static void Shutdown();
+
+private:
+    // A triangle ready to be rasterized. The edge functions and the depth are planes in
+    // pixel coordinates, evaluated at the pixel centers.
+    struct Triangle {
+        float Edge[3][3];   // a * x + b * y + c, positive inside
+        float Depth[3];
+        int MinX;
+        int MinY;
+        int MaxX;
+        int MaxY;
+    };
+
+    typedef void (*JobFunc)(unsigned int Job);
+
+    static void RunJobs(JobFunc pJob, unsigned int NumJobs);
+    static bool RunNextJob(unsigned int Generation);
+    static void WorkerThread();
+
+    static void SetupOccluder(unsigned int Occluder);
+    static void RasterizeBand(unsigned int Band);
+    static void TestInstances(unsigned int Chunk);
+
+    static void RasterizeTriangle(const Triangle& Tri, int FirstRow, int EndRow);
+    static bool IsBoxVisible(const Matrix4f& WVP, bool& InFrustum);
+
+    static std::mutex s_mutex;
+    static std::condition_variable s_condition;
+    static std::condition_variable s_doneCondition;
+    static std::vector<std::thread> s_threads;
+    static bool s_stop;
+    static unsigned int s_generation;
+    static JobFunc s_pJob;
+    static unsigned int s_numJobs;
+    static unsigned int s_nextJob;
+    static unsigned int s_numDoneJobs;
+
+    static std::vector<Vector3f> s_positions;
+    static std::vector<unsigned int> s_indices;
+    static std::vector<float> s_depth;
+    static std::vector<float> s_tileDepth;
+    static std::vector<Triangle> s_triangles;       // of all the occluders in a row
+    static std::vector<unsigned int> s_occluders;
+
+    // Inputs of the running Cull for the jobs
+    static unsigned int s_numInstances;
+    static const Matrix4f* s_pWVPMats;
+    static Vector3f s_boxMin;
+    static Vector3f s_boxMax;
+    static unsigned char* s_pVisible;
+
+    static std::atomic<unsigned int> s_numVisible;
+    static std::atomic<unsigned int> s_numFrustumCulled;
+    static Stats s_stats;
+};
+
+
+#endif	/* OCCLUSION_CULLER_H */
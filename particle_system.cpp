@@ -20,6 +20,7 @@
 #include "util.h"
 #include "particle_system.h"
 #include "math_3d.h"
+#include "gl_state.h"
 
 #include "math_3d.cpp"
 
@@ -30,6 +31,12 @@
 #define PARTICLE_TYPE_SHELL 1.0f
 #define PARTICLE_TYPE_SECONDARY_SHELL 2.0f
 
+// One sprite per particle type, indexed by Particle::Type. The layer is clamped by the
+// sampler so the types past the end of the list use the last sprite.
+static const char* ParticleSprites[] = {
+    "./Content/fireworks_red.jpg"
+};
+
 struct Particle
 {
     float Type;    
@@ -45,7 +52,6 @@ ParticleSystem::ParticleSystem()
     m_currTFB = 1;
     m_isFirst = true;
     m_time = 0;
-    m_pTexture = NULL;            
     
     ZERO_MEM(m_transformFeedback);
     ZERO_MEM(m_particleBuffer);
@@ -54,14 +60,12 @@ ParticleSystem::ParticleSystem()
 
 ParticleSystem::~ParticleSystem()
 {
-    SAFE_DELETE(m_pTexture);
-    
     if (m_transformFeedback[0] != 0) {
         glDeleteTransformFeedbacks(2, m_transformFeedback);
     }
     
     if (m_particleBuffer[0] != 0) {
-        glDeleteBuffers(2, m_particleBuffer);
+        GLState::DeleteBuffers(2, m_particleBuffer);
     }
 }
 
@@ -77,16 +81,20 @@ bool ParticleSystem::InitParticleSystem(const Vector3f& Pos)
     Particles[0].LifetimeMillis = 0.0f;
 
     glGenTransformFeedbacks(2, m_transformFeedback);    
-    glGenBuffers(2, m_particleBuffer);
+    GLState::CreateBuffers(2, m_particleBuffer);
     
     for (unsigned int i = 0; i < 2 ; i++) {
         glBindTransformFeedback(GL_TRANSFORM_FEEDBACK, m_transformFeedback[i]);
         glBindBufferBase(GL_TRANSFORM_FEEDBACK_BUFFER, 0, m_particleBuffer[i]);
-        glBindBuffer(GL_ARRAY_BUFFER, m_particleBuffer[i]);
-        glBufferData(GL_ARRAY_BUFFER, sizeof(Particles), Particles, GL_DYNAMIC_DRAW);
+        GLState::BufferData(m_particleBuffer[i], sizeof(Particles), Particles, GL_DYNAMIC_DRAW);
     }
                       
-    if (!m_updateTechnique.Init()) {
+    // Both programs are built together, wait for them only once they are needed
+    if (!m_updateTechnique.Init() || !m_billboardTechnique.Init()) {
+        return false;
+    }
+
+    if (!m_updateTechnique.Wait()) {
         return false;
     }
     
@@ -103,7 +111,7 @@ bool ParticleSystem::InitParticleSystem(const Vector3f& Pos)
     
     m_randomTexture.Bind(RANDOM_TEXTURE_UNIT);
 
-    if (!m_billboardTechnique.Init()) {
+    if (!m_billboardTechnique.Wait()) {
         return false;
     }
     
@@ -113,9 +121,9 @@ bool ParticleSystem::InitParticleSystem(const Vector3f& Pos)
 
     m_billboardTechnique.SetBillboardSize(0.01f);
     
-    m_pTexture = new Texture(GL_TEXTURE_2D, "./Content/fireworks_red.jpg");
+    const std::vector<std::string> Sprites(ParticleSprites, ParticleSprites + ARRAY_SIZE_IN_ELEMENTS(ParticleSprites));
     
-    if (!m_pTexture->Load()) {
+    if (!m_sprites.Init(Sprites)) {
         return false;
     }        
     
@@ -144,15 +152,13 @@ void ParticleSystem::UpdateParticles(int DeltaTimeMillis)
    
     m_randomTexture.Bind(RANDOM_TEXTURE_UNIT);
     
-    glEnable(GL_RASTERIZER_DISCARD);
+    GLState::Enable(GL_RASTERIZER_DISCARD);
     
-    glBindBuffer(GL_ARRAY_BUFFER, m_particleBuffer[m_currVB]);    
+    GLState::BindBuffer(GL_ARRAY_BUFFER, m_particleBuffer[m_currVB]);    
     glBindTransformFeedback(GL_TRANSFORM_FEEDBACK, m_transformFeedback[m_currTFB]);
 
-    glEnableVertexAttribArray(0);
-    glEnableVertexAttribArray(1);
-    glEnableVertexAttribArray(2);
-    glEnableVertexAttribArray(3);
+    // The arrays stay enabled after the draw, the next user of the VAO sets its own
+    GLState::SetVertexAttribArrays(0xF);
 
     glVertexAttribPointer(0, 1, GL_FLOAT, GL_FALSE, sizeof(Particle), 0);                          // type
     glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(Particle), (const GLvoid*)4);         // position
@@ -171,30 +177,27 @@ void ParticleSystem::UpdateParticles(int DeltaTimeMillis)
     }            
     
     glEndTransformFeedback();
-
-    glDisableVertexAttribArray(0);
-    glDisableVertexAttribArray(1);
-    glDisableVertexAttribArray(2);
-    glDisableVertexAttribArray(3);
 }
     
 
 void ParticleSystem::RenderParticles(const Matrix4f& VP, const Vector3f& CameraPos)
 {
+    FrameUniforms& Frame = UniformBuffers::EditFrame();
+    Frame.VP = VP;
+    Frame.EyeWorldPos = CameraPos;
+    UniformBuffers::Update();
+
     m_billboardTechnique.Enable();
-    m_billboardTechnique.SetCameraPosition(CameraPos);
-    m_billboardTechnique.SetVP(VP);
-    m_pTexture->Bind(COLOR_TEXTURE_UNIT);
+    m_sprites.Bind(COLOR_TEXTURE_UNIT);
     
-    glDisable(GL_RASTERIZER_DISCARD);
+    GLState::Disable(GL_RASTERIZER_DISCARD);
 
-    glBindBuffer(GL_ARRAY_BUFFER, m_particleBuffer[m_currTFB]);    
+    GLState::BindBuffer(GL_ARRAY_BUFFER, m_particleBuffer[m_currTFB]);    
 
-    glEnableVertexAttribArray(0);
+    GLState::SetVertexAttribArrays(0x3);
 
     glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(Particle), (const GLvoid*)4);  // position
+    glVertexAttribPointer(1, 1, GL_FLOAT, GL_FALSE, sizeof(Particle), 0);                 // type -> layer
 
     glDrawTransformFeedback(GL_POINTS, m_transformFeedback[m_currTFB]);
-
-    glDisableVertexAttribArray(0);
 }
@@ -25,11 +25,15 @@
 #include "random_texture.h"
 #include "billboard_technique.h"
 #include "texture.h"
+#include "sprite_array.h"
 
 #include "ps_update_technique.cpp"
 #include "random_texture.cpp"
 #include "billboard_technique.cpp"
 #include "texture.cpp"
+#include "asset_registry.cpp"
+#include "texture_loader.cpp"
+#include "sprite_array.cpp"
 
 class ParticleSystem
 {
@@ -55,7 +59,7 @@ private:
     PSUpdateTechnique m_updateTechnique;
     BillboardTechnique m_billboardTechnique;
     RandomTexture m_randomTexture;
-    Texture* m_pTexture;
+    SpriteArray m_sprites;
     int m_time;
 };
 
@@ -18,15 +18,24 @@
 
 #include "pipeline.h"
 
-const Matrix4f& Pipeline::GetVPTrans()
+const Matrix4f& Pipeline::GetViewTrans()
 {
-    Matrix4f CameraTranslationTrans, CameraRotateTrans, PersProjTrans;
+    Matrix4f CameraTranslationTrans, CameraRotateTrans;
 
     CameraTranslationTrans.InitTranslationTransform(-m_camera.Pos.x, -m_camera.Pos.y, -m_camera.Pos.z);
     CameraRotateTrans.InitCameraTransform(m_camera.Target, m_camera.Up);
+
+    m_Vtransformation = CameraRotateTrans * CameraTranslationTrans;
+    return m_Vtransformation;
+}
+
+const Matrix4f& Pipeline::GetVPTrans()
+{
+    Matrix4f PersProjTrans;
+
     PersProjTrans.InitPersProjTransform(m_persProjInfo);
     
-    m_VPTtransformation = PersProjTrans * CameraRotateTrans * CameraTranslationTrans;
+    m_VPTtransformation = PersProjTrans * GetViewTrans();
     return m_VPTtransformation;
 }
 
@@ -68,6 +68,7 @@ public:
         m_camera.Up = Up;
     }
 
+    const Matrix4f& GetViewTrans();
     const Matrix4f& GetVPTrans();
     const Matrix4f& GetWVPTrans();
     const Matrix4f& GetWorldTrans();
@@ -85,6 +86,7 @@ private:
         Vector3f Up;
     } m_camera;
 
+    Matrix4f m_Vtransformation;
     Matrix4f m_WVPtransformation;
     Matrix4f m_VPTtransformation;
     Matrix4f m_WorldTransformation;
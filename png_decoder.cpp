@@ -0,0 +1,774 @@
+/*
+
+	Copyright 2011 Etay Meiri
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#pragma once
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+
+#include "png_decoder.h"
+
+#define PNG_FAST_BITS 9
+
+static const unsigned short PNGLengthBase[29] = {
+    3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+    35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258
+};
+
+static const unsigned char PNGLengthExtra[29] = {
+    0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2,
+    3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0
+};
+
+static const unsigned short PNGDistanceBase[30] = {
+    1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193,
+    257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577
+};
+
+static const unsigned char PNGDistanceExtra[30] = {
+    0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6,
+    7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13
+};
+
+// Order in which a dynamic block sends the lengths of the code length alphabet
+static const unsigned char PNGCodeLengthOrder[19] = {
+    16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15
+};
+
+
+struct PNGHuffman {
+    unsigned short Fast[1 << PNG_FAST_BITS];    // symbol << 4 | length for the short codes, 0 otherwise
+    unsigned short Counts[16];                  // number of codes of each length
+    unsigned short Symbols[288];                // sorted by code
+
+    // Rejects over subscribed sets. Incomplete sets are legal (a single distance code).
+    bool Build(const unsigned char* pLengths, unsigned int Count)
+    {
+        unsigned short Offsets[16];
+
+        memset(Counts, 0, sizeof(Counts));
+        memset(Fast, 0, sizeof(Fast));
+
+        for (unsigned int i = 0 ; i < Count ; i++) {
+            Counts[pLengths[i]]++;
+        }
+
+        Counts[0] = 0;
+        int Left = 1;
+
+        for (unsigned int Len = 1 ; Len < 16 ; Len++) {
+            Left = (Left << 1) - Counts[Len];
+
+            if (Left < 0) {
+                return false;
+            }
+        }
+
+        Offsets[1] = 0;
+
+        for (unsigned int Len = 1 ; Len < 15 ; Len++) {
+            Offsets[Len + 1] = Offsets[Len] + Counts[Len];
+        }
+
+        for (unsigned int i = 0 ; i < Count ; i++) {
+            if (pLengths[i] != 0) {
+                Symbols[Offsets[pLengths[i]]++] = (unsigned short)i;
+            }
+        }
+
+        // Deflate sends codes from the most significant bit, the lookup is indexed by
+        // the next bits of the stream in the order they arrive
+        unsigned int Code = 0;
+        unsigned int Index = 0;
+
+        for (unsigned int Len = 1 ; Len <= PNG_FAST_BITS ; Len++) {
+            for (unsigned int i = 0 ; i < Counts[Len] ; i++, Index++, Code++) {
+                unsigned int Reversed = 0;
+
+                for (unsigned int b = 0 ; b < Len ; b++) {
+                    Reversed |= ((Code >> b) & 1) << (Len - 1 - b);
+                }
+
+                for (unsigned int Fill = Reversed ; Fill < (1u << PNG_FAST_BITS) ; Fill += 1u << Len) {
+                    Fast[Fill] = (unsigned short)((Symbols[Index] << 4) | Len);
+                }
+            }
+
+            Code <<= 1;
+        }
+
+        return true;
+    }
+};
+
+
+// Codes of the fixed Huffman blocks. Built before main so the decode threads can share them.
+struct PNGFixedTables {
+    PNGFixedTables()
+    {
+        unsigned char Lengths[288];
+
+        memset(&Lengths[0], 8, 144);
+        memset(&Lengths[144], 9, 112);
+        memset(&Lengths[256], 7, 24);
+        memset(&Lengths[280], 8, 8);
+        Literals.Build(Lengths, 288);
+
+        memset(Lengths, 5, 30);
+        Distances.Build(Lengths, 30);
+    }
+
+    PNGHuffman Literals;
+    PNGHuffman Distances;
+};
+
+static const PNGFixedTables PNGFixed;
+
+
+// Inflates a zlib stream into a buffer of known size. The Adler-32 checksum is not
+// verified, the PNG filters catch most corruption anyway.
+class PNGInflater
+{
+public:
+    PNGInflater(const unsigned char* pData, size_t Size)
+    {
+        m_pData = pData;
+        m_size = Size;
+        m_pos = 0;
+        m_bits = 0;
+        m_numBits = 0;
+        m_padding = 0;
+    }
+
+    bool Inflate(std::vector<unsigned char>& Out);
+
+private:
+    // Zeros are shifted in past the end of the input, the caller checks m_padding
+    // before trusting the result
+    void FillBits()
+    {
+        while (m_numBits <= 56) {
+            uint64_t Byte = 0;
+
+            if (m_pos < m_size) {
+                Byte = m_pData[m_pos++];
+            }
+            else {
+                m_padding++;
+            }
+
+            m_bits |= Byte << m_numBits;
+            m_numBits += 8;
+        }
+    }
+
+    unsigned int GetBits(unsigned int Count)
+    {
+        if (m_numBits < Count) {
+            FillBits();
+        }
+
+        const unsigned int Value = (unsigned int)(m_bits & ((1ull << Count) - 1));
+        m_bits >>= Count;
+        m_numBits -= Count;
+
+        return Value;
+    }
+
+    bool Overrun() const
+    {
+        return m_padding * 8 > m_numBits;
+    }
+
+    // Returns -1 for an invalid code
+    int DecodeSymbol(const PNGHuffman& Table)
+    {
+        if (m_numBits < 16) {
+            FillBits();
+        }
+
+        const unsigned int Entry = Table.Fast[m_bits & ((1 << PNG_FAST_BITS) - 1)];
+
+        if (Entry != 0) {
+            m_bits >>= Entry & 15;
+            m_numBits -= Entry & 15;
+            return Entry >> 4;
+        }
+
+        // Walk the canonical code one bit at a time
+        int Code = 0;
+        int First = 0;
+        int Index = 0;
+
+        for (unsigned int Len = 1 ; Len < 16 ; Len++) {
+            Code |= (int)(m_bits & 1);
+            m_bits >>= 1;
+            m_numBits--;
+
+            const int Count = Table.Counts[Len];
+
+            if (Code - Count < First) {
+                return Table.Symbols[Index + (Code - First)];
+            }
+
+            Index += Count;
+            First = (First + Count) << 1;
+            Code <<= 1;
+        }
+
+        return -1;
+    }
+
+    bool ReadStoredBlock(std::vector<unsigned char>& Out, size_t& OutPos);
+    bool ReadDynamicTables(PNGHuffman& Literals, PNGHuffman& Distances);
+    bool ReadCompressedBlock(const PNGHuffman& Literals, const PNGHuffman& Distances, std::vector<unsigned char>& Out, size_t& OutPos);
+
+    const unsigned char* m_pData;
+    size_t m_size;
+    size_t m_pos;
+    uint64_t m_bits;
+    unsigned int m_numBits;
+    unsigned int m_padding;
+};
+
+
+bool PNGInflater::ReadStoredBlock(std::vector<unsigned char>& Out, size_t& OutPos)
+{
+    GetBits(m_numBits & 7);
+
+    const unsigned int Length = GetBits(16);
+    const unsigned int NLength = GetBits(16);
+
+    if ((Length ^ 0xFFFF) != NLength || Length > Out.size() - OutPos) {
+        return false;
+    }
+
+    // Drain what is left in the bit buffer, then copy straight from the input
+    unsigned int i = 0;
+
+    for ( ; i < Length && m_numBits >= 8 ; i++) {
+        Out[OutPos++] = (unsigned char)GetBits(8);
+    }
+
+    if (i < Length) {
+        if (Length - i > m_size - m_pos) {
+            return false;
+        }
+
+        memcpy(&Out[OutPos], &m_pData[m_pos], Length - i);
+        OutPos += Length - i;
+        m_pos += Length - i;
+    }
+
+    return !Overrun();
+}
+
+
+bool PNGInflater::ReadDynamicTables(PNGHuffman& Literals, PNGHuffman& Distances)
+{
+    const unsigned int NumLiterals = GetBits(5) + 257;
+    const unsigned int NumDistances = GetBits(5) + 1;
+    const unsigned int NumCodeLengths = GetBits(4) + 4;
+
+    if (NumLiterals > 286 || NumDistances > 30) {
+        return false;
+    }
+
+    unsigned char Lengths[286 + 30];
+    memset(Lengths, 0, 19);
+
+    for (unsigned int i = 0 ; i < NumCodeLengths ; i++) {
+        Lengths[PNGCodeLengthOrder[i]] = (unsigned char)GetBits(3);
+    }
+
+    PNGHuffman CodeLengths;
+
+    if (!CodeLengths.Build(Lengths, 19)) {
+        return false;
+    }
+
+    const unsigned int Total = NumLiterals + NumDistances;
+    unsigned int i = 0;
+
+    while (i < Total) {
+        const int Symbol = DecodeSymbol(CodeLengths);
+
+        if (Symbol < 0) {
+            return false;
+        }
+
+        if (Symbol < 16) {
+            Lengths[i++] = (unsigned char)Symbol;
+            continue;
+        }
+
+        unsigned char Value = 0;
+        unsigned int Repeat = 0;
+
+        if (Symbol == 16) {
+            if (i == 0) {
+                return false;
+            }
+
+            Value = Lengths[i - 1];
+            Repeat = 3 + GetBits(2);
+        }
+        else if (Symbol == 17) {
+            Repeat = 3 + GetBits(3);
+        }
+        else {
+            Repeat = 11 + GetBits(7);
+        }
+
+        if (i + Repeat > Total) {
+            return false;
+        }
+
+        memset(&Lengths[i], Value, Repeat);
+        i += Repeat;
+    }
+
+    if (Lengths[256] == 0) {
+        return false;
+    }
+
+    return Literals.Build(Lengths, NumLiterals) && Distances.Build(&Lengths[NumLiterals], NumDistances) && !Overrun();
+}
+
+
+bool PNGInflater::ReadCompressedBlock(const PNGHuffman& Literals, const PNGHuffman& Distances, std::vector<unsigned char>& Out, size_t& OutPos)
+{
+    unsigned char* pOut = Out.empty() ? NULL : &Out[0];
+    const size_t OutSize = Out.size();
+
+    for (;;) {
+        const int Symbol = DecodeSymbol(Literals);
+
+        if (Symbol < 256) {
+            if (Symbol < 0 || OutPos >= OutSize) {
+                return false;
+            }
+
+            pOut[OutPos++] = (unsigned char)Symbol;
+            continue;
+        }
+
+        if (Symbol == 256) {
+            return !Overrun();
+        }
+
+        if (Symbol > 285) {
+            return false;
+        }
+
+        const unsigned int Length = PNGLengthBase[Symbol - 257] + GetBits(PNGLengthExtra[Symbol - 257]);
+        const int DistanceSymbol = DecodeSymbol(Distances);
+
+        if (DistanceSymbol < 0 || DistanceSymbol > 29) {
+            return false;
+        }
+
+        const size_t Distance = PNGDistanceBase[DistanceSymbol] + GetBits(PNGDistanceExtra[DistanceSymbol]);
+
+        if (Distance > OutPos || Length > OutSize - OutPos || Overrun()) {
+            return false;
+        }
+
+        const unsigned char* pSrc = &pOut[OutPos - Distance];
+        unsigned char* pDst = &pOut[OutPos];
+
+        if (Distance >= Length) {
+            memcpy(pDst, pSrc, Length);
+        }
+        else {
+            // Overlapping copy repeats the last Distance bytes
+            for (unsigned int i = 0 ; i < Length ; i++) {
+                pDst[i] = pSrc[i];
+            }
+        }
+
+        OutPos += Length;
+    }
+}
+
+
+bool PNGInflater::Inflate(std::vector<unsigned char>& Out)
+{
+    if (m_size < 2) {
+        return false;
+    }
+
+    const unsigned int CMF = m_pData[0];
+    const unsigned int FLG = m_pData[1];
+
+    // Deflate with a window of at most 32K and no preset dictionary
+    if ((CMF & 15) != 8 || (CMF >> 4) > 7 || (CMF * 256 + FLG) % 31 != 0 || (FLG & 0x20)) {
+        return false;
+    }
+
+    m_pos = 2;
+
+    size_t OutPos = 0;
+    bool Last = false;
+
+    while (!Last) {
+        Last = GetBits(1) != 0;
+
+        const unsigned int Type = GetBits(2);
+        bool Ret = false;
+
+        if (Type == 0) {
+            Ret = ReadStoredBlock(Out, OutPos);
+        }
+        else if (Type == 1) {
+            Ret = ReadCompressedBlock(PNGFixed.Literals, PNGFixed.Distances, Out, OutPos);
+        }
+        else if (Type == 2) {
+            PNGHuffman Literals;
+            PNGHuffman Distances;
+
+            Ret = ReadDynamicTables(Literals, Distances) && ReadCompressedBlock(Literals, Distances, Out, OutPos);
+        }
+
+        if (!Ret) {
+            return false;
+        }
+    }
+
+    return OutPos == Out.size();
+}
+
+
+static unsigned int PNGReadU32(const unsigned char* p)
+{
+    return ((unsigned int)p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3];
+}
+
+
+static unsigned char PNGPaeth(int a, int b, int c)
+{
+    const int p = a + b - c;
+    const int pa = abs(p - a);
+    const int pb = abs(p - b);
+    const int pc = abs(p - c);
+
+    if (pa <= pb && pa <= pc) {
+        return (unsigned char)a;
+    }
+
+    return (unsigned char)((pb <= pc) ? b : c);
+}
+
+
+// Reverses the filter of each row in place. Rows are RowBytes long, each preceded by
+// its filter type.
+static bool PNGUnfilter(unsigned char* pData, unsigned int Height, size_t RowBytes, unsigned int PixelBytes)
+{
+    const unsigned char* pPrev = NULL;
+
+    for (unsigned int y = 0 ; y < Height ; y++) {
+        const unsigned int Filter = pData[0];
+        unsigned char* pRow = pData + 1;
+
+        // The row above the first one is all zeros, which turns Up into None, Average
+        // into a halved Sub and Paeth into Sub
+        if (pPrev == NULL) {
+            if (Filter == 2) {
+                pData += RowBytes + 1;
+                pPrev = pRow;
+                continue;
+            }
+
+            if (Filter == 3) {
+                for (size_t i = PixelBytes ; i < RowBytes ; i++) {
+                    pRow[i] += pRow[i - PixelBytes] >> 1;
+                }
+
+                pData += RowBytes + 1;
+                pPrev = pRow;
+                continue;
+            }
+        }
+
+        switch (Filter) {
+            case 0:
+                break;
+
+            case 1:
+                for (size_t i = PixelBytes ; i < RowBytes ; i++) {
+                    pRow[i] += pRow[i - PixelBytes];
+                }
+                break;
+
+            case 2:
+                for (size_t i = 0 ; i < RowBytes ; i++) {
+                    pRow[i] += pPrev[i];
+                }
+                break;
+
+            case 3:
+                for (size_t i = 0 ; i < PixelBytes ; i++) {
+                    pRow[i] += pPrev[i] >> 1;
+                }
+
+                for (size_t i = PixelBytes ; i < RowBytes ; i++) {
+                    pRow[i] += (unsigned char)((pRow[i - PixelBytes] + pPrev[i]) >> 1);
+                }
+                break;
+
+            case 4:
+                if (pPrev == NULL) {
+                    for (size_t i = PixelBytes ; i < RowBytes ; i++) {
+                        pRow[i] += pRow[i - PixelBytes];
+                    }
+                    break;
+                }
+
+                for (size_t i = 0 ; i < PixelBytes ; i++) {
+                    pRow[i] += pPrev[i];
+                }
+
+                for (size_t i = PixelBytes ; i < RowBytes ; i++) {
+                    pRow[i] += PNGPaeth(pRow[i - PixelBytes], pPrev[i], pPrev[i - PixelBytes]);
+                }
+                break;
+
+            default:
+                return false;
+        }
+
+        pPrev = pRow;
+        pData += RowBytes + 1;
+    }
+
+    return true;
+}
+
+
+bool DecodePNG(const unsigned char* pData, size_t Size, unsigned int& Width, unsigned int& Height, std::vector<unsigned char>& Pixels)
+{
+    static const unsigned char Signature[8] = { 0x89, 'P', 'N', 'G', 0x0D, 0x0A, 0x1A, 0x0A };
+
+    if (Size < 8 + 25 || memcmp(pData, Signature, 8) != 0 || PNGReadU32(&pData[8]) != 13 || memcmp(&pData[12], "IHDR", 4) != 0) {
+        return false;
+    }
+
+    const unsigned int ImageWidth = PNGReadU32(&pData[16]);
+    const unsigned int ImageHeight = PNGReadU32(&pData[20]);
+    const unsigned int BitDepth = pData[24];
+    const unsigned int ColorType = pData[25];
+    const unsigned int Interlace = pData[28];
+
+    unsigned int Channels = 0;
+
+    switch (ColorType) {
+        case 0: Channels = 1; break;
+        case 2: Channels = 3; break;
+        case 3: Channels = 1; break;
+        case 4: Channels = 2; break;
+        case 6: Channels = 4; break;
+        default: return false;
+    }
+
+    const bool ValidDepth = (ColorType == 0) ? (BitDepth == 1 || BitDepth == 2 || BitDepth == 4 || BitDepth == 8 || BitDepth == 16) :
+                            (ColorType == 3) ? (BitDepth == 1 || BitDepth == 2 || BitDepth == 4 || BitDepth == 8) :
+                                               (BitDepth == 8 || BitDepth == 16);
+
+    if (!ValidDepth || Interlace != 0 || pData[26] != 0 || pData[27] != 0 ||
+        ImageWidth == 0 || ImageHeight == 0 || ImageWidth > 32768 || ImageHeight > 32768) {
+        return false;
+    }
+
+    // Gather the palette, the transparent color and the compressed stream
+    unsigned char Palette[256][4];
+    unsigned int PaletteSize = 0;
+    bool HasKey = false;
+    unsigned int Key[3] = { 0, 0, 0 };
+    std::vector<unsigned char> Compressed;
+
+    // Indices past the end of the palette read as opaque black
+    memset(Palette, 0, sizeof(Palette));
+
+    for (unsigned int i = 0 ; i < 256 ; i++) {
+        Palette[i][3] = 255;
+    }
+
+    size_t Pos = 8 + 25;
+
+    for (;;) {
+        if (Pos + 12 > Size) {
+            return false;
+        }
+
+        const unsigned int Length = PNGReadU32(&pData[Pos]);
+        const unsigned char* pType = &pData[Pos + 4];
+        const unsigned char* pChunk = &pData[Pos + 8];
+
+        if (Length > Size - Pos - 12) {
+            return false;
+        }
+
+        if (memcmp(pType, "IDAT", 4) == 0) {
+            Compressed.insert(Compressed.end(), pChunk, pChunk + Length);
+        }
+        else if (memcmp(pType, "PLTE", 4) == 0) {
+            if (Length % 3 != 0 || Length > 256 * 3) {
+                return false;
+            }
+
+            PaletteSize = Length / 3;
+
+            for (unsigned int i = 0 ; i < PaletteSize ; i++) {
+                Palette[i][0] = pChunk[i * 3];
+                Palette[i][1] = pChunk[i * 3 + 1];
+                Palette[i][2] = pChunk[i * 3 + 2];
+            }
+        }
+        else if (memcmp(pType, "tRNS", 4) == 0) {
+            if (ColorType == 3) {
+                for (unsigned int i = 0 ; i < Length && i < 256 ; i++) {
+                    Palette[i][3] = pChunk[i];
+                }
+            }
+            else if (ColorType == 0 && Length >= 2) {
+                Key[0] = (pChunk[0] << 8) | pChunk[1];
+                HasKey = true;
+            }
+            else if (ColorType == 2 && Length >= 6) {
+                for (unsigned int i = 0 ; i < 3 ; i++) {
+                    Key[i] = (pChunk[i * 2] << 8) | pChunk[i * 2 + 1];
+                }
+                HasKey = true;
+            }
+        }
+        else if (memcmp(pType, "IEND", 4) == 0) {
+            break;
+        }
+        else if (!(pType[0] & 0x20)) {
+            // Unknown critical chunk
+            return false;
+        }
+
+        Pos += Length + 12;
+    }
+
+    if (Compressed.empty() || (ColorType == 3 && PaletteSize == 0)) {
+        return false;
+    }
+
+    const unsigned int BitsPerPixel = Channels * BitDepth;
+    const unsigned int PixelBytes = (BitsPerPixel + 7) / 8;
+    const size_t RowBytes = ((size_t)ImageWidth * BitsPerPixel + 7) / 8;
+
+    std::vector<unsigned char> Raw((RowBytes + 1) * ImageHeight);
+    PNGInflater Inflater(&Compressed[0], Compressed.size());
+
+    if (!Inflater.Inflate(Raw) || !PNGUnfilter(&Raw[0], ImageHeight, RowBytes, PixelBytes)) {
+        return false;
+    }
+
+    // Expand every row to RGBA
+    Pixels.resize((size_t)ImageWidth * ImageHeight * 4);
+
+    const unsigned int MaxValue = (1 << BitDepth) - 1;
+    const unsigned int GrayScale = (BitDepth < 8) ? 255 / MaxValue : 1;
+
+    for (unsigned int y = 0 ; y < ImageHeight ; y++) {
+        const unsigned char* pRow = &Raw[y * (RowBytes + 1) + 1];
+        unsigned char* pOut = &Pixels[(size_t)y * ImageWidth * 4];
+
+        if (BitDepth < 8) {
+            for (unsigned int x = 0 ; x < ImageWidth ; x++, pOut += 4) {
+                const unsigned int Bit = x * BitDepth;
+                const unsigned int Value = (pRow[Bit >> 3] >> (8 - BitDepth - (Bit & 7))) & MaxValue;
+
+                if (ColorType == 3) {
+                    memcpy(pOut, Palette[Value], 4);
+                }
+                else {
+                    pOut[0] = pOut[1] = pOut[2] = (unsigned char)(Value * GrayScale);
+                    pOut[3] = (HasKey && Value == Key[0]) ? 0 : 255;
+                }
+            }
+            continue;
+        }
+
+        const unsigned int Step = BitDepth / 8;
+
+        switch (ColorType) {
+            case 0:
+                for (unsigned int x = 0 ; x < ImageWidth ; x++, pRow += Step, pOut += 4) {
+                    const unsigned int Value = (Step == 2) ? ((pRow[0] << 8) | pRow[1]) : pRow[0];
+                    pOut[0] = pOut[1] = pOut[2] = pRow[0];
+                    pOut[3] = (HasKey && Value == Key[0]) ? 0 : 255;
+                }
+                break;
+
+            case 2:
+                for (unsigned int x = 0 ; x < ImageWidth ; x++, pRow += Step * 3, pOut += 4) {
+                    pOut[0] = pRow[0];
+                    pOut[1] = pRow[Step];
+                    pOut[2] = pRow[Step * 2];
+                    pOut[3] = 255;
+
+                    if (HasKey) {
+                        bool Match = true;
+
+                        for (unsigned int i = 0 ; i < 3 ; i++) {
+                            const unsigned int Value = (Step == 2) ? ((pRow[i * 2] << 8) | pRow[i * 2 + 1]) : pRow[i];
+                            Match = Match && (Value == Key[i]);
+                        }
+
+                        pOut[3] = Match ? 0 : 255;
+                    }
+                }
+                break;
+
+            case 3:
+                for (unsigned int x = 0 ; x < ImageWidth ; x++, pOut += 4) {
+                    memcpy(pOut, Palette[pRow[x]], 4);
+                }
+                break;
+
+            case 4:
+                for (unsigned int x = 0 ; x < ImageWidth ; x++, pRow += Step * 2, pOut += 4) {
+                    pOut[0] = pOut[1] = pOut[2] = pRow[0];
+                    pOut[3] = pRow[Step];
+                }
+                break;
+
+            case 6:
+                if (Step == 1) {
+                    memcpy(pOut, pRow, (size_t)ImageWidth * 4);
+                    break;
+                }
+
+                for (unsigned int x = 0 ; x < ImageWidth ; x++, pRow += 8, pOut += 4) {
+                    pOut[0] = pRow[0];
+                    pOut[1] = pRow[2];
+                    pOut[2] = pRow[4];
+                    pOut[3] = pRow[6];
+                }
+                break;
+        }
+    }
+
+    Width = ImageWidth;
+    Height = ImageHeight;
+
+    return true;
+}
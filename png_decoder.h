@@ -0,0 +1,30 @@
+/*
+
+	Copyright 2011 Etay Meiri
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef PNG_DECODER_H
+#define	PNG_DECODER_H
+
+#include <vector>
+#include <stddef.h>
+
+// Decodes non interlaced PNG files of every color type and bit depth into 8 bit RGBA
+// rows, top row first. 16 bit samples keep their high byte and tRNS transparency is
+// applied. Interlaced and corrupt files return false.
+bool DecodePNG(const unsigned char* pData, size_t Size, unsigned int& Width, unsigned int& Height, std::vector<unsigned char>& Pixels);
+
+#endif	/* PNG_DECODER_H */
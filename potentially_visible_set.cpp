@@ -0,0 +1,150 @@
+/*
+
+	Copyright 2011 Etay Meiri
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <algorithm>
+
+#include "potentially_visible_set.h"
+
+#define PVS_MAGIC 0x53565650    // "PVVS"
+
+// Header of the PVS files, followed by the bits of all the cells
+struct PotentiallyVisibleSetHeader {
+    unsigned int Magic;
+    unsigned int Res[3];
+    float Min[3];
+    float Max[3];
+    unsigned int NumEntries;
+};
+
+
+int PotentiallyVisibleSet::GetCell(const Vector3f& Pos) const
+{
+    if (IsEmpty()) {
+        return -1;
+    }
+
+    const float Coords[3] = { Pos.x, Pos.y, Pos.z };
+    const float Mins[3] = { Min.x, Min.y, Min.z };
+    const float Maxs[3] = { Max.x, Max.y, Max.z };
+    unsigned int Cell[3];
+
+    for (unsigned int i = 0 ; i < 3 ; i++) {
+        if (Coords[i] < Mins[i] || Coords[i] > Maxs[i]) {
+            return -1;
+        }
+
+        // The far faces of the box belong to the last cells
+        const float t = (Coords[i] - Mins[i]) / (Maxs[i] - Mins[i]);
+        Cell[i] = std::min((unsigned int)(t * Res[i]), Res[i] - 1);
+    }
+
+    return (Cell[2] * Res[1] + Cell[1]) * Res[0] + Cell[0];
+}
+
+
+const unsigned int* PotentiallyVisibleSet::GetVisibleEntries(const Vector3f& Pos) const
+{
+    const int Cell = GetCell(Pos);
+
+    return (Cell < 0) ? NULL : &Bits[Cell * GetNumWords()];
+}
+
+
+unsigned int PotentiallyVisibleSet::CountVisibleEntries(unsigned int Cell) const
+{
+    unsigned int Count = 0;
+
+    for (unsigned int i = 0 ; i < NumEntries ; i++) {
+        Count += (Bits[Cell * GetNumWords() + i / 32] >> (i % 32)) & 1;
+    }
+
+    return Count;
+}
+
+
+bool PotentiallyVisibleSet::Load(const std::string& FileName)
+{
+    FILE* f = fopen(FileName.c_str(), "rb");
+
+    if (!f) {
+        fprintf(stderr, "Error opening '%s'\n", FileName.c_str());
+        return false;
+    }
+
+    PotentiallyVisibleSetHeader Header;
+    bool Ret = fread(&Header, sizeof(Header), 1, f) == 1 && Header.Magic == PVS_MAGIC &&
+               Header.NumEntries > 0 && Header.NumEntries <= (1 << 24);
+
+    if (Ret) {
+        for (unsigned int i = 0 ; i < 3 ; i++) {
+            Res[i] = Header.Res[i];
+            Ret = Ret && Header.Res[i] >= 1 && Header.Res[i] <= 1024;
+        }
+
+        Min = Vector3f(Header.Min[0], Header.Min[1], Header.Min[2]);
+        Max = Vector3f(Header.Max[0], Header.Max[1], Header.Max[2]);
+        NumEntries = Header.NumEntries;
+    }
+
+    if (Ret) {
+        Bits.resize(GetNumCells() * GetNumWords());
+        Ret = fread(&Bits[0], sizeof(unsigned int), Bits.size(), f) == Bits.size();
+    }
+
+    fclose(f);
+
+    if (!Ret) {
+        fprintf(stderr, "'%s' is not a valid PVS\n", FileName.c_str());
+        Bits.clear();
+    }
+
+    return Ret;
+}
+
+
+bool PotentiallyVisibleSet::Save(const std::string& FileName) const
+{
+    FILE* f = fopen(FileName.c_str(), "wb");
+
+    if (!f) {
+        fprintf(stderr, "Error creating '%s'\n", FileName.c_str());
+        return false;
+    }
+
+    PotentiallyVisibleSetHeader Header;
+    Header.Magic = PVS_MAGIC;
+    memcpy(Header.Res, Res, sizeof(Header.Res));
+    memcpy(Header.Min, &Min, sizeof(Header.Min));
+    memcpy(Header.Max, &Max, sizeof(Header.Max));
+    Header.NumEntries = NumEntries;
+
+    const bool Ret = fwrite(&Header, sizeof(Header), 1, f) == 1 &&
+                     fwrite(&Bits[0], sizeof(unsigned int), Bits.size(), f) == Bits.size();
+
+    fclose(f);
+
+    if (!Ret) {
+        fprintf(stderr, "Error writing '%s'\n", FileName.c_str());
+    }
+
+    return Ret;
+}
@@ -0,0 +1,65 @@
+/*
+
+	Copyright 2011 Etay Meiri
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef POTENTIALLY_VISIBLE_SET_H
+#define	POTENTIALLY_VISIBLE_SET_H
+
+#include <string>
+#include <vector>
+
+#include "math_3d.h"
+
+// A grid of view cells over a box of a static scene, each with one bit per sub-mesh
+// (see Mesh::GetNumEntries) that is set if the sub-mesh may be seen from somewhere in
+// the cell. Finding the set of the camera is a division and an index, whatever the
+// size of the scene.
+struct PotentiallyVisibleSet {
+    PotentiallyVisibleSet()
+    {
+        Res[0] = Res[1] = Res[2] = 0;
+        NumEntries = 0;
+    }
+
+    unsigned int Res[3];                // cells along x, y and z
+    Vector3f Min;
+    Vector3f Max;
+    unsigned int NumEntries;
+    std::vector<unsigned int> Bits;     // GetNumWords() per cell, x runs fastest
+
+    unsigned int GetNumCells() const { return Res[0] * Res[1] * Res[2]; }
+
+    unsigned int GetNumWords() const { return (NumEntries + 31) / 32; }
+
+    bool IsEmpty() const { return Bits.empty(); }
+
+    // -1 outside the box
+    int GetCell(const Vector3f& Pos) const;
+
+    // The bitset of the cell around Pos, NULL outside the box where anything may be seen
+    const unsigned int* GetVisibleEntries(const Vector3f& Pos) const;
+
+    // Number of bits set in the given cell
+    unsigned int CountVisibleEntries(unsigned int Cell) const;
+
+    bool Load(const std::string& FileName);
+
+    bool Save(const std::string& FileName) const;
+};
+
+
+#endif	/* POTENTIALLY_VISIBLE_SET_H */
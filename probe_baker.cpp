@@ -0,0 +1,293 @@
+/*
+
+	Copyright 2011 Etay Meiri
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#pragma once
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <algorithm>
+#include <thread>
+#include <chrono>
+
+#include "probe_baker.h"
+#include "irradiance_probes.h"
+#include "lighting_technique.h"
+#include "cascaded_shadows.h"
+#include "texture_loader.h"
+#include "uniform_buffers.h"
+#include "pipeline.h"
+#include "mesh.h"
+#include "gl_state.h"
+#include "util.h"
+
+#include "irradiance_probes.cpp"
+
+GLuint ProbeBaker::s_fbo = 0;
+GLuint ProbeBaker::s_colorTexture = 0;
+GLuint ProbeBaker::s_depthTexture = 0;
+std::vector<float> ProbeBaker::s_pixels;
+
+// View direction and up vector of the cube faces
+static const Vector3f ProbeFaces[6][2] = {
+    { Vector3f( 1.0f,  0.0f,  0.0f), Vector3f(0.0f, 1.0f,  0.0f) },
+    { Vector3f(-1.0f,  0.0f,  0.0f), Vector3f(0.0f, 1.0f,  0.0f) },
+    { Vector3f( 0.0f,  1.0f,  0.0f), Vector3f(0.0f, 0.0f, -1.0f) },
+    { Vector3f( 0.0f, -1.0f,  0.0f), Vector3f(0.0f, 0.0f,  1.0f) },
+    { Vector3f( 0.0f,  0.0f,  1.0f), Vector3f(0.0f, 1.0f,  0.0f) },
+    { Vector3f( 0.0f,  0.0f, -1.0f), Vector3f(0.0f, 1.0f,  0.0f) }
+};
+
+
+// The real L2 spherical harmonics in the order the lighting shader evaluates them
+static void EvalSHBasis(const Vector3f& d, float* pBasis)
+{
+    pBasis[0] = 0.282095f;
+    pBasis[1] = 0.488603f * d.y;
+    pBasis[2] = 0.488603f * d.z;
+    pBasis[3] = 0.488603f * d.x;
+    pBasis[4] = 1.092548f * d.x * d.y;
+    pBasis[5] = 1.092548f * d.y * d.z;
+    pBasis[6] = 0.315392f * (3.0f * d.z * d.z - 1.0f);
+    pBasis[7] = 1.092548f * d.x * d.z;
+    pBasis[8] = 0.546274f * (d.x * d.x - d.y * d.y);
+}
+
+
+bool ProbeBaker::CreateFramebuffer()
+{
+    s_colorTexture = GLState::CreateTexture(GL_TEXTURE_2D);
+    GLState::BindTextureForEdit(s_colorTexture);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA32F, PROBE_BAKE_FACE_SIZE, PROBE_BAKE_FACE_SIZE, 0, GL_RGBA, GL_FLOAT, NULL);
+
+    s_depthTexture = GLState::CreateTexture(GL_TEXTURE_2D);
+    GLState::BindTextureForEdit(s_depthTexture);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT32F, PROBE_BAKE_FACE_SIZE, PROBE_BAKE_FACE_SIZE, 0,
+                 GL_DEPTH_COMPONENT, GL_FLOAT, NULL);
+
+    glGenFramebuffers(1, &s_fbo);
+    glBindFramebuffer(GL_FRAMEBUFFER, s_fbo);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, s_colorTexture, 0);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, s_depthTexture, 0);
+
+    const GLenum Status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+    if (Status != GL_FRAMEBUFFER_COMPLETE) {
+        fprintf(stderr, "Probe framebuffer error, status: 0x%x\n", Status);
+        return false;
+    }
+
+    s_pixels.resize(PROBE_BAKE_FACE_SIZE * PROBE_BAKE_FACE_SIZE * 4);
+
+    return GLCheckError();
+}
+
+
+void ProbeBaker::DestroyFramebuffer()
+{
+    if (s_fbo != 0) {
+        glDeleteFramebuffers(1, &s_fbo);
+        s_fbo = 0;
+    }
+
+    GLuint Textures[] = { s_colorTexture, s_depthTexture };
+    GLState::DeleteTextures(ARRAY_SIZE_IN_ELEMENTS(Textures), Textures);
+
+    s_colorTexture = 0;
+    s_depthTexture = 0;
+}
+
+
+bool ProbeBaker::Bake(Mesh* pMesh, LightingTechnique* pEffect, const DirectionalLight& Light,
+                      const std::string& FileName)
+{
+    ProbeVolume Volume;
+
+    if (!pMesh->GetBounds(Volume.Min, Volume.Max)) {
+        fprintf(stderr, "Nothing to bake the probes of\n");
+        return false;
+    }
+
+    // About the same spacing along every side
+    const Vector3f Size = Volume.Max - Volume.Min;
+    const float Longest = std::max(std::max(Size.x, Size.y), std::max(Size.z, 1e-3f));
+    const float SideSizes[3] = { Size.x, Size.y, Size.z };
+
+    for (unsigned int i = 0 ; i < 3 ; i++) {
+        Volume.Res[i] = std::max((unsigned int)ceilf(SideSizes[i] / Longest * (PROBE_BAKE_MAX_RES - 1)) + 1, 2u);
+    }
+
+    if (!CreateFramebuffer()) {
+        DestroyFramebuffer();
+        return false;
+    }
+
+    // Every probe sees the whole scene
+    PersProjInfo Proj;
+    Proj.FOV = 90.0f;
+    Proj.Width = PROBE_BAKE_FACE_SIZE;
+    Proj.Height = PROBE_BAKE_FACE_SIZE;
+    Proj.zFar = sqrtf(Size.x * Size.x + Size.y * Size.y + Size.z * Size.z) + 1.0f;
+    Proj.zNear = Proj.zFar * 1e-3f;
+
+    CascadedShadows::SetSceneBounds(Volume.Min, Volume.Max);
+
+    // The first bounce only sees the direct light and the sky
+    DirectionalLight DirectLight = Light;
+    DirectLight.AmbientIntensity = 0.0f;
+    pEffect->SetDirectionalLight(DirectLight);
+
+    const Vector3f Sky = Light.Color * Light.AmbientIntensity;
+    glClearColor(Sky.x, Sky.y, Sky.z, 1.0f);
+
+    glFrontFace(GL_CW);
+    glCullFace(GL_BACK);
+    GLState::Enable(GL_CULL_FACE);
+    GLState::Enable(GL_DEPTH_TEST);
+
+    // The textures load in the background
+    while (TextureLoader::IsBusy()) {
+        TextureLoader::Update();
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+
+    Volume.Coeffs.resize(Volume.GetNumProbes() * PROBE_SH_COEFFS);
+    std::vector<Vector3f> Coeffs(Volume.Coeffs.size());
+
+    for (unsigned int Bounce = 0 ; Bounce < PROBE_BAKE_BOUNCES ; Bounce++) {
+        unsigned int Probe = 0;
+
+        for (unsigned int z = 0 ; z < Volume.Res[2] ; z++) {
+            for (unsigned int y = 0 ; y < Volume.Res[1] ; y++) {
+                for (unsigned int x = 0 ; x < Volume.Res[0] ; x++) {
+                    RenderProbe(pMesh, pEffect, Volume.GetProbePos(x, y, z), Proj, Light.Direction,
+                                &Coeffs[Probe * PROBE_SH_COEFFS]);
+                    Probe++;
+                }
+            }
+        }
+
+        // Lights the next bounce
+        Volume.Coeffs = Coeffs;
+
+        if (!IrradianceProbes::SetVolume(Volume)) {
+            DestroyFramebuffer();
+            return false;
+        }
+
+        printf("Baked bounce %u of %u, %u probes\n", Bounce + 1, PROBE_BAKE_BOUNCES, Volume.GetNumProbes());
+    }
+
+    DestroyFramebuffer();
+    glClearColor(0.0f, 0.0f, 0.0f, 0.0f);
+    pEffect->SetDirectionalLight(Light);
+
+    return IrradianceProbes::Save(FileName, Volume);
+}
+
+
+void ProbeBaker::RenderProbe(Mesh* pMesh, LightingTechnique* pEffect, const Vector3f& Pos,
+                             const PersProjInfo& Proj, const Vector3f& LightDir, Vector3f* pCoeffs)
+{
+    Matrix4f World;
+    World.InitIdentity();
+
+    for (unsigned int i = 0 ; i < PROBE_SH_COEFFS ; i++) {
+        pCoeffs[i] = Vector3f(0.0f, 0.0f, 0.0f);
+    }
+
+    float TotalWeight = 0.0f;
+
+    for (unsigned int i = 0 ; i < ARRAY_SIZE_IN_ELEMENTS(ProbeFaces) ; i++) {
+        const Vector3f& N = ProbeFaces[i][0];
+        const Vector3f& Up = ProbeFaces[i][1];
+
+        Pipeline p;
+        p.SetCamera(Pos, N, Up);
+        p.SetPerspectiveProj(Proj);
+
+        FrameUniforms& Frame = UniformBuffers::EditFrame();
+        Frame.VP = p.GetVPTrans();
+        Frame.InvVP = Frame.VP.Inverse();
+        Frame.EyeWorldPos = Pos;
+        Frame.ZNear = Proj.zNear;
+        Frame.ZFar = Proj.zFar;
+        Frame.ScreenSize = Vector2f(Proj.Width, Proj.Height);
+
+        const Matrix4f WVP = p.GetWVPTrans().Transpose();
+
+        CascadedShadows::Update(Pos, N, Proj, LightDir);
+        UniformBuffers::Update();
+        CascadedShadows::Render(pMesh, 1, &World, 0, NULL);
+
+        glBindFramebuffer(GL_FRAMEBUFFER, s_fbo);
+        glViewport(0, 0, PROBE_BAKE_FACE_SIZE, PROBE_BAKE_FACE_SIZE);
+        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+
+        pEffect->SetPass(LIGHTING_PASS_FORWARD);
+        pEffect->Enable();
+        pMesh->Render(1, &WVP, &World, pEffect);
+
+        glReadPixels(0, 0, PROBE_BAKE_FACE_SIZE, PROBE_BAKE_FACE_SIZE, GL_RGBA, GL_FLOAT, &s_pixels[0]);
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+        ProjectFace(N, Up.Cross(N), N.Cross(Up.Cross(N)), pCoeffs, TotalWeight);
+    }
+
+    // The solid angles of the texels add up to about 4 pi. Dividing the cosine lobe by
+    // pi leaves 1, 2/3 and 1/4 for the three bands.
+    const float BandScale[3] = { 1.0f, 2.0f / 3.0f, 0.25f };
+
+    for (unsigned int i = 0 ; i < PROBE_SH_COEFFS ; i++) {
+        const unsigned int Band = (i == 0) ? 0 : (i < 4 ? 1 : 2);
+        pCoeffs[i] *= 4.0f * (float)M_PI / TotalWeight * BandScale[Band];
+    }
+}
+
+
+// Adds the radiance of the face in s_pixels, weighted by the solid angle of each texel.
+// The texel at (u, v) in [-1, 1] looks along N + u U + v V.
+void ProbeBaker::ProjectFace(const Vector3f& N, const Vector3f& U, const Vector3f& V, Vector3f* pCoeffs,
+                             float& TotalWeight)
+{
+    const float TexelSize = 2.0f / PROBE_BAKE_FACE_SIZE;
+
+    for (unsigned int y = 0 ; y < PROBE_BAKE_FACE_SIZE ; y++) {
+        for (unsigned int x = 0 ; x < PROBE_BAKE_FACE_SIZE ; x++) {
+            const float u = (x + 0.5f) * TexelSize - 1.0f;
+            const float v = (y + 0.5f) * TexelSize - 1.0f;
+            const float LengthSq = 1.0f + u * u + v * v;
+            const float Weight = TexelSize * TexelSize / (LengthSq * sqrtf(LengthSq));
+
+            Vector3f Dir = N + U * u + V * v;
+            Dir.Normalize();
+
+            float Basis[PROBE_SH_COEFFS];
+            EvalSHBasis(Dir, Basis);
+
+            const float* pPixel = &s_pixels[(y * PROBE_BAKE_FACE_SIZE + x) * 4];
+            const Vector3f Radiance(pPixel[0], pPixel[1], pPixel[2]);
+
+            for (unsigned int i = 0 ; i < PROBE_SH_COEFFS ; i++) {
+                pCoeffs[i] += Radiance * (Basis[i] * Weight);
+            }
+
+            TotalWeight += Weight;
+        }
+    }
+}
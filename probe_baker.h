@@ -0,0 +1,70 @@
+/*
+
+	Copyright 2011 Etay Meiri
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef PROBE_BAKER_H
+#define	PROBE_BAKER_H
+
+#include <string>
+
+#include "irradiance_probes.h"
+
+// Width and height of the cube faces rendered at every probe
+#define PROBE_BAKE_FACE_SIZE 32
+
+// Probes along the longest side of the scene, the other sides get as many as keep the
+// spacing about the same
+#define PROBE_BAKE_MAX_RES 16
+
+// Every bounce after the first lights the scene with the probes of the previous one
+#define PROBE_BAKE_BOUNCES 2
+
+class Mesh;
+class LightingTechnique;
+struct DirectionalLight;
+
+// Offline bake of an IrradianceProbes volume for a static scene. Every probe renders
+// the cube around it with the lighting technique and projects the radiance onto L2
+// spherical harmonics, which are then convolved with the cosine lobe. The sky is the
+// ambient color of the directional light, so the probes in the open reproduce the
+// constant ambient term and those that are occluded get darker or pick up the color
+// of the lit surfaces around them.
+class ProbeBaker
+{
+public:
+    // Bakes pMesh, drawn once with its object space as world space, and writes the
+    // volume to FileName. The probes fill the bounds of the mesh. Leaves the volume
+    // current.
+    static bool Bake(Mesh* pMesh, LightingTechnique* pEffect, const DirectionalLight& Light,
+                     const std::string& FileName);
+
+private:
+    static bool CreateFramebuffer();
+    static void RenderProbe(Mesh* pMesh, LightingTechnique* pEffect, const Vector3f& Pos,
+                            const PersProjInfo& Proj, const Vector3f& LightDir, Vector3f* pCoeffs);
+    static void ProjectFace(const Vector3f& N, const Vector3f& U, const Vector3f& V, Vector3f* pCoeffs,
+                            float& TotalWeight);
+    static void DestroyFramebuffer();
+
+    static GLuint s_fbo;
+    static GLuint s_colorTexture;
+    static GLuint s_depthTexture;
+    static std::vector<float> s_pixels;
+};
+
+
+#endif	/* PROBE_BAKER_H */
@@ -168,12 +168,14 @@ bool PSUpdateTechnique::Init()
     Varyings[2] = "Velocity1";    
     Varyings[3] = "Age1";
     
-    glTransformFeedbackVaryings(m_shaderProg, 4, Varyings, GL_INTERLEAVED_ATTRIBS);
+    SetTransformFeedbackVaryings(Varyings, 4, GL_INTERLEAVED_ATTRIBS);
 
-    if (!Finalize()) {
-        return false;
-    }
-    
+    return Finalize();
+}
+
+
+bool PSUpdateTechnique::OnFinalized()
+{    
     m_deltaTimeMillisLocation = GetUniformLocation("gDeltaTimeMillis");
     m_randomTextureLocation = GetUniformLocation("gRandomTexture");
     m_timeLocation = GetUniformLocation("gTime");
@@ -27,6 +27,8 @@ public:
     PSUpdateTechnique();
     
     virtual bool Init();    
+
+    virtual bool OnFinalized();
     
     void SetParticleLifetime(float Lifetime);
     
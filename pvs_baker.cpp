@@ -0,0 +1,194 @@
+/*
+
+	Copyright 2011 Etay Meiri
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <algorithm>
+
+#include "pvs_baker.h"
+#include "visibility_buffer.h"
+#include "visibility_technique.h"
+#include "pipeline.h"
+#include "mesh.h"
+#include "gl_state.h"
+#include "util.h"
+
+#include "potentially_visible_set.cpp"
+
+std::vector<unsigned int> PVSBaker::s_ids;
+
+// View direction and up vector of the cube faces
+static const Vector3f PVSFaces[6][2] = {
+    { Vector3f( 1.0f,  0.0f,  0.0f), Vector3f(0.0f, 1.0f,  0.0f) },
+    { Vector3f(-1.0f,  0.0f,  0.0f), Vector3f(0.0f, 1.0f,  0.0f) },
+    { Vector3f( 0.0f,  1.0f,  0.0f), Vector3f(0.0f, 0.0f, -1.0f) },
+    { Vector3f( 0.0f, -1.0f,  0.0f), Vector3f(0.0f, 0.0f,  1.0f) },
+    { Vector3f( 0.0f,  0.0f,  1.0f), Vector3f(0.0f, 1.0f,  0.0f) },
+    { Vector3f( 0.0f,  0.0f, -1.0f), Vector3f(0.0f, 1.0f,  0.0f) }
+};
+
+
+bool PVSBaker::Bake(Mesh* pMesh, VisibilityTechnique* pTechnique, const std::string& FileName)
+{
+    PotentiallyVisibleSet Sets;
+
+    if (!pMesh->GetBounds(Sets.Min, Sets.Max)) {
+        fprintf(stderr, "Nothing to bake the PVS of\n");
+        return false;
+    }
+
+    // About cubic cells
+    const Vector3f Size = Sets.Max - Sets.Min;
+    const float Longest = std::max(std::max(Size.x, Size.y), std::max(Size.z, 1e-3f));
+    const float SideSizes[3] = { Size.x, Size.y, Size.z };
+
+    for (unsigned int i = 0 ; i < 3 ; i++) {
+        Sets.Res[i] = std::max((unsigned int)ceilf(SideSizes[i] / Longest * PVS_BAKE_MAX_RES), 1u);
+    }
+
+    Sets.NumEntries = pMesh->GetNumEntries();
+    Sets.Bits.resize(Sets.GetNumCells() * Sets.GetNumWords(), 0);
+
+    VisibilityBuffer Buffer;
+
+    if (!Buffer.Init(PVS_BAKE_FACE_SIZE, PVS_BAKE_FACE_SIZE)) {
+        return false;
+    }
+
+    s_ids.resize(PVS_BAKE_FACE_SIZE * PVS_BAKE_FACE_SIZE * 2);
+
+    // Every sample sees the whole scene
+    PersProjInfo Proj;
+    Proj.FOV = 90.0f;
+    Proj.Width = PVS_BAKE_FACE_SIZE;
+    Proj.Height = PVS_BAKE_FACE_SIZE;
+    Proj.zFar = sqrtf(Size.x * Size.x + Size.y * Size.y + Size.z * Size.z) + 1.0f;
+    Proj.zNear = Proj.zFar * 1e-4f;
+
+    glFrontFace(GL_CW);
+    glCullFace(GL_BACK);
+    GLState::Enable(GL_CULL_FACE);
+    GLState::Enable(GL_DEPTH_TEST);
+    glViewport(0, 0, PVS_BAKE_FACE_SIZE, PVS_BAKE_FACE_SIZE);
+
+    std::vector<unsigned int> Seen(Sets.GetNumWords());
+    const Vector3f CellSize(Size.x / Sets.Res[0], Size.y / Sets.Res[1], Size.z / Sets.Res[2]);
+
+    // The corners, each added to the cells around it
+    for (int z = 0 ; z <= (int)Sets.Res[2] ; z++) {
+        for (int y = 0 ; y <= (int)Sets.Res[1] ; y++) {
+            for (int x = 0 ; x <= (int)Sets.Res[0] ; x++) {
+                const Vector3f Pos(Sets.Min.x + CellSize.x * x, Sets.Min.y + CellSize.y * y, Sets.Min.z + CellSize.z * z);
+
+                if (!RenderSample(pMesh, pTechnique, Buffer, Pos, Proj, Seen)) {
+                    return false;
+                }
+
+                for (unsigned int i = 0 ; i < 8 ; i++) {
+                    AddToCell(Sets, x - (i & 1), y - ((i >> 1) & 1), z - ((i >> 2) & 1), Seen);
+                }
+            }
+        }
+    }
+
+    // The centers
+    for (int z = 0 ; z < (int)Sets.Res[2] ; z++) {
+        for (int y = 0 ; y < (int)Sets.Res[1] ; y++) {
+            for (int x = 0 ; x < (int)Sets.Res[0] ; x++) {
+                const Vector3f Pos(Sets.Min.x + CellSize.x * (x + 0.5f),
+                                   Sets.Min.y + CellSize.y * (y + 0.5f),
+                                   Sets.Min.z + CellSize.z * (z + 0.5f));
+
+                if (!RenderSample(pMesh, pTechnique, Buffer, Pos, Proj, Seen)) {
+                    return false;
+                }
+
+                AddToCell(Sets, x, y, z, Seen);
+            }
+        }
+    }
+
+    unsigned int TotalVisible = 0;
+
+    for (unsigned int i = 0 ; i < Sets.GetNumCells() ; i++) {
+        TotalVisible += Sets.CountVisibleEntries(i);
+    }
+
+    printf("Baked %u view cells (%ux%ux%u), %.1f of %u sub-meshes visible per cell on average\n",
+           Sets.GetNumCells(), Sets.Res[0], Sets.Res[1], Sets.Res[2],
+           (float)TotalVisible / Sets.GetNumCells(), Sets.NumEntries);
+
+    return Sets.Save(FileName);
+}
+
+
+// Renders the six faces around Pos and sets the bits of the entries they show in Seen
+bool PVSBaker::RenderSample(Mesh* pMesh, VisibilityTechnique* pTechnique, VisibilityBuffer& Buffer,
+                            const Vector3f& Pos, const PersProjInfo& Proj, std::vector<unsigned int>& Seen)
+{
+    Matrix4f World;
+    World.InitIdentity();
+
+    std::fill(Seen.begin(), Seen.end(), 0);
+
+    for (unsigned int i = 0 ; i < ARRAY_SIZE_IN_ELEMENTS(PVSFaces) ; i++) {
+        Pipeline p;
+        p.SetCamera(Pos, PVSFaces[i][0], PVSFaces[i][1]);
+        p.SetPerspectiveProj(Proj);
+
+        const Matrix4f WVP = p.GetWVPTrans().Transpose();
+
+        Buffer.BindForWriting();
+
+        if (!pTechnique->Enable() || !pMesh->RenderVisibility(1, &WVP, &World, pTechnique)) {
+            fprintf(stderr, "The mesh doesn't fit in the visibility buffer\n");
+            glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
+            return false;
+        }
+
+        Buffer.ReadIDs(&s_ids[0]);
+
+        // The second ID holds the entry, all ones where nothing was drawn
+        for (unsigned int j = 1 ; j < s_ids.size() ; j += 2) {
+            if (s_ids[j] != 0xFFFFFFFF) {
+                const unsigned int Entry = s_ids[j] >> VISIBILITY_ENTRY_SHIFT;
+                Seen[Entry / 32] |= 1u << (Entry % 32);
+            }
+        }
+    }
+
+    glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
+
+    return true;
+}
+
+
+void PVSBaker::AddToCell(PotentiallyVisibleSet& Sets, int x, int y, int z, const std::vector<unsigned int>& Seen)
+{
+    if (x < 0 || y < 0 || z < 0 || x >= (int)Sets.Res[0] || y >= (int)Sets.Res[1] || z >= (int)Sets.Res[2]) {
+        return;
+    }
+
+    unsigned int* pBits = &Sets.Bits[((z * Sets.Res[1] + y) * Sets.Res[0] + x) * Sets.GetNumWords()];
+
+    for (unsigned int i = 0 ; i < Seen.size() ; i++) {
+        pBits[i] |= Seen[i];
+    }
+}
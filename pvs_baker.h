@@ -0,0 +1,61 @@
+/*
+
+	Copyright 2011 Etay Meiri
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef PVS_BAKER_H
+#define	PVS_BAKER_H
+
+#include <string>
+#include <vector>
+
+#include "potentially_visible_set.h"
+
+// Width and height of the cube faces rendered at every sample
+#define PVS_BAKE_FACE_SIZE 128
+
+// Cells along the longest side of the scene, the other sides get as many as keep the
+// cells about cubic
+#define PVS_BAKE_MAX_RES 8
+
+class Mesh;
+class VisibilityTechnique;
+class VisibilityBuffer;
+
+// Offline bake of a PotentiallyVisibleSet for a static scene. The cube around every
+// corner and every center of the cells is rendered into a visibility buffer and the
+// entries found in it are added to the cells that share the point. A corner is shared
+// by up to eight cells so the sets of neighbors agree where the camera crosses over.
+//
+// The sets are sampled, not exact: a sub-mesh seen only through a gap between the
+// samples or smaller than a texel from all of them is missed.
+class PVSBaker
+{
+public:
+    // Bakes pMesh, drawn once with its object space as world space, and writes the
+    // sets to FileName. The cells fill the bounds of the mesh.
+    static bool Bake(Mesh* pMesh, VisibilityTechnique* pTechnique, const std::string& FileName);
+
+private:
+    static bool RenderSample(Mesh* pMesh, VisibilityTechnique* pTechnique, VisibilityBuffer& Buffer,
+                             const Vector3f& Pos, const PersProjInfo& Proj, std::vector<unsigned int>& Seen);
+    static void AddToCell(PotentiallyVisibleSet& Sets, int x, int y, int z, const std::vector<unsigned int>& Seen);
+
+    static std::vector<unsigned int> s_ids;
+};
+
+
+#endif	/* PVS_BAKER_H */
@@ -19,6 +19,7 @@
 #include "random_texture.h"
 #include "math_3d.h"
 #include "util.h"
+#include "gl_state.h"
 
 #include "math_3d.cpp"
 
@@ -31,7 +32,7 @@ RandomTexture::RandomTexture()
 RandomTexture::~RandomTexture()
 {
     if (m_textureObj != 0) {
-        glDeleteTextures(1, &m_textureObj);
+        GLState::DeleteTextures(1, &m_textureObj);
     }
 }
 
@@ -44,12 +45,12 @@ bool RandomTexture::InitRandomTexture(unsigned int Size)
         pRandomData[i].z = RandomFloat();
     }
         
-    glGenTextures(1, &m_textureObj);
-    glBindTexture(GL_TEXTURE_1D, m_textureObj);
+    m_textureObj = GLState::CreateTexture(GL_TEXTURE_1D);
+    GLState::BindTextureForEdit(m_textureObj);
     glTexImage1D(GL_TEXTURE_1D, 0, GL_RGB, Size, 0.0f, GL_RGB, GL_FLOAT, pRandomData);
-    glTexParameterf(GL_TEXTURE_1D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-	glTexParameterf(GL_TEXTURE_1D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-    glTexParameterf(GL_TEXTURE_1D, GL_TEXTURE_WRAP_S, GL_REPEAT);    
+    GLState::TextureParameterf(m_textureObj, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+	GLState::TextureParameterf(m_textureObj, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    GLState::TextureParameterf(m_textureObj, GL_TEXTURE_WRAP_S, GL_REPEAT);    
     
     delete [] pRandomData;
     
@@ -59,7 +60,6 @@ bool RandomTexture::InitRandomTexture(unsigned int Size)
     
 void RandomTexture::Bind(GLenum TextureUnit)
 {
-    glActiveTexture(TextureUnit);
-    glBindTexture(GL_TEXTURE_1D, m_textureObj);
+    GLState::BindTexture(TextureUnit - GL_TEXTURE0, GL_TEXTURE_1D, m_textureObj);
 }
 
@@ -0,0 +1,85 @@
+/*
+
+	Copyright 2011 Etay Meiri
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#pragma once
+#include <algorithm>
+
+#include "sampler_cache.h"
+
+std::map<SamplerDesc, GLuint> SamplerCache::s_samplers;
+SamplerDesc SamplerCache::s_default;
+GLuint SamplerCache::s_defaultSampler = 0;
+
+
+float SamplerCache::GetMaxAnisotropy()
+{
+    GLfloat MaxAnisotropy = 1.0f;
+
+    if (GLEW_ARB_texture_filter_anisotropic || GLEW_EXT_texture_filter_anisotropic) {
+        glGetFloatv(GL_MAX_TEXTURE_MAX_ANISOTROPY_EXT, &MaxAnisotropy);
+    }
+
+    return MaxAnisotropy;
+}
+
+
+GLuint SamplerCache::GetSampler(const SamplerDesc& Desc)
+{
+    SamplerDesc Key = Desc;
+    Key.MaxAnisotropy = std::min(std::max(Desc.MaxAnisotropy, 1.0f), GetMaxAnisotropy());
+
+    std::map<SamplerDesc, GLuint>::iterator it = s_samplers.find(Key);
+
+    if (it != s_samplers.end()) {
+        return it->second;
+    }
+
+    GLuint Sampler = 0;
+    glGenSamplers(1, &Sampler);
+
+    const GLint MinFilter = (Key.Filter == SAMPLER_FILTER_TRILINEAR) ? GL_LINEAR_MIPMAP_LINEAR : GL_LINEAR;
+
+    glSamplerParameteri(Sampler, GL_TEXTURE_MIN_FILTER, MinFilter);
+    glSamplerParameteri(Sampler, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glSamplerParameteri(Sampler, GL_TEXTURE_WRAP_S, Key.Wrap);
+    glSamplerParameteri(Sampler, GL_TEXTURE_WRAP_T, Key.Wrap);
+
+    if (Key.MaxAnisotropy > 1.0f) {
+        glSamplerParameterf(Sampler, GL_TEXTURE_MAX_ANISOTROPY_EXT, Key.MaxAnisotropy);
+    }
+
+    s_samplers[Key] = Sampler;
+
+    return Sampler;
+}
+
+
+void SamplerCache::SetDefault(const SamplerDesc& Desc)
+{
+    s_default = Desc;
+    s_defaultSampler = 0;
+}
+
+
+GLuint SamplerCache::GetDefaultSampler()
+{
+    if (s_defaultSampler == 0) {
+        s_defaultSampler = GetSampler(s_default);
+    }
+
+    return s_defaultSampler;
+}
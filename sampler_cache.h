@@ -0,0 +1,80 @@
+/*
+
+	Copyright 2011 Etay Meiri
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef SAMPLER_CACHE_H
+#define	SAMPLER_CACHE_H
+
+#include <map>
+#include <GL/glew.h>
+
+enum SamplerFilter {
+    SAMPLER_FILTER_BILINEAR,    // the base level only, like textures without mipmaps
+    SAMPLER_FILTER_TRILINEAR
+};
+
+struct SamplerDesc {
+    SamplerDesc()
+    {
+        Filter = SAMPLER_FILTER_TRILINEAR;
+        MaxAnisotropy = 1.0f;
+        Wrap = GL_REPEAT;
+    }
+
+    bool operator<(const SamplerDesc& Other) const
+    {
+        if (Filter != Other.Filter) {
+            return Filter < Other.Filter;
+        }
+
+        if (MaxAnisotropy != Other.MaxAnisotropy) {
+            return MaxAnisotropy < Other.MaxAnisotropy;
+        }
+
+        return Wrap < Other.Wrap;
+    }
+
+    SamplerFilter Filter;
+    float MaxAnisotropy;    // 1.0 disables anisotropic filtering
+    GLenum Wrap;
+};
+
+// Shares one sampler object between all the users of the same sampling state. A bound
+// sampler overrides the filtering parameters of the texture, so the whole scene can be
+// switched between filtering modes by changing the default. GL thread only.
+class SamplerCache
+{
+public:
+    static GLuint GetSampler(const SamplerDesc& Desc);
+
+    static const SamplerDesc& GetDefault() { return s_default; }
+
+    static void SetDefault(const SamplerDesc& Desc);
+
+    static GLuint GetDefaultSampler();
+
+    // 1.0 when anisotropic filtering is not supported
+    static float GetMaxAnisotropy();
+
+private:
+    static std::map<SamplerDesc, GLuint> s_samplers;
+    static SamplerDesc s_default;
+    static GLuint s_defaultSampler;
+};
+
+
+#endif	/* SAMPLER_CACHE_H */
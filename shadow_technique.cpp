@@ -0,0 +1,139 @@
+/*
+
+	Copyright 2011 Etay Meiri
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+#include "shadow_technique.h"
+#include "uniform_buffers.h"
+#include "util.h"
+
+static const char* pShadowVS = "                                                    \n\
+#version 410                                                                        \n\
+                                                                                    \n\
+#ifdef LAYER_FROM_VS                                                                \n\
+#extension GL_ARB_shader_viewport_layer_array : require                             \n\
+#endif                                                                              \n\
+                                                                                    \n\
+layout (location = 0) in vec3 Position;                                             \n\
+layout (location = 3) in mat4 World;                                                \n\
+                                                                                    \n\
+uniform int gFirstCascade;                                                          \n\
+uniform int gNumCascades;                                                           \n\
+                                                                                    \n\
+#ifndef LAYER_FROM_VS                                                               \n\
+flat out int Layer;                                                                 \n\
+#endif                                                                              \n\
+                                                                                    \n\
+"
+UNIFORM_BLOCKS_GLSL
+"                                                                                   \n\
+void main()                                                                         \n\
+{                                                                                   \n\
+    int Cascade = gFirstCascade + gl_InstanceID % gNumCascades;                     \n\
+    gl_Position = gShadowCascadeVP[Cascade] * (World * vec4(Position, 1.0));        \n\
+                                                                                    \n\
+#ifdef LAYER_FROM_VS                                                                \n\
+    gl_Layer = Cascade;                                                             \n\
+#else                                                                               \n\
+    Layer = Cascade;                                                                \n\
+#endif                                                                              \n\
+}";
+
+static const char* pShadowGS = "                                                    \n\
+#version 410                                                                        \n\
+                                                                                    \n\
+layout (triangles) in;                                                              \n\
+layout (triangle_strip, max_vertices = 3) out;                                      \n\
+                                                                                    \n\
+flat in int Layer[];                                                                \n\
+                                                                                    \n\
+void main()                                                                         \n\
+{                                                                                   \n\
+    for (int i = 0 ; i < 3 ; i++) {                                                 \n\
+        gl_Position = gl_in[i].gl_Position;                                         \n\
+        gl_Layer = Layer[0];                                                        \n\
+        EmitVertex();                                                               \n\
+    }                                                                               \n\
+                                                                                    \n\
+    EndPrimitive();                                                                 \n\
+}";
+
+static const char* pShadowFS = "                                                    \n\
+#version 410                                                                        \n\
+                                                                                    \n\
+void main()                                                                         \n\
+{                                                                                   \n\
+}";
+
+
+ShadowTechnique::ShadowTechnique()
+{
+}
+
+
+bool ShadowTechnique::Init()
+{
+    if (!Technique::Init()) {
+        return false;
+    }
+
+    if (GLEW_ARB_shader_viewport_layer_array) {
+        const std::string VS = InsertAfterVersion(pShadowVS, "#define LAYER_FROM_VS\n");
+
+        if (!AddShader(GL_VERTEX_SHADER, VS.c_str())) {
+            return false;
+        }
+    }
+    else {
+        if (!AddShader(GL_VERTEX_SHADER, pShadowVS)) {
+            return false;
+        }
+
+        if (!AddShader(GL_GEOMETRY_SHADER, pShadowGS)) {
+            return false;
+        }
+    }
+
+    if (!AddShader(GL_FRAGMENT_SHADER, pShadowFS)) {
+        return false;
+    }
+
+    return Finalize();
+}
+
+
+bool ShadowTechnique::OnFinalized()
+{
+    UniformBuffers::BindBlocks(m_shaderProg);
+
+    m_firstCascadeLocation = GetUniformLocation("gFirstCascade");
+    m_numCascadesLocation = GetUniformLocation("gNumCascades");
+
+    if (m_firstCascadeLocation == INVALID_UNIFORM_LOCATION ||
+        m_numCascadesLocation == INVALID_UNIFORM_LOCATION) {
+        return false;
+    }
+
+    return GLCheckError();
+}
+
+
+void ShadowTechnique::SetCascades(unsigned int FirstCascade, unsigned int NumCascades)
+{
+    glUniform1i(m_firstCascadeLocation, FirstCascade);
+    glUniform1i(m_numCascadesLocation, NumCascades);
+}
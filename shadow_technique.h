@@ -0,0 +1,46 @@
+/*
+
+	Copyright 2011 Etay Meiri
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef SHADOW_TECHNIQUE_H
+#define	SHADOW_TECHNIQUE_H
+
+#include "technique.h"
+
+// Renders the depth of the shadow casters into a range of the cascades at once. The
+// instance matrices are world matrices, each repeated for every cascade of the range
+// (see Mesh::RenderDepth), and gl_InstanceID picks the layer. The layer is written by
+// the vertex shader with ARB_shader_viewport_layer_array and by a pass-through
+// geometry shader without it.
+class ShadowTechnique : public Technique
+{
+public:
+    ShadowTechnique();
+
+    virtual bool Init();
+
+    virtual bool OnFinalized();
+
+    void SetCascades(unsigned int FirstCascade, unsigned int NumCascades);
+
+private:
+    GLuint m_firstCascadeLocation;
+    GLuint m_numCascadesLocation;
+};
+
+
+#endif	/* SHADOW_TECHNIQUE_H */
@@ -0,0 +1,119 @@
+/*
+
+	Copyright 2011 Etay Meiri
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#pragma once
+#include <algorithm>
+
+#include "util.h"
+#include "sprite_array.h"
+#include "gl_state.h"
+#include "image_decoder.cpp"
+
+// Bilinear resize, good enough for the odd sprite whose size does not match the first one
+static void ResizeSprite(const std::vector<unsigned char>& Src, unsigned int SrcWidth, unsigned int SrcHeight,
+                         std::vector<unsigned char>& Dest, unsigned int Width, unsigned int Height)
+{
+    Dest.resize((size_t)Width * Height * 4);
+
+    for (unsigned int y = 0 ; y < Height ; y++) {
+        const float v = std::max((y + 0.5f) * SrcHeight / Height - 0.5f, 0.0f);
+        const unsigned int y0 = std::min((unsigned int)v, SrcHeight - 1);
+        const unsigned int y1 = std::min(y0 + 1, SrcHeight - 1);
+        const float fy = v - y0;
+
+        for (unsigned int x = 0 ; x < Width ; x++) {
+            const float u = std::max((x + 0.5f) * SrcWidth / Width - 0.5f, 0.0f);
+            const unsigned int x0 = std::min((unsigned int)u, SrcWidth - 1);
+            const unsigned int x1 = std::min(x0 + 1, SrcWidth - 1);
+            const float fx = u - x0;
+
+            for (unsigned int c = 0 ; c < 4 ; c++) {
+                const float Top = Src[((size_t)y0 * SrcWidth + x0) * 4 + c] * (1.0f - fx) + Src[((size_t)y0 * SrcWidth + x1) * 4 + c] * fx;
+                const float Bottom = Src[((size_t)y1 * SrcWidth + x0) * 4 + c] * (1.0f - fx) + Src[((size_t)y1 * SrcWidth + x1) * 4 + c] * fx;
+                Dest[((size_t)y * Width + x) * 4 + c] = (unsigned char)(Top * (1.0f - fy) + Bottom * fy + 0.5f);
+            }
+        }
+    }
+}
+
+
+SpriteArray::SpriteArray()
+{
+    m_textureObj = 0;
+    m_numLayers = 0;
+}
+
+
+SpriteArray::~SpriteArray()
+{
+    if (m_textureObj != 0) {
+        GLState::DeleteTextures(1, &m_textureObj);
+    }
+}
+
+
+bool SpriteArray::Init(const std::vector<std::string>& FileNames)
+{
+    if (FileNames.empty()) {
+        return false;
+    }
+
+    m_textureObj = GLState::CreateTexture(GL_TEXTURE_2D_ARRAY);
+
+    unsigned int Width = 0;
+    unsigned int Height = 0;
+    std::vector<unsigned char> Pixels;
+    std::vector<unsigned char> Resized;
+
+    for (unsigned int i = 0 ; i < FileNames.size() ; i++) {
+        unsigned int ImageWidth = 0;
+        unsigned int ImageHeight = 0;
+
+        if (!ImageDecoder::Load(FileNames[i], ImageWidth, ImageHeight, Pixels)) {
+            return false;
+        }
+
+        const unsigned char* pData = &Pixels[0];
+
+        if (i == 0) {
+            Width = ImageWidth;
+            Height = ImageHeight;
+            GLState::BindTextureForEdit(m_textureObj);
+            glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, GL_RGBA8, Width, Height, FileNames.size(), 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+        }
+        else if (ImageWidth != Width || ImageHeight != Height) {
+            ResizeSprite(Pixels, ImageWidth, ImageHeight, Resized, Width, Height);
+            pData = &Resized[0];
+        }
+
+        GLState::TextureSubImage3D(m_textureObj, 0, 0, 0, i, Width, Height, 1, GL_RGBA, GL_UNSIGNED_BYTE, pData);
+    }
+
+    GLState::GenerateTextureMipmap(m_textureObj);
+    GLState::TextureParameterf(m_textureObj, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+    GLState::TextureParameterf(m_textureObj, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+
+    m_numLayers = FileNames.size();
+
+    return GLCheckError();
+}
+
+
+void SpriteArray::Bind(GLenum TextureUnit)
+{
+    GLState::BindTexture(TextureUnit - GL_TEXTURE0, GL_TEXTURE_2D_ARRAY, m_textureObj);
+}
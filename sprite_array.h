@@ -0,0 +1,53 @@
+/*
+
+	Copyright 2011 Etay Meiri
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef SPRITE_ARRAY_H
+#define	SPRITE_ARRAY_H
+
+#include <string>
+#include <vector>
+
+#include <GL/glew.h>
+
+// Packs sprite images into the layers of a single GL_TEXTURE_2D_ARRAY so that
+// billboards of different types can be drawn with one bind and one draw call. The
+// sprite of layer i is the i-th file given to Init.
+class SpriteArray
+{
+public:
+    SpriteArray();
+
+    ~SpriteArray();
+
+    // Every image is scaled to the size of the first one
+    bool Init(const std::vector<std::string>& FileNames);
+
+    void Bind(GLenum TextureUnit);
+
+    unsigned int GetNumLayers() const
+    {
+        return m_numLayers;
+    }
+
+private:
+    GLuint m_textureObj;
+    unsigned int m_numLayers;
+};
+
+
+#endif	/* SPRITE_ARRAY_H */
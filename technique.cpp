@@ -19,15 +19,31 @@
 #include <stdio.h>
 #include <string.h>
 #include <assert.h>
+#include <sys/stat.h>
+#ifdef WIN32
+#include <direct.h>
+#endif
 
 #include "technique.h"
+#include "uniform_buffers.cpp"
+#include "gl_state.cpp"
 #include "util.h"
 
+#define PROGRAM_BINARY_MAGIC 0x50474F4C   // "LOGP"
+
+// Header of the files in SHADER_CACHE_DIR, followed by the program binary
+struct ProgramBinaryHeader {
+    unsigned int Magic;
+    unsigned int Size;
+    GLenum Format;
+};
+
 static const char* pVSName = "VS";
 static const char* pTessCSName = "TessCS";
 static const char* pTessESName = "TessES";
 static const char* pGSName = "GS";
 static const char* pFSName = "FS";
+static const char* pCSName = "CS";
 
 const char* ShaderType2ShaderName(GLuint Type)
 {
@@ -42,6 +58,8 @@ const char* ShaderType2ShaderName(GLuint Type)
             return pGSName;
         case GL_FRAGMENT_SHADER:
             return pFSName;
+        case GL_COMPUTE_SHADER:
+            return pCSName;
         default:
             assert(0);
     }
@@ -52,115 +70,464 @@ const char* ShaderType2ShaderName(GLuint Type)
 Technique::Technique()
 {
     m_shaderProg = 0;
+    m_feedbackBufferMode = GL_INTERLEAVED_ATTRIBS;
+    m_permutation = 0;
 }
 
 
 Technique::~Technique()
 {
-    // Delete the intermediate shader objects that have been added to the program
-    // The list will only contain something if shaders were compiled but the object itself
-    // was destroyed prior to linking.
-    for (ShaderObjList::iterator it = m_shaderObjList.begin() ; it != m_shaderObjList.end() ; it++)
-    {
-        glDeleteShader(*it);
+    for (std::map<unsigned int, Program>::iterator it = m_programs.begin() ; it != m_programs.end() ; it++) {
+        // Delete the intermediate shader objects that have been added to the program
+        // The list will only contain something if shaders were compiled but the object itself
+        // was destroyed prior to linking.
+        for (ShaderObjList::iterator Shader = it->second.ShaderObjs.begin() ; Shader != it->second.ShaderObjs.end() ; Shader++)
+        {
+            glDeleteShader(*Shader);
+        }
+
+        GLState::DeleteProgram(it->second.Obj);
     }
 
-    if (m_shaderProg != 0)
-    {
-        glDeleteProgram(m_shaderProg);
-        m_shaderProg = 0;
-    }
+    m_shaderProg = 0;
 }
 
 
 bool Technique::Init()
 {
-    m_shaderProg = glCreateProgram();
+    // Let the driver use as many compiler threads as it likes
+    static bool s_compilerThreadsSet = false;
+
+    if (!s_compilerThreadsSet) {
+        if (GLEW_KHR_parallel_shader_compile) {
+            glMaxShaderCompilerThreadsKHR(0xFFFFFFFF);
+        }
+        else if (GLEW_ARB_parallel_shader_compile) {
+            glMaxShaderCompilerThreadsARB(0xFFFFFFFF);
+        }
+
+        s_compilerThreadsSet = true;
+    }
+
+    return true;
+}
+
+// Use this method to add shaders to the program. When finished - call finalize()
+bool Technique::AddShader(GLenum ShaderType, const char* pShaderText)
+{
+    ShaderSource Source;
+    Source.Type = ShaderType;
+    Source.Text = pShaderText;
+    m_shaderSources.push_back(Source);
+
+    return true;
+}
+
+
+void Technique::SetTransformFeedbackVaryings(const char* const* ppVaryings, unsigned int Count, GLenum BufferMode)
+{
+    m_feedbackVaryings.assign(ppVaryings, ppVaryings + Count);
+    m_feedbackBufferMode = BufferMode;
+}
 
-    if (m_shaderProg == 0) {
+
+// After all the shaders have been added to the program call this function. The
+// program is loaded from the shader cache when the sources, the transform feedback
+// varyings and the driver are the same as when it was saved. Otherwise the shaders
+// are compiled and linked without waiting for the result, see IsReady and Wait.
+bool Technique::Finalize()
+{
+    return BuildPermutation(m_permutation);
+}
+
+
+// Makes Key the current permutation, the sources are kept for the ones built later
+bool Technique::BuildPermutation(unsigned int Key)
+{
+    m_permutation = Key;
+
+    Program& Prog = m_programs[Key];
+    Prog.Obj = glCreateProgram();
+    Prog.State = TECHNIQUE_FAILED;
+
+    m_shaderProg = Prog.Obj;
+
+    if (Prog.Obj == 0) {
         fprintf(stderr, "Error creating shader program\n");
         return false;
     }
 
+    std::vector<ShaderSource> Sources = m_shaderSources;
+    const std::string Defines = GetPermutationDefines(Key);
+
+    if (!Defines.empty()) {
+        for (unsigned int i = 0 ; i < Sources.size() ; i++) {
+            Sources[i].Text = InsertAfterVersion(Sources[i].Text.c_str(), Defines);
+        }
+    }
+
+    Prog.CacheFileName = GetCacheFileName(Sources);
+
+    if (!Prog.CacheFileName.empty() && LoadProgramBinary(Prog)) {
+        Prog.State = OnFinalized() ? TECHNIQUE_READY : TECHNIQUE_FAILED;
+        return Prog.State == TECHNIQUE_READY && GLCheckError();
+    }
+
+    // A rejected binary replaces the program object
+    m_shaderProg = Prog.Obj;
+    SubmitShaders(Prog, Sources);
+
+    Prog.State = TECHNIQUE_LINKING;
+
+    return GLCheckError();
+}
+
+
+std::string Technique::GetPermutationDefines(unsigned int /*Key*/) const
+{
+    return "";
+}
+
+
+unsigned int Technique::GetPermutation() const
+{
+    return m_permutation;
+}
+
+
+bool Technique::OnFinalized()
+{
     return true;
 }
 
-// Use this method to add shaders to the program. When finished - call finalize()
-bool Technique::AddShader(GLenum ShaderType, const char* pShaderText)
+
+// Nothing here queries the status of the shaders or of the program, which would
+// wait for the driver
+void Technique::SubmitShaders(Program& Prog, const std::vector<ShaderSource>& Sources)
+{
+    for (unsigned int i = 0 ; i < Sources.size() ; i++) {
+        GLuint ShaderObj = glCreateShader(Sources[i].Type);
+
+        if (ShaderObj == 0) {
+            fprintf(stderr, "Error creating shader type %d\n", Sources[i].Type);
+            continue;
+        }
+
+        // Save the shader object - will be deleted in the destructor
+        Prog.ShaderObjs.push_back(ShaderObj);
+
+        const GLchar* p[1];
+        p[0] = Sources[i].Text.c_str();
+        GLint Lengths[1];
+        Lengths[0]= Sources[i].Text.size();
+        glShaderSource(ShaderObj, 1, p, Lengths);
+
+        glCompileShader(ShaderObj);
+
+        glAttachShader(Prog.Obj, ShaderObj);
+    }
+
+    if (!m_feedbackVaryings.empty()) {
+        std::vector<const GLchar*> Varyings(m_feedbackVaryings.size());
+
+        for (unsigned int i = 0 ; i < m_feedbackVaryings.size() ; i++) {
+            Varyings[i] = m_feedbackVaryings[i].c_str();
+        }
+
+        glTransformFeedbackVaryings(Prog.Obj, Varyings.size(), &Varyings[0], m_feedbackBufferMode);
+    }
+
+    if (GLEW_ARB_get_program_binary) {
+        glProgramParameteri(Prog.Obj, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+    }
+
+    glLinkProgram(Prog.Obj);
+}
+
+
+bool Technique::IsReady()
 {
-    GLuint ShaderObj = glCreateShader(ShaderType);
+    std::map<unsigned int, Program>::iterator it = m_programs.find(m_permutation);
 
-    if (ShaderObj == 0) {
-        fprintf(stderr, "Error creating shader type %d\n", ShaderType);
+    if (it == m_programs.end()) {
         return false;
     }
 
-    // Save the shader object - will be deleted in the destructor
-    m_shaderObjList.push_back(ShaderObj);
+    if (it->second.State == TECHNIQUE_LINKING && (GLEW_KHR_parallel_shader_compile || GLEW_ARB_parallel_shader_compile)) {
+        GLint Completed = GL_FALSE;
+        glGetProgramiv(m_shaderProg, GL_COMPLETION_STATUS_KHR, &Completed);
 
-    const GLchar* p[1];
-    p[0] = pShaderText;
-    GLint Lengths[1];
-    Lengths[0]= strlen(pShaderText);
-    glShaderSource(ShaderObj, 1, p, Lengths);
+        if (!Completed) {
+            return false;
+        }
+    }
 
-    glCompileShader(ShaderObj);
+    // Without the extension this blocks like Wait
+    return Wait();
+}
 
-    GLint success;
-    glGetShaderiv(ShaderObj, GL_COMPILE_STATUS, &success);
 
-    if (!success) {
-        GLchar InfoLog[1024];
-        glGetShaderInfoLog(ShaderObj, 1024, NULL, InfoLog);
-        fprintf(stderr, "Error compiling %s: '%s'\n", ShaderType2ShaderName(ShaderType), InfoLog);
+bool Technique::Wait()
+{
+    std::map<unsigned int, Program>::iterator it = m_programs.find(m_permutation);
+
+    if (it == m_programs.end()) {
         return false;
     }
 
-    glAttachShader(m_shaderProg, ShaderObj);
+    if (it->second.State == TECHNIQUE_LINKING) {
+        it->second.State = CompleteLink(it->second) ? TECHNIQUE_READY : TECHNIQUE_FAILED;
+    }
 
-    return GLCheckError();
+    return it->second.State == TECHNIQUE_READY;
 }
 
 
-// After all the shaders have been added to the program call this function
-// to link and validate the program.
-bool Technique::Finalize()
+bool Technique::EnablePermutation(unsigned int Key)
+{
+    if (Key != m_permutation || m_programs.find(Key) == m_programs.end()) {
+        std::map<unsigned int, Program>::iterator it = m_programs.find(Key);
+
+        if (it == m_programs.end()) {
+            BuildPermutation(Key);
+        }
+        else {
+            m_permutation = Key;
+            m_shaderProg = it->second.Obj;
+        }
+    }
+
+    if (!Wait()) {
+        return false;
+    }
+
+    GLState::UseProgram(m_shaderProg);
+
+    return true;
+}
+
+
+bool Technique::CompleteLink(Program& Prog)
 {
     GLint Success = 0;
     GLchar ErrorLog[1024] = { 0 };
 
-    glLinkProgram(m_shaderProg);
-
-    glGetProgramiv(m_shaderProg, GL_LINK_STATUS, &Success);
+    glGetProgramiv(Prog.Obj, GL_LINK_STATUS, &Success);
 	if (Success == 0) {
-		glGetProgramInfoLog(m_shaderProg, sizeof(ErrorLog), NULL, ErrorLog);
+        // A shader that didn't compile is the more useful message
+        for (ShaderObjList::iterator it = Prog.ShaderObjs.begin() ; it != Prog.ShaderObjs.end() ; it++) {
+            GLint ShaderType = 0;
+            glGetShaderiv(*it, GL_COMPILE_STATUS, &Success);
+            glGetShaderiv(*it, GL_SHADER_TYPE, &ShaderType);
+
+            if (!Success) {
+                glGetShaderInfoLog(*it, sizeof(ErrorLog), NULL, ErrorLog);
+                fprintf(stderr, "Error compiling %s: '%s'\n", ShaderType2ShaderName(ShaderType), ErrorLog);
+                return false;
+            }
+        }
+
+		glGetProgramInfoLog(Prog.Obj, sizeof(ErrorLog), NULL, ErrorLog);
 		fprintf(stderr, "Error linking shader program: '%s'\n", ErrorLog);
         return false;
 	}
 
-    glValidateProgram(m_shaderProg);
-    glGetProgramiv(m_shaderProg, GL_VALIDATE_STATUS, &Success);
+    // Delete the intermediate shader objects that have been added to the program
+    for (ShaderObjList::iterator it = Prog.ShaderObjs.begin() ; it != Prog.ShaderObjs.end() ; it++)
+    {
+        glDeleteShader(*it);
+    }
+
+    Prog.ShaderObjs.clear();
+
+    if (!Prog.CacheFileName.empty()) {
+        SaveProgramBinary(Prog);
+    }
+
+    if (!OnFinalized()) {
+        return false;
+    }
+
+    // Until OnFinalized points the samplers to their units they all share unit 0, which
+    // is invalid once their types differ
+    glValidateProgram(Prog.Obj);
+    glGetProgramiv(Prog.Obj, GL_VALIDATE_STATUS, &Success);
     if (!Success) {
-        glGetProgramInfoLog(m_shaderProg, sizeof(ErrorLog), NULL, ErrorLog);
+        glGetProgramInfoLog(Prog.Obj, sizeof(ErrorLog), NULL, ErrorLog);
         fprintf(stderr, "Invalid shader program: '%s'\n", ErrorLog);
         return false;
     }
 
-    // Delete the intermediate shader objects that have been added to the program
-    for (ShaderObjList::iterator it = m_shaderObjList.begin() ; it != m_shaderObjList.end() ; it++)
-    {
-        glDeleteShader(*it);
+    return GLCheckError();
+}
+
+
+static void HashString(unsigned long long& Hash, const char* pString)
+{
+    // The terminator is hashed too so that "ab" + "c" differs from "a" + "bc"
+    do {
+        Hash ^= (unsigned char)*pString;
+        Hash *= 0x100000001b3ULL;
+    } while (*pString++);
+}
+
+
+// FNV-1a of the driver, the shaders and the transform feedback varyings. Empty when
+// the driver can't return program binaries.
+std::string Technique::GetCacheFileName(const std::vector<ShaderSource>& Sources) const
+{
+    GLint NumFormats = 0;
+
+    if (GLEW_ARB_get_program_binary) {
+        glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &NumFormats);
     }
 
-    m_shaderObjList.clear();
+    if (NumFormats == 0) {
+        return "";
+    }
 
-    return GLCheckError();
+    const GLenum DriverStrings[] = { GL_VENDOR, GL_RENDERER, GL_VERSION, GL_SHADING_LANGUAGE_VERSION };
+    unsigned long long Hash = 0xcbf29ce484222325ULL;
+
+    for (unsigned int i = 0 ; i < ARRAY_SIZE_IN_ELEMENTS(DriverStrings) ; i++) {
+        const GLubyte* pString = glGetString(DriverStrings[i]);
+        HashString(Hash, pString ? (const char*)pString : "");
+    }
+
+    for (unsigned int i = 0 ; i < Sources.size() ; i++) {
+        char Type[16];
+        snprintf(Type, sizeof(Type), "%x", Sources[i].Type);
+        HashString(Hash, Type);
+        HashString(Hash, Sources[i].Text.c_str());
+    }
+
+    for (unsigned int i = 0 ; i < m_feedbackVaryings.size() ; i++) {
+        char Mode[16];
+        snprintf(Mode, sizeof(Mode), "%x", m_feedbackBufferMode);
+        HashString(Hash, Mode);
+        HashString(Hash, m_feedbackVaryings[i].c_str());
+    }
+
+    char FileName[64];
+    snprintf(FileName, sizeof(FileName), "%s/%016llx.bin", SHADER_CACHE_DIR, Hash);
+
+    return FileName;
+}
+
+
+// Returns false, leaving a fresh program object behind, when the file is missing
+// or the driver rejects the binary
+bool Technique::LoadProgramBinary(Program& Prog)
+{
+    FILE* f = fopen(Prog.CacheFileName.c_str(), "rb");
+
+    if (!f) {
+        return false;
+    }
+
+    ProgramBinaryHeader Header;
+    std::vector<unsigned char> Binary;
+    bool Ret = fread(&Header, sizeof(Header), 1, f) == 1 && Header.Magic == PROGRAM_BINARY_MAGIC && Header.Size > 0;
+
+    if (Ret) {
+        Binary.resize(Header.Size);
+        Ret = fread(&Binary[0], 1, Binary.size(), f) == Binary.size();
+    }
+
+    fclose(f);
+
+    if (!Ret) {
+        return false;
+    }
+
+    glProgramBinary(Prog.Obj, Header.Format, &Binary[0], Binary.size());
+
+    GLint Success = 0;
+    glGetProgramiv(Prog.Obj, GL_LINK_STATUS, &Success);
+
+    if (Success == 0) {
+        // A failed binary leaves the program unusable, start over with a new one
+        glGetError();
+        GLState::DeleteProgram(Prog.Obj);
+        Prog.Obj = glCreateProgram();
+        return false;
+    }
+
+    return true;
+}
+
+
+// The binary is written to a temporary file first so that an interrupted run
+// can't leave a truncated one behind
+void Technique::SaveProgramBinary(const Program& Prog) const
+{
+    GLint Size = 0;
+    glGetProgramiv(Prog.Obj, GL_PROGRAM_BINARY_LENGTH, &Size);
+
+    if (Size <= 0) {
+        return;
+    }
+
+    ProgramBinaryHeader Header;
+    std::vector<unsigned char> Binary(Size);
+    GLsizei Length = 0;
+
+    glGetProgramBinary(Prog.Obj, Size, &Length, &Header.Format, &Binary[0]);
+
+    if (Length <= 0) {
+        return;
+    }
+
+    Header.Magic = PROGRAM_BINARY_MAGIC;
+    Header.Size = Length;
+
+#ifdef WIN32
+    _mkdir(SHADER_CACHE_DIR);
+#else
+    mkdir(SHADER_CACHE_DIR, 0755);
+#endif
+
+    const std::string TempFileName = Prog.CacheFileName + ".tmp";
+    FILE* f = fopen(TempFileName.c_str(), "wb");
+
+    if (!f) {
+        printf("Error creating '%s'\n", TempFileName.c_str());
+        return;
+    }
+
+    const bool Ret = fwrite(&Header, sizeof(Header), 1, f) == 1 &&
+                     fwrite(&Binary[0], 1, Length, f) == (size_t)Length;
+
+    fclose(f);
+
+    remove(Prog.CacheFileName.c_str());
+
+    if (!Ret || rename(TempFileName.c_str(), Prog.CacheFileName.c_str()) != 0) {
+        remove(TempFileName.c_str());
+    }
+}
+
+
+std::string Technique::InsertAfterVersion(const char* pShaderText, const std::string& Text)
+{
+    std::string Shader(pShaderText);
+    const size_t Version = Shader.find("#version");
+
+    if (Version != std::string::npos) {
+        const size_t LineEnd = Shader.find('\n', Version);
+        Shader.insert(LineEnd == std::string::npos ? Shader.size() : LineEnd + 1, Text);
+    }
+    else {
+        Shader.insert(0, Text);
+    }
+
+    return Shader;
 }
 
 
 void Technique::Enable()
 {
-    glUseProgram(m_shaderProg);
+    GLState::UseProgram(m_shaderProg);
 }
 
 
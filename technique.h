@@ -20,8 +20,18 @@
 #define	TECHNIQUE_H
 
 #include <list>
+#include <map>
+#include <string>
+#include <vector>
 #include <GL/glew.h>
 
+// Linked programs are saved here and loaded back on the next start, see Finalize
+#define SHADER_CACHE_DIR "./ShaderCache"
+
+// Init of the derived classes adds the shaders and calls Finalize, which only hands
+// the program to the driver. Drivers with KHR_parallel_shader_compile build it in the
+// background, so all the techniques should be initialized before waiting on any.
+// A technique may also build permutations of its shaders, see EnablePermutation.
 class Technique
 {
 public:
@@ -32,14 +42,45 @@ public:
 
     virtual bool Init();
 
+    // Polls the program without blocking when the driver allows it. Once it is linked,
+    // OnFinalized runs and this returns true from then on.
+    bool IsReady();
+
+    // Blocks until the program is linked and returns false if the build failed.
+    // Call this, or wait for IsReady, before Enable.
+    bool Wait();
+
     void Enable();
 
+    // Enables the program built from the shaders with GetPermutationDefines(Key). The
+    // permutations other than the one of Finalize are built the first time they are
+    // enabled, which blocks until they are linked. They go through the shader cache
+    // like any other program so that is usually only a binary load.
+    bool EnablePermutation(unsigned int Key);
+
 protected:
 
+    // The shaders are only recorded here and compiled by Finalize
     bool AddShader(GLenum ShaderType, const char* pShaderText);
 
+    // Sets the outputs captured by transform feedback, call before Finalize
+    void SetTransformFeedbackVaryings(const char* const* ppVaryings, unsigned int Count, GLenum BufferMode);
+
     bool Finalize();
 
+    // Called once the program is linked, the derived classes look up their uniforms here
+    virtual bool OnFinalized();
+
+    // The #defines added after the #version line of every shader of a permutation.
+    // Key 0 is the one built by Finalize and gets none by default.
+    virtual std::string GetPermutationDefines(unsigned int Key) const;
+
+    // The permutation m_shaderProg belongs to, also while OnFinalized runs for it
+    unsigned int GetPermutation() const;
+
+    // Returns the shader with Text added after its #version line
+    static std::string InsertAfterVersion(const char* pShaderText, const std::string& Text);
+
     GLint GetUniformLocation(const char* pUniformName);
     
     GLint GetProgramParam(GLint param);
@@ -48,8 +89,40 @@ protected:
     
 private:
 
+    struct ShaderSource {
+        GLenum Type;
+        std::string Text;
+    };
+
     typedef std::list<GLuint> ShaderObjList;
-    ShaderObjList m_shaderObjList;
+
+    enum ProgramState {
+        TECHNIQUE_LINKING,
+        TECHNIQUE_READY,
+        TECHNIQUE_FAILED
+    };
+
+    struct Program {
+        GLuint Obj;
+        ProgramState State;
+        ShaderObjList ShaderObjs;
+        std::string CacheFileName;
+    };
+
+    bool BuildPermutation(unsigned int Key);
+    void SubmitShaders(Program& Prog, const std::vector<ShaderSource>& Sources);
+    bool CompleteLink(Program& Prog);
+
+    std::string GetCacheFileName(const std::vector<ShaderSource>& Sources) const;
+    bool LoadProgramBinary(Program& Prog);
+    void SaveProgramBinary(const Program& Prog) const;
+
+    std::vector<ShaderSource> m_shaderSources;
+    std::vector<std::string> m_feedbackVaryings;
+    GLenum m_feedbackBufferMode;
+
+    std::map<unsigned int, Program> m_programs;
+    unsigned int m_permutation;
 };
 
 #define INVALID_UNIFORM_LOCATION 0xFFFFFFFF
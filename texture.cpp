@@ -17,38 +17,445 @@
 */
 #pragma once
 #include <iostream>
+#include <assert.h>
+#include <string.h>
+#include <algorithm>
+#include <sys/stat.h>
 #include "util.h"
 #include "texture.h"
+#include "gl_state.cpp"
+#include "ktx2.cpp"
+#include "image_decoder.cpp"
+#include "texture_residency.cpp"
+#include "texture_streamer.cpp"
 
 Texture::Texture(GLenum TextureTarget, const std::string& FileName)
 {
     m_textureTarget = TextureTarget;
     m_fileName      = FileName;
-    m_pImage        = NULL;
+    m_decodedWidth  = 0;
+    m_decodedHeight = 0;
+    m_decodedLevel  = 0;
+    m_wantedSize    = TextureStreamer::GetFirstLoadSize();
+    m_textureObj    = 0;
+    m_width         = 0;
+    m_height        = 0;
+    m_numLevels     = 0;
+    m_numDroppedLevels = 0;
+    m_internalFormat = GL_RGBA8;
+    m_blockSize     = 0;
+    m_lastUsedFrame = 0;
+}
+
+
+Texture::~Texture()
+{
+    if (m_textureObj != 0) {
+        GLState::DeleteTextures(1, &m_textureObj);
+    }
+
+    TextureResidency::OnDelete(this);
+    TextureStreamer::OnDelete(this);
 }
 
 bool Texture::Load()
 {
-    try {
-        m_pImage = new Magick::Image(m_fileName);
-        m_pImage->write(&m_blob, "RGBA");
+    return Decode() && Upload();
+}
+
+
+// Number of levels of a full mip chain, down to 1x1
+static unsigned int GetNumMipLevels(unsigned int Width, unsigned int Height)
+{
+    unsigned int NumLevels = 1;
+
+    while ((Width >> NumLevels) > 0 || (Height >> NumLevels) > 0) {
+        NumLevels++;
+    }
+
+    return NumLevels;
+}
+
+
+static unsigned int CalcLevelForSize(unsigned int Width, unsigned int Height, unsigned int NumLevels, unsigned int Size)
+{
+    unsigned int Level = 0;
+
+    if (Size > 0) {
+        while (Level + 1 < NumLevels && std::max(Width >> Level, Height >> Level) > Size) {
+            Level++;
+        }
+    }
+
+    return Level;
+}
+
+
+// Halves an RGBA image with a box filter, the last row or column of odd sizes is
+// averaged with itself
+static void DownsampleRGBA(std::vector<unsigned char>& Pixels, unsigned int& Width, unsigned int& Height)
+{
+    const unsigned int NewWidth = std::max(Width / 2, 1u);
+    const unsigned int NewHeight = std::max(Height / 2, 1u);
+    std::vector<unsigned char> Half((size_t)NewWidth * NewHeight * 4);
+
+    for (unsigned int y = 0 ; y < NewHeight ; y++) {
+        const unsigned char* pRow0 = &Pixels[(size_t)std::min(y * 2, Height - 1) * Width * 4];
+        const unsigned char* pRow1 = &Pixels[(size_t)std::min(y * 2 + 1, Height - 1) * Width * 4];
+        unsigned char* pOut = &Half[(size_t)y * NewWidth * 4];
+
+        for (unsigned int x = 0 ; x < NewWidth ; x++) {
+            const unsigned int x0 = std::min(x * 2, Width - 1) * 4;
+            const unsigned int x1 = std::min(x * 2 + 1, Width - 1) * 4;
+
+            for (unsigned int c = 0 ; c < 4 ; c++) {
+                pOut[x * 4 + c] = (unsigned char)((pRow0[x0 + c] + pRow0[x1 + c] + pRow1[x0 + c] + pRow1[x1 + c] + 2) / 4);
+            }
+        }
+    }
+
+    Pixels.swap(Half);
+    Width = NewWidth;
+    Height = NewHeight;
+}
+
+
+std::string Texture::GetCookedFileName(const std::string& FileName)
+{
+    return FileName + ".ktx2";
+}
+
+
+// Returns the GL format of a cooked image, or 0 if the driver cannot sample it
+static GLenum GetCompressedFormat(unsigned int VkFormat)
+{
+    switch (VkFormat) {
+        case VK_FORMAT_BC1_RGB_UNORM_BLOCK:
+            return GLEW_EXT_texture_compression_s3tc ? GL_COMPRESSED_RGB_S3TC_DXT1_EXT : 0;
+
+        case VK_FORMAT_BC1_RGBA_UNORM_BLOCK:
+            return GLEW_EXT_texture_compression_s3tc ? GL_COMPRESSED_RGBA_S3TC_DXT1_EXT : 0;
+
+        case VK_FORMAT_BC3_UNORM_BLOCK:
+            return GLEW_EXT_texture_compression_s3tc ? GL_COMPRESSED_RGBA_S3TC_DXT5_EXT : 0;
+
+        case VK_FORMAT_BC5_UNORM_BLOCK:
+            return GLEW_ARB_texture_compression_rgtc ? GL_COMPRESSED_RG_RGTC2 : 0;
+
+        case VK_FORMAT_BC7_UNORM_BLOCK:
+            return GLEW_ARB_texture_compression_bptc ? GL_COMPRESSED_RGBA_BPTC_UNORM : 0;
+
+        default:
+            return 0;
+    }
+}
+
+
+bool Texture::ReadCooked()
+{
+    const std::string CookedFileName = GetCookedFileName(m_fileName);
+
+    struct stat Cooked;
+    struct stat Source;
+
+    if (stat(CookedFileName.c_str(), &Cooked) != 0) {
+        return false;
+    }
+
+    // A missing source is fine, the cooked files may be shipped alone
+    if (stat(m_fileName.c_str(), &Source) == 0 && Source.st_mtime > Cooked.st_mtime) {
+        printf("'%s' is older than its source, ignoring it\n", CookedFileName.c_str());
+        return false;
     }
-    catch (Magick::Error& Error) {
-        std::cout << "Error loading texture '" << m_fileName << "': " << Error.what() << std::endl;
+
+    if (!ReadKTX2(CookedFileName, m_cooked) || GetCompressedFormat(m_cooked.VkFormat) == 0) {
+        m_cooked = KTX2Image();
         return false;
     }
 
-    glGenTextures(1, &m_textureObj);
-    glBindTexture(m_textureTarget, m_textureObj);
-    glTexImage2D(m_textureTarget, 0, GL_RGBA, m_pImage->columns(), m_pImage->rows(), 0.0, GL_RGBA, GL_UNSIGNED_BYTE, m_blob.data());
-    glTexParameterf(m_textureTarget, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-	glTexParameterf(m_textureTarget, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    return true;
+}
+
+
+// Only the levels from the wanted one down are kept. The cooked files store them all,
+// images are shrunk on the CPU and get the rest of their chain on the GPU.
+bool Texture::Decode()
+{
+    const unsigned int WantedSize = m_wantedSize;
+
+    if (ReadCooked()) {
+        m_decodedWidth = m_cooked.Levels[0].Width;
+        m_decodedHeight = m_cooked.Levels[0].Height;
+        m_decodedLevel = CalcLevelForSize(m_decodedWidth, m_decodedHeight, m_cooked.Levels.size(), WantedSize);
+
+        const size_t Skipped = m_cooked.Levels[m_decodedLevel].Offset;
+
+        m_cooked.Data.erase(m_cooked.Data.begin(), m_cooked.Data.begin() + Skipped);
+        m_cooked.Levels.erase(m_cooked.Levels.begin(), m_cooked.Levels.begin() + m_decodedLevel);
+
+        for (unsigned int i = 0 ; i < m_cooked.Levels.size() ; i++) {
+            m_cooked.Levels[i].Offset -= Skipped;
+        }
+
+        return true;
+    }
+
+    if (!ImageDecoder::Load(m_fileName, m_decodedWidth, m_decodedHeight, m_pixels)) {
+        return false;
+    }
+
+    m_decodedLevel = CalcLevelForSize(m_decodedWidth, m_decodedHeight,
+                                      GetNumMipLevels(m_decodedWidth, m_decodedHeight), WantedSize);
+
+    unsigned int Width = m_decodedWidth;
+    unsigned int Height = m_decodedHeight;
+
+    for (unsigned int i = 0 ; i < m_decodedLevel ; i++) {
+        DownsampleRGBA(m_pixels, Width, Height);
+    }
+
+    return true;
+}
+
+
+bool Texture::Upload()
+{
+    if (!m_cooked.Levels.empty()) {
+        return UploadData(&m_cooked.Data[0]);
+    }
+
+    assert(!m_pixels.empty());
+
+    return UploadData(&m_pixels[0]);
+}
+
+
+bool Texture::UploadFromPixelBuffer(size_t Offset)
+{
+    return UploadData((const unsigned char*)NULL + Offset);
+}
+
+
+size_t Texture::GetDecodedSize() const
+{
+    return m_cooked.Levels.empty() ? m_pixels.size() : m_cooked.Data.size();
+}
+
+
+void Texture::CopyDecodedData(void* pDest) const
+{
+    if (!m_cooked.Levels.empty()) {
+        memcpy(pDest, &m_cooked.Data[0], m_cooked.Data.size());
+    }
+    else {
+        memcpy(pDest, &m_pixels[0], m_pixels.size());
+    }
+}
+
+
+// pData is either a pointer to the decoded data or an offset in the bound unpack buffer
+bool Texture::UploadData(const unsigned char* pData)
+{
+    // A reload replaces the shrunk texture
+    if (m_textureObj != 0) {
+        GLState::DeleteTextures(1, &m_textureObj);
+        m_textureObj = 0;
+    }
+
+    m_width = m_decodedWidth;
+    m_height = m_decodedHeight;
+    m_numDroppedLevels = m_decodedLevel;
+
+    bool Ret;
+
+    if (!m_cooked.Levels.empty()) {
+        Ret = UploadCooked(pData);
+    }
+    else {
+        m_internalFormat = GL_RGBA8;
+        m_blockSize = 0;
+
+        // Full chain down to 1x1, as built by glGenerateMipmap from the first level
+        m_numLevels = GetNumMipLevels(m_width, m_height);
+
+        m_textureObj = GLState::CreateTexture(m_textureTarget);
+        GLState::BindTextureForEdit(m_textureObj);
+        glTexImage2D(m_textureTarget, m_numDroppedLevels, m_internalFormat, GetWidth(), GetHeight(), 0, GL_RGBA, GL_UNSIGNED_BYTE, pData);
+        GLState::TextureParameteri(m_textureObj, GL_TEXTURE_BASE_LEVEL, m_numDroppedLevels);
+        GLState::TextureParameteri(m_textureObj, GL_TEXTURE_MAX_LEVEL, m_numLevels - 1);
+        GLState::GenerateTextureMipmap(m_textureObj);
+        GLState::TextureParameterf(m_textureObj, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+        GLState::TextureParameterf(m_textureObj, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+
+        Ret = GLCheckError();
+    }
+
+    // The GL has its own copy now
+    ReleaseDecodedData();
+
+    TextureResidency::OnUpload(this);
+    TextureStreamer::OnUpload(this);
+
+    return Ret;
+}
+
+// The cooked levels are uploaded as they are stored in the file
+bool Texture::UploadCooked(const unsigned char* pData)
+{
+    const GLenum Format = GetCompressedFormat(m_cooked.VkFormat);
+    const unsigned int NumLevels = m_cooked.Levels.size();
+
+    m_numLevels = m_numDroppedLevels + NumLevels;
+    m_internalFormat = Format;
+    m_blockSize = GetBlockSize(m_cooked.VkFormat);
+
+    m_textureObj = GLState::CreateTexture(m_textureTarget);
+    GLState::BindTextureForEdit(m_textureObj);
+
+    for (unsigned int i = 0 ; i < NumLevels ; i++) {
+        const KTX2Level& Level = m_cooked.Levels[i];
+        glCompressedTexImage2D(m_textureTarget, m_numDroppedLevels + i, Format, Level.Width, Level.Height, 0, Level.Size, pData + Level.Offset);
+    }
+
+    GLState::TextureParameteri(m_textureObj, GL_TEXTURE_BASE_LEVEL, m_numDroppedLevels);
+    GLState::TextureParameteri(m_textureObj, GL_TEXTURE_MAX_LEVEL, m_numLevels - 1);
+    GLState::TextureParameterf(m_textureObj, GL_TEXTURE_MIN_FILTER, (NumLevels > 1) ? GL_LINEAR_MIPMAP_LINEAR : GL_LINEAR);
+    GLState::TextureParameterf(m_textureObj, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
 
     return GLCheckError();
 }
 
+
+void Texture::ReleaseDecodedData()
+{
+    // Swapping frees the memory, clear() would keep it
+    std::vector<unsigned char>().swap(m_pixels);
+    m_cooked = KTX2Image();
+}
+
+
 void Texture::Bind(GLenum TextureUnit)
 {
-    glActiveTexture(TextureUnit);
-    glBindTexture(m_textureTarget, m_textureObj);
+    GLState::BindTexture(TextureUnit - GL_TEXTURE0, m_textureTarget, m_textureObj);
+
+    m_lastUsedFrame = TextureResidency::GetFrame();
+
+    TextureStreamer::OnBind(this);
+}
+
+
+void Texture::SetWantedLevel(unsigned int Level)
+{
+    m_wantedSize = std::max(std::max(m_width >> Level, m_height >> Level), 1u);
+}
+
+
+unsigned int Texture::GetWantedLevel() const
+{
+    return GetLevelForSize(m_wantedSize);
+}
+
+
+unsigned int Texture::GetLevelForSize(unsigned int Size) const
+{
+    return CalcLevelForSize(m_width, m_height, m_numLevels, Size);
+}
+
+
+unsigned int Texture::GetWidth() const
+{
+    return std::max(m_width >> m_numDroppedLevels, 1u);
+}
+
+
+unsigned int Texture::GetHeight() const
+{
+    return std::max(m_height >> m_numDroppedLevels, 1u);
+}
+
+
+// Level is counted from the top of the full mip chain
+size_t Texture::GetLevelBytes(unsigned int Level) const
+{
+    const size_t Width = std::max(m_width >> Level, 1u);
+    const size_t Height = std::max(m_height >> Level, 1u);
+
+    if (m_blockSize > 0) {
+        return ((Width + 3) / 4) * ((Height + 3) / 4) * m_blockSize;
+    }
+
+    return Width * Height * 4;
+}
+
+
+size_t Texture::GetGPUBytes() const
+{
+    size_t Bytes = 0;
+
+    for (unsigned int i = m_numDroppedLevels ; i < m_numLevels ; i++) {
+        Bytes += GetLevelBytes(i);
+    }
+
+    return Bytes;
+}
+
+
+size_t Texture::GetWantedGPUBytes() const
+{
+    size_t Bytes = 0;
+
+    for (unsigned int i = GetWantedLevel() ; i < m_numLevels ; i++) {
+        Bytes += GetLevelBytes(i);
+    }
+
+    return Bytes;
+}
+
+
+// The new texture only allocates the levels below the top one and gets them copied on
+// the GPU. They keep their index so the base level moves down by one.
+bool Texture::DropTopLevel()
+{
+    const unsigned int BaseLevel = m_numDroppedLevels + 1;
+
+    if (m_textureObj == 0 || BaseLevel >= m_numLevels || !GLEW_ARB_copy_image) {
+        return false;
+    }
+
+    const GLuint TextureObj = GLState::CreateTexture(m_textureTarget);
+    GLState::BindTextureForEdit(TextureObj);
+
+    for (unsigned int Level = BaseLevel ; Level < m_numLevels ; Level++) {
+        const unsigned int Width = std::max(m_width >> Level, 1u);
+        const unsigned int Height = std::max(m_height >> Level, 1u);
+
+        if (m_blockSize > 0) {
+            glCompressedTexImage2D(m_textureTarget, Level, m_internalFormat, Width, Height, 0, GetLevelBytes(Level), NULL);
+        }
+        else {
+            glTexImage2D(m_textureTarget, Level, m_internalFormat, Width, Height, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+        }
+    }
+
+    GLState::TextureParameteri(TextureObj, GL_TEXTURE_BASE_LEVEL, BaseLevel);
+    GLState::TextureParameteri(TextureObj, GL_TEXTURE_MAX_LEVEL, m_numLevels - 1);
+    GLState::TextureParameterf(TextureObj, GL_TEXTURE_MIN_FILTER, (BaseLevel + 1 < m_numLevels) ? GL_LINEAR_MIPMAP_LINEAR : GL_LINEAR);
+    GLState::TextureParameterf(TextureObj, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+
+    for (unsigned int Level = BaseLevel ; Level < m_numLevels ; Level++) {
+        glCopyImageSubData(m_textureObj, m_textureTarget, Level, 0, 0, 0,
+                           TextureObj, m_textureTarget, Level, 0, 0, 0,
+                           std::max(m_width >> Level, 1u), std::max(m_height >> Level, 1u), 1);
+    }
+
+    if (!GLCheckError()) {
+        GLState::DeleteTextures(1, &TextureObj);
+        return false;
+    }
+
+    GLState::DeleteTextures(1, &m_textureObj);
+    m_textureObj = TextureObj;
+    m_numDroppedLevels++;
+
+    return true;
 }
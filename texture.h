@@ -20,25 +20,122 @@
 #define	TEXTURE_H
 
 #include <string>
+#include <vector>
+#include <atomic>
 
 #include <GL/glew.h>
-#include <Magick++.h>
+
+#include "ktx2.h"
 
 class Texture
 {
 public:
     Texture(GLenum TextureTarget, const std::string& FileName);
 
+    ~Texture();
+
+    // Uses the cooked KTX2 file of the image when it exists and is not older than the
+    // image itself (see TextureCooker). Falls back to decoding the image otherwise and
+    // builds the mip chain on the GPU. Either way the texture is trilinear by default.
     bool Load();
 
+    // Reads and decodes the image file. Does not touch GL so it can run on any thread.
+    bool Decode();
+
+    // Creates the GL texture from the decoded image and frees the decoded copy. Must be
+    // called on the GL thread. Replaces the texture when it has already been uploaded.
+    bool Upload();
+
+    // Size of the data Upload reads, and a copy of it (for instance into a mapped buffer)
+    size_t GetDecodedSize() const;
+    void CopyDecodedData(void* pDest) const;
+
+    // Same as Upload but reads the data copied by CopyDecodedData at the given offset of
+    // the buffer bound to GL_PIXEL_UNPACK_BUFFER
+    bool UploadFromPixelBuffer(size_t Offset);
+
+    bool IsLoaded() const
+    {
+        return m_textureObj != 0;
+    }
+
+    const std::string& GetFileName() const
+    {
+        return m_fileName;
+    }
+
     void Bind(GLenum TextureUnit);
 
+    // Recreates the texture without its largest mip level, copying the others on the
+    // GPU. The file must be loaded again to get the level back.
+    //
+    // The levels keep their index in the full mip chain whatever is resident, the
+    // texture is clamped to the resident ones with GL_TEXTURE_BASE_LEVEL.
+    bool DropTopLevel();
+
+    // Largest level of the full mip chain that the next Decode keeps, the ones above
+    // are skipped. Set by TextureStreamer, which also limits the size of first loads.
+    void SetWantedLevel(unsigned int Level);
+    unsigned int GetWantedLevel() const;
+
+    // First level of the full mip chain whose largest side is at most Size
+    unsigned int GetLevelForSize(unsigned int Size) const;
+
+    // Size of the largest resident level
+    unsigned int GetWidth() const;
+    unsigned int GetHeight() const;
+
+    unsigned int GetNumResidentLevels() const
+    {
+        return m_numLevels - m_numDroppedLevels;
+    }
+
+    unsigned int GetNumDroppedLevels() const
+    {
+        return m_numDroppedLevels;
+    }
+
+    // GPU memory of the resident levels and of the levels from the wanted one down
+    size_t GetGPUBytes() const;
+    size_t GetWantedGPUBytes() const;
+
+    // Value of TextureResidency::GetFrame when the texture was last bound
+    unsigned int GetLastUsedFrame() const
+    {
+        return m_lastUsedFrame;
+    }
+
+    static std::string GetCookedFileName(const std::string& FileName);
+
 private:
+    bool ReadCooked();
+    bool UploadData(const unsigned char* pData);
+    bool UploadCooked(const unsigned char* pData);
+    void ReleaseDecodedData();
+    size_t GetLevelBytes(unsigned int Level) const;
+
     std::string m_fileName;
     GLenum m_textureTarget;
     GLuint m_textureObj;
-    Magick::Image* m_pImage;
-    Magick::Blob m_blob;
+    std::vector<unsigned char> m_pixels;   // RGBA rows, top row first
+    unsigned int m_decodedWidth;           // of level 0, even when it was skipped
+    unsigned int m_decodedHeight;
+    unsigned int m_decodedLevel;           // first level of m_pixels or m_cooked
+
+    // Largest side of the first level Decode keeps, 0 for all of them. Read by Decode
+    // on the loader threads.
+    std::atomic<unsigned int> m_wantedSize;
+    KTX2Image m_cooked;
+
+    // Written on the GL thread only, the decoded data above may change on a loader
+    // thread while the texture is in use
+    unsigned int m_width;
+    unsigned int m_height;
+    unsigned int m_numLevels;
+    unsigned int m_numDroppedLevels;
+    GLenum m_internalFormat;
+    unsigned int m_blockSize;           // 0 for uncompressed RGBA
+    unsigned int m_lastUsedFrame;
 };
 
 
@@ -0,0 +1,353 @@
+/*
+
+	Copyright 2011 Etay Meiri
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#pragma once
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <ctype.h>
+#include <algorithm>
+#include <vector>
+
+#include "texture_cooker.h"
+#include "texture.h"
+#include "ktx2.cpp"
+#include "image_decoder.cpp"
+
+
+static unsigned short ToRGB565(const unsigned char* c)
+{
+    return ((c[0] * 31 + 127) / 255) << 11 | ((c[1] * 63 + 127) / 255) << 5 | ((c[2] * 31 + 127) / 255);
+}
+
+
+static void FromRGB565(unsigned short c, int* pOut)
+{
+    const int r = (c >> 11) & 31;
+    const int g = (c >> 5) & 63;
+    const int b = c & 31;
+
+    pOut[0] = (r << 3) | (r >> 2);
+    pOut[1] = (g << 2) | (g >> 4);
+    pOut[2] = (b << 3) | (b >> 2);
+}
+
+
+// BC1 color block. The endpoints are the corners of the bounding box of the colors
+// along the diagonal that follows their correlation, pulled in by 1/16 of the range
+// so the interpolated colors cover the block better. Always uses the 4 color mode.
+void TextureCooker::EncodeColorBlock(const unsigned char Pixels[16][4], unsigned char* pOut)
+{
+    int Min[3] = { 255, 255, 255 };
+    int Max[3] = { 0, 0, 0 };
+
+    for (unsigned int i = 0 ; i < 16 ; i++) {
+        for (unsigned int j = 0 ; j < 3 ; j++) {
+            Min[j] = std::min(Min[j], (int)Pixels[i][j]);
+            Max[j] = std::max(Max[j], (int)Pixels[i][j]);
+        }
+    }
+
+    // Flip the green and blue extents when they are anti correlated with red
+    int Mean[3];
+
+    for (unsigned int j = 0 ; j < 3 ; j++) {
+        Mean[j] = (Min[j] + Max[j]) / 2;
+    }
+
+    int CovRG = 0;
+    int CovRB = 0;
+
+    for (unsigned int i = 0 ; i < 16 ; i++) {
+        const int r = Pixels[i][0] - Mean[0];
+        CovRG += r * (Pixels[i][1] - Mean[1]);
+        CovRB += r * (Pixels[i][2] - Mean[2]);
+    }
+
+    if (CovRG < 0) {
+        std::swap(Min[1], Max[1]);
+    }
+
+    if (CovRB < 0) {
+        std::swap(Min[2], Max[2]);
+    }
+
+    unsigned char Endpoints[2][3];
+
+    for (unsigned int j = 0 ; j < 3 ; j++) {
+        const int Inset = (Max[j] - Min[j]) / 16;
+        Endpoints[0][j] = (unsigned char)std::min(std::max(Max[j] - Inset, 0), 255);
+        Endpoints[1][j] = (unsigned char)std::min(std::max(Min[j] + Inset, 0), 255);
+    }
+
+    unsigned short c0 = ToRGB565(Endpoints[0]);
+    unsigned short c1 = ToRGB565(Endpoints[1]);
+
+    // The 4 color mode requires c0 > c1
+    if (c0 < c1) {
+        std::swap(c0, c1);
+    }
+
+    unsigned int Indices = 0;
+
+    if (c0 != c1) {
+        int Palette[4][3];
+        FromRGB565(c0, Palette[0]);
+        FromRGB565(c1, Palette[1]);
+
+        for (unsigned int j = 0 ; j < 3 ; j++) {
+            Palette[2][j] = (2 * Palette[0][j] + Palette[1][j]) / 3;
+            Palette[3][j] = (Palette[0][j] + 2 * Palette[1][j]) / 3;
+        }
+
+        for (unsigned int i = 0 ; i < 16 ; i++) {
+            unsigned int Best = 0;
+            int BestDistance = INT_MAX;
+
+            for (unsigned int k = 0 ; k < 4 ; k++) {
+                const int dr = Pixels[i][0] - Palette[k][0];
+                const int dg = Pixels[i][1] - Palette[k][1];
+                const int db = Pixels[i][2] - Palette[k][2];
+                const int Distance = dr * dr + dg * dg + db * db;
+
+                if (Distance < BestDistance) {
+                    Best = k;
+                    BestDistance = Distance;
+                }
+            }
+
+            Indices |= Best << (i * 2);
+        }
+    }
+
+    pOut[0] = c0 & 0xFF;
+    pOut[1] = c0 >> 8;
+    pOut[2] = c1 & 0xFF;
+    pOut[3] = c1 >> 8;
+
+    for (unsigned int i = 0 ; i < 4 ; i++) {
+        pOut[4 + i] = (Indices >> (i * 8)) & 0xFF;
+    }
+}
+
+
+// BC4 block of a single channel (the alpha of BC3 and both channels of BC5) in the
+// 8 value mode between the extremes of the block
+void TextureCooker::EncodeChannelBlock(const unsigned char Values[16], unsigned char* pOut)
+{
+    int Min = 255;
+    int Max = 0;
+
+    for (unsigned int i = 0 ; i < 16 ; i++) {
+        Min = std::min(Min, (int)Values[i]);
+        Max = std::max(Max, (int)Values[i]);
+    }
+
+    unsigned long long Indices = 0;
+
+    if (Max > Min) {
+        int Palette[8];
+        Palette[0] = Max;
+        Palette[1] = Min;
+
+        for (unsigned int k = 1 ; k < 7 ; k++) {
+            Palette[k + 1] = ((7 - k) * Max + k * Min) / 7;
+        }
+
+        for (unsigned int i = 0 ; i < 16 ; i++) {
+            unsigned int Best = 0;
+            int BestDistance = INT_MAX;
+
+            for (unsigned int k = 0 ; k < 8 ; k++) {
+                const int Distance = abs(Values[i] - Palette[k]);
+
+                if (Distance < BestDistance) {
+                    Best = k;
+                    BestDistance = Distance;
+                }
+            }
+
+            Indices |= (unsigned long long)Best << (i * 3);
+        }
+    }
+
+    pOut[0] = (unsigned char)Max;
+    pOut[1] = (unsigned char)Min;
+
+    for (unsigned int i = 0 ; i < 6 ; i++) {
+        pOut[2 + i] = (Indices >> (i * 8)) & 0xFF;
+    }
+}
+
+
+// Compresses one RGBA8 mip level and appends it to the image. The blocks on the right
+// and bottom edges repeat the last row and column.
+void TextureCooker::EncodeLevel(const unsigned char* pPixels, unsigned int Width, unsigned int Height, unsigned int VkFormat, KTX2Image& Image)
+{
+    const unsigned int BlockSize = (VkFormat == VK_FORMAT_BC1_RGB_UNORM_BLOCK) ? 8 : 16;
+    const unsigned int NumBlocksX = (Width + 3) / 4;
+    const unsigned int NumBlocksY = (Height + 3) / 4;
+
+    KTX2Level Level;
+    Level.Width = Width;
+    Level.Height = Height;
+    Level.Offset = Image.Data.size();
+    Level.Size = NumBlocksX * NumBlocksY * BlockSize;
+
+    Image.Data.resize(Level.Offset + Level.Size);
+    Image.Levels.push_back(Level);
+
+    unsigned char* pOut = &Image.Data[Level.Offset];
+
+    for (unsigned int by = 0 ; by < NumBlocksY ; by++) {
+        for (unsigned int bx = 0 ; bx < NumBlocksX ; bx++) {
+            unsigned char Pixels[16][4];
+
+            for (unsigned int y = 0 ; y < 4 ; y++) {
+                for (unsigned int x = 0 ; x < 4 ; x++) {
+                    const unsigned int px = std::min(bx * 4 + x, Width - 1);
+                    const unsigned int py = std::min(by * 4 + y, Height - 1);
+                    memcpy(Pixels[y * 4 + x], pPixels + (py * Width + px) * 4, 4);
+                }
+            }
+
+            unsigned char Channel[2][16];
+
+            for (unsigned int i = 0 ; i < 16 ; i++) {
+                Channel[0][i] = Pixels[i][(VkFormat == VK_FORMAT_BC5_UNORM_BLOCK) ? 0 : 3];
+                Channel[1][i] = Pixels[i][1];
+            }
+
+            switch (VkFormat) {
+                case VK_FORMAT_BC1_RGB_UNORM_BLOCK:
+                    EncodeColorBlock(Pixels, pOut);
+                    break;
+
+                case VK_FORMAT_BC3_UNORM_BLOCK:
+                    EncodeChannelBlock(Channel[0], pOut);
+                    EncodeColorBlock(Pixels, pOut + 8);
+                    break;
+
+                case VK_FORMAT_BC5_UNORM_BLOCK:
+                    EncodeChannelBlock(Channel[0], pOut);
+                    EncodeChannelBlock(Channel[1], pOut + 8);
+                    break;
+            }
+
+            pOut += BlockSize;
+        }
+    }
+}
+
+
+static bool IsNormalMap(const std::string& FileName)
+{
+    std::string Name = FileName.substr(FileName.find_last_of("/\\") + 1);
+    std::transform(Name.begin(), Name.end(), Name.begin(), ::tolower);
+
+    return Name.find("_bump") != std::string::npos ||
+           Name.find("_ddn") != std::string::npos ||
+           Name.find("_normal") != std::string::npos;
+}
+
+
+bool TextureCooker::Cook(const std::string& SrcFileName)
+{
+    std::vector<unsigned char> Pixels;
+    unsigned int Width = 0;
+    unsigned int Height = 0;
+
+    if (!ImageDecoder::Load(SrcFileName, Width, Height, Pixels)) {
+        return false;
+    }
+
+    unsigned int VkFormat = VK_FORMAT_BC1_RGB_UNORM_BLOCK;
+
+    if (IsNormalMap(SrcFileName)) {
+        VkFormat = VK_FORMAT_BC5_UNORM_BLOCK;
+    }
+    else {
+        for (unsigned int i = 0 ; i < Width * Height ; i++) {
+            if (Pixels[i * 4 + 3] < 255) {
+                VkFormat = VK_FORMAT_BC3_UNORM_BLOCK;
+                break;
+            }
+        }
+    }
+
+    KTX2Image Image;
+    Image.VkFormat = VkFormat;
+
+    // Every level is a 2x2 box filter of the previous one down to 1x1
+    for (;;) {
+        EncodeLevel(&Pixels[0], Width, Height, VkFormat, Image);
+
+        if (Width == 1 && Height == 1) {
+            break;
+        }
+
+        const unsigned int NextWidth = std::max(Width / 2, 1u);
+        const unsigned int NextHeight = std::max(Height / 2, 1u);
+        std::vector<unsigned char> Next(NextWidth * NextHeight * 4);
+
+        for (unsigned int y = 0 ; y < NextHeight ; y++) {
+            for (unsigned int x = 0 ; x < NextWidth ; x++) {
+                const unsigned int x0 = std::min(x * 2, Width - 1);
+                const unsigned int x1 = std::min(x * 2 + 1, Width - 1);
+                const unsigned int y0 = std::min(y * 2, Height - 1);
+                const unsigned int y1 = std::min(y * 2 + 1, Height - 1);
+
+                for (unsigned int c = 0 ; c < 4 ; c++) {
+                    const unsigned int Sum = Pixels[(y0 * Width + x0) * 4 + c] + Pixels[(y0 * Width + x1) * 4 + c] +
+                                             Pixels[(y1 * Width + x0) * 4 + c] + Pixels[(y1 * Width + x1) * 4 + c];
+                    Next[(y * NextWidth + x) * 4 + c] = (unsigned char)((Sum + 2) / 4);
+                }
+            }
+        }
+
+        Pixels.swap(Next);
+        Width = NextWidth;
+        Height = NextHeight;
+    }
+
+    const std::string DstFileName = Texture::GetCookedFileName(SrcFileName);
+
+    if (!WriteKTX2(DstFileName, Image)) {
+        printf("Error writing '%s'\n", DstFileName.c_str());
+        return false;
+    }
+
+    const char* pFormat = (VkFormat == VK_FORMAT_BC1_RGB_UNORM_BLOCK) ? "BC1" :
+                          (VkFormat == VK_FORMAT_BC3_UNORM_BLOCK) ? "BC3" : "BC5";
+
+    printf("Cooked '%s' (%s, %d levels)\n", DstFileName.c_str(), pFormat, (int)Image.Levels.size());
+
+    return true;
+}
+
+
+bool TextureCooker::CookFiles(int NumFiles, char** ppFileNames)
+{
+    bool Ret = true;
+
+    for (int i = 0 ; i < NumFiles ; i++) {
+        Ret = Cook(ppFileNames[i]) && Ret;
+    }
+
+    return Ret;
+}
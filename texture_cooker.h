@@ -0,0 +1,45 @@
+/*
+
+	Copyright 2011 Etay Meiri
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef TEXTURE_COOKER_H
+#define	TEXTURE_COOKER_H
+
+#include <string>
+
+#include "ktx2.h"
+
+// Converts source images into block compressed KTX2 files with a full mip chain, which
+// Texture::Load then uploads as is. The format follows from the content: BC5 for the
+// normal and bump maps (by file name), BC3 if any pixel is translucent and BC1 otherwise.
+class TextureCooker
+{
+public:
+    // Writes Texture::GetCookedFileName(SrcFileName)
+    static bool Cook(const std::string& SrcFileName);
+
+    // Entry point of the --cook command line mode
+    static bool CookFiles(int NumFiles, char** ppFileNames);
+
+private:
+    static void EncodeColorBlock(const unsigned char Pixels[16][4], unsigned char* pOut);
+    static void EncodeChannelBlock(const unsigned char Values[16], unsigned char* pOut);
+    static void EncodeLevel(const unsigned char* pPixels, unsigned int Width, unsigned int Height, unsigned int VkFormat, KTX2Image& Image);
+};
+
+
+#endif	/* TEXTURE_COOKER_H */
@@ -0,0 +1,280 @@
+/*
+
+	Copyright 2011 Etay Meiri
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#pragma once
+#include <stdio.h>
+#include <algorithm>
+#include <chrono>
+
+#include "texture_loader.h"
+#include "texture.h"
+#include "gl_state.h"
+
+std::mutex TextureLoader::s_mutex;
+std::condition_variable TextureLoader::s_condition;
+std::vector<std::thread> TextureLoader::s_threads;
+bool TextureLoader::s_stop = false;
+std::multimap<float, Texture*> TextureLoader::s_pending;
+std::set<Texture*> TextureLoader::s_decoding;
+std::deque<Texture*> TextureLoader::s_decoded;
+TextureLoader::PixelBuffer TextureLoader::s_pixelBuffers[TEXTURE_LOADER_PIXEL_BUFFERS];
+unsigned int TextureLoader::s_nextPixelBuffer = 0;
+GLuint TextureLoader::s_placeholder = 0;
+
+
+void TextureLoader::Load(Texture* pTexture, float Priority)
+{
+    std::lock_guard<std::mutex> Lock(s_mutex);
+
+    // The threads are started on first use and leave one core to the GL thread
+    if (s_threads.empty()) {
+        const unsigned int NumThreads = std::max(std::thread::hardware_concurrency(), 2u) - 1;
+
+        s_stop = false;
+
+        for (unsigned int i = 0 ; i < NumThreads ; i++) {
+            s_threads.push_back(std::thread(&TextureLoader::DecodeThread));
+        }
+    }
+
+    s_pending.insert(std::make_pair(Priority, pTexture));
+    s_condition.notify_one();
+}
+
+
+void TextureLoader::Cancel(Texture* pTexture)
+{
+    std::unique_lock<std::mutex> Lock(s_mutex);
+
+    for (std::multimap<float, Texture*>::iterator it = s_pending.begin() ; it != s_pending.end() ; it++) {
+        if (it->second == pTexture) {
+            s_pending.erase(it);
+            return;
+        }
+    }
+
+    while (s_decoding.count(pTexture) > 0) {
+        s_condition.wait(Lock);
+    }
+
+    s_decoded.erase(std::remove(s_decoded.begin(), s_decoded.end(), pTexture), s_decoded.end());
+}
+
+
+void TextureLoader::DecodeThread()
+{
+    std::unique_lock<std::mutex> Lock(s_mutex);
+
+    for (;;) {
+        while (!s_stop && s_pending.empty()) {
+            s_condition.wait(Lock);
+        }
+
+        if (s_stop) {
+            break;
+        }
+
+        Texture* pTexture = s_pending.begin()->second;
+        s_pending.erase(s_pending.begin());
+        s_decoding.insert(pTexture);
+
+        Lock.unlock();
+        const bool Decoded = pTexture->Decode();
+        Lock.lock();
+
+        s_decoding.erase(pTexture);
+
+        // A texture that fails to decode keeps the placeholder. The error has been
+        // reported by Decode.
+        if (Decoded) {
+            s_decoded.push_back(pTexture);
+        }
+
+        // Wake up Cancel
+        s_condition.notify_all();
+    }
+}
+
+
+// Copies the decoded data into the next buffer of the ring and creates the texture
+// from there. The texture is left alone when the GPU is still reading that buffer.
+TextureLoader::UploadResult TextureLoader::UploadThroughPixelBuffer(Texture* pTexture)
+{
+    PixelBuffer& Pbo = s_pixelBuffers[s_nextPixelBuffer];
+
+    if (Pbo.Buffer == 0) {
+        Pbo.Buffer = GLState::CreateBuffer();
+    }
+
+    if (Pbo.Fence != 0) {
+        if (glClientWaitSync(Pbo.Fence, 0, 0) == GL_TIMEOUT_EXPIRED) {
+            return UPLOAD_BUSY;
+        }
+
+        glDeleteSync(Pbo.Fence);
+        Pbo.Fence = 0;
+    }
+
+    const size_t Size = pTexture->GetDecodedSize();
+
+    if (Size > Pbo.Size) {
+        GLState::BufferData(Pbo.Buffer, Size, NULL, GL_STREAM_DRAW);
+        Pbo.Size = Size;
+    }
+
+    void* pMapping = GLState::MapBufferRange(Pbo.Buffer, 0, Size, GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+
+    if (!pMapping) {
+        return pTexture->Upload() ? UPLOAD_DONE : UPLOAD_FAILED;
+    }
+
+    pTexture->CopyDecodedData(pMapping);
+    GLState::UnmapBuffer(Pbo.Buffer);
+
+    // Every other upload passes client memory so the buffer is bound only for this one
+    GLState::BindBuffer(GL_PIXEL_UNPACK_BUFFER, Pbo.Buffer);
+    const bool Uploaded = pTexture->UploadFromPixelBuffer(0);
+    GLState::BindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+
+    Pbo.Fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    s_nextPixelBuffer = (s_nextPixelBuffer + 1) % TEXTURE_LOADER_PIXEL_BUFFERS;
+
+    return Uploaded ? UPLOAD_DONE : UPLOAD_FAILED;
+}
+
+
+void TextureLoader::Update(double BudgetMs)
+{
+    const std::chrono::steady_clock::time_point Start = std::chrono::steady_clock::now();
+
+    for (bool First = true ; ; First = false) {
+        Texture* pTexture = NULL;
+
+        {
+            std::lock_guard<std::mutex> Lock(s_mutex);
+
+            if (s_decoded.empty()) {
+                break;
+            }
+
+            pTexture = s_decoded.front();
+        }
+
+        const std::chrono::duration<double, std::milli> Elapsed = std::chrono::steady_clock::now() - Start;
+
+        if (!First && Elapsed.count() > BudgetMs) {
+            break;
+        }
+
+        const UploadResult Result = UploadThroughPixelBuffer(pTexture);
+
+        if (Result == UPLOAD_BUSY) {
+            break;
+        }
+
+        // The decoded data is gone either way so a failed texture is not retried. It
+        // keeps the placeholder, like the ones that fail to decode.
+        if (Result == UPLOAD_FAILED) {
+            printf("Error uploading texture '%s'\n", pTexture->GetFileName().c_str());
+        }
+
+        // Only Cancel removes textures from the front and it runs on this thread too
+        std::lock_guard<std::mutex> Lock(s_mutex);
+        s_decoded.pop_front();
+    }
+}
+
+
+bool TextureLoader::IsBusy()
+{
+    std::lock_guard<std::mutex> Lock(s_mutex);
+
+    return !s_pending.empty() || !s_decoding.empty() || !s_decoded.empty();
+}
+
+
+bool TextureLoader::IsQueued(Texture* pTexture)
+{
+    std::lock_guard<std::mutex> Lock(s_mutex);
+
+    for (std::multimap<float, Texture*>::const_iterator it = s_pending.begin() ; it != s_pending.end() ; it++) {
+        if (it->second == pTexture) {
+            return true;
+        }
+    }
+
+    return s_decoding.count(pTexture) > 0 ||
+           std::find(s_decoded.begin(), s_decoded.end(), pTexture) != s_decoded.end();
+}
+
+
+GLuint TextureLoader::GetPlaceholder()
+{
+    if (s_placeholder == 0) {
+        const unsigned char Grey[4] = { 128, 128, 128, 255 };
+
+        s_placeholder = GLState::CreateTexture(GL_TEXTURE_2D);
+        GLState::BindTextureForEdit(s_placeholder);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, 1, 1, 0, GL_RGBA, GL_UNSIGNED_BYTE, Grey);
+        GLState::TextureParameteri(s_placeholder, GL_TEXTURE_MAX_LEVEL, 0);
+        GLState::TextureParameterf(s_placeholder, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        GLState::TextureParameterf(s_placeholder, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    }
+
+    return s_placeholder;
+}
+
+
+void TextureLoader::Shutdown()
+{
+    {
+        std::lock_guard<std::mutex> Lock(s_mutex);
+        s_stop = true;
+        s_pending.clear();
+    }
+
+    s_condition.notify_all();
+
+    for (unsigned int i = 0 ; i < s_threads.size() ; i++) {
+        s_threads[i].join();
+    }
+
+    s_threads.clear();
+    s_decoding.clear();
+    s_decoded.clear();
+
+    for (unsigned int i = 0 ; i < TEXTURE_LOADER_PIXEL_BUFFERS ; i++) {
+        PixelBuffer& Pbo = s_pixelBuffers[i];
+
+        if (Pbo.Fence != 0) {
+            glDeleteSync(Pbo.Fence);
+        }
+
+        if (Pbo.Buffer != 0) {
+            GLState::DeleteBuffers(1, &Pbo.Buffer);
+        }
+
+        Pbo.Buffer = 0;
+        Pbo.Size = 0;
+        Pbo.Fence = 0;
+    }
+
+    if (s_placeholder != 0) {
+        GLState::DeleteTextures(1, &s_placeholder);
+        s_placeholder = 0;
+    }
+}
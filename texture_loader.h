@@ -0,0 +1,96 @@
+/*
+
+	Copyright 2011 Etay Meiri
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef TEXTURE_LOADER_H
+#define	TEXTURE_LOADER_H
+
+#include <map>
+#include <set>
+#include <deque>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <GL/glew.h>
+
+class Texture;
+
+// Time the GL thread may spend per frame on texture uploads
+#define TEXTURE_UPLOAD_BUDGET_MS 2.0
+
+#define TEXTURE_LOADER_PIXEL_BUFFERS 4
+
+// Decodes textures on a pool of threads and uploads them on the GL thread through a
+// ring of pixel buffer objects, a few per frame. Until then a texture is not loaded
+// (Texture::IsLoaded) and its users draw the placeholder instead.
+//
+// Load and Update must be called on the GL thread, once per frame for Update.
+class TextureLoader
+{
+public:
+    // Textures with a lower priority are decoded first, equal ones in order
+    static void Load(Texture* pTexture, float Priority = 0.0f);
+
+    // Drops a texture that is about to be deleted, waiting for its decoding if needed
+    static void Cancel(Texture* pTexture);
+
+    // Uploads decoded textures until the budget is spent (at least one per call)
+    static void Update(double BudgetMs = TEXTURE_UPLOAD_BUDGET_MS);
+
+    // True while textures are waiting to be decoded or uploaded
+    static bool IsBusy();
+
+    // True while the given texture is waiting to be decoded or uploaded
+    static bool IsQueued(Texture* pTexture);
+
+    // 1x1 grey texture to draw in place of the textures that are not loaded yet
+    static GLuint GetPlaceholder();
+
+    // Stops the threads and releases the GL objects. Must run before exiting.
+    static void Shutdown();
+
+private:
+    enum UploadResult {
+        UPLOAD_DONE,
+        UPLOAD_FAILED,
+        UPLOAD_BUSY     // the GPU is still reading the next buffer of the ring
+    };
+
+    static void DecodeThread();
+    static UploadResult UploadThroughPixelBuffer(Texture* pTexture);
+
+    struct PixelBuffer {
+        GLuint Buffer;
+        size_t Size;
+        GLsync Fence;   // signaled once the GPU has consumed the last upload
+    };
+
+    static std::mutex s_mutex;
+    static std::condition_variable s_condition;
+    static std::vector<std::thread> s_threads;
+    static bool s_stop;
+    static std::multimap<float, Texture*> s_pending;    // waiting for a decode thread
+    static std::set<Texture*> s_decoding;
+    static std::deque<Texture*> s_decoded;              // waiting for the upload
+    static PixelBuffer s_pixelBuffers[TEXTURE_LOADER_PIXEL_BUFFERS];
+    static unsigned int s_nextPixelBuffer;
+    static GLuint s_placeholder;
+};
+
+
+#endif	/* TEXTURE_LOADER_H */
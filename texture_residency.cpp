@@ -0,0 +1,162 @@
+/*
+
+	Copyright 2011 Etay Meiri
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#pragma once
+#include <stdio.h>
+#include <vector>
+#include <algorithm>
+
+#include "texture_residency.h"
+#include "texture.h"
+#include "texture_loader.h"
+
+size_t TextureResidency::s_budget = 0;
+size_t TextureResidency::s_residentBytes = 0;
+size_t TextureResidency::s_reservedBytes = 0;
+unsigned int TextureResidency::s_frame = 1;
+std::map<Texture*, size_t> TextureResidency::s_textures;
+std::map<Texture*, size_t> TextureResidency::s_reloading;
+
+
+static bool CompareLastUsed(const Texture* pLeft, const Texture* pRight)
+{
+    return pLeft->GetLastUsedFrame() < pRight->GetLastUsedFrame();
+}
+
+
+void TextureResidency::SetBudget(size_t Bytes)
+{
+    s_budget = Bytes;
+}
+
+
+void TextureResidency::OnUpload(Texture* pTexture)
+{
+    std::map<Texture*, size_t>::iterator it = s_reloading.find(pTexture);
+
+    if (it != s_reloading.end()) {
+        s_reservedBytes -= it->second;
+        s_reloading.erase(it);
+    }
+
+    size_t& Bytes = s_textures[pTexture];
+
+    s_residentBytes -= Bytes;
+    Bytes = pTexture->GetGPUBytes();
+    s_residentBytes += Bytes;
+}
+
+
+void TextureResidency::OnDelete(Texture* pTexture)
+{
+    std::map<Texture*, size_t>::iterator it = s_reloading.find(pTexture);
+
+    if (it != s_reloading.end()) {
+        s_reservedBytes -= it->second;
+        s_reloading.erase(it);
+    }
+
+    it = s_textures.find(pTexture);
+
+    if (it != s_textures.end()) {
+        s_residentBytes -= it->second;
+        s_textures.erase(it);
+    }
+}
+
+
+void TextureResidency::Update()
+{
+    s_frame++;
+
+    // A reload that is no longer queued without having been uploaded has failed to
+    // decode. The texture stays shrunk.
+    for (std::map<Texture*, size_t>::iterator it = s_reloading.begin() ; it != s_reloading.end() ; ) {
+        if (TextureLoader::IsQueued(it->first)) {
+            it++;
+        }
+        else {
+            s_reservedBytes -= it->second;
+            s_reloading.erase(it++);
+        }
+    }
+
+    if (s_budget > 0 && s_residentBytes > s_budget) {
+        Evict();
+    }
+    else {
+        Restore();
+    }
+}
+
+
+// Shrinks the least recently used textures first, each one down to the minimum size
+// before moving to the next. Textures that are being reloaded are left alone.
+void TextureResidency::Evict()
+{
+    std::vector<Texture*> Textures;
+
+    for (std::map<Texture*, size_t>::const_iterator it = s_textures.begin() ; it != s_textures.end() ; it++) {
+        if (s_reloading.count(it->first) == 0) {
+            Textures.push_back(it->first);
+        }
+    }
+
+    std::sort(Textures.begin(), Textures.end(), CompareLastUsed);
+
+    for (unsigned int i = 0 ; i < Textures.size() && s_residentBytes > s_budget ; i++) {
+        Texture* pTexture = Textures[i];
+
+        while (s_residentBytes > s_budget &&
+               pTexture->GetNumResidentLevels() > 1 &&
+               std::max(pTexture->GetWidth(), pTexture->GetHeight()) > RESIDENCY_MIN_TEXTURE_SIZE) {
+            if (!pTexture->DropTopLevel()) {
+                break;
+            }
+
+            OnUpload(pTexture);
+        }
+    }
+}
+
+
+// Reloads the shrunk textures that were drawn during the last frame, as long as the
+// levels they want fit. Reloads are reserved up front so that they never push the total
+// over the budget, which keeps Evict and Restore from undoing each other.
+void TextureResidency::Restore()
+{
+    for (std::map<Texture*, size_t>::const_iterator it = s_textures.begin() ; it != s_textures.end() ; it++) {
+        Texture* pTexture = it->first;
+
+        if (pTexture->GetNumDroppedLevels() <= pTexture->GetWantedLevel() ||
+            pTexture->GetLastUsedFrame() + 1 < s_frame ||
+            s_reloading.count(pTexture) > 0) {
+            continue;
+        }
+
+        const size_t ExtraBytes = pTexture->GetWantedGPUBytes() - it->second;
+
+        if (s_budget > 0 && s_residentBytes + s_reservedBytes + ExtraBytes > s_budget) {
+            continue;
+        }
+
+        s_reloading[pTexture] = ExtraBytes;
+        s_reservedBytes += ExtraBytes;
+
+        TextureLoader::Load(pTexture);
+    }
+}
@@ -0,0 +1,78 @@
+/*
+
+	Copyright 2011 Etay Meiri
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef TEXTURE_RESIDENCY_H
+#define	TEXTURE_RESIDENCY_H
+
+#include <map>
+#include <stddef.h>
+
+class Texture;
+
+// Textures are not shrunk below this size, whatever the budget
+#define RESIDENCY_MIN_TEXTURE_SIZE 64
+
+// Tracks the GPU memory of every uploaded texture and keeps the total within a budget.
+// When over budget the top mip levels of the least recently used textures are dropped.
+// A texture that is drawn with fewer levels than it wants (all of them, or what
+// TextureStreamer asks for) is reloaded from its file as soon as they fit in the budget.
+//
+// Everything here runs on the GL thread.
+class TextureResidency
+{
+public:
+    // In bytes, 0 (the default) disables the budget
+    static void SetBudget(size_t Bytes);
+
+    static size_t GetBudget()
+    {
+        return s_budget;
+    }
+
+    static size_t GetResidentBytes()
+    {
+        return s_residentBytes;
+    }
+
+    // Incremented by Update. Textures record it when they are bound.
+    static unsigned int GetFrame()
+    {
+        return s_frame;
+    }
+
+    // Drops or reloads mip levels. Call once per frame after TextureStreamer::Update.
+    static void Update();
+
+    // Called by Texture whenever its GL object has been (re)created or deleted
+    static void OnUpload(Texture* pTexture);
+    static void OnDelete(Texture* pTexture);
+
+private:
+    static void Evict();
+    static void Restore();
+
+    static size_t s_budget;
+    static size_t s_residentBytes;
+    static size_t s_reservedBytes;                  // what the pending reloads will add
+    static unsigned int s_frame;
+    static std::map<Texture*, size_t> s_textures;   // resident bytes of each texture
+    static std::map<Texture*, size_t> s_reloading;  // bytes reserved for each reload
+};
+
+
+#endif	/* TEXTURE_RESIDENCY_H */
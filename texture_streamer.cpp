@@ -0,0 +1,326 @@
+/*
+
+	Copyright 2011 Etay Meiri
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#pragma once
+#include <stdio.h>
+#include <algorithm>
+
+#include "texture_streamer.h"
+#include "texture.h"
+#include "texture_loader.h"
+#include "texture_residency.h"
+#include "engine_common.h"
+#include "gl_state.h"
+#include "util.h"
+
+GLuint TextureStreamer::s_feedbackImage = 0;
+unsigned int TextureStreamer::s_feedbackWidth = 0;
+unsigned int TextureStreamer::s_feedbackHeight = 0;
+std::vector<unsigned int> TextureStreamer::s_clearData;
+TextureStreamer::Readback TextureStreamer::s_readbacks[STREAMING_READBACK_BUFFERS];
+unsigned int TextureStreamer::s_nextReadback = 0;
+unsigned int TextureStreamer::s_numReadbacks = 0;
+unsigned int TextureStreamer::s_frame = 0;
+bool TextureStreamer::s_recording = false;
+GLint TextureStreamer::s_textureLocation = -1;
+std::vector<TextureStreamer::Slot> TextureStreamer::s_slots;
+std::vector<unsigned int> TextureStreamer::s_freeSlots;
+std::map<const Texture*, unsigned int> TextureStreamer::s_slotOfTexture;
+
+// A feedback texel holds the slot of the texture plus one above the level, 0 when empty
+#define STREAMING_LEVEL_BITS 4
+#define STREAMING_NO_REQUEST 0xFFFFFFFF
+
+
+bool TextureStreamer::Init(unsigned int WindowWidth, unsigned int WindowHeight)
+{
+    if (!GLEW_ARB_shader_image_load_store || !GLEW_ARB_texture_query_lod || !GLEW_ARB_copy_image) {
+        printf("Texture streaming needs image load/store, textureQueryLod and copy image, loading every level\n");
+        return false;
+    }
+
+    s_feedbackWidth = (WindowWidth + STREAMING_FEEDBACK_TILE - 1) / STREAMING_FEEDBACK_TILE;
+    s_feedbackHeight = (WindowHeight + STREAMING_FEEDBACK_TILE - 1) / STREAMING_FEEDBACK_TILE;
+    s_clearData.assign(s_feedbackWidth * s_feedbackHeight, 0);
+
+    s_feedbackImage = GLState::CreateTexture(GL_TEXTURE_2D);
+    GLState::BindTextureForEdit(s_feedbackImage);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_R32UI, s_feedbackWidth, s_feedbackHeight, 0, GL_RED_INTEGER, GL_UNSIGNED_INT, NULL);
+    GLState::TextureParameteri(s_feedbackImage, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    GLState::TextureParameteri(s_feedbackImage, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    GLState::TextureParameteri(s_feedbackImage, GL_TEXTURE_MAX_LEVEL, 0);
+
+    for (unsigned int i = 0 ; i < STREAMING_READBACK_BUFFERS ; i++) {
+        s_readbacks[i].Buffer = GLState::CreateBuffer();
+        GLState::BufferData(s_readbacks[i].Buffer, s_clearData.size() * sizeof(unsigned int), NULL, GL_STREAM_READ);
+        s_readbacks[i].Fence = NULL;
+    }
+
+    if (!GLCheckError()) {
+        Shutdown();
+        return false;
+    }
+
+    return true;
+}
+
+
+void TextureStreamer::BeginFeedback(GLint TextureLocation, GLint TileLocation)
+{
+    if (!IsEnabled()) {
+        return;
+    }
+
+    s_frame++;
+
+    GLState::TextureSubImage2D(s_feedbackImage, 0, 0, 0, s_feedbackWidth, s_feedbackHeight, GL_RED_INTEGER, GL_UNSIGNED_INT, &s_clearData[0]);
+
+    glBindImageTexture(TEXTURE_FEEDBACK_IMAGE_UNIT, s_feedbackImage, 0, GL_FALSE, 0, GL_WRITE_ONLY, GL_R32UI);
+
+    s_recording = true;
+
+    SetFeedbackProgram(TextureLocation, TileLocation);
+}
+
+
+// The uniforms belong to the program so they are set again for every program that
+// draws during the frame
+void TextureStreamer::SetFeedbackProgram(GLint TextureLocation, GLint TileLocation)
+{
+    if (!s_recording) {
+        return;
+    }
+
+    s_textureLocation = (TileLocation == -1) ? -1 : TextureLocation;
+
+    if (s_textureLocation == -1) {
+        return;
+    }
+
+    // Every pixel of a tile gets its turn
+    const unsigned int Pixel = s_frame % (STREAMING_FEEDBACK_TILE * STREAMING_FEEDBACK_TILE);
+
+    glUniform2i(TileLocation, Pixel % STREAMING_FEEDBACK_TILE, Pixel / STREAMING_FEEDBACK_TILE);
+    glUniform2i(TextureLocation, 0, 0);
+}
+
+
+// The copy into the pixel buffer is queued behind the draws. When every buffer still
+// waits for the GPU the feedback of this frame is lost, which is fine.
+void TextureStreamer::EndFeedback()
+{
+    if (!s_recording) {
+        return;
+    }
+
+    if (s_textureLocation != -1) {
+        glUniform2i(s_textureLocation, 0, 0);
+        s_textureLocation = -1;
+    }
+
+    s_recording = false;
+
+    Readback& Buffer = s_readbacks[s_nextReadback];
+
+    if (Buffer.Fence != NULL) {
+        return;
+    }
+
+    glMemoryBarrier(GL_TEXTURE_UPDATE_BARRIER_BIT);
+
+    GLState::BindBuffer(GL_PIXEL_PACK_BUFFER, Buffer.Buffer);
+    GLState::GetTextureImage(s_feedbackImage, 0, GL_RED_INTEGER, GL_UNSIGNED_INT, s_clearData.size() * sizeof(unsigned int), NULL);
+    GLState::BindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+    Buffer.Fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    s_nextReadback = (s_nextReadback + 1) % STREAMING_READBACK_BUFFERS;
+}
+
+
+// Readbacks are consumed in the order they were queued, starting with the oldest
+void TextureStreamer::Update()
+{
+    bool Changed = false;
+
+    for (unsigned int i = 0 ; i < STREAMING_READBACK_BUFFERS ; i++) {
+        Readback& Buffer = s_readbacks[(s_nextReadback + i) % STREAMING_READBACK_BUFFERS];
+
+        if (Buffer.Fence == NULL) {
+            continue;
+        }
+
+        const GLenum Status = glClientWaitSync(Buffer.Fence, 0, 0);
+
+        if (Status != GL_ALREADY_SIGNALED && Status != GL_CONDITION_SATISFIED) {
+            break;
+        }
+
+        glDeleteSync(Buffer.Fence);
+        Buffer.Fence = NULL;
+
+        const unsigned int* pFeedback = (const unsigned int*)GLState::MapBufferRange(Buffer.Buffer, 0,
+                                                                                     s_clearData.size() * sizeof(unsigned int),
+                                                                                     GL_MAP_READ_BIT);
+
+        if (pFeedback) {
+            ReadFeedback(pFeedback);
+            GLState::UnmapBuffer(Buffer.Buffer);
+            Changed = true;
+        }
+    }
+
+    if (Changed) {
+        ApplyRequests();
+    }
+}
+
+
+// Each slot remembers the finest level of two windows of readbacks so that a level
+// stays wanted for one to two windows after the last request
+void TextureStreamer::ReadFeedback(const unsigned int* pFeedback)
+{
+    if (s_numReadbacks++ % STREAMING_KEEP_READBACKS == 0) {
+        for (unsigned int i = 0 ; i < s_slots.size() ; i++) {
+            s_slots[i].PreviousLevel = s_slots[i].CurrentLevel;
+            s_slots[i].CurrentLevel = STREAMING_NO_REQUEST;
+        }
+    }
+
+    for (unsigned int i = 0 ; i < s_clearData.size() ; i++) {
+        const unsigned int Value = pFeedback[i];
+
+        if (Value == 0) {
+            continue;
+        }
+
+        // A slot may have been freed, or even reused, since the frame was drawn. At
+        // worst a texture loads a level too many for a while.
+        const unsigned int SlotIndex = (Value >> STREAMING_LEVEL_BITS) - 1;
+        const unsigned int Level = Value & ((1 << STREAMING_LEVEL_BITS) - 1);
+
+        if (SlotIndex < s_slots.size()) {
+            s_slots[SlotIndex].CurrentLevel = std::min(s_slots[SlotIndex].CurrentLevel, Level);
+        }
+    }
+}
+
+
+// Levels that are no longer wanted are dropped here, the missing ones are reloaded by
+// TextureResidency once they fit in its budget
+void TextureStreamer::ApplyRequests()
+{
+    for (unsigned int i = 0 ; i < s_slots.size() ; i++) {
+        Texture* pTexture = s_slots[i].pTexture;
+
+        if (!pTexture) {
+            continue;
+        }
+
+        const unsigned int MinSizeLevel = pTexture->GetLevelForSize(STREAMING_MIN_TEXTURE_SIZE);
+        const unsigned int Level = std::min(std::min(s_slots[i].CurrentLevel, s_slots[i].PreviousLevel), MinSizeLevel);
+
+        pTexture->SetWantedLevel(Level);
+
+        if (TextureLoader::IsQueued(pTexture) || pTexture->GetNumDroppedLevels() >= Level) {
+            continue;
+        }
+
+        while (pTexture->GetNumDroppedLevels() < Level) {
+            if (!pTexture->DropTopLevel()) {
+                break;
+            }
+        }
+
+        TextureResidency::OnUpload(pTexture);
+    }
+}
+
+
+void TextureStreamer::OnBind(const Texture* pTexture)
+{
+    if (s_textureLocation == -1) {
+        return;
+    }
+
+    std::map<const Texture*, unsigned int>::const_iterator it = s_slotOfTexture.find(pTexture);
+
+    if (it == s_slotOfTexture.end()) {
+        glUniform2i(s_textureLocation, 0, 0);
+    }
+    else {
+        glUniform2i(s_textureLocation, it->second + 1, pTexture->GetNumDroppedLevels());
+    }
+}
+
+
+void TextureStreamer::OnUpload(Texture* pTexture)
+{
+    if (!IsEnabled() || s_slotOfTexture.count(pTexture) > 0) {
+        return;
+    }
+
+    unsigned int SlotIndex;
+
+    if (!s_freeSlots.empty()) {
+        SlotIndex = s_freeSlots.back();
+        s_freeSlots.pop_back();
+    }
+    else {
+        SlotIndex = s_slots.size();
+        s_slots.push_back(Slot());
+    }
+
+    s_slots[SlotIndex].pTexture = pTexture;
+    s_slots[SlotIndex].CurrentLevel = STREAMING_NO_REQUEST;
+    s_slots[SlotIndex].PreviousLevel = STREAMING_NO_REQUEST;
+    s_slotOfTexture[pTexture] = SlotIndex;
+}
+
+
+void TextureStreamer::OnDelete(Texture* pTexture)
+{
+    std::map<const Texture*, unsigned int>::iterator it = s_slotOfTexture.find(pTexture);
+
+    if (it == s_slotOfTexture.end()) {
+        return;
+    }
+
+    s_slots[it->second].pTexture = NULL;
+    s_freeSlots.push_back(it->second);
+    s_slotOfTexture.erase(it);
+}
+
+
+void TextureStreamer::Shutdown()
+{
+    for (unsigned int i = 0 ; i < STREAMING_READBACK_BUFFERS ; i++) {
+        if (s_readbacks[i].Fence != NULL) {
+            glDeleteSync(s_readbacks[i].Fence);
+            s_readbacks[i].Fence = NULL;
+        }
+
+        if (s_readbacks[i].Buffer != 0) {
+            GLState::DeleteBuffers(1, &s_readbacks[i].Buffer);
+            s_readbacks[i].Buffer = 0;
+        }
+    }
+
+    if (s_feedbackImage != 0) {
+        GLState::DeleteTextures(1, &s_feedbackImage);
+        s_feedbackImage = 0;
+    }
+}
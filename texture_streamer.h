@@ -0,0 +1,125 @@
+/*
+
+	Copyright 2011 Etay Meiri
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef TEXTURE_STREAMER_H
+#define	TEXTURE_STREAMER_H
+
+#include <map>
+#include <vector>
+#include <GL/glew.h>
+
+class Texture;
+
+// Side of the screen tiles that share a texel of the feedback image
+#define STREAMING_FEEDBACK_TILE 8
+
+#define STREAMING_READBACK_BUFFERS 3
+
+// Textures are first loaded with their largest side capped to this, the feedback asks
+// for more where needed. Textures that are no longer seen go back down to it.
+#define STREAMING_MIN_TEXTURE_SIZE 64
+
+// A requested level stays wanted for at least this many readbacks after the last request
+#define STREAMING_KEEP_READBACKS 60
+
+// Loads the mip levels of the textures that the frame actually samples.
+//
+// While the feedback is on, the fragment shader of the lighting technique writes the
+// texture and the mip level it samples into a small integer image, one texel per
+// screen tile from a different pixel of the tile every frame. The image is read back
+// through pixel buffers without stalling and, a few frames later, each texture gets
+// the finest level requested recently as its wanted level (Texture::SetWantedLevel).
+// Levels above it are dropped right away, the missing ones are reloaded by
+// TextureResidency.
+//
+// Everything here runs on the GL thread.
+class TextureStreamer
+{
+public:
+    // Creates the feedback image for a window of the given size. Returns false, and
+    // leaves the streaming off, when the GL lacks image load/store or textureQueryLod.
+    static bool Init(unsigned int WindowWidth, unsigned int WindowHeight);
+
+    static bool IsEnabled()
+    {
+        return s_feedbackImage != 0;
+    }
+
+    // Largest side of the textures loaded for the first time, 0 for no limit
+    static unsigned int GetFirstLoadSize()
+    {
+        return IsEnabled() ? STREAMING_MIN_TEXTURE_SIZE : 0;
+    }
+
+    // Starts recording the feedback of the current program. TextureLocation is an ivec2
+    // uniform that receives the slot of each texture plus one and its base level, and
+    // TileLocation an ivec2 uniform with the pixel of the tiles that writes. Both are -1
+    // for a program without feedback.
+    static void BeginFeedback(GLint TextureLocation, GLint TileLocation);
+
+    // Call after switching programs between BeginFeedback and EndFeedback, with the
+    // locations in the new program
+    static void SetFeedbackProgram(GLint TextureLocation, GLint TileLocation);
+
+    // Queues the readback of the feedback image
+    static void EndFeedback();
+
+    // Reads back the finished feedback and updates the wanted levels. Call once per
+    // frame before TextureResidency::Update.
+    static void Update();
+
+    // Called by Texture. A NULL texture turns the feedback off for the next draws.
+    static void OnBind(const Texture* pTexture);
+    static void OnUpload(Texture* pTexture);
+    static void OnDelete(Texture* pTexture);
+
+    // Releases the GL objects. Must run before exiting.
+    static void Shutdown();
+
+private:
+    static void ReadFeedback(const unsigned int* pFeedback);
+    static void ApplyRequests();
+
+    struct Readback {
+        GLuint Buffer;
+        GLsync Fence;   // NULL when the buffer is free
+    };
+
+    struct Slot {
+        Texture* pTexture;
+        unsigned int CurrentLevel;      // finest level requested since the last window
+        unsigned int PreviousLevel;     // finest level requested in the window before
+    };
+
+    static GLuint s_feedbackImage;
+    static unsigned int s_feedbackWidth;
+    static unsigned int s_feedbackHeight;
+    static std::vector<unsigned int> s_clearData;
+    static Readback s_readbacks[STREAMING_READBACK_BUFFERS];
+    static unsigned int s_nextReadback;
+    static unsigned int s_numReadbacks;
+    static unsigned int s_frame;
+    static bool s_recording;            // between BeginFeedback and EndFeedback
+    static GLint s_textureLocation;     // -1 when the current program doesn't record
+    static std::vector<Slot> s_slots;
+    static std::vector<unsigned int> s_freeSlots;
+    static std::map<const Texture*, unsigned int> s_slotOfTexture;
+};
+
+
+#endif	/* TEXTURE_STREAMER_H */
@@ -0,0 +1,141 @@
+/*
+
+	Copyright 2011 Etay Meiri
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+#include <stdio.h>
+#include <string.h>
+
+#include "uniform_buffers.h"
+#include "engine_common.h"
+#include "gl_state.h"
+#include "util.h"
+
+FrameUniforms UniformBuffers::s_frame;
+LightUniforms UniformBuffers::s_lights;
+MaterialUniforms UniformBuffers::s_material;
+bool UniformBuffers::s_dirty = true;
+GLuint UniformBuffers::s_buffer = 0;
+GLintptr UniformBuffers::s_lightsOffset = 0;
+GLintptr UniformBuffers::s_materialOffset = 0;
+GLsizeiptr UniformBuffers::s_size = 0;
+
+static_assert(sizeof(FrameUniforms) == 160, "FrameUniforms must match the std140 layout");
+static_assert(sizeof(UniformPointLight) == 64, "UniformPointLight must match the std140 layout");
+static_assert(sizeof(UniformSpotLight) == 80, "UniformSpotLight must match the std140 layout");
+static_assert(sizeof(LightUniforms) == 64 + 64 * MAX_POINT_LIGHTS + 80 * MAX_SPOT_LIGHTS + 64 * NUM_SHADOW_CASCADES + 48,
+              "LightUniforms must match the std140 layout");
+static_assert(NUM_SHADOW_CASCADES == 4, "The shadow texel sizes are a vec4");
+
+FrameUniforms& UniformBuffers::EditFrame()
+{
+    s_dirty = true;
+    return s_frame;
+}
+
+
+LightUniforms& UniformBuffers::EditLights()
+{
+    s_dirty = true;
+    return s_lights;
+}
+
+
+MaterialUniforms& UniformBuffers::EditMaterial()
+{
+    s_dirty = true;
+    return s_material;
+}
+
+
+void UniformBuffers::BindBlocks(GLuint Program)
+{
+    const char* pNames[] = { "FrameUniforms", "LightUniforms", "MaterialUniforms" };
+    const GLuint Bindings[] = { FRAME_UNIFORM_BINDING, LIGHT_UNIFORM_BINDING, MATERIAL_UNIFORM_BINDING };
+
+    for (unsigned int i = 0 ; i < ARRAY_SIZE_IN_ELEMENTS(pNames) ; i++) {
+        const GLuint Index = glGetUniformBlockIndex(Program, pNames[i]);
+
+        // The blocks that the program doesn't use are optimized away
+        if (Index != GL_INVALID_INDEX) {
+            glUniformBlockBinding(Program, Index, Bindings[i]);
+        }
+    }
+}
+
+
+// The blocks are placed one after the other at the offset alignment of the GL
+bool UniformBuffers::CreateBuffer()
+{
+    GLint Alignment = 256;
+    glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &Alignment);
+
+    s_lightsOffset = (sizeof(FrameUniforms) + Alignment - 1) / Alignment * Alignment;
+    s_materialOffset = (s_lightsOffset + sizeof(LightUniforms) + Alignment - 1) / Alignment * Alignment;
+    s_size = s_materialOffset + sizeof(MaterialUniforms);
+
+    s_buffer = GLState::CreateBuffer();
+    GLState::BufferData(s_buffer, s_size, NULL, GL_STREAM_DRAW);
+
+    GLState::BindBufferRange(GL_UNIFORM_BUFFER, FRAME_UNIFORM_BINDING, s_buffer, 0, sizeof(FrameUniforms));
+    GLState::BindBufferRange(GL_UNIFORM_BUFFER, LIGHT_UNIFORM_BINDING, s_buffer, s_lightsOffset, sizeof(LightUniforms));
+    GLState::BindBufferRange(GL_UNIFORM_BUFFER, MATERIAL_UNIFORM_BINDING, s_buffer, s_materialOffset, sizeof(MaterialUniforms));
+
+    return GLCheckError();
+}
+
+
+// The previous contents are invalidated so the driver can hand out fresh memory
+// instead of waiting for the draws that still read them
+bool UniformBuffers::Update()
+{
+    if (s_buffer == 0 && !CreateBuffer()) {
+        return false;
+    }
+
+    if (!s_dirty) {
+        return true;
+    }
+
+    unsigned char* p = (unsigned char*)GLState::MapBufferRange(s_buffer, 0, s_size,
+                                                               GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+
+    if (!p) {
+        return false;
+    }
+
+    memcpy(p, &s_frame, sizeof(s_frame));
+    memcpy(p + s_lightsOffset, &s_lights, sizeof(s_lights));
+    memcpy(p + s_materialOffset, &s_material, sizeof(s_material));
+
+    GLState::UnmapBuffer(s_buffer);
+
+    s_dirty = false;
+
+    return true;
+}
+
+
+void UniformBuffers::Shutdown()
+{
+    if (s_buffer != 0) {
+        GLState::DeleteBuffers(1, &s_buffer);
+        s_buffer = 0;
+    }
+
+    s_dirty = true;
+}
@@ -0,0 +1,207 @@
+/*
+
+	Copyright 2011 Etay Meiri
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef UNIFORM_BUFFERS_H
+#define	UNIFORM_BUFFERS_H
+
+#include <GL/glew.h>
+
+#include "math_3d.h"
+
+// The light lists are sized by the 16KB uniform block that every GL guarantees
+#define MAX_POINT_LIGHTS 64
+#define MAX_SPOT_LIGHTS  64
+
+// Cascades of the directional light shadows, their texel sizes share a vec4
+#define NUM_SHADOW_CASCADES 4
+
+#define UNIFORM_STRINGIFY(x) #x
+#define UNIFORM_TO_STRING(x) UNIFORM_STRINGIFY(x)
+
+// GLSL of the blocks, spliced into the shader strings that use them
+#define UNIFORM_BLOCKS_GLSL "                                                       \n\
+const int MAX_POINT_LIGHTS = " UNIFORM_TO_STRING(MAX_POINT_LIGHTS) ";               \n\
+const int MAX_SPOT_LIGHTS = " UNIFORM_TO_STRING(MAX_SPOT_LIGHTS) ";                 \n\
+const int NUM_SHADOW_CASCADES = " UNIFORM_TO_STRING(NUM_SHADOW_CASCADES) ";         \n\
+                                                                                    \n\
+struct BaseLight                                                                    \n\
+{                                                                                   \n\
+    vec3 Color;                                                                     \n\
+    float AmbientIntensity;                                                         \n\
+    float DiffuseIntensity;                                                         \n\
+};                                                                                  \n\
+                                                                                    \n\
+struct DirectionalLight                                                             \n\
+{                                                                                   \n\
+    BaseLight Base;                                                                 \n\
+    vec3 Direction;                                                                 \n\
+};                                                                                  \n\
+                                                                                    \n\
+struct Attenuation                                                                  \n\
+{                                                                                   \n\
+    float Constant;                                                                 \n\
+    float Linear;                                                                   \n\
+    float Exp;                                                                      \n\
+};                                                                                  \n\
+                                                                                    \n\
+struct PointLight                                                                   \n\
+{                                                                                   \n\
+    BaseLight Base;                                                                 \n\
+    vec3 Position;                                                                  \n\
+    Attenuation Atten;                                                              \n\
+};                                                                                  \n\
+                                                                                    \n\
+struct SpotLight                                                                    \n\
+{                                                                                   \n\
+    PointLight Base;                                                                \n\
+    vec3 Direction;                                                                 \n\
+    float Cutoff;                                                                   \n\
+};                                                                                  \n\
+                                                                                    \n\
+layout (std140) uniform FrameUniforms                                               \n\
+{                                                                                   \n\
+    layout (row_major) mat4 gVP;                                                    \n\
+    layout (row_major) mat4 gInvVP;                                                 \n\
+    vec3 gEyeWorldPos;                                                              \n\
+    float gZNear;                                                                   \n\
+    float gZFar;                                                                    \n\
+    vec2 gScreenSize;                                                               \n\
+};                                                                                  \n\
+                                                                                    \n\
+layout (std140) uniform LightUniforms                                               \n\
+{                                                                                   \n\
+    DirectionalLight gDirectionalLight;                                             \n\
+    int gNumPointLights;                                                            \n\
+    int gNumSpotLights;                                                             \n\
+    PointLight gPointLights[MAX_POINT_LIGHTS];                                      \n\
+    SpotLight gSpotLights[MAX_SPOT_LIGHTS];                                         \n\
+    layout (row_major) mat4 gShadowCascadeVP[NUM_SHADOW_CASCADES];                  \n\
+    vec4 gShadowTexelSize;                                                          \n\
+    vec4 gProbeVolumeMin;                                                           \n\
+    vec4 gProbeVolumeInvSize;                                                       \n\
+};                                                                                  \n\
+                                                                                    \n\
+layout (std140) uniform MaterialUniforms                                            \n\
+{                                                                                   \n\
+    vec4 gColor[4];                                                                 \n\
+    float gMatSpecularIntensity;                                                    \n\
+    float gSpecularPower;                                                           \n\
+};                                                                                  \n\
+"
+
+// The structures below mirror the std140 layout of UNIFORM_BLOCKS_GLSL, padding included
+
+struct UniformBaseLight {
+    Vector3f Color;
+    float AmbientIntensity;
+    float DiffuseIntensity;
+    float Pad[3];
+};
+
+struct UniformDirectionalLight {
+    UniformBaseLight Base;
+    Vector3f Direction;
+    float Pad;
+};
+
+struct UniformAttenuation {
+    float Constant;
+    float Linear;
+    float Exp;
+    float Pad;
+};
+
+struct UniformPointLight {
+    UniformBaseLight Base;
+    Vector3f Position;
+    float Pad;
+    UniformAttenuation Atten;
+};
+
+struct UniformSpotLight {
+    UniformPointLight Base;
+    Vector3f Direction;
+    float Cutoff;           // cosine of the angle
+};
+
+// Constant for the whole frame, shared by all the techniques
+struct FrameUniforms {
+    Matrix4f VP;            // row major like Matrix4f
+    Matrix4f InvVP;         // clip space back to world space
+    Vector3f EyeWorldPos;
+    float ZNear;
+    float ZFar;
+    float Pad;
+    Vector2f ScreenSize;    // in pixels
+};
+
+struct LightUniforms {
+    UniformDirectionalLight DirectionalLight;
+    int NumPointLights;
+    int NumSpotLights;
+    int Pad[2];
+    UniformPointLight PointLights[MAX_POINT_LIGHTS];
+    UniformSpotLight SpotLights[MAX_SPOT_LIGHTS];
+    Matrix4f ShadowCascadeVP[NUM_SHADOW_CASCADES];      // world to the clip space of each cascade
+    float ShadowTexelSize[NUM_SHADOW_CASCADES];         // in world units
+    Vector4f ProbeVolumeMin;                            // xyz, box of the irradiance probes
+    Vector4f ProbeVolumeInvSize;                        // xyz, one over the size of the box
+};
+
+struct MaterialUniforms {
+    Vector4f Colors[4];     // picked by the instance ID
+    float SpecularIntensity;
+    float SpecularPower;
+    float Pad[2];
+};
+
+// Keeps the uniform blocks shared by the techniques in one buffer. The Edit functions
+// return the CPU copy of a block and mark it for upload, Update then writes the whole
+// buffer with a single map. The blocks stay bound to FRAME_UNIFORM_BINDING,
+// LIGHT_UNIFORM_BINDING and MATERIAL_UNIFORM_BINDING. GL thread only.
+class UniformBuffers
+{
+public:
+    static FrameUniforms& EditFrame();
+    static LightUniforms& EditLights();
+    static MaterialUniforms& EditMaterial();
+
+    // Uploads the blocks if any changed since the last call. Call once per frame after
+    // the changes and before drawing. Creates the buffer on the first call.
+    static bool Update();
+
+    // Points the blocks that the program uses to their binding. Call after linking.
+    static void BindBlocks(GLuint Program);
+
+    static void Shutdown();
+
+private:
+    static bool CreateBuffer();
+
+    static FrameUniforms s_frame;
+    static LightUniforms s_lights;
+    static MaterialUniforms s_material;
+    static bool s_dirty;
+    static GLuint s_buffer;
+    static GLintptr s_lightsOffset;
+    static GLintptr s_materialOffset;
+    static GLsizeiptr s_size;
+};
+
+
+#endif	/* UNIFORM_BUFFERS_H */
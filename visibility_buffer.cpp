@@ -0,0 +1,113 @@
+/*
+
+	Copyright 2011 Etay Meiri
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+#include <stdio.h>
+
+#include "visibility_buffer.h"
+#include "engine_common.h"
+#include "gl_state.h"
+#include "util.h"
+
+VisibilityBuffer::VisibilityBuffer()
+{
+    m_width = 0;
+    m_height = 0;
+    m_fbo = 0;
+    m_texture = 0;
+    m_depthTexture = 0;
+}
+
+
+VisibilityBuffer::~VisibilityBuffer()
+{
+    if (m_fbo != 0) {
+        glDeleteFramebuffers(1, &m_fbo);
+    }
+
+    if (m_texture != 0) {
+        GLState::DeleteTextures(1, &m_texture);
+    }
+
+    if (m_depthTexture != 0) {
+        GLState::DeleteTextures(1, &m_depthTexture);
+    }
+}
+
+
+bool VisibilityBuffer::Init(unsigned int WindowWidth, unsigned int WindowHeight)
+{
+    m_width = WindowWidth;
+    m_height = WindowHeight;
+
+    // Integer textures can't be filtered and the depth is never sampled
+    m_texture = GLState::CreateTexture(GL_TEXTURE_2D);
+    GLState::BindTextureForEdit(m_texture);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RG32UI, WindowWidth, WindowHeight, 0, GL_RG_INTEGER, GL_UNSIGNED_INT, NULL);
+    GLState::TextureParameteri(m_texture, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    GLState::TextureParameteri(m_texture, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+
+    m_depthTexture = GLState::CreateTexture(GL_TEXTURE_2D);
+    GLState::BindTextureForEdit(m_depthTexture);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT32F, WindowWidth, WindowHeight, 0, GL_DEPTH_COMPONENT, GL_FLOAT, NULL);
+
+    glGenFramebuffers(1, &m_fbo);
+    glBindFramebuffer(GL_DRAW_FRAMEBUFFER, m_fbo);
+
+    glFramebufferTexture2D(GL_DRAW_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, m_texture, 0);
+    glFramebufferTexture2D(GL_DRAW_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, m_depthTexture, 0);
+
+    const GLenum Status = glCheckFramebufferStatus(GL_DRAW_FRAMEBUFFER);
+
+    glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
+
+    if (Status != GL_FRAMEBUFFER_COMPLETE) {
+        fprintf(stderr, "Visibility buffer error, status: 0x%x\n", Status);
+        return false;
+    }
+
+    return GLCheckError();
+}
+
+
+void VisibilityBuffer::BindForWriting()
+{
+    glBindFramebuffer(GL_DRAW_FRAMEBUFFER, m_fbo);
+
+    // glClear would convert floats for an integer target
+    const GLuint Empty[] = { 0xFFFFFFFF, 0xFFFFFFFF, 0xFFFFFFFF, 0xFFFFFFFF };
+    const GLfloat Depth = 1.0f;
+    glClearBufferuiv(GL_COLOR, 0, Empty);
+    glClearBufferfv(GL_DEPTH, 0, &Depth);
+}
+
+
+void VisibilityBuffer::BindForReading()
+{
+    glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
+
+    GLState::BindTexture(VISIBILITY_TEXTURE_UNIT_INDEX, GL_TEXTURE_2D, m_texture);
+}
+
+
+void VisibilityBuffer::ReadIDs(unsigned int* pIDs)
+{
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, m_fbo);
+    glReadPixels(0, 0, m_width, m_height, GL_RG_INTEGER, GL_UNSIGNED_INT, pIDs);
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, 0);
+}
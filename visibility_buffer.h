@@ -0,0 +1,54 @@
+/*
+
+	Copyright 2011 Etay Meiri
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef VISIBILITY_BUFFER_H
+#define	VISIBILITY_BUFFER_H
+
+#include <GL/glew.h>
+
+// Render target of the visibility buffer shading: two 32 bit integers per pixel that
+// name the triangle and the instance that cover it, see VisibilityTechnique, and the
+// depth they were tested with. The attributes come back from the mesh buffers.
+class VisibilityBuffer
+{
+public:
+    VisibilityBuffer();
+
+    ~VisibilityBuffer();
+
+    bool Init(unsigned int WindowWidth, unsigned int WindowHeight);
+
+    // Clears the target to no triangle, the draws that follow fill it
+    void BindForWriting();
+
+    // Back to the default framebuffer with the target on VISIBILITY_TEXTURE_UNIT
+    void BindForReading();
+
+    // Copies the IDs to pIDs, two per pixel, for the offline bakes
+    void ReadIDs(unsigned int* pIDs);
+
+private:
+    unsigned int m_width;
+    unsigned int m_height;
+    GLuint m_fbo;
+    GLuint m_texture;
+    GLuint m_depthTexture;
+};
+
+
+#endif	/* VISIBILITY_BUFFER_H */
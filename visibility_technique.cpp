@@ -0,0 +1,144 @@
+/*
+
+	Copyright 2011 Etay Meiri
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+#include "visibility_technique.h"
+#include "engine_common.h"
+#include "util.h"
+
+static const char* pVisibilityVS = "                                                \n\
+#version 410                                                                        \n\
+                                                                                    \n\
+#ifdef CLASSIFICATION                                                               \n\
+// A triangle that covers the screen, drawn without vertex arrays                   \n\
+void main()                                                                         \n\
+{                                                                                   \n\
+    vec2 Corner = vec2((gl_VertexID << 1) & 2, gl_VertexID & 2);                    \n\
+    gl_Position = vec4(Corner * 2.0 - 1.0, 0.0, 1.0);                               \n\
+}                                                                                   \n\
+#else                                                                               \n\
+layout (location = 0) in vec3 Position;                                             \n\
+layout (location = 3) in mat4 WVP;                                                  \n\
+                                                                                    \n\
+flat out uint InstanceID;                                                           \n\
+                                                                                    \n\
+void main()                                                                         \n\
+{                                                                                   \n\
+    gl_Position = WVP * vec4(Position, 1.0);                                        \n\
+    InstanceID = uint(gl_InstanceID);                                               \n\
+}                                                                                   \n\
+#endif";
+
+static const char* pVisibilityFS = "                                                \n\
+#version 410                                                                        \n\
+"
+VISIBILITY_GLSL
+"                                                                                   \n\
+                                                                                    \n\
+#ifdef CLASSIFICATION                                                               \n\
+uniform usampler2D gVisibilityMap;                                                  \n\
+uniform usamplerBuffer gMeshEntries;                                                \n\
+                                                                                    \n\
+void main()                                                                         \n\
+{                                                                                   \n\
+    uint ID = texelFetch(gVisibilityMap, ivec2(gl_FragCoord.xy), 0).y;              \n\
+                                                                                    \n\
+    // Keeps the cleared depth, which is no material                                \n\
+    if (ID == VISIBILITY_EMPTY) {                                                   \n\
+        discard;                                                                    \n\
+    }                                                                               \n\
+                                                                                    \n\
+    uint Material = texelFetch(gMeshEntries, int(ID >> VISIBILITY_ENTRY_SHIFT)).w;  \n\
+    gl_FragDepth = GetMaterialDepth(Material);                                      \n\
+}                                                                                   \n\
+#else                                                                               \n\
+uniform uint gEntry;                                                                \n\
+                                                                                    \n\
+flat in uint InstanceID;                                                            \n\
+                                                                                    \n\
+layout (location = 0) out uvec2 VisibilityID;                                       \n\
+                                                                                    \n\
+void main()                                                                         \n\
+{                                                                                   \n\
+    VisibilityID = uvec2(gl_PrimitiveID, (gEntry << VISIBILITY_ENTRY_SHIFT) | InstanceID);\n\
+}                                                                                   \n\
+#endif";
+
+#define PERMUTATION_CLASSIFICATION 1
+
+
+VisibilityTechnique::VisibilityTechnique()
+{
+    m_entryLocation = INVALID_UNIFORM_LOCATION;
+}
+
+
+bool VisibilityTechnique::Init()
+{
+    if (!Technique::Init()) {
+        return false;
+    }
+
+    if (!AddShader(GL_VERTEX_SHADER, pVisibilityVS)) {
+        return false;
+    }
+
+    if (!AddShader(GL_FRAGMENT_SHADER, pVisibilityFS)) {
+        return false;
+    }
+
+    return Finalize();
+}
+
+
+std::string VisibilityTechnique::GetPermutationDefines(unsigned int Key) const
+{
+    return (Key == PERMUTATION_CLASSIFICATION) ? "#define CLASSIFICATION\n" : "";
+}
+
+
+bool VisibilityTechnique::OnFinalized()
+{
+    if (GetPermutation() == PERMUTATION_CLASSIFICATION) {
+        glProgramUniform1i(m_shaderProg, GetUniformLocation("gVisibilityMap"), VISIBILITY_TEXTURE_UNIT_INDEX);
+        glProgramUniform1i(m_shaderProg, GetUniformLocation("gMeshEntries"), MESH_ENTRY_TEXTURE_UNIT_INDEX);
+        return true;
+    }
+
+    m_entryLocation = GetUniformLocation("gEntry");
+
+    return m_entryLocation != INVALID_UNIFORM_LOCATION;
+}
+
+
+bool VisibilityTechnique::Enable()
+{
+    return EnablePermutation(0);
+}
+
+
+void VisibilityTechnique::SetEntry(unsigned int Entry)
+{
+    glUniform1ui(m_entryLocation, Entry);
+}
+
+
+bool VisibilityTechnique::EnableClassification()
+{
+    return EnablePermutation(PERMUTATION_CLASSIFICATION);
+}
@@ -0,0 +1,76 @@
+/*
+
+	Copyright 2011 Etay Meiri
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef VISIBILITY_TECHNIQUE_H
+#define	VISIBILITY_TECHNIQUE_H
+
+#include "technique.h"
+#include "uniform_buffers.h"
+
+// A pixel of the visibility buffer is the triangle within its draw and the entry of
+// the mesh with the instance within the draw, or all ones where nothing was drawn
+#define VISIBILITY_ENTRY_SHIFT      20
+#define VISIBILITY_MAX_ENTRIES      (1 << (32 - VISIBILITY_ENTRY_SHIFT))
+#define VISIBILITY_MAX_INSTANCES    (1 << VISIBILITY_ENTRY_SHIFT)
+#define VISIBILITY_MAX_MATERIALS    4095
+
+// Shared by the classification and the resolve, which must agree to the bit on the
+// depth of a material. The values are exact in a float and far apart in any depth
+// format.
+#define VISIBILITY_GLSL "                                                           \n\
+const uint VISIBILITY_ENTRY_SHIFT = " UNIFORM_TO_STRING(VISIBILITY_ENTRY_SHIFT) "u; \n\
+const uint VISIBILITY_INSTANCE_MASK = (1u << VISIBILITY_ENTRY_SHIFT) - 1u;          \n\
+const uint VISIBILITY_EMPTY = 0xFFFFFFFFu;                                          \n\
+                                                                                    \n\
+float GetMaterialDepth(uint Material)                                               \n\
+{                                                                                   \n\
+    return float(Material + 1u) / 4096.0;                                           \n\
+}                                                                                   \n\
+"
+
+// The two passes of the visibility buffer that don't shade. The first one draws the
+// meshes into the visibility buffer from the positions alone (see Mesh::RenderVisibility).
+// The classification then turns the visibility buffer into the material of every pixel,
+// written as its depth, so that the resolve can shade each material with a fullscreen
+// triangle that the depth test restricts to its pixels (see Mesh::ResolveVisibility).
+class VisibilityTechnique : public Technique
+{
+public:
+    VisibilityTechnique();
+
+    virtual bool Init();
+
+    virtual bool OnFinalized();
+
+    // The pass that fills the visibility buffer. SetEntry names the entry of the mesh
+    // drawn next.
+    bool Enable();
+    void SetEntry(unsigned int Entry);
+
+    bool EnableClassification();
+
+protected:
+
+    virtual std::string GetPermutationDefines(unsigned int Key) const;
+
+private:
+    GLuint m_entryLocation;
+};
+
+
+#endif	/* VISIBILITY_TECHNIQUE_H */